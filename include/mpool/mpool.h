@@ -24,6 +24,14 @@ struct mpool;                   /* opaque mpool handle */
 struct mpool_mdc;               /* opaque MDC (metadata container) handle */
 struct mpool_mcache_map;        /* opaque mcache map handle */
 struct mpool_mlog;              /* opaque mlog handle */
+struct mpool_mlog_merge;        /* opaque mlog merge iterator handle */
+struct mpool_mbio_cq;           /* opaque async mblock I/O completion queue */
+struct mpool_mblock_writer;     /* opaque streaming mblock writer handle */
+struct mpool_mbframe_writer;    /* opaque framed mblock writer handle */
+struct mpool_mbframe_reader;    /* opaque framed mblock reader handle */
+struct mpool_mbkv_writer;       /* opaque indexed sorted mblock writer handle */
+struct mpool_mbkv_reader;       /* opaque indexed sorted mblock reader handle */
+struct mpool_slab;              /* opaque slab store handle */
 
 #define MPOOL_RUNDIR_ROOT       "/var/run/mpool"
 
@@ -74,6 +82,44 @@ mpool_activate(
 	uint32_t                flags,
 	struct mpool_devrpt    *ei);
 
+/**
+ * struct mpool_activate_result - outcome of the activation of an mpool
+ * @mar_name:   mpool name
+ * @mar_poolid: mpool UUID
+ * @mar_devc:   number of member devices found
+ * @mar_active: the mpool was already active and was left alone
+ * @mar_err:    activation status
+ * @mar_nsec:   time taken to activate the mpool, in nanoseconds
+ * @mar_devrpt: activation error detail
+ */
+struct mpool_activate_result {
+	char                    mar_name[MPOOL_NAMESZ_MAX];
+	uuid_le                 mar_poolid;
+	int                     mar_devc;
+	bool                    mar_active;
+	mpool_err_t             mar_err;
+	uint64_t                mar_nsec;
+	struct mpool_devrpt     mar_devrpt;
+};
+
+/**
+ * mpool_activate_all() - Activate all the inactive mpools found on the system
+ * @flags: mpool management flags
+ * @rescp: (output) count of mpools found
+ * @resvp: (output) vector of per-mpool results, to be freed with free()
+ * @ei:    error detail
+ *
+ * Scans the block devices once and activates the mpools found concurrently
+ * with default parameters.  The status of each activation is returned in
+ * its result rather than by the function, which only fails if the scan does.
+ */
+mpool_err_t
+mpool_activate_all(
+	uint32_t                        flags,
+	int                            *rescp,
+	struct mpool_activate_result  **resvp,
+	struct mpool_devrpt            *ei);
+
 /**
  * mpool_deactivate() - Deactivate an mpool by name
  * @mpname: mpool name
@@ -154,6 +200,9 @@ mpool_open(const char *mpname, uint32_t flags, struct mpool **mp, struct mpool_d
 /**
  * mpool_close() - Close an mpool
  * @mp: mpool handle
+ *
+ * Fails with EBUSY while mlogs are open or mcache maps are mapped through
+ * the handle.
  */
 /* MTF_MOCK */
 mpool_err_t mpool_close(struct mpool *mp);
@@ -212,6 +261,177 @@ mpool_params_get(struct mpool *mp, struct mpool_params *params, struct mpool_dev
 mpool_err_t
 mpool_params_set(struct mpool *mp, struct mpool_params *params, struct mpool_devrpt *ei);
 
+/**
+ * struct mpool_client_params - libmpool tunables of an mpool handle
+ * @mcp_objcache:     cache object properties and mpool params in the library
+ * @mcp_objcache_max: maximum number of objects in the object properties cache
+ * @mcp_iodepth:      maximum number of async mblock I/Os issued concurrently
+ * @mcp_rdsplit:      split mblock reads larger than this many bytes, 0 to disable
+ * @mcp_rdpar:        maximum number of concurrent sub-reads of a split read
+ * @mcp_ra_max:       maximum mblock read-ahead per stream in bytes, 0 to disable
+ * @mcp_rdcache_sz:   size in bytes of the mblock page cache, 0 to disable
+ * @mcp_mbpool_lowat: refill the mblock pool below this many mblocks, 0 for half of hiwat
+ * @mcp_mbpool_hiwat: mblocks per media class in the mblock pool, 0 to disable
+ * @mcp_delq_rate:    maximum deferred mblock deletes per second, 0 for no limit
+ * @mcp_hotset_max:   mblocks in the mcache hot set descriptor, 0 to disable
+ * @mcp_mapcache_sz:  total length in bytes of idle cached mcache maps, 0 to disable
+ *
+ * Unlike struct mpool_params, these parameters are private to a single
+ * mpool handle and are not persisted.
+ *
+ * The object properties cache serves mpool_mblock_find(),
+ * mpool_mblock_props_get(), mpool_mlog_open() and mpool_params_get()
+ * without a system call.  It is kept coherent with changes made through
+ * the same mpool handle only, so it must be disabled if the objects of
+ * the mpool are modified by other processes or through other handles.
+ *
+ * If mcp_rdsplit is non-zero, mpool_mblock_read() splits reads larger than
+ * mcp_rdsplit bytes into mcp_rdsplit-sized sub-reads and issues up to
+ * mcp_rdpar of them concurrently on the async mblock I/O engine, reading
+ * directly into the caller's buffers.  Only reads whose iovecs are all page
+ * aligned are split.
+ *
+ * If mcp_ra_max is non-zero, mpool_mblock_read() detects threads reading a
+ * committed mblock sequentially and reads ahead of them asynchronously, in
+ * a window that doubles on each sequential read up to mcp_ra_max bytes.
+ * Reads covered by read-ahead are served by copying from buffers private
+ * to the mpool handle.
+ *
+ * If mcp_rdcache_sz is non-zero, whole-page mpool_mblock_read()s are served
+ * from a page cache private to the mpool handle.  Pages are dropped when
+ * their mblock is aborted or deleted through the same handle.
+ *
+ * If mcp_mbpool_hiwat is non-zero, mpool_mblock_alloc() of non-spare
+ * mblocks is served from a per-media class pool of pre-allocated mblocks,
+ * refilled up to mcp_mbpool_hiwat mblocks by a background thread once it
+ * falls below mcp_mbpool_lowat.  A media class is pooled from its first
+ * allocation on.  Pooled mblocks count against the capacity of their
+ * media class and are aborted by mpool_close().
+ *
+ * mcp_delq_rate paces the deletes queued by mpool_mblock_delete_defer().
+ *
+ * If mcp_mapcache_sz is non-zero, mpool_mcache_mmap() of a vector of
+ * mblocks that is already mapped with the same advice through the same
+ * handle returns the existing map, and mpool_mcache_munmap() only unmaps a
+ * map once all its users unmapped it.  Unmapped maps are moreover kept
+ * idle, up to that total length, so that mapping the same mblocks again
+ * costs a hash lookup.  Cached maps are dropped when one of their mblocks
+ * is deleted through the same handle.  Otherwise each mpool_mcache_mmap()
+ * creates a map of its own.
+ *
+ * If mcp_hotset_max is non-zero, the resident page ranges of the mblocks
+ * of each mcache map are recorded, at a bounded cost per mblock, when it
+ * is unmapped or the handle is closed, and mpool_close() saves those of
+ * the mcp_hotset_max hottest mblocks in a descriptor in the run directory
+ * of the mpool, for mpool_mcache_warmup() to replay after a restart.
+ */
+struct mpool_client_params {
+	uint8_t     mcp_objcache;
+	uint8_t     mcp_rsvd1[3];
+	uint32_t    mcp_objcache_max;
+	uint32_t    mcp_iodepth;
+	uint32_t    mcp_rdsplit;
+	uint32_t    mcp_rdpar;
+	uint32_t    mcp_ra_max;
+	uint64_t    mcp_rdcache_sz;
+	uint32_t    mcp_mbpool_lowat;
+	uint32_t    mcp_mbpool_hiwat;
+	uint32_t    mcp_delq_rate;
+	uint32_t    mcp_hotset_max;
+	uint64_t    mcp_mapcache_sz;
+};
+
+/**
+ * struct mpool_objcache_stats - object properties cache statistics
+ * @mos_hits:      lookups served from the cache
+ * @mos_misses:    lookups that required a system call
+ * @mos_evictions: objects evicted to make room for other objects
+ * @mos_invals:    objects invalidated by abort, delete, or erase
+ */
+struct mpool_objcache_stats {
+	uint64_t    mos_hits;
+	uint64_t    mos_misses;
+	uint64_t    mos_evictions;
+	uint64_t    mos_invals;
+};
+
+/**
+ * struct mpool_rdcache_stats - mblock page cache statistics
+ * @mrs_hits:      pages served from the cache
+ * @mrs_misses:    pages read from media
+ * @mrs_evictions: pages evicted to make room for other pages
+ * @mrs_invals:    pages invalidated by mblock abort or delete
+ */
+struct mpool_rdcache_stats {
+	uint64_t    mrs_hits;
+	uint64_t    mrs_misses;
+	uint64_t    mrs_evictions;
+	uint64_t    mrs_invals;
+};
+
+/**
+ * struct mpool_mapcache_stats - mcache map cache statistics
+ * @mms_hits:      mpool_mcache_mmap() calls served from the cache
+ * @mms_misses:    mpool_mcache_mmap() calls that created a map
+ * @mms_evictions: idle maps unmapped to stay within mcp_mapcache_sz
+ * @mms_invals:    maps dropped because one of their mblocks was deleted
+ * @mms_idle:      total length in bytes of the idle maps
+ */
+struct mpool_mapcache_stats {
+	uint64_t    mms_hits;
+	uint64_t    mms_misses;
+	uint64_t    mms_evictions;
+	uint64_t    mms_invals;
+	uint64_t    mms_idle;
+};
+
+/**
+ * mpool_client_params_init() - initialize client params to their defaults
+ * @params: params instance to initialize
+ */
+void mpool_client_params_init(struct mpool_client_params *params);
+
+/**
+ * mpool_client_params_get() - get the client params of an mpool handle
+ * @mp:     mpool handle
+ * @params: client params (output)
+ */
+mpool_err_t mpool_client_params_get(struct mpool *mp, struct mpool_client_params *params);
+
+/**
+ * mpool_client_params_set() - set the client params of an mpool handle
+ * @mp:     mpool handle
+ * @params: client params
+ *
+ * Must not be called concurrently with any other call on the mpool handle,
+ * ideally it is called right after mpool_open().  The background threads
+ * of the handle are kept idle while the params are replaced, but for the
+ * compaction threads of slab stores, which count as callers: close the
+ * stores that compact in the background first.
+ */
+mpool_err_t mpool_client_params_set(struct mpool *mp, const struct mpool_client_params *params);
+
+/**
+ * mpool_objcache_stats_get() - get object properties cache statistics
+ * @mp:    mpool handle
+ * @stats: cache statistics (output)
+ */
+mpool_err_t mpool_objcache_stats_get(struct mpool *mp, struct mpool_objcache_stats *stats);
+
+/**
+ * mpool_rdcache_stats_get() - get mblock page cache statistics
+ * @mp:    mpool handle
+ * @stats: cache statistics (output)
+ */
+mpool_err_t mpool_rdcache_stats_get(struct mpool *mp, struct mpool_rdcache_stats *stats);
+
+/**
+ * mpool_mapcache_stats_get() - get mcache map cache statistics
+ * @mp:    mpool handle
+ * @stats: cache statistics (output)
+ */
+mpool_err_t mpool_mapcache_stats_get(struct mpool *mp, struct mpool_mapcache_stats *stats);
+
 
 /*
  * Mpool Data Manager APIs
@@ -383,6 +603,71 @@ mpool_err_t mpool_mlog_erase(struct mpool_mlog *mlogh, uint64_t mingen);
  */
 mpool_err_t mpool_mlog_props_get(struct mpool_mlog *mlogh, struct mlog_props *props);
 
+/**
+ * mpool_mlog_key_fn - Extract the merge key from an mlog record
+ * @rec:    record data
+ * @reclen: record length
+ * @arg:    opaque argument given to mpool_mlog_merge_open()
+ *
+ * Return: the key by which the record is ordered (e.g., a sequence number)
+ */
+typedef uint64_t mpool_mlog_key_fn(const void *rec, size_t reclen, void *arg);
+
+/**
+ * mpool_mlog_merge_open() - Create an iterator that merges records from several mlogs
+ * @mlogv: vector of open mlog handles
+ * @mlogc: number of mlog handles in mlogv
+ * @keyfn: key extractor
+ * @arg:   opaque argument passed to keyfn
+ * @winsz: per-mlog read-ahead window size in bytes (0 for default)
+ * @mmp:   merge iterator handle (output)
+ *
+ * Each mlog is rewound and then read through its own read-ahead window, so
+ * memory usage is proportional to the number of mlogs rather than to the
+ * total number of records.  Records are returned in ascending key order,
+ * records with equal keys are returned in mlogv order.  Each mlog must be
+ * sorted by key, and its read cursor must not be used by the caller until
+ * the iterator is closed.
+ *
+ * Return: %0 on success, <%0 on error
+ */
+mpool_err_t
+mpool_mlog_merge_open(
+	struct mpool_mlog         **mlogv,
+	int                         mlogc,
+	mpool_mlog_key_fn          *keyfn,
+	void                       *arg,
+	size_t                      winsz,
+	struct mpool_mlog_merge   **mmp);
+
+/**
+ * mpool_mlog_merge_next() - Read the next record in merged order
+ * @mm:    merge iterator handle
+ * @data:  buffer to read data into
+ * @len:   buffer len
+ * @rdlen: length of the returned record, %0 at end of all mlogs (output)
+ * @srcp:  index in mlogv of the mlog the record came from (output, may be NULL)
+ *
+ * Return: %0 on success, <%0 on error
+ *         If mpool_errno() of the return value is EOVERFLOW, then the receive buffer
+ *         "data" is too small and must be resized according to the value returned in "rdlen".
+ */
+mpool_err_t
+mpool_mlog_merge_next(
+	struct mpool_mlog_merge    *mm,
+	void                       *data,
+	size_t                      len,
+	size_t                     *rdlen,
+	int                        *srcp);
+
+/**
+ * mpool_mlog_merge_close() - Destroy a merge iterator
+ * @mm: merge iterator handle
+ *
+ * The mlog handles given to mpool_mlog_merge_open() remain open.
+ */
+void mpool_mlog_merge_close(struct mpool_mlog_merge *mm);
+
 
 /******************************** MDC APIs ************************************/
 
@@ -593,6 +878,68 @@ mpool_err_t mpool_mblock_abort(struct mpool *mp, uint64_t mbid);
 /* MTF_MOCK */
 mpool_err_t mpool_mblock_delete(struct mpool *mp, uint64_t mbid);
 
+/**
+ * mpool_mblock_commitv() - commit a vector of mblocks
+ * @mp:    mpool
+ * @mbidv: mblock object IDs
+ * @mbidc: number of mblock object IDs
+ * @errv:  per mblock errors (output, may be NULL)
+ *
+ * The mblocks are committed concurrently.  A commit is ordered after all
+ * async writes to the same mblock submitted before this call.
+ *
+ * Return: the error of the lowest-indexed mblock that failed, if any
+ */
+mpool_err_t
+mpool_mblock_commitv(struct mpool *mp, const uint64_t *mbidv, int mbidc, mpool_err_t *errv);
+
+/**
+ * mpool_mblock_abortv() - abort a vector of mblocks
+ * @mp:    mpool
+ * @mbidv: mblock object IDs
+ * @mbidc: number of mblock object IDs
+ * @errv:  per mblock errors (output, may be NULL)
+ *
+ * Return: the error of the lowest-indexed mblock that failed, if any
+ */
+mpool_err_t
+mpool_mblock_abortv(struct mpool *mp, const uint64_t *mbidv, int mbidc, mpool_err_t *errv);
+
+/**
+ * mpool_mblock_deletev() - delete a vector of mblocks
+ * @mp:    mpool
+ * @mbidv: mblock object IDs
+ * @mbidc: number of mblock object IDs
+ * @errv:  per mblock errors (output, may be NULL)
+ *
+ * Return: the error of the lowest-indexed mblock that failed, if any
+ */
+mpool_err_t
+mpool_mblock_deletev(struct mpool *mp, const uint64_t *mbidv, int mbidc, mpool_err_t *errv);
+
+/**
+ * mpool_mblock_delete_defer() - queue mblocks for deletion in the background
+ * @mp:    mpool
+ * @mbidv: mblock object IDs
+ * @mbidc: number of mblock object IDs
+ *
+ * The mblocks are deleted by a background thread at a rate of at most
+ * mcp_delq_rate per second.  The caller must not use them after this call.
+ * mpool_close() deletes all mblocks still queued before returning.
+ */
+mpool_err_t mpool_mblock_delete_defer(struct mpool *mp, const uint64_t *mbidv, int mbidc);
+
+/**
+ * mpool_mblock_delete_drain() - wait for all deferred deletes to complete
+ * @mp:    mpool
+ * @failc: number of deferred deletes that failed since the last drain (output, may be NULL)
+ *
+ * Each failed deferred delete is logged with its mblock ID.
+ *
+ * Return: the error of the first deferred delete that failed since the last drain
+ */
+mpool_err_t mpool_mblock_delete_drain(struct mpool *mp, uint64_t *failc);
+
 /**
  * mpool_mblock_props_get() - get properties of an mblock
  * @mp:    mpool
@@ -636,6 +983,739 @@ mpool_err_t mpool_mblock_write(struct mpool *mp, uint64_t mbid, const struct iov
 mpool_err_t
 mpool_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset);
 
+/**
+ * enum mpool_mbio_op - async mblock I/O operation
+ */
+enum mpool_mbio_op {
+	MPOOL_MBIO_READ  = 1,
+	MPOOL_MBIO_WRITE = 2,
+};
+
+/**
+ * struct mpool_mbio_cqe - async mblock I/O completion
+ * @mce_mbid: mblock object ID
+ * @mce_arg:  caller argument given at submission
+ * @mce_err:  status of the I/O, as returned by mpool_mblock_read/write()
+ * @mce_op:   enum mpool_mbio_op
+ */
+struct mpool_mbio_cqe {
+	uint64_t    mce_mbid;
+	void       *mce_arg;
+	mpool_err_t mce_err;
+	uint32_t    mce_op;
+	uint32_t    mce_rsvd1;
+};
+
+/**
+ * mpool_mbio_cb - async mblock I/O completion callback
+ * @cqe: completion
+ *
+ * Invoked from a library I/O thread, so it must not block for long.
+ */
+typedef void mpool_mbio_cb(const struct mpool_mbio_cqe *cqe);
+
+/**
+ * mpool_mbio_cq_create() - create an async mblock I/O completion queue
+ * @cqp: completion queue (output)
+ *
+ * A completion queue is not bound to an mpool and may collect completions
+ * of I/Os submitted to several mpools.
+ */
+mpool_err_t mpool_mbio_cq_create(struct mpool_mbio_cq **cqp);
+
+/**
+ * mpool_mbio_cq_destroy() - destroy an async mblock I/O completion queue
+ * @cq: completion queue
+ *
+ * Return: %0 on success, EBUSY if I/Os are pending or completions unreaped
+ */
+mpool_err_t mpool_mbio_cq_destroy(struct mpool_mbio_cq *cq);
+
+/**
+ * mpool_mbio_cq_reap() - reap async mblock I/O completions
+ * @cq:     completion queue
+ * @cqev:   vector of completions (output)
+ * @cqec:   length of cqev[]
+ * @min:    minimum number of completions to wait for
+ * @reaped: number of completions returned in cqev[] (output)
+ *
+ * Waits until at least @min completions are available, or until there are
+ * no more I/Os pending on @cq, and returns up to @cqec completions.
+ * A @min of zero polls the queue without blocking.
+ */
+mpool_err_t
+mpool_mbio_cq_reap(
+	struct mpool_mbio_cq   *cq,
+	struct mpool_mbio_cqe  *cqev,
+	int                     cqec,
+	int                     min,
+	int                    *reaped);
+
+/**
+ * mpool_mblock_write_async() - write data to an mblock asynchronously
+ * @mp:   mpool
+ * @mbid: mblock object ID
+ * @iov:  iovec containing data to be written
+ * @iovc: iovec count
+ * @cq:   completion queue (may be NULL if @cb is given)
+ * @cb:   completion callback (may be NULL if @cq is given)
+ * @arg:  caller argument returned in the completion
+ *
+ * Same semantics as mpool_mblock_write().  Writes to the same mblock are
+ * issued one at a time, in submission order.  The iovec and the buffers
+ * it describes must remain valid until the write completes.  On completion
+ * @cb is invoked first if given, then the completion is posted to @cq if
+ * given.
+ *
+ * Return: %0 if the write was queued, <%0 on error
+ */
+mpool_err_t
+mpool_mblock_write_async(
+	struct mpool           *mp,
+	uint64_t                mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg);
+
+/**
+ * mpool_mblock_read_async() - read data from an mblock asynchronously
+ * @mp:     mpool
+ * @mbid:   mblock object ID
+ * @iov:    iovec for output data
+ * @iovc:   iovec count
+ * @offset: PAGE aligned offset into the mblock
+ * @cq:     completion queue (may be NULL if @cb is given)
+ * @cb:     completion callback (may be NULL if @cq is given)
+ * @arg:    caller argument returned in the completion
+ *
+ * Same semantics as mpool_mblock_read().  Reads are issued in any order
+ * and concurrently with each other, up to mcp_iodepth at a time.
+ *
+ * Return: %0 if the read was queued, <%0 on error
+ */
+mpool_err_t
+mpool_mblock_read_async(
+	struct mpool           *mp,
+	uint64_t                mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg);
+
+/**
+ * struct mpool_mblock_rdreq - one read of a multi-mblock gather read
+ * @mrr_mbid:   mblock object ID
+ * @mrr_offset: PAGE aligned offset into the mblock
+ * @mrr_iov:    iovec for output data
+ * @mrr_iovc:   iovec count
+ * @mrr_err:    status of this read (output)
+ */
+struct mpool_mblock_rdreq {
+	uint64_t            mrr_mbid;
+	off_t               mrr_offset;
+	const struct iovec *mrr_iov;
+	int                 mrr_iovc;
+	mpool_err_t         mrr_err;
+};
+
+/**
+ * mpool_mblock_readv_multi() - read from many mblocks in one call
+ * @mp:   mpool
+ * @reqv: vector of reads
+ * @nreq: length of reqv[]
+ *
+ * Reads that target adjacent ranges of the same mblock are coalesced into
+ * a single read, and the resulting reads are issued concurrently on the
+ * async mblock I/O engine.  If a coalesced read fails, the reads it was
+ * made of are reissued one by one, so that the status returned in the
+ * mrr_err of each read is its own.
+ *
+ * Unless @nreq is 1, the reads bypass the read cache and read-ahead of
+ * mpool_mblock_read(): they neither hit nor fill them.
+ *
+ * Return: %0 if all reads succeeded, otherwise the status of the first
+ * failed read in @reqv
+ */
+mpool_err_t mpool_mblock_readv_multi(struct mpool *mp, struct mpool_mblock_rdreq *reqv, int nreq);
+
+/**
+ * mpool_mblock_writer_open() - open a streaming writer on an mblock
+ * @mp:    mpool
+ * @mbid:  ID of an allocated, uncommitted and unwritten mblock
+ * @depth: number of optimal-size buffers, or 0 for the default (minimum 2)
+ * @wp:    writer handle (output)
+ *
+ * The writer accepts appends of any size and alignment, stages them in
+ * page-aligned buffers of mpr_optimal_wrsz bytes and writes each buffer
+ * asynchronously as soon as it is full, so that up to @depth - 1 writes
+ * are queued while the next buffer is filled.  As the writes of an mblock
+ * append, they are issued one at a time: open writers on several mblocks
+ * to keep more than one write in flight.
+ */
+mpool_err_t
+mpool_mblock_writer_open(
+	struct mpool                *mp,
+	uint64_t                     mbid,
+	int                          depth,
+	struct mpool_mblock_writer **wp);
+
+/**
+ * mpool_mblock_writer_append() - append data to an mblock
+ * @w:    writer handle
+ * @data: data to append
+ * @len:  length of data
+ *
+ * Return: %0 on success, ENOSPC if the data does not fit into the mblock,
+ * or the error of a previously failed write
+ */
+mpool_err_t mpool_mblock_writer_append(struct mpool_mblock_writer *w, const void *data, size_t len);
+
+/**
+ * mpool_mblock_writer_close() - flush and commit an mblock, free the writer
+ * @w:   writer handle
+ * @len: number of bytes appended (output, may be NULL)
+ *
+ * The final write is zero-padded to a multiple of PAGE_SIZE.  If any write
+ * failed the mblock is aborted instead of committed and the error returned.
+ */
+mpool_err_t mpool_mblock_writer_close(struct mpool_mblock_writer *w, size_t *len);
+
+/**
+ * mpool_mblock_writer_abort() - abort an mblock and free the writer
+ * @w: writer handle
+ */
+mpool_err_t mpool_mblock_writer_abort(struct mpool_mblock_writer *w);
+
+/*
+ * Framed mblocks
+ *
+ * A framed mblock stores a stream of data as a sequence of fixed-size
+ * frames, each optionally compressed and each protected by a CRC32C, and
+ * ends with an index of the frames so that a read only needs to read,
+ * verify and decompress the frames that overlap it.  Framed mblocks must
+ * be written and read exclusively through the mpool_mbframe API.
+ */
+
+#define MPOOL_MBFRAME_COMPRESS      0x0001  /* compress frames */
+
+/**
+ * mpool_mbframe_writer_open() - open a framed writer on an mblock
+ * @mp:      mpool
+ * @mbid:    ID of an allocated, uncommitted and unwritten mblock
+ * @framesz: frame size in bytes, rounded up to PAGE_SIZE, or 0 for the default
+ * @flags:   MPOOL_MBFRAME_* flags
+ * @wp:      writer handle (output)
+ *
+ * Frames that do not compress to less than their length are stored raw.
+ */
+mpool_err_t
+mpool_mbframe_writer_open(
+	struct mpool                 *mp,
+	uint64_t                      mbid,
+	uint32_t                      framesz,
+	uint32_t                      flags,
+	struct mpool_mbframe_writer **wp);
+
+/**
+ * mpool_mbframe_writer_append() - append data to a framed mblock
+ * @w:    writer handle
+ * @data: data to append
+ * @len:  length of data
+ *
+ * Return: %0 on success, ENOSPC if the data does not fit into the mblock,
+ * or the error of a previously failed write
+ */
+mpool_err_t mpool_mbframe_writer_append(struct mpool_mbframe_writer *w, const void *data, size_t len);
+
+/**
+ * mpool_mbframe_writer_close() - write the frame index and commit, free the writer
+ * @w:     writer handle
+ * @len:   number of bytes appended (output, may be NULL)
+ * @wrlen: number of bytes written to the mblock (output, may be NULL)
+ *
+ * If any write failed the mblock is aborted instead of committed and the
+ * error returned.
+ */
+mpool_err_t
+mpool_mbframe_writer_close(struct mpool_mbframe_writer *w, size_t *len, size_t *wrlen);
+
+/**
+ * mpool_mbframe_writer_abort() - abort a framed mblock and free the writer
+ * @w: writer handle
+ */
+mpool_err_t mpool_mbframe_writer_abort(struct mpool_mbframe_writer *w);
+
+/**
+ * mpool_mbframe_reader_open() - open a reader on a committed framed mblock
+ * @mp:   mpool
+ * @mbid: mblock ID
+ * @rp:   reader handle (output)
+ * @len:  length of the data stored in the mblock (output, may be NULL)
+ *
+ * Reads and verifies the frame index.  A reader must not be used by more
+ * than one thread at a time.
+ *
+ * Return: EBADMSG if the mblock is not a valid framed mblock
+ */
+mpool_err_t
+mpool_mbframe_reader_open(
+	struct mpool                 *mp,
+	uint64_t                      mbid,
+	struct mpool_mbframe_reader **rp,
+	size_t                       *len);
+
+/**
+ * mpool_mbframe_read() - read data from a framed mblock
+ * @r:      reader handle
+ * @buf:    output buffer, no alignment required
+ * @len:    number of bytes to read
+ * @offset: offset of the data, no alignment required
+ *
+ * Return: EINVAL if the range extends past the end of the data, EBADMSG if
+ * a frame fails its checksum or does not decompress
+ */
+mpool_err_t
+mpool_mbframe_read(struct mpool_mbframe_reader *r, void *buf, size_t len, off_t offset);
+
+/**
+ * mpool_mbframe_reader_close() - free a reader
+ * @r: reader handle
+ */
+void mpool_mbframe_reader_close(struct mpool_mbframe_reader *r);
+
+/*
+ * Indexed sorted mblocks
+ *
+ * An indexed sorted mblock is an immutable table of key/value pairs written
+ * in key order in one streaming pass.  It holds fixed-size data blocks, a
+ * binary-searchable index of the last key of each data block and a bloom
+ * filter blocked by cache line, so that a point lookup reads one filter
+ * page, one index page and one data page (with the default block size),
+ * and a lookup of an absent key usually touches only the filter.  Keys are
+ * compared with memcmp(), a key that is a prefix of another sorting first.
+ * Indexed sorted mblocks must be written and read exclusively through the
+ * mpool_mbkv API.
+ */
+
+#define MPOOL_MBKV_KLEN_MAX         1024    /* maximum key length */
+#define MPOOL_MBKV_BLOOM_BITS       10      /* default bloom filter bits per key */
+
+#define MPOOL_MBKV_MMAP             0x0001  /* access the mblock through an mcache map */
+
+/**
+ * mpool_mbkv_writer_open() - open an indexed sorted writer on an mblock
+ * @mp:    mpool
+ * @mbid:  ID of an allocated, uncommitted and unwritten mblock
+ * @blksz: block size in bytes, rounded up to PAGE_SIZE, or 0 for PAGE_SIZE
+ * @bits:  bloom filter bits per key, at most 32, or 0 for no filter
+ * @wp:    writer handle (output)
+ */
+mpool_err_t
+mpool_mbkv_writer_open(
+	struct mpool               *mp,
+	uint64_t                    mbid,
+	uint32_t                    blksz,
+	uint32_t                    bits,
+	struct mpool_mbkv_writer  **wp);
+
+/**
+ * mpool_mbkv_writer_add() - append a key/value pair to an indexed sorted mblock
+ * @w:    writer handle
+ * @key:  key, greater than the key of the previous pair
+ * @klen: key length, from 1 to MPOOL_MBKV_KLEN_MAX
+ * @val:  value
+ * @vlen: value length
+ *
+ * Return: %0 on success, EINVAL if the key is out of order, EMSGSIZE if the
+ * pair does not fit into a block, ENOSPC if the mblock is full, or the
+ * error of a previously failed write
+ */
+mpool_err_t
+mpool_mbkv_writer_add(
+	struct mpool_mbkv_writer   *w,
+	const void                 *key,
+	size_t                      klen,
+	const void                 *val,
+	size_t                      vlen);
+
+/**
+ * mpool_mbkv_writer_close() - write the index and the filter and commit, free the writer
+ * @w:     writer handle
+ * @nkeys: number of pairs added (output, may be NULL)
+ * @wrlen: number of bytes written to the mblock (output, may be NULL)
+ *
+ * If any write failed the mblock is aborted instead of committed and the
+ * error returned.
+ */
+mpool_err_t
+mpool_mbkv_writer_close(struct mpool_mbkv_writer *w, uint64_t *nkeys, size_t *wrlen);
+
+/**
+ * mpool_mbkv_writer_abort() - abort an indexed sorted mblock and free the writer
+ * @w: writer handle
+ */
+mpool_err_t mpool_mbkv_writer_abort(struct mpool_mbkv_writer *w);
+
+/**
+ * mpool_mbkv_reader_open() - open a reader on a committed indexed sorted mblock
+ * @mp:    mpool
+ * @mbid:  mblock ID
+ * @flags: MPOOL_MBKV_* flags
+ * @rp:    reader handle (output)
+ * @nkeys: number of pairs stored in the mblock (output, may be NULL)
+ *
+ * Loads the last key of each index block.  With MPOOL_MBKV_MMAP, lookups
+ * access the mblock in place through an mcache map and the reader may be
+ * used by several threads at a time; otherwise lookups read the pages they
+ * need and a reader must not be used by more than one thread at a time.
+ *
+ * Return: EBADMSG if the mblock is not a valid indexed sorted mblock
+ */
+mpool_err_t
+mpool_mbkv_reader_open(
+	struct mpool               *mp,
+	uint64_t                    mbid,
+	uint32_t                    flags,
+	struct mpool_mbkv_reader  **rp,
+	uint64_t                   *nkeys);
+
+/**
+ * mpool_mbkv_get() - look up a key in an indexed sorted mblock
+ * @r:      reader handle
+ * @key:    key
+ * @klen:   key length
+ * @vbuf:   buffer for the value (may be NULL if @vbufsz is 0)
+ * @vbufsz: size of @vbuf, at most that many bytes of the value are copied
+ * @vlen:   length of the value (output, may be NULL)
+ *
+ * Return: ENOENT if the key is not found, EBADMSG if a block is corrupt
+ */
+mpool_err_t
+mpool_mbkv_get(
+	struct mpool_mbkv_reader   *r,
+	const void                 *key,
+	size_t                      klen,
+	void                       *vbuf,
+	size_t                      vbufsz,
+	size_t                     *vlen);
+
+/**
+ * mpool_mbkv_reader_close() - free a reader
+ * @r: reader handle
+ */
+void mpool_mbkv_reader_close(struct mpool_mbkv_reader *r);
+
+/**
+ * mpool_mblock_migrate() - copy an mblock to another media class
+ * @mp:      mpool
+ * @srcid:   ID of a committed mblock
+ * @mclassp: media class of the copy
+ * @dstid:   ID of the committed copy (output)
+ *
+ * Reads from the source mblock are overlapped with writes to the copy.
+ * The source mblock is left intact; the caller switches its references to
+ * the copy and then deletes the source mblock.
+ */
+mpool_err_t
+mpool_mblock_migrate(
+	struct mpool           *mp,
+	uint64_t                srcid,
+	enum mp_media_classp    mclassp,
+	uint64_t               *dstid);
+
+/**
+ * struct mpool_tier_params - mblock tiering policy
+ * @mtp_period_ms: interval between policy evaluations
+ * @mtp_hot:       promote mblocks whose score is at least this
+ * @mtp_cold:      demote mblocks whose score is at most this
+ * @mtp_maxobj:    maximum number of mblocks migrated per period
+ * @mtp_bwcap:     maximum migration bandwidth in bytes per second, 0 for no limit
+ *
+ * The score of an mblock is the number of mpool_mblock_read() calls on it,
+ * halved every period, plus one per 16 of its pages resident in mcache maps.
+ * Only mblocks read or committed while the engine is started, or that are
+ * in an mcache map, are considered.
+ */
+struct mpool_tier_params {
+	uint32_t    mtp_period_ms;
+	uint32_t    mtp_hot;
+	uint32_t    mtp_cold;
+	uint32_t    mtp_maxobj;
+	uint64_t    mtp_bwcap;
+};
+
+/**
+ * struct mpool_tier_stats - mblock tiering statistics
+ * @mts_tracked:  mblocks currently tracked
+ * @mts_promoted: mblocks migrated to the staging media class
+ * @mts_demoted:  mblocks migrated to the capacity media class
+ * @mts_bytes:    bytes copied by migrations
+ * @mts_failed:   migrations that failed
+ * @mts_rejected: migrations rejected by the remap callback
+ */
+struct mpool_tier_stats {
+	uint64_t    mts_tracked;
+	uint64_t    mts_promoted;
+	uint64_t    mts_demoted;
+	uint64_t    mts_bytes;
+	uint64_t    mts_failed;
+	uint64_t    mts_rejected;
+};
+
+/**
+ * mpool_tier_remap_fn - hand a migrated mblock over to the client
+ * @arg:   argument given to mpool_tier_start()
+ * @oldid: ID of the source mblock
+ * @newid: ID of the committed copy on the other media class
+ *
+ * Called from the tiering thread.  The client switches its references
+ * from @oldid to @newid and returns true, after which the source mblock is
+ * deleted with mpool_mblock_delete_defer().  If the client returns false,
+ * e.g., because it no longer references @oldid, the copy is deleted.  The
+ * callback must not call mpool_tier_stop().
+ */
+typedef bool mpool_tier_remap_fn(void *arg, uint64_t oldid, uint64_t newid);
+
+/**
+ * mpool_tier_params_init() - initialize tiering params to their defaults
+ * @params: params instance to initialize
+ */
+void mpool_tier_params_init(struct mpool_tier_params *params);
+
+/**
+ * mpool_tier_start() - start tiering the mblocks of an mpool handle
+ * @mp:     mpool handle
+ * @params: tiering policy
+ * @remap:  remap callback
+ * @arg:    remap callback argument
+ *
+ * Both the staging and the capacity media class must exist.  mpool_close()
+ * stops the tiering engine.
+ */
+mpool_err_t
+mpool_tier_start(
+	struct mpool                   *mp,
+	const struct mpool_tier_params *params,
+	mpool_tier_remap_fn            *remap,
+	void                           *arg);
+
+/**
+ * mpool_tier_stop() - stop tiering, waiting for a migration in progress
+ * @mp: mpool handle
+ */
+mpool_err_t mpool_tier_stop(struct mpool *mp);
+
+/**
+ * mpool_tier_stats_get() - get mblock tiering statistics
+ * @mp:    mpool handle
+ * @stats: tiering statistics (output)
+ */
+mpool_err_t mpool_tier_stats_get(struct mpool *mp, struct mpool_tier_stats *stats);
+
+/**
+ * struct mpool_slab_obj - handle of an object in a slab store
+ * @mso_mbid: ID of the slab mblock that holds the object
+ * @mso_off:  offset of the object in the slab mblock
+ * @mso_len:  length of the object
+ */
+struct mpool_slab_obj {
+	uint64_t    mso_mbid;
+	uint32_t    mso_off;
+	uint32_t    mso_len;
+};
+
+/**
+ * struct mpool_slab_params - slab store parameters
+ * @msp_dead_pct:  compact slabs with at least this percentage of dead bytes,
+ *                 0 to disable background compaction
+ * @msp_period_ms: interval between background compactions, and time for
+ *                 which the old handles of relocated objects remain readable
+ */
+struct mpool_slab_params {
+	uint32_t    msp_dead_pct;
+	uint32_t    msp_period_ms;
+};
+
+/**
+ * struct mpool_slab_stats - slab store statistics
+ * @mss_slabs:     slab mblocks
+ * @mss_capacity:  capacity of the slab mblocks in bytes
+ * @mss_objects:   live objects
+ * @mss_bytes:     live bytes
+ * @mss_compacted: slabs compacted
+ * @mss_relocated: objects relocated by compaction
+ */
+struct mpool_slab_stats {
+	uint64_t    mss_slabs;
+	uint64_t    mss_capacity;
+	uint64_t    mss_objects;
+	uint64_t    mss_bytes;
+	uint64_t    mss_compacted;
+	uint64_t    mss_relocated;
+};
+
+/**
+ * mpool_slab_remap_fn - hand a relocated object over to the client
+ * @arg:    argument given to mpool_slab_open()
+ * @oldobj: handle of the object in the compacted slab
+ * @newobj: handle of the readable copy of the object
+ *
+ * Called from the compaction thread, or from mpool_slab_compact().  The
+ * client switches its references from @oldobj to @newobj and returns true.
+ * If the client returns false, e.g., because it deleted the object, the
+ * copy is deleted.  Either way @oldobj is deleted.
+ */
+typedef bool
+mpool_slab_remap_fn(
+	void                           *arg,
+	const struct mpool_slab_obj    *oldobj,
+	const struct mpool_slab_obj    *newobj);
+
+/**
+ * mpool_slab_params_init() - initialize slab store params to their defaults
+ * @params: params instance to initialize
+ */
+void mpool_slab_params_init(struct mpool_slab_params *params);
+
+/**
+ * mpool_slab_open() - open a store of small objects packed into mblocks
+ * @mp:      mpool
+ * @mclassp: media class of the slab mblocks
+ * @params:  store parameters, or NULL for the defaults
+ * @remap:   remap callback, or NULL to disable compaction
+ * @arg:     remap callback argument
+ * @msp:     store handle (output)
+ *
+ * Objects are immutable and are packed back to back into slab mblocks.
+ * The store does not persist which objects are live: after reopening a
+ * store, the client attaches the handles of its live objects with
+ * mpool_slab_attach(), then reclaims the slabs left without any with
+ * mpool_slab_reclaim().  All functions of a store are thread safe.
+ */
+mpool_err_t
+mpool_slab_open(
+	struct mpool                   *mp,
+	enum mp_media_classp            mclassp,
+	const struct mpool_slab_params *params,
+	mpool_slab_remap_fn            *remap,
+	void                           *arg,
+	struct mpool_slab             **msp);
+
+/**
+ * mpool_slab_close() - seal the open slab and free a store
+ * @ms: store handle
+ */
+mpool_err_t mpool_slab_close(struct mpool_slab *ms);
+
+/**
+ * mpool_slab_putv() - store a vector of objects
+ * @ms:   store handle
+ * @iov:  one iovec per object
+ * @iovc: number of objects
+ * @objv: object handles (output)
+ *
+ * The objects are readable once their slab is sealed, i.e., when it fills
+ * up or on mpool_slab_flush().  On error, the objects before the failing
+ * one are stored.
+ */
+mpool_err_t
+mpool_slab_putv(struct mpool_slab *ms, const struct iovec *iov, int iovc, struct mpool_slab_obj *objv);
+
+/**
+ * mpool_slab_put() - store an object
+ * @ms:   store handle
+ * @data: object data
+ * @len:  object length, at most the capacity of an mblock
+ * @obj:  object handle (output)
+ */
+mpool_err_t
+mpool_slab_put(struct mpool_slab *ms, const void *data, size_t len, struct mpool_slab_obj *obj);
+
+/**
+ * mpool_slab_flush() - make all stored objects readable
+ * @ms: store handle
+ *
+ * Seals the open slab, even if it is not full.  If sealing fails, the
+ * objects stored since the previous seal are lost.
+ */
+mpool_err_t mpool_slab_flush(struct mpool_slab *ms);
+
+/**
+ * mpool_slab_get() - get a pointer to the data of an object
+ * @ms:    store handle
+ * @obj:   object handle
+ * @datap: object data, not aligned (output)
+ *
+ * The data is read in place through an mcache map.  The pointer remains
+ * valid until the object is deleted, or for msp_period_ms after it is
+ * relocated by compaction.
+ *
+ * Return: ENOENT if the object does not exist, EAGAIN if its slab is not
+ * sealed yet
+ */
+mpool_err_t
+mpool_slab_get(struct mpool_slab *ms, const struct mpool_slab_obj *obj, const void **datap);
+
+/**
+ * mpool_slab_del() - delete an object
+ * @ms:  store handle
+ * @obj: object handle
+ *
+ * A slab whose objects are all deleted is deleted.
+ */
+mpool_err_t mpool_slab_del(struct mpool_slab *ms, const struct mpool_slab_obj *obj);
+
+/**
+ * mpool_slab_attach() - attach live objects stored by a previous store
+ * @ms:   store handle
+ * @objv: object handles
+ * @objc: number of object handles
+ *
+ * Slab mblocks without attached objects are not known to the store, and
+ * are never compacted nor deleted by it, unless they are passed to
+ * mpool_slab_reclaim().
+ */
+mpool_err_t mpool_slab_attach(struct mpool_slab *ms, const struct mpool_slab_obj *objv, int objc);
+
+/**
+ * mpool_slab_reclaim() - delete slab mblocks that hold no live object
+ * @ms:    store handle
+ * @mbidv: IDs of slab mblocks
+ * @mbidc: number of IDs
+ *
+ * The store does not persist which objects are live, so the slabs whose
+ * objects were all deleted, but which were not deleted themselves before
+ * the store was closed, e.g., because of a crash or because they were
+ * waiting out the msp_period_ms of compaction, are leaked.  The client
+ * reclaims them by passing, once it attached all its live objects, the IDs
+ * of the slab mblocks it may have used, e.g., all those that appeared in
+ * its handles since it last called this function.  Of those, the slabs
+ * without attached objects are deleted.  IDs of mblocks that were deleted
+ * already are ignored.
+ *
+ * Must not be called from the remap callback.
+ */
+mpool_err_t mpool_slab_reclaim(struct mpool_slab *ms, const uint64_t *mbidv, int mbidc);
+
+/**
+ * mpool_slab_compact() - compact all slabs that are dead enough now
+ * @ms: store handle
+ *
+ * Return: EINVAL if the store has no remap callback
+ */
+mpool_err_t mpool_slab_compact(struct mpool_slab *ms);
+
+/**
+ * mpool_slab_stats_get() - get slab store statistics
+ * @ms:    store handle
+ * @stats: store statistics (output)
+ */
+mpool_err_t mpool_slab_stats_get(struct mpool_slab *ms, struct mpool_slab_stats *stats);
+
 
 /******************************** MCACHE APIs ************************************/
 
@@ -691,6 +1771,46 @@ mpool_mcache_mincore(
 	size_t                     *rssp,
 	size_t                     *vssp);
 
+/**
+ * struct mpool_mcache_rss - residency of an mblock in an mcache map
+ * @mcr_resident: number of resident pages, estimated if sampled
+ * @mcr_pages:    number of pages of the mblock in the map
+ */
+struct mpool_mcache_rss {
+	uint64_t    mcr_resident;
+	uint64_t    mcr_pages;
+};
+
+/**
+ * mpool_mcache_residency() - Get the resident pages of each mblock of a map
+ * @map:     mcache map handle
+ * @mbidx:   mcache map index of the first mblock
+ * @mbidc:   number of mblocks
+ * @stride:  probe one group of 512 pages out of every @stride, 0 or 1 to
+ *           probe every page
+ * @rssv:    residency of each mblock (output, @mbidc entries)
+ * @bitmapv: page residency bitmaps (output, may be NULL, must be NULL if
+ *           @stride is greater than 1)
+ *
+ * Unlike mpool_mcache_mincore(), reports per-mblock counts, never
+ * allocates, and when sampling costs in proportion to the number of pages
+ * probed rather than to the size of the map.  The bitmap of each mblock is
+ * (mcr_pages + 63) / 64 words, bit i of word j being set if page
+ * 64 * j + i is resident, and the bitmaps of successive mblocks follow each
+ * other.
+ *
+ * Return: %0 on success, mpool_err_t on failure
+ */
+/* MTF_MOCK */
+mpool_err_t
+mpool_mcache_residency(
+	struct mpool_mcache_map    *map,
+	const uint32_t              mbidx,
+	const uint32_t              mbidc,
+	uint32_t                    stride,
+	struct mpool_mcache_rss    *rssv,
+	uint64_t                   *bitmapv);
+
 /**
  * mpool_mcache_getbase() - Get the base address of a memory-mapped mblock in an mcache map
  * @map:   mcache map handle
@@ -726,6 +1846,178 @@ mpool_mcache_getpages(
 	const off_t                 offsetv[],
 	void                       *pagev[]);
 
+/**
+ * mpool_mcache_prefetchv() - Prefetch a vector of pages from any mblocks of a map
+ * @map:       mcache map handle
+ * @pagec:     page count (len of @mbidxv and @pagenumv arrays)
+ * @mbidxv:    vector of mcache map mblock indexes
+ * @pagenumv:  vector of page numbers within the respective mblocks
+ * @residentv: bitmap of (pagec + 63) / 64 words, bit i is set if page i was
+ *             resident when sampled (output, may be NULL)
+ *
+ * Adjacent pages are coalesced and readahead is started for each run that
+ * has a non-resident page, without waiting for it to complete, so that the
+ * faults of all the pages of a batch overlap rather than being taken one
+ * after the other.  A caller can use @residentv to decide whether to
+ * access the pages now or to do other work first.
+ *
+ * Return: %0 on success, mpool_err_t on failure
+ */
+/* MTF_MOCK */
+mpool_err_t
+mpool_mcache_prefetchv(
+	struct mpool_mcache_map    *map,
+	const uint32_t              pagec,
+	const uint32_t              mbidxv[],
+	const off_t                 pagenumv[],
+	uint64_t                   *residentv);
+
+#define MPOOL_MCACHE_POPULATE       0x0001  /* populate the map after a direct read */
+
+/**
+ * mpool_mcache_read() - Read a range of a memory-mapped mblock
+ * @map:    mcache map handle
+ * @mbidx:  mcache map mblock index
+ * @offset: offset into the mblock, no alignment required
+ * @len:    number of bytes to read
+ * @buf:    output buffer, no alignment required
+ * @flags:  MPOOL_MCACHE_* flags
+ *
+ * Copies the range from the map if its pages are resident, or if only a
+ * few of them are not, and otherwise reads it from media with a single
+ * mblock read, which is cheaper than faulting in many pages one at a time.
+ * With MPOOL_MCACHE_POPULATE, readahead of the range into the map is then
+ * started without waiting for it.
+ *
+ * Return: %0 on success, mpool_err_t on failure
+ */
+/* MTF_MOCK */
+mpool_err_t
+mpool_mcache_read(
+	struct mpool_mcache_map    *map,
+	const uint32_t              mbidx,
+	off_t                       offset,
+	size_t                      len,
+	void                       *buf,
+	uint32_t                    flags);
+
+/**
+ * mpool_mcache_access() - Report accesses to an mcache map
+ * @map:  mcache map handle
+ * @hits: number of accesses since the last report
+ *
+ * Feeds the mcache advisor, if started.  Cheap enough to be called on
+ * every lookup.
+ */
+mpool_err_t mpool_mcache_access(struct mpool_mcache_map *map, uint32_t hits);
+
+struct mpool_mcache_hotset;     /* opaque mcache hot set descriptor */
+
+/**
+ * mpool_mcache_hotset_load() - Load the mcache hot set saved by the last mpool_close()
+ * @mp:      mpool handle
+ * @hotsetp: hot set descriptor (output)
+ *
+ * The descriptor is only saved if mcp_hotset_max was non-zero.
+ *
+ * Return: %0 on success, ENOENT if no descriptor was saved, EBADMSG if it
+ * is corrupt
+ */
+mpool_err_t mpool_mcache_hotset_load(struct mpool *mp, struct mpool_mcache_hotset **hotsetp);
+
+/**
+ * mpool_mcache_hotset_free() - Free a hot set descriptor
+ * @hotset: hot set descriptor (may be NULL)
+ */
+void mpool_mcache_hotset_free(struct mpool_mcache_hotset *hotset);
+
+/**
+ * mpool_mcache_warmup() - Populate a map with its recorded hot set in the background
+ * @map:    mcache map handle
+ * @hotset: hot set descriptor
+ *
+ * Queues the recorded page ranges of the mblocks of @map, which a
+ * background thread of the mpool handle then populates in large requests,
+ * hottest ranges first.  Returns without waiting, and @hotset may be freed
+ * right away.  Unmapping @map drops its ranges not populated yet.
+ *
+ * Return: %0 on success, mpool_err_t on failure
+ */
+mpool_err_t
+mpool_mcache_warmup(struct mpool_mcache_map *map, const struct mpool_mcache_hotset *hotset);
+
+/**
+ * struct mpool_mcache_advisor_params - mcache advisor policy
+ * @mcap_period_ms: interval between policy evaluations
+ * @mcap_stride:    sample one group of 512 pages out of every @mcap_stride
+ *                  when estimating the residency of a map, 0 or 1 for all
+ * @mcap_budget:    memory budget in bytes for all the mcache maps of the handle
+ *
+ * The heat of a map is the number of accesses reported on it, halved every
+ * period.  Each period the maps are charged to the budget hottest first,
+ * pinned maps ahead of all others.  An accessed map is charged its length
+ * and is advised MADV_WILLNEED if it is not mostly resident, a map no
+ * longer accessed is charged its resident pages, and a map that does not
+ * fit is demoted one step per period, from MADV_COLD to MADV_DONTNEED to
+ * mpool_mcache_purge(), or only advised MADV_COLD while still accessed.
+ */
+struct mpool_mcache_advisor_params {
+	uint32_t    mcap_period_ms;
+	uint32_t    mcap_stride;
+	uint64_t    mcap_budget;
+};
+
+/**
+ * struct mpool_mcache_advisor_stats - mcache advisor statistics
+ * @mcas_maps:     mcache maps currently mapped
+ * @mcas_resident: resident bytes of the maps at the last period, estimated
+ * @mcas_periods:  policy periods run
+ * @mcas_willneed: maps advised MADV_WILLNEED
+ * @mcas_cold:     maps advised MADV_COLD
+ * @mcas_dontneed: maps advised MADV_DONTNEED
+ * @mcas_purged:   maps purged
+ */
+struct mpool_mcache_advisor_stats {
+	uint64_t    mcas_maps;
+	uint64_t    mcas_resident;
+	uint64_t    mcas_periods;
+	uint64_t    mcas_willneed;
+	uint64_t    mcas_cold;
+	uint64_t    mcas_dontneed;
+	uint64_t    mcas_purged;
+};
+
+/**
+ * mpool_mcache_advisor_params_init() - initialize advisor params to their defaults
+ * @params: params instance to initialize
+ */
+void mpool_mcache_advisor_params_init(struct mpool_mcache_advisor_params *params);
+
+/**
+ * mpool_mcache_advisor_start() - start re-advising the mcache maps of an mpool handle
+ * @mp:     mpool handle
+ * @params: advisor policy
+ *
+ * The advice given at mpool_mcache_mmap() time then only applies until
+ * the first period.  mpool_close() stops the advisor.
+ */
+mpool_err_t
+mpool_mcache_advisor_start(struct mpool *mp, const struct mpool_mcache_advisor_params *params);
+
+/**
+ * mpool_mcache_advisor_stop() - stop the mcache advisor
+ * @mp: mpool handle
+ */
+mpool_err_t mpool_mcache_advisor_stop(struct mpool *mp);
+
+/**
+ * mpool_mcache_advisor_stats_get() - get mcache advisor statistics
+ * @mp:    mpool handle
+ * @stats: advisor statistics (output)
+ */
+mpool_err_t
+mpool_mcache_advisor_stats_get(struct mpool *mp, struct mpool_mcache_advisor_stats *stats);
+
 /**
  * mpool_mcache_mmap() - Create an mcache map
  * @mp:     handle for the mpool
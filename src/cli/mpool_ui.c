@@ -7,6 +7,7 @@
 
 #include <util/platform.h>
 #include <util/string.h>
+#include <util/mutex.h>
 
 #include <mpool/mpool.h>
 
@@ -73,6 +74,44 @@ static void mpool_params_defaults(struct mpool_params *params)
 	strcpy(params->mp_label, MPOOL_LABEL_DEFAULT);
 }
 
+/**
+ * struct trim_progress - last progress reported for each device being trimmed
+ * @tp_lock: serializes the callbacks, which come from all the trim threads
+ * @tp_devv: device names
+ * @tp_pctv: last percentage reported for each device
+ * @tp_devc: number of devices
+ */
+struct trim_progress {
+	struct mutex    tp_lock;
+	char          **tp_devv;
+	int             tp_pctv[MPOOL_DRIVES_MAX];
+	int             tp_devc;
+};
+
+static void mpool_trim_progress(void *arg, const char *dev, u64 done, u64 total)
+{
+	struct trim_progress   *tp = arg;
+	int                     i, pct;
+
+	for (i = 0; i < tp->tp_devc; i++) {
+		if (!strcmp(tp->tp_devv[i], dev))
+			break;
+	}
+
+	if (i == tp->tp_devc || !total)
+		return;
+
+	/* Report every 10%. */
+	pct = (done * 100 / total) / 10 * 10;
+
+	mutex_lock(&tp->tp_lock);
+	if (pct != tp->tp_pctv[i]) {
+		tp->tp_pctv[i] = pct;
+		fprintf(co.co_fp, "Trimming %s: %d%%\n", dev, pct);
+	}
+	mutex_unlock(&tp->tp_lock);
+}
+
 static merr_t mpool_prepare(char **devices, int dcnt)
 {
 	struct mpool_devrpt devrpt;
@@ -132,7 +171,16 @@ static merr_t mpool_prepare(char **devices, int dcnt)
 
 	if (!co.co_dry_run) {
 		if (co.co_discard) {
-			err = mp_trim_device(dcnt, devices, &devrpt);
+			struct trim_progress tp = {
+				.tp_devv = devices,
+				.tp_devc = dcnt,
+			};
+
+			mutex_init(&tp.tp_lock);
+			err = mp_trim_devices(dcnt, devices, MP_TRIM_DISCARD,
+					      co.co_verbose ? mpool_trim_progress : NULL, &tp,
+					      &devrpt);
+			mutex_destroy(&tp.tp_lock);
 			if (err)
 				goto exit;
 		}
@@ -578,6 +626,63 @@ static void mpool_scan_help(struct verb_s *v, bool terse)
 	mpool_generic_verb_help(v, &h, terse, NULL, 0);
 }
 
+/**
+ * mpool_scan_activate() - Activate all inactive mpools concurrently
+ * @flags: mpool management flags
+ */
+static merr_t mpool_scan_activate(u32 flags)
+{
+	struct mpool_activate_result   *resv, *res;
+	struct mpool_devrpt             ei = { };
+
+	char    uuidstr[MPOOL_UUID_SIZE * 3];
+	char    errbuf[128];
+	int     resc, i;
+	u32     nactive = 0;
+	merr_t  err;
+
+	err = mpool_activate_all(flags, &resc, &resv, &ei);
+	if (err) {
+		emit_err(co.co_fp, err, errbuf, sizeof(errbuf), "activate mpools", "", &ei);
+		return err;
+	}
+
+	if (resc == 0 && geteuid() != 0) {
+		printf("Run as root to scan and activate all mpools\n");
+		return merr(EPERM);
+	}
+
+	for (i = 0; i < resc; ++i) {
+		res = resv + i;
+
+		if (res->mar_active) {
+			++nactive;
+			continue;
+		}
+
+		if (res->mar_err) {
+			printf("Unable to activate mpool %s: %s\n", res->mar_name,
+			       mpool_strinfo(res->mar_err, errbuf, sizeof(errbuf)));
+			continue;
+		}
+
+		++nactive;
+
+		if (co.co_verbose > 0) {
+			uuid_unparse(*(uuid_t *)&res->mar_poolid, uuidstr);
+
+			printf("Activated mpool %s  %s  %d devices in %lu ms\n", res->mar_name,
+			       uuidstr, res->mar_devc, (ulong)(res->mar_nsec / 1000000));
+		}
+	}
+
+	printf("%u mpools now active\n", nactive);
+
+	free(resv);
+
+	return 0;
+}
+
 static merr_t mpool_scan_func(struct verb_s *v, int argc, char **argv)
 {
 	struct mpool_devrpt     ei = { };
@@ -619,6 +724,9 @@ static merr_t mpool_scan_func(struct verb_s *v, int argc, char **argv)
 		return err;
 	}
 
+	if (co.co_activate && !co.co_dry_run)
+		return mpool_scan_activate(flags);
+
 	err = mpool_scan(&allc, &allv, &ei);
 	if (err) {
 		emit_err(co.co_fp, err, errbuf, sizeof(errbuf),
@@ -0,0 +1,449 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mcache advisor module.
+ *
+ * Each policy period the advisor thread samples the resident pages of every
+ * registered map, adds the accesses reported since the last period to the
+ * halved heat of the map, and then walks the maps hottest first, pinned
+ * maps ahead of all others, charging them to the budget:
+ *
+ * - a pinned or accessed map is charged its full length and, if less than
+ *   7/8 of it is resident, advised MADV_WILLNEED;
+ * - a map that is no longer accessed is charged its resident pages only
+ *   and left alone;
+ * - a map that does not fit in what is left of the budget is demoted one
+ *   step per period, from MADV_COLD to MADV_DONTNEED to a purge of its
+ *   pages from the mcache, unless it is still accessed, in which case it
+ *   is only ever advised MADV_COLD.
+ *
+ * Maps are advised as a whole, under the lock of the map list, so that
+ * unmapping a map waits for the advisor to be done with it.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/minmax.h>
+#include <util/page.h>
+
+#include <mpctl/impool.h>
+
+#include <time.h>
+#include <sys/mman.h>
+
+#include "advisor.h"
+#include "residency.h"
+
+#define NSEC_PER_SEC            1000000000ull
+
+#ifndef MADV_COLD
+#define MADV_COLD               20
+#endif
+
+enum mp_advisor_state {
+	MP_ADVISOR_NONE,
+	MP_ADVISOR_WILLNEED,
+	MP_ADVISOR_COLD,
+	MP_ADVISOR_DONTNEED,
+	MP_ADVISOR_PURGED,
+};
+
+/**
+ * struct mp_advisor - mcache advisor
+ * @a_mp:      mpool handle
+ * @a_lock:    protects the fields from a_cv to a_stats
+ * @a_cv:      signaled when the advisor is stopped
+ * @a_tid:     advisor thread
+ * @a_started: advisor thread is running
+ * @a_stop:    advisor thread must exit
+ * @a_params:  policy parameters
+ * @a_stats:   statistics, but for mcas_maps
+ * @a_maplock: protects the fields from a_maps on
+ * @a_maps:    registered maps
+ * @a_mapc:    number of registered maps
+ * @a_candmax: size of a_candv
+ * @a_candv:   registered maps, in the order of the walk
+ */
+struct mp_advisor {
+	struct mpool                       *a_mp;
+	struct mutex                        a_lock;
+	pthread_cond_t                      a_cv;
+	pthread_t                           a_tid;
+	bool                                a_started;
+	bool                                a_stop;
+	struct mpool_mcache_advisor_params  a_params;
+	struct mpool_mcache_advisor_stats   a_stats;
+	struct mutex                        a_maplock;
+	struct mp_advisor_ent              *a_maps;
+	u64                                 a_mapc;
+	u64                                 a_candmax;
+	struct mp_advisor_ent             **a_candv;
+};
+
+static u64 mp_advisor_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int mp_advisor_cmp(const void *lhs, const void *rhs)
+{
+	const struct mp_advisor_ent *l = *(void * const *)lhs, *r = *(void * const *)rhs;
+	bool                         lpin, rpin;
+
+	lpin = l->ae_advice == MPC_VMA_PINNED;
+	rpin = r->ae_advice == MPC_VMA_PINNED;
+
+	if (lpin != rpin)
+		return lpin ? -1 : 1;
+
+	if (l->ae_heat != r->ae_heat)
+		return l->ae_heat > r->ae_heat ? -1 : 1;
+
+	/* Of equally hot maps, keep the smaller ones. */
+	if (l->ae_pagec != r->ae_pagec)
+		return l->ae_pagec < r->ae_pagec ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * mp_advisor_demote() - Take an over budget map one step down the ladder
+ * @adv:   advisor
+ * @ent:   map entry
+ * @stats: statistics to update
+ */
+static void
+mp_advisor_demote(
+	struct mp_advisor                  *adv,
+	struct mp_advisor_ent              *ent,
+	struct mpool_mcache_advisor_stats  *stats)
+{
+	merr_t  err;
+
+	if (ent->ae_heat > 0 || ent->ae_state < MP_ADVISOR_COLD ||
+	    ent->ae_state == MP_ADVISOR_PURGED) {
+		err = mpool_mcache_madvise(ent->ae_map, 0, 0, SIZE_MAX, MADV_COLD);
+		if (!err) {
+			ent->ae_state = MP_ADVISOR_COLD;
+			stats->mcas_cold++;
+			return;
+		}
+
+		/* Kernels before 5.4 do not know MADV_COLD. */
+		if (merr_errno(err) != EINVAL || ent->ae_heat > 0)
+			return;
+	} else if (ent->ae_state == MP_ADVISOR_DONTNEED) {
+		err = mpool_mcache_purge(ent->ae_map, adv->a_mp);
+		ent->ae_state = MP_ADVISOR_PURGED;
+		stats->mcas_purged += !err;
+		return;
+	}
+
+	err = mpool_mcache_madvise(ent->ae_map, 0, 0, SIZE_MAX, MADV_DONTNEED);
+	ent->ae_state = MP_ADVISOR_DONTNEED;
+	stats->mcas_dontneed += !err;
+}
+
+/**
+ * mp_advisor_period() - Run one policy period
+ */
+static void mp_advisor_period(struct mp_advisor *adv)
+{
+	struct mpool_mcache_advisor_stats   stats = { };
+	struct mp_advisor_ent             **candv, *ent;
+	u64                                 left, want, n, i;
+	u32                                 stride;
+	bool                                hot;
+
+	mutex_lock(&adv->a_lock);
+	left = adv->a_params.mcap_budget / PAGE_SIZE;
+	stride = adv->a_params.mcap_stride;
+	mutex_unlock(&adv->a_lock);
+
+	mutex_lock(&adv->a_maplock);
+	if (adv->a_candmax < adv->a_mapc) {
+		n = max_t(u64, adv->a_mapc * 2, 64);
+
+		candv = realloc(adv->a_candv, n * sizeof(*candv));
+		if (!candv) {
+			mutex_unlock(&adv->a_maplock);
+			return;
+		}
+
+		adv->a_candv = candv;
+		adv->a_candmax = n;
+	}
+
+	candv = adv->a_candv;
+	n = 0;
+
+	for (ent = adv->a_maps; ent; ent = ent->ae_next) {
+		if (mp_rss_scan(ent->ae_addr, ent->ae_pagec, stride, &ent->ae_rss, NULL))
+			ent->ae_rss = 0;
+
+		ent->ae_heat = ent->ae_heat / 2 + (u32)atomic_xchg(&ent->ae_hits, 0);
+		stats.mcas_resident += ent->ae_rss * PAGE_SIZE;
+		candv[n++] = ent;
+	}
+
+	qsort(candv, n, sizeof(*candv), mp_advisor_cmp);
+
+	for (i = 0; i < n; i++) {
+		ent = candv[i];
+		hot = ent->ae_heat > 0 || ent->ae_advice == MPC_VMA_PINNED;
+		want = hot ? ent->ae_pagec : ent->ae_rss;
+
+		if (want <= left) {
+			left -= want;
+
+			if (hot && ent->ae_rss < ent->ae_pagec - ent->ae_pagec / 8) {
+				if (!mpool_mcache_madvise(ent->ae_map, 0, 0, SIZE_MAX, MADV_WILLNEED))
+					stats.mcas_willneed++;
+				ent->ae_state = MP_ADVISOR_WILLNEED;
+			} else if (hot) {
+				ent->ae_state = MP_ADVISOR_NONE;
+			}
+			continue;
+		}
+
+		/* Pinned maps are never demoted, and a hot map keeps what it has if it fits. */
+		if (ent->ae_advice == MPC_VMA_PINNED || (hot && ent->ae_rss <= left)) {
+			left -= min_t(u64, left, ent->ae_rss);
+			continue;
+		}
+
+		if (ent->ae_rss > 0)
+			mp_advisor_demote(adv, ent, &stats);
+	}
+	mutex_unlock(&adv->a_maplock);
+
+	mutex_lock(&adv->a_lock);
+	adv->a_stats.mcas_periods++;
+	adv->a_stats.mcas_resident = stats.mcas_resident;
+	adv->a_stats.mcas_willneed += stats.mcas_willneed;
+	adv->a_stats.mcas_cold += stats.mcas_cold;
+	adv->a_stats.mcas_dontneed += stats.mcas_dontneed;
+	adv->a_stats.mcas_purged += stats.mcas_purged;
+	mutex_unlock(&adv->a_lock);
+}
+
+static void *mp_advisor_main(void *arg)
+{
+	struct mp_advisor  *adv = arg;
+	struct timespec     ts;
+	u64                 deadline;
+
+	mutex_lock(&adv->a_lock);
+	while (!adv->a_stop) {
+		deadline = mp_advisor_now() + adv->a_params.mcap_period_ms * 1000000ull;
+		ts.tv_sec = deadline / NSEC_PER_SEC;
+		ts.tv_nsec = deadline % NSEC_PER_SEC;
+
+		while (!adv->a_stop && mp_advisor_now() < deadline)
+			pthread_cond_timedwait(&adv->a_cv, &adv->a_lock.pth_mutex, &ts);
+
+		if (adv->a_stop)
+			break;
+
+		mutex_unlock(&adv->a_lock);
+		mp_advisor_period(adv);
+		mutex_lock(&adv->a_lock);
+	}
+	mutex_unlock(&adv->a_lock);
+
+	return NULL;
+}
+
+static void mp_advisor_stop(struct mp_advisor *adv)
+{
+	mutex_lock(&adv->a_lock);
+	if (!adv->a_started) {
+		mutex_unlock(&adv->a_lock);
+		return;
+	}
+
+	adv->a_stop = true;
+	pthread_cond_broadcast(&adv->a_cv);
+	mutex_unlock(&adv->a_lock);
+
+	pthread_join(adv->a_tid, NULL);
+
+	mutex_lock(&adv->a_lock);
+	adv->a_started = false;
+	mutex_unlock(&adv->a_lock);
+}
+
+void mpool_mcache_advisor_params_init(struct mpool_mcache_advisor_params *params)
+{
+	memset(params, 0, sizeof(*params));
+
+	params->mcap_period_ms = MP_ADVISOR_PERIOD_MS_DEFAULT;
+	params->mcap_stride = MP_ADVISOR_STRIDE_DEFAULT;
+	params->mcap_budget = MP_ADVISOR_BUDGET_DEFAULT;
+}
+
+mpool_err_t
+mpool_mcache_advisor_start(struct mpool *mp, const struct mpool_mcache_advisor_params *params)
+{
+	struct mp_advisor  *adv;
+	int                 rc;
+
+	if (!mp || !params || !params->mcap_period_ms || params->mcap_budget < PAGE_SIZE)
+		return merr(EINVAL);
+
+	adv = mp->mp_advisor;
+
+	mutex_lock(&adv->a_lock);
+	if (adv->a_started) {
+		mutex_unlock(&adv->a_lock);
+		return merr(EBUSY);
+	}
+
+	adv->a_params = *params;
+	adv->a_stop = false;
+
+	rc = pthread_create(&adv->a_tid, NULL, mp_advisor_main, adv);
+	if (rc) {
+		mutex_unlock(&adv->a_lock);
+		return merr(rc);
+	}
+
+	adv->a_started = true;
+	mutex_unlock(&adv->a_lock);
+
+	return 0;
+}
+
+mpool_err_t mpool_mcache_advisor_stop(struct mpool *mp)
+{
+	if (!mp)
+		return merr(EINVAL);
+
+	mp_advisor_stop(mp->mp_advisor);
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mcache_advisor_stats_get(struct mpool *mp, struct mpool_mcache_advisor_stats *stats)
+{
+	struct mp_advisor  *adv;
+
+	if (!mp || !stats)
+		return merr(EINVAL);
+
+	adv = mp->mp_advisor;
+
+	mutex_lock(&adv->a_lock);
+	*stats = adv->a_stats;
+	mutex_unlock(&adv->a_lock);
+
+	mutex_lock(&adv->a_maplock);
+	stats->mcas_maps = adv->a_mapc;
+	mutex_unlock(&adv->a_maplock);
+
+	return 0;
+}
+
+void mp_advisor_map_add(struct mp_advisor *adv, struct mp_advisor_ent *ent)
+{
+	if (!adv)
+		return;
+
+	atomic_set(&ent->ae_hits, 0);
+	ent->ae_heat = 0;
+	ent->ae_rss = 0;
+	ent->ae_state = MP_ADVISOR_NONE;
+	ent->ae_prev = NULL;
+
+	mutex_lock(&adv->a_maplock);
+	ent->ae_next = adv->a_maps;
+	if (adv->a_maps)
+		adv->a_maps->ae_prev = ent;
+	adv->a_maps = ent;
+	adv->a_mapc++;
+	mutex_unlock(&adv->a_maplock);
+}
+
+void mp_advisor_map_remove(struct mp_advisor *adv, struct mp_advisor_ent *ent)
+{
+	if (!adv)
+		return;
+
+	mutex_lock(&adv->a_maplock);
+	if (ent->ae_prev)
+		ent->ae_prev->ae_next = ent->ae_next;
+	else
+		adv->a_maps = ent->ae_next;
+
+	if (ent->ae_next)
+		ent->ae_next->ae_prev = ent->ae_prev;
+
+	ent->ae_prev = ent->ae_next = NULL;
+	adv->a_mapc--;
+	mutex_unlock(&adv->a_maplock);
+}
+
+void
+mp_advisor_map_walk(
+	struct mp_advisor  *adv,
+	void              (*fn)(struct mp_advisor_ent *ent, void *arg),
+	void               *arg)
+{
+	struct mp_advisor_ent *ent;
+
+	if (!adv)
+		return;
+
+	mutex_lock(&adv->a_maplock);
+	for (ent = adv->a_maps; ent; ent = ent->ae_next)
+		fn(ent, arg);
+	mutex_unlock(&adv->a_maplock);
+}
+
+merr_t mp_advisor_create(struct mpool *mp, struct mp_advisor **advp)
+{
+	pthread_condattr_t  attr;
+	struct mp_advisor  *adv;
+
+	if (!mp || !advp)
+		return merr(EINVAL);
+
+	adv = calloc(1, sizeof(*adv));
+	if (!adv)
+		return merr(ENOMEM);
+
+	adv->a_mp = mp;
+	mutex_init(&adv->a_lock);
+	mutex_init(&adv->a_maplock);
+
+	/* The period deadlines are in CLOCK_MONOTONIC time. */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&adv->a_cv, &attr);
+	pthread_condattr_destroy(&attr);
+
+	*advp = adv;
+
+	return 0;
+}
+
+void mp_advisor_destroy(struct mp_advisor *adv)
+{
+	if (!adv)
+		return;
+
+	mp_advisor_stop(adv);
+
+	pthread_cond_destroy(&adv->a_cv);
+	mutex_destroy(&adv->a_maplock);
+	mutex_destroy(&adv->a_lock);
+	free(adv->a_candv);
+	free(adv);
+}
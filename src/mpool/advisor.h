@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_ADVISOR_H
+#define MPOOL_ADVISOR_H
+
+/*
+ * Adaptive mcache advice.
+ *
+ * While the advisor is started, a thread periodically samples the
+ * residency of each mcache map of an mpool handle and the accesses the
+ * client reported on it with mpool_mcache_access(), and re-advises the
+ * maps so that the hottest ones stay resident within a memory budget,
+ * rather than leaving them to the advice they were created with.
+ */
+
+#include <util/platform.h>
+#include <util/atomic.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_ADVISOR_PERIOD_MS_DEFAULT    1000
+#define MP_ADVISOR_STRIDE_DEFAULT       4
+#define MP_ADVISOR_BUDGET_DEFAULT       (1ul << 30)
+
+struct mp_advisor;
+
+/**
+ * struct mp_advisor_ent - advisor entry, embedded in an mcache map
+ * @ae_prev:   previous registered map
+ * @ae_next:   next registered map
+ * @ae_map:    map handle
+ * @ae_addr:   base address of the map
+ * @ae_pagec:  number of pages of the map
+ * @ae_advice: advice the map was created with
+ * @ae_hits:   accesses reported since the last period
+ * @ae_heat:   access count, halved every period
+ * @ae_rss:    resident pages at the last period
+ * @ae_state:  advice last given by the advisor
+ */
+struct mp_advisor_ent {
+	struct mp_advisor_ent      *ae_prev;
+	struct mp_advisor_ent      *ae_next;
+	struct mpool_mcache_map    *ae_map;
+	void                       *ae_addr;
+	size_t                      ae_pagec;
+	u32                         ae_advice;
+	atomic_t                    ae_hits;
+	u64                         ae_heat;
+	u64                         ae_rss;
+	u32                         ae_state;
+};
+
+/**
+ * mp_advisor_create() - Create the (stopped) advisor of an mpool handle
+ * @mp:   mpool handle
+ * @advp: advisor (output)
+ */
+merr_t mp_advisor_create(struct mpool *mp, struct mp_advisor **advp);
+
+/**
+ * mp_advisor_destroy() - Stop and destroy an advisor
+ * @adv: advisor (may be NULL)
+ *
+ * All maps must have been unregistered.
+ */
+void mp_advisor_destroy(struct mp_advisor *adv);
+
+/**
+ * mp_advisor_map_add() - Register an mcache map
+ * @adv: advisor (may be NULL)
+ * @ent: entry, of which ae_map, ae_addr, ae_pagec and ae_advice must be set
+ */
+void mp_advisor_map_add(struct mp_advisor *adv, struct mp_advisor_ent *ent);
+
+/**
+ * mp_advisor_map_remove() - Unregister an mcache map before unmapping it
+ * @adv: advisor (may be NULL)
+ * @ent: entry
+ *
+ * Waits for the advisor to be done with the map.
+ */
+void mp_advisor_map_remove(struct mp_advisor *adv, struct mp_advisor_ent *ent);
+
+/**
+ * mp_advisor_map_walk() - Call a function on each registered mcache map
+ * @adv: advisor (may be NULL)
+ * @fn:  function, which must not register nor unregister maps
+ * @arg: function argument
+ */
+void
+mp_advisor_map_walk(
+	struct mp_advisor  *adv,
+	void              (*fn)(struct mp_advisor_ent *ent, void *arg),
+	void               *arg);
+
+/**
+ * mp_advisor_access() - Account accesses to a registered mcache map
+ * @ent:  entry
+ * @hits: number of accesses
+ */
+static inline void mp_advisor_access(struct mp_advisor_ent *ent, u32 hits)
+{
+	atomic_add(hits, &ent->ae_hits);
+}
+
+#endif /* MPOOL_ADVISOR_H */
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * CRC32C module.
+ *
+ * The portable implementation is slicing-by-8 over tables built on first
+ * use.  On x86_64 the SSE4.2 crc32 instruction, which implements the same
+ * polynomial, is selected at runtime when available.
+ */
+
+#include <util/platform.h>
+#include <util/byteorder.h>
+
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY     0x82f63b78u     /* reflected Castagnoli polynomial */
+
+static u32              crc32c_tabv[8][256];
+static pthread_once_t   crc32c_once = PTHREAD_ONCE_INIT;
+static bool             crc32c_hw;
+
+static void crc32c_init(void)
+{
+	u32 crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		crc32c_tabv[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_tabv[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_tabv[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_tabv[j][i] = crc;
+		}
+	}
+
+#if defined(__x86_64__)
+	crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static u32 crc32c_sw(u32 crc, const u8 *p, size_t len)
+{
+	u64 w;
+
+	while (len > 0 && ((uintptr_t)p & 7)) {
+		crc = crc32c_tabv[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8) {
+		w = le64_to_cpu(*(const u64 *)p) ^ crc;
+
+		crc = crc32c_tabv[7][w & 0xff] ^
+			crc32c_tabv[6][(w >> 8) & 0xff] ^
+			crc32c_tabv[5][(w >> 16) & 0xff] ^
+			crc32c_tabv[4][(w >> 24) & 0xff] ^
+			crc32c_tabv[3][(w >> 32) & 0xff] ^
+			crc32c_tabv[2][(w >> 40) & 0xff] ^
+			crc32c_tabv[1][(w >> 48) & 0xff] ^
+			crc32c_tabv[0][w >> 56];
+
+		p += 8;
+		len -= 8;
+	}
+
+	while (len-- > 0)
+		crc = crc32c_tabv[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static u32 crc32c_hw_x86(u32 crc, const u8 *p, size_t len)
+{
+	u64 crc64;
+
+	while (len > 0 && ((uintptr_t)p & 7)) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+		len--;
+	}
+
+	crc64 = crc;
+	while (len >= 8) {
+		crc64 = __builtin_ia32_crc32di(crc64, *(const u64 *)p);
+		p += 8;
+		len -= 8;
+	}
+	crc = crc64;
+
+	while (len-- > 0)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+
+	return crc;
+}
+#endif
+
+u32 crc32c(u32 crc, const void *data, size_t len)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+
+	crc = ~crc;
+
+#if defined(__x86_64__)
+	if (crc32c_hw)
+		return ~crc32c_hw_x86(crc, data, len);
+#endif
+
+	return ~crc32c_sw(crc, data, len);
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_CRC32C_H
+#define MPOOL_CRC32C_H
+
+#include <util/platform.h>
+
+/**
+ * crc32c() - Compute or extend a CRC32C (Castagnoli) checksum
+ * @crc:  CRC of the preceding data, 0 to start a new checksum
+ * @data: data
+ * @len:  length of data
+ *
+ * Uses the SSE4.2 crc32 instruction when the CPU supports it.
+ */
+u32 crc32c(u32 crc, const void *data, size_t len);
+
+#endif /* MPOOL_CRC32C_H */
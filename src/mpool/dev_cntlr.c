@@ -11,29 +11,129 @@
 #include <util/uuid.h>
 #include <util/page.h>
 #include <util/minmax.h>
+#include <util/mutex.h>
 
 #include <mpool/mpool_devrpt.h>
 
 #include "device_table.h"
 #include "dev_cntlr.h"
 #include "logging.h"
+#include "workers.h"
+
+#define TRIM_WORKERS            4       /* threads trimming a device */
+#define TRIM_RANGES_MIN         64      /* ranges a device is split into, at least */
+
+/**
+ * struct trim_work - state shared by the threads trimming a device
+ * @tw_lock:     protects the fields below
+ * @tw_dev:      device path
+ * @tw_fd:       device file descriptor
+ * @tw_cmd:      BLKSECDISCARD until it fails once, then BLKDISCARD, or BLKZEROOUT
+ * @tw_next:     offset of the next range to trim
+ * @tw_end:      end of the granularity aligned part of the device
+ * @tw_rangesz:  size of a range, a multiple of the discard granularity
+ * @tw_done:     bytes trimmed
+ * @tw_err:      first error, which stops the trim
+ * @tw_progress: progress callback (may be NULL)
+ * @tw_arg:      progress callback argument
+ */
+struct trim_work {
+	struct mutex            tw_lock;
+	const char             *tw_dev;
+	int                     tw_fd;
+	unsigned long           tw_cmd;
+	u64                     tw_next;
+	u64                     tw_end;
+	u64                     tw_rangesz;
+	u64                     tw_done;
+	merr_t                  tw_err;
+	mp_trim_progress_fn    *tw_progress;
+	void                   *tw_arg;
+};
+
+static void *trim_worker(void *arg)
+{
+	struct trim_work   *work = arg;
+	unsigned long       cmd;
+	u64                 range[2];
+	int                 rc;
+
+	mutex_lock(&work->tw_lock);
+
+	while (!work->tw_err && work->tw_next < work->tw_end) {
+		range[0] = work->tw_next;
+		range[1] = min_t(u64, work->tw_rangesz, work->tw_end - range[0]);
+		work->tw_next += range[1];
+		cmd = work->tw_cmd;
+
+		mutex_unlock(&work->tw_lock);
+
+		rc = ioctl(work->tw_fd, cmd, &range);
+		if (rc && cmd == BLKSECDISCARD) {
+			cmd = BLKDISCARD;
+			rc = ioctl(work->tw_fd, cmd, &range);
+		}
+
+		/* Taking the lock may clobber errno. */
+		rc = rc ? errno : 0;
+
+		mutex_lock(&work->tw_lock);
+
+		if (rc) {
+			if (!work->tw_err) {
+				work->tw_err = merr(rc);
+				mp_pr_err("Failed to trim device %s cmd %lu range 0x%lx 0x%lx",
+					  work->tw_err, work->tw_dev, cmd, range[0], range[1]);
+			}
+			break;
+		}
+
+		/* Secure discard is not retried once it failed. */
+		if (cmd == BLKDISCARD)
+			work->tw_cmd = cmd;
+
+		work->tw_done += range[1];
+
+		/* Called under the lock so that progress is reported in order. */
+		if (work->tw_progress)
+			work->tw_progress(work->tw_arg, work->tw_dev, work->tw_done, work->tw_end);
+	}
+
+	mutex_unlock(&work->tw_lock);
+
+	return NULL;
+}
 
 /**
  * generic_trim_device():
- * @dev:
+ * @dev:      device path
+ * @policy:   how to trim a device that reports that discard zeroes data
+ * @progress: progress callback (may be NULL)
+ * @arg:      progress callback argument
  * @rcode:
+ *
+ * The device is split in granularity aligned ranges, at most
+ * discard_max_bytes long, which TRIM_WORKERS threads discard concurrently.
+ * Trimming is best effort: only failing to open the device is an error.
  */
-merr_t generic_trim_device(const char *dev, enum mpool_rc *rcode)
+merr_t
+generic_trim_device(
+	const char             *dev,
+	enum mp_trim_policy     policy,
+	mp_trim_progress_fn    *progress,
+	void                   *arg,
+	enum mpool_rc          *rcode)
 {
-	u64            range[2];
-	merr_t         err = 0;
-	struct stat    stats;
-	int            fd;
-	char           sysfs_dpath[PATH_MAX]; /* /sys/block/<dev_name> */
-	u64            maxd_bytes;
-	u64            grand_bytes;
-	u64            dev_sz_bytes;
-	unsigned long  cmd;
+	struct trim_work    work = { };
+	merr_t              err = 0;
+	struct stat         stats;
+	int                 fd;
+	char                sysfs_dpath[PATH_MAX]; /* /sys/block/<dev_name> */
+	u64                 maxd_bytes;
+	u64                 grand_bytes;
+	u64                 dev_sz_bytes;
+	u64                 rangesz;
+	u64                 zeroes;
 
 	fd = open(dev, O_WRONLY | O_CLOEXEC);
 	if (-1 == fd) {
@@ -74,45 +174,47 @@ merr_t generic_trim_device(const char *dev, enum mpool_rc *rcode)
 
 	if (maxd_bytes == 0 || grand_bytes == 0)
 		goto exit;
+
 	/*
 	 * Round down max discard to a granularity multiple.
 	 */
-	range[1] = (maxd_bytes / grand_bytes) * grand_bytes;
-	if (range[1] == 0) {
+	rangesz = (maxd_bytes / grand_bytes) * grand_bytes;
+	if (rangesz == 0) {
 		mse_log(MPOOL_INFO
 			"Discard parameters inconsistent for device %s, 0x%lx 0x%lx",
 			dev, maxd_bytes, grand_bytes);
 		goto exit;
 	}
 
-	cmd = BLKSECDISCARD;
-	for (range[0] = 0; range[0] < dev_sz_bytes; range[0] += range[1]) {
-		int    rc;
-
-		/* Don't pass end of device. */
-		if (range[0] + range[1] > dev_sz_bytes) {
-			range[1] = dev_sz_bytes - range[0];
-			/* Adjust to granularity. */
-			range[1] = (range[1] / grand_bytes) * grand_bytes;
-			if (range[1] == 0)
-				break;
-		}
+	work.tw_cmd = BLKSECDISCARD;
 
-		rc = ioctl(fd, cmd, &range);
-		if (rc && cmd == BLKSECDISCARD) {
-			cmd = BLKDISCARD;
-			rc = ioctl(fd, cmd, &range);
-		}
-
-		if (rc) {
-			err = merr(errno);
-			mpool_elog(MPOOL_INFO
-				   "Failed to trim device %s cmd %lu range 0x%lx 0x%lx, @@e",
-				   err, dev, cmd, range[0], range[1]);
+	/* Same as MP_PD_CMD_DISCARD_ZERO in the PD properties. */
+	if (!sysfs_get_val_u64(sysfs_dpath, "/queue/discard_zeroes_data", 1, &zeroes) && zeroes) {
+		if (policy == MP_TRIM_SKIP)
 			goto exit;
-		}
+
+		if (policy == MP_TRIM_ZEROOUT)
+			work.tw_cmd = BLKZEROOUT;
 	}
 
+	/*
+	 * Split the device in enough ranges to keep the workers busy and to
+	 * report progress, each ending on a granularity boundary.
+	 */
+	work.tw_end = (dev_sz_bytes / grand_bytes) * grand_bytes;
+	work.tw_rangesz = (work.tw_end / TRIM_RANGES_MIN / grand_bytes) * grand_bytes;
+	work.tw_rangesz = clamp_t(u64, work.tw_rangesz, grand_bytes, rangesz);
+
+	mutex_init(&work.tw_lock);
+	work.tw_dev = dev;
+	work.tw_fd = fd;
+	work.tw_progress = progress;
+	work.tw_arg = arg;
+
+	mp_run_workers(trim_worker, &work, TRIM_WORKERS);
+
+	mutex_destroy(&work.tw_lock);
+
 exit:
 	close(fd);
 
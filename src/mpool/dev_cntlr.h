@@ -14,6 +14,7 @@
 #include <util/platform.h>
 #include <mpool/mpool_ioctl.h>
 #include <mpctl/pd_props.h>
+#include <mpctl/impool.h>
 
 #include "mpctl.h"
 
@@ -33,7 +34,13 @@ struct dev_interface {
  */
 enum device_phys_if get_dev_interface(const char *path);
 
-merr_t generic_trim_device(const char *dev, enum mpool_rc *rcode);
+merr_t
+generic_trim_device(
+	const char             *dev,
+	enum mp_trim_policy     policy,
+	mp_trim_progress_fn    *progress,
+	void                   *arg,
+	enum mpool_rc          *rcode);
 
 merr_t generic_get_awsz(const char *dev, u32 *datasz);
 
@@ -19,6 +19,7 @@
 
 #include "dev_cntlr.h"
 #include "logging.h"
+#include "probecache.h"
 
 #include <assert.h>
 
@@ -650,7 +651,7 @@ static merr_t dev_get_prop(const char *dpath, const char *ppath, struct pd_prop
 	return err;
 }
 
-merr_t imp_dev_get_prop(const char *path, struct pd_prop *pd_prop)
+merr_t imp_dev_get_prop_uncached(const char *path, struct pd_prop *pd_prop)
 {
 	struct dev_table_ent   *dev_ent;
 	struct stat	        st;
@@ -705,6 +706,38 @@ merr_t imp_dev_get_prop(const char *path, struct pd_prop *pd_prop)
 	return err;
 }
 
+merr_t imp_dev_get_prop(const char *path, struct pd_prop *pd_prop)
+{
+	const struct mp_probe_rec  *hit = NULL;
+	struct mp_probe_cache      *pc = NULL;
+	struct mp_probe_rec         rec;
+	merr_t                      err;
+
+	/* Only block devices are cached, looking at a file is cheap. */
+	if (!mp_probe_key(path, &rec)) {
+		pc = mp_probe_cache_open();
+		if (pc)
+			hit = mp_probe_cache_find(pc, &rec);
+	}
+
+	if (hit && (hit->pr_flags & MP_PROBE_PROP)) {
+		*pd_prop = hit->pr_prop;
+		mp_probe_cache_close(pc);
+		return 0;
+	}
+
+	err = imp_dev_get_prop_uncached(path, pd_prop);
+	if (!err && pc) {
+		rec.pr_flags = MP_PROBE_PROP;
+		rec.pr_prop = *pd_prop;
+		mp_probe_cache_update(pc, &rec);
+	}
+
+	mp_probe_cache_close(pc);
+
+	return err;
+}
+
 merr_t imp_dev_alloc_get_prop(int dcnt, char **devices, struct pd_prop **pd_prop)
 {
 	struct pd_prop *pdp;
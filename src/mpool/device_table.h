@@ -93,6 +93,13 @@ merr_t sysfs_get_dpath(const char *dpath, char *sysfs_dpath, size_t sysfs_dpath_
  */
 merr_t sysfs_pd_disable_wbt(const char *ppath);
 
+/**
+ * imp_dev_get_prop_uncached() - get the device properties, bypassing the probe cache
+ * @path:    device or file path
+ * @pd_prop: device properties (output)
+ */
+merr_t imp_dev_get_prop_uncached(const char *path, struct pd_prop *pd_prop);
+
 /**
  * partname_to_diskname() -
  * @diskname: (output) Path of whole disk
@@ -7,12 +7,16 @@
 
 #include <util/platform.h>
 #include <util/string.h>
+#include <util/atomic.h>
 #include <mpool/mpool.h>
 #include <mpctl/impool.h>
 #include <mpcore/mpcore_defs.h>
 
 #include "discover.h"
+#include "device_table.h"
 #include "logging.h"
+#include "probecache.h"
+#include "workers.h"
 
 #include <stdio.h>
 #include <mntent.h>
@@ -21,9 +25,7 @@
 #include <string.h>
 #include <libgen.h>
 #include <mpool_blkid/blkid.h>
-#include <sys/types.h>
 #include <dirent.h>
-#include <string.h>
 
 bool imp_mpool_activated(const char *name)
 {
@@ -92,6 +94,133 @@ imp_entry_match(
 	return (nmatched >= matchmin);
 }
 
+/**
+ * struct imp_probe - block device probed by imp_entries_get()
+ * @ip_path:  device path
+ * @ip_rec:   probe results
+ * @ip_errno: errno of a failed attempt to open the device, else 0
+ * @ip_keyed: ip_rec holds the cache key of the device
+ * @ip_fresh: ip_rec holds results not in the cache
+ * @ip_match: the device is returned by imp_entries_get()
+ */
+struct imp_probe {
+	char                    ip_path[NAME_MAX + 8];
+	struct mp_probe_rec     ip_rec;
+	int                     ip_errno;
+	bool                    ip_keyed;
+	bool                    ip_fresh;
+	bool                    ip_match;
+};
+
+/**
+ * struct imp_probe_work - block devices probed concurrently
+ * @ipw_pc:     probe cache, may be NULL
+ * @ipw_probev: devices
+ * @ipw_probec: number of devices
+ * @ipw_next:   index of the next device to probe
+ */
+struct imp_probe_work {
+	const struct mp_probe_cache    *ipw_pc;
+	struct imp_probe               *ipw_probev;
+	int                             ipw_probec;
+	atomic_t                        ipw_next;
+};
+
+/**
+ * imp_probe_one() - Probe a block device, unless the probe cache has its results
+ */
+static void imp_probe_one(const struct mp_probe_cache *pc, struct imp_probe *probe)
+{
+	const struct mp_probe_rec  *hit = NULL;
+	struct mp_probe_rec        *rec = &probe->ip_rec;
+	const char                 *d_uuid, *d_type, *d_label;
+	blkid_probe                 pr;
+	merr_t                      err;
+	int                         rc;
+
+	probe->ip_keyed = !mp_probe_key(probe->ip_path, rec);
+	if (probe->ip_keyed && pc)
+		hit = mp_probe_cache_find(pc, rec);
+
+	/* The properties of mpool members are needed as well. */
+	if (hit && (hit->pr_flags & MP_PROBE_BLKID) &&
+	    (!(hit->pr_flags & MP_PROBE_MPOOL) || (hit->pr_flags & MP_PROBE_PROP))) {
+		*rec = *hit;
+		return;
+	}
+
+	if (!probe->ip_keyed)
+		memset(rec, 0, sizeof(*rec));
+
+	pr = blkid_new_probe_from_filename(probe->ip_path);
+	if (!pr) {
+		probe->ip_errno = errno;
+		return;
+	}
+
+	/* 1 means that no signature was found, which is worth caching. */
+	rc = blkid_do_probe(pr);
+	if (rc < 0) {
+		blkid_free_probe(pr);
+		return;
+	}
+
+	rec->pr_flags = MP_PROBE_BLKID;
+
+	d_type = d_label = NULL;
+	if (rc == 0) {
+		blkid_probe_lookup_value(pr, "TYPE", &d_type, NULL);
+		blkid_probe_lookup_value(pr, "LABEL", &d_label, NULL);
+	}
+
+	if (d_type && !strcmp(d_type, "mpool") && d_label) {
+		d_uuid = NULL;
+		blkid_probe_lookup_value(pr, "UUID", &d_uuid, NULL);
+		if (!d_uuid || mpool_parse_uuid(d_uuid, &rec->pr_uuid) == -1)
+			memset(&rec->pr_uuid, 0, sizeof(rec->pr_uuid));
+
+		/* The LABEL contains a zero terminated mpool name, but
+		 * place a zero at the end as a safeguard.
+		 */
+		strlcpy(rec->pr_name, d_label, sizeof(rec->pr_name));
+		rec->pr_flags |= MP_PROBE_MPOOL;
+
+		err = imp_dev_get_prop_uncached(probe->ip_path, &rec->pr_prop);
+		if (!err)
+			rec->pr_flags |= MP_PROBE_PROP;
+	}
+
+	blkid_free_probe(pr);
+
+	probe->ip_fresh = probe->ip_keyed;
+}
+
+static void *imp_probe_worker(void *arg)
+{
+	struct imp_probe_work  *work = arg;
+	int                     i;
+
+	while ((i = atomic_inc_return(&work->ipw_next) - 1) < work->ipw_probec)
+		imp_probe_one(work->ipw_pc, work->ipw_probev + i);
+
+	return NULL;
+}
+
+/**
+ * imp_probe_all() - Probe block devices with a bounded number of threads
+ */
+static void imp_probe_all(const struct mp_probe_cache *pc, struct imp_probe *probev, int probec)
+{
+	struct imp_probe_work   work;
+
+	work.ipw_pc = pc;
+	work.ipw_probev = probev;
+	work.ipw_probec = probec;
+	atomic_set(&work.ipw_next, 0);
+
+	mp_run_workers(imp_probe_worker, &work, mp_workers_io(MP_PROBE_THREADS_MAX, probec));
+}
+
 /**
  * imp_entries_get() - look at devices in /sys/class/block, returns one entry
  *	for each device that matches the input parameters.
@@ -108,6 +237,9 @@ imp_entry_match(
  *	A free is needed if the function returns 0 (no error) and entry_cnt is
  *	non 0 and entries was passed in not NULL.
  * @entry_cnt: number of matching devices.
+ *
+ * The devices are listed in a single pass and then probed concurrently,
+ * skipping those whose results are in the probe cache, unless @dpath is set.
  */
 merr_t
 imp_entries_get(
@@ -118,19 +250,16 @@ imp_entries_get(
 	struct imp_entry  **entries,
 	int                *entry_cnt)
 {
-	struct imp_entry   *my_entries = NULL;
-	const char         *d_uuid, *d_type, *d_label;
-	blkid_probe         pr;
-	struct dirent      *d;
+	struct imp_probe       *probev = NULL, *probe;
+	struct mp_probe_cache  *pc;
+	struct imp_entry        entry;
+	struct dirent          *d;
 
-	int     cnt = 0, saved_cnt = 0, ret;
+	int     probec = 0, probemax = 0, cnt = 0, i;
 	bool    eacces_logged = false;
-	bool    first_pass = true;
-	bool    invert = false;
 	char   *rpath = NULL;
-	bool    rc;
 	DIR    *dir;
-	merr_t  err;
+	merr_t  err = 0;
 
 	if (!entry_cnt)
 		return merr(EINVAL);
@@ -151,116 +280,114 @@ imp_entries_get(
 		return err;
 	}
 
-	/* On first_pass, get a count.
-	 * On second pass, copy entries.
-	 */
-second_pass_libblkid:
 	while ((d = readdir(dir))) {
-		char filename[NAME_MAX + 8];
-		struct imp_entry entry;
 		int n;
 
 		if (d->d_name[0] == '.')
 			continue;
 
-		n = snprintf(filename, sizeof(filename), "/dev/%s", d->d_name);
-		if (n >= sizeof(filename)) {
-			err = merr(ENAMETOOLONG);
-			mp_pr_err("design fail", err);
-			continue;
-		}
+		if (probec == probemax) {
+			probemax = probemax * 2 ?: 64;
 
-		pr = blkid_new_probe_from_filename(filename);
-		if (!pr) {
-			if (errno == EACCES && !eacces_logged) {
-				err = merr(errno);
-				mp_pr_err("Device discovery may need access rights in /sys/class/block",
-					  err);
-				eacces_logged = true;
+			probe = realloc(probev, probemax * sizeof(*probev));
+			if (!probe) {
+				err = merr(ENOMEM);
+				goto errout;
 			}
-			continue;
-		}
 
-		rc = blkid_do_probe(pr);
-		if (rc) {
-			blkid_free_probe(pr);
-			continue;
+			probev = probe;
 		}
 
-		blkid_probe_lookup_value(pr, "TYPE", &d_type, NULL);
-		if (!d_type || strcmp(d_type, "mpool")) {
-			blkid_free_probe(pr);
+		probe = probev + probec;
+		memset(probe, 0, sizeof(*probe));
+
+		n = snprintf(probe->ip_path, sizeof(probe->ip_path), "/dev/%s", d->d_name);
+		if (n >= sizeof(probe->ip_path)) {
+			err = merr(ENAMETOOLONG);
+			mp_pr_err("design fail", err);
 			continue;
 		}
 
-		blkid_probe_lookup_value(pr, "UUID", &d_uuid, NULL);
-		ret = mpool_parse_uuid(d_uuid, &entry.mp_uuid);
-		if (ret == -1)
-			memset(&entry.mp_uuid, 0, sizeof(entry.mp_uuid));
+		probec++;
+	}
 
-		blkid_probe_lookup_value(pr, "LABEL", &d_label, NULL);
+	pc = mp_probe_cache_open();
 
-		if (!d_label) {
-			blkid_free_probe(pr);
-			continue;
-		}
+	/*
+	 * A lookup of a single device guards against overwriting it, so it is
+	 * not answered from the cache, whose results may be stale.
+	 */
+	imp_probe_all(dpath ? NULL : pc, probev, probec);
 
-		/* The LABEL contains a zero terminated mpool name, but
-		 * place a zero at the end as a safeguard.
-		 */
-		strlcpy(entry.mp_name, d_label, sizeof(entry.mp_name));
-		strlcpy(entry.mp_path, filename, sizeof(entry.mp_path));
-
-		rc = imp_entry_match(&entry, name, uuid, rpath, invert);
-		if (rc) {
-			if (!first_pass) {
-				err = imp_dev_get_prop(filename, &entry.mp_pd_prop);
-				if (!err)
-					*my_entries++ = entry;
-			}
+	for (i = 0; i < probec; i++) {
+		probe = probev + i;
 
-			cnt++;
-			if (!first_pass && cnt == saved_cnt) {
-				blkid_free_probe(pr);
-				break;
-			}
+		if (probe->ip_errno == EACCES && !eacces_logged) {
+			err = merr(EACCES);
+			mp_pr_err("Device discovery may need access rights in /sys/class/block", err);
+			eacces_logged = true;
 		}
 
-		blkid_free_probe(pr);
+		if (probe->ip_fresh && pc)
+			mp_probe_cache_update(pc, &probe->ip_rec);
 	}
 
+	mp_probe_cache_close(pc);
+
 	err = 0;
 
-	if (first_pass) {
-		first_pass = false;
-		if (cnt == 0)
-			goto errout;
+	for (i = 0; i < probec; i++) {
+		probe = probev + i;
 
-		if (!entries) {
-			*entry_cnt = cnt;
-			goto errout;
-		}
+		if (!(probe->ip_rec.pr_flags & MP_PROBE_MPOOL))
+			continue;
 
-		*entries = calloc(cnt, sizeof(**entries));
-		if (!*entries) {
-			err = merr(ENOMEM);
-			goto errout;
-		}
+		strlcpy(entry.mp_name, probe->ip_rec.pr_name, sizeof(entry.mp_name));
+		entry.mp_uuid = probe->ip_rec.pr_uuid;
+		strlcpy(entry.mp_path, probe->ip_path, sizeof(entry.mp_path));
+
+		if (!imp_entry_match(&entry, name, uuid, rpath, false))
+			continue;
+
+		/* Return only the entries for which we could acquire valid
+		 * information.
+		 */
+		if (entries && !(probe->ip_rec.pr_flags & MP_PROBE_PROP))
+			continue;
 
-		my_entries = *entries;
-		saved_cnt = cnt;
-		cnt = 0;
-		rewinddir(dir);
-		goto second_pass_libblkid;
+		probe->ip_match = true;
+		cnt++;
 	}
 
-	/* Return only the entries for which we could acquire valid
-	 * information.
-	 */
-	*entry_cnt = my_entries - *entries;
+	if (cnt == 0 || !entries) {
+		*entry_cnt = cnt;
+		goto errout;
+	}
+
+	*entries = calloc(cnt, sizeof(**entries));
+	if (!*entries) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (i = 0; i < probec; i++) {
+		probe = probev + i;
+
+		if (!probe->ip_match)
+			continue;
+
+		entry = (struct imp_entry){ };
+		strlcpy(entry.mp_name, probe->ip_rec.pr_name, sizeof(entry.mp_name));
+		entry.mp_uuid = probe->ip_rec.pr_uuid;
+		entry.mp_pd_prop = probe->ip_rec.pr_prop;
+		strlcpy(entry.mp_path, probe->ip_path, sizeof(entry.mp_path));
+
+		(*entries)[(*entry_cnt)++] = entry;
+	}
 
 errout:
 	closedir(dir);
+	free(probev);
 	free(rpath);
 
 	return err;
@@ -0,0 +1,906 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mcache hot set module.
+ *
+ * Layout of a hot set descriptor:
+ *
+ *   header | record 0 | ranges of record 0 | record 1 | ...
+ *
+ * Each record is an mblock ID, the heat of the map it was recorded from
+ * and its number of ranges, and each range is a page offset and a page
+ * count.  Resident runs of pages separated by at most MP_HOTSET_GAP pages
+ * are recorded as a single range, and the gap is doubled until there are
+ * at most MP_HOTSET_RUNS_MAX ranges, so that replaying a record issues a
+ * few large requests.  The header holds the CRC32C of the records.  All
+ * fields are little-endian.
+ *
+ * Records are appended as maps are unmapped.  Once there are twice as many
+ * records as are saved, or when saving, the superseded records are dropped
+ * and then all but the hottest ones.
+ *
+ * The warmup thread pops the hottest queued range, ties going to the
+ * earliest queued one, and populates it MP_WARMUP_CHUNK bytes at a time,
+ * with MADV_POPULATE_READ or, on kernels before 5.14, MADV_WILLNEED.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/minmax.h>
+#include <util/page.h>
+#include <util/omf.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crc32c.h"
+#include "hotset.h"
+#include "residency.h"
+
+#define HOTSET_MAGIC            0x5453484du     /* "MHST" */
+#define HOTSET_VERSION          1
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ      22
+#endif
+
+/**
+ * struct hotset_hdr_omf - hot set descriptor header
+ * @hsh_magic: HOTSET_MAGIC
+ * @hsh_vers:  HOTSET_VERSION
+ * @hsh_recc:  number of records
+ * @hsh_crc:   CRC32C of the records and their ranges
+ */
+struct hotset_hdr_omf {
+	__le32 hsh_magic;
+	__le32 hsh_vers;
+	__le32 hsh_recc;
+	__le32 hsh_crc;
+} __packed;
+
+OMF_SETGET(struct hotset_hdr_omf, hsh_magic, 32)
+OMF_SETGET(struct hotset_hdr_omf, hsh_vers, 32)
+OMF_SETGET(struct hotset_hdr_omf, hsh_recc, 32)
+OMF_SETGET(struct hotset_hdr_omf, hsh_crc, 32)
+
+/**
+ * struct hotset_rec_omf - hot set record, followed by its ranges
+ * @hsr_mbid: mblock object ID
+ * @hsr_heat: heat of the map the mblock was recorded from
+ * @hsr_runc: number of ranges
+ */
+struct hotset_rec_omf {
+	__le64 hsr_mbid;
+	__le32 hsr_heat;
+	__le32 hsr_runc;
+} __packed;
+
+OMF_SETGET(struct hotset_rec_omf, hsr_mbid, 64)
+OMF_SETGET(struct hotset_rec_omf, hsr_heat, 32)
+OMF_SETGET(struct hotset_rec_omf, hsr_runc, 32)
+
+/**
+ * struct hotset_run_omf - range of resident pages
+ * @hsu_pgoff: offset of the range in the mblock, in pages
+ * @hsu_pgcnt: length of the range, in pages
+ */
+struct hotset_run_omf {
+	__le32 hsu_pgoff;
+	__le32 hsu_pgcnt;
+} __packed;
+
+OMF_SETGET(struct hotset_run_omf, hsu_pgoff, 32)
+OMF_SETGET(struct hotset_run_omf, hsu_pgcnt, 32)
+
+struct mp_hotset_run {
+	u32                     hu_pgoff;
+	u32                     hu_pgcnt;
+};
+
+/**
+ * struct mp_hotset_rec - resident ranges of an mblock
+ * @hr_mbid:  mblock object ID
+ * @hr_seq:   order in which the record was made
+ * @hr_pages: number of pages in the ranges
+ * @hr_heat:  heat of the map the mblock was recorded from
+ * @hr_runc:  number of ranges
+ * @hr_runv:  ranges, in offset order
+ */
+struct mp_hotset_rec {
+	u64                     hr_mbid;
+	u64                     hr_seq;
+	u64                     hr_pages;
+	u32                     hr_heat;
+	u32                     hr_runc;
+	struct mp_hotset_run   *hr_runv;
+};
+
+/**
+ * struct mpool_mcache_hotset - hot set descriptor
+ * @mh_recc:   number of records
+ * @mh_recmax: size of mh_recv
+ * @mh_recv:   records, in mblock ID order once loaded
+ */
+struct mpool_mcache_hotset {
+	u32                     mh_recc;
+	u32                     mh_recmax;
+	struct mp_hotset_rec   *mh_recv;
+};
+
+/**
+ * struct mp_warmup_item - queued range
+ * @wi_key:  map handle
+ * @wi_addr: start of the range in the map
+ * @wi_len:  length of the range
+ * @wi_heat: recorded heat
+ * @wi_seq:  order in which the range was queued
+ */
+struct mp_warmup_item {
+	const void             *wi_key;
+	char                   *wi_addr;
+	size_t                  wi_len;
+	u32                     wi_heat;
+	u64                     wi_seq;
+};
+
+/**
+ * struct mp_hotset - hot set recorder and warmup engine
+ * @hs_lock:       protects the fields from hs_max to hs_rec
+ * @hs_max:        maximum number of records saved
+ * @hs_seq:        number of records made
+ * @hs_rec:        records
+ * @hs_wlock:      protects the fields from hs_wcv on
+ * @hs_wcv:        signaled when ranges are queued or a range is done
+ * @hs_tid:        warmup thread
+ * @hs_started:    warmup thread is running
+ * @hs_stop:       warmup thread must exit
+ * @hs_nopopulate: the kernel does not know MADV_POPULATE_READ
+ * @hs_busy:       map the warmup thread is populating
+ * @hs_cancel:     map the warmup thread must stop populating
+ * @hs_wseq:       number of ranges queued
+ * @hs_itemc:      number of queued ranges
+ * @hs_itemmax:    size of hs_itemv
+ * @hs_itemv:      queued ranges, hottest last
+ */
+struct mp_hotset {
+	struct mutex                hs_lock;
+	u32                         hs_max;
+	u64                         hs_seq;
+	struct mpool_mcache_hotset  hs_rec;
+
+	struct mutex                hs_wlock;
+	pthread_cond_t              hs_wcv;
+	pthread_t                   hs_tid;
+	bool                        hs_started;
+	bool                        hs_stop;
+	bool                        hs_nopopulate;
+	const void                 *hs_busy;
+	const void                 *hs_cancel;
+	u64                         hs_wseq;
+	u32                         hs_itemc;
+	u32                         hs_itemmax;
+	struct mp_warmup_item      *hs_itemv;
+};
+
+static int mp_hotset_mbid_cmp(const void *lhs, const void *rhs)
+{
+	const struct mp_hotset_rec *l = lhs, *r = rhs;
+
+	if (l->hr_mbid != r->hr_mbid)
+		return l->hr_mbid < r->hr_mbid ? -1 : 1;
+
+	/* Latest record first. */
+	if (l->hr_seq != r->hr_seq)
+		return l->hr_seq > r->hr_seq ? -1 : 1;
+
+	return 0;
+}
+
+static int mp_hotset_heat_cmp(const void *lhs, const void *rhs)
+{
+	const struct mp_hotset_rec *l = lhs, *r = rhs;
+
+	if (l->hr_heat != r->hr_heat)
+		return l->hr_heat > r->hr_heat ? -1 : 1;
+
+	if (l->hr_pages != r->hr_pages)
+		return l->hr_pages > r->hr_pages ? -1 : 1;
+
+	return 0;
+}
+
+static int mp_warmup_item_cmp(const void *lhs, const void *rhs)
+{
+	const struct mp_warmup_item *l = lhs, *r = rhs;
+
+	if (l->wi_heat != r->wi_heat)
+		return l->wi_heat < r->wi_heat ? -1 : 1;
+
+	if (l->wi_seq != r->wi_seq)
+		return l->wi_seq > r->wi_seq ? -1 : 1;
+
+	return 0;
+}
+
+static void mp_hotset_free_recs(struct mpool_mcache_hotset *set)
+{
+	u32 i;
+
+	for (i = 0; i < set->mh_recc; i++)
+		free(set->mh_recv[i].hr_runv);
+
+	free(set->mh_recv);
+	set->mh_recv = NULL;
+	set->mh_recc = set->mh_recmax = 0;
+}
+
+/**
+ * mp_hotset_compact() - Drop superseded records, then all but the max hottest
+ */
+static void mp_hotset_compact(struct mpool_mcache_hotset *set, u32 max)
+{
+	struct mp_hotset_rec   *recv = set->mh_recv;
+	u32                     i, n = 0;
+
+	qsort(recv, set->mh_recc, sizeof(*recv), mp_hotset_mbid_cmp);
+
+	for (i = 0; i < set->mh_recc; i++) {
+		if (n > 0 && recv[n - 1].hr_mbid == recv[i].hr_mbid)
+			free(recv[i].hr_runv);
+		else
+			recv[n++] = recv[i];
+	}
+
+	if (n > max) {
+		qsort(recv, n, sizeof(*recv), mp_hotset_heat_cmp);
+
+		for (i = max; i < n; i++)
+			free(recv[i].hr_runv);
+		n = max;
+	}
+
+	set->mh_recc = n;
+}
+
+/**
+ * mp_hotset_runs() - Turn a residency bitmap into ranges
+ * @bitmap: residency bitmap
+ * @pagec:  number of pages
+ * @gap:    merge runs separated by at most this many pages
+ * @runv:   ranges (output, MP_HOTSET_RUNS_MAX entries)
+ * @pagesp: number of pages in the ranges (output)
+ *
+ * Return: the number of ranges, of which only the first MP_HOTSET_RUNS_MAX
+ * are stored
+ */
+static u32
+mp_hotset_runs(const u64 *bitmap, size_t pagec, u32 gap, struct mp_hotset_run *runv, u64 *pagesp)
+{
+	struct mp_hotset_run    run = { };
+	size_t                  pg;
+	u64                     pages = 0;
+	u32                     runc = 0;
+
+	for (pg = 0; pg < pagec; pg++) {
+		if (!(pg % 64) && !bitmap[pg / 64]) {
+			pg += 63;
+			continue;
+		}
+
+		if (!(bitmap[pg / 64] & (1ull << (pg % 64))))
+			continue;
+
+		if (run.hu_pgcnt && pg <= run.hu_pgoff + run.hu_pgcnt + gap) {
+			run.hu_pgcnt = pg + 1 - run.hu_pgoff;
+			continue;
+		}
+
+		if (run.hu_pgcnt) {
+			if (runc < MP_HOTSET_RUNS_MAX)
+				runv[runc] = run;
+			pages += run.hu_pgcnt;
+			runc++;
+		}
+
+		run.hu_pgoff = pg;
+		run.hu_pgcnt = 1;
+	}
+
+	if (run.hu_pgcnt) {
+		if (runc < MP_HOTSET_RUNS_MAX)
+			runv[runc] = run;
+		pages += run.hu_pgcnt;
+		runc++;
+	}
+
+	*pagesp = pages;
+
+	return runc;
+}
+
+/**
+ * mp_hotset_scan() - Get the residency bitmap of an mblock at a bounded cost
+ * @addr:   base address of the mblock in its map
+ * @pagec:  number of pages of the mblock
+ * @bitmap: one bit per granule, set if a page of it is resident
+ *          (output, MP_HOTSET_SCAN_BITS bits)
+ * @granp:  pages per granule (output)
+ *
+ * Return: the number of granules, 0 on error
+ */
+static u32 mp_hotset_scan(const void *addr, size_t pagec, u64 *bitmap, u32 *granp)
+{
+	unsigned char   vec[MP_RSS_CHUNK];
+	const char     *base = addr;
+	size_t          pg, n, i;
+	u32             gran = 1, bitc;
+	bool            probe;
+
+	while ((size_t)gran * MP_HOTSET_SCAN_BITS < pagec)
+		gran *= 2;
+
+	bitc = (pagec + gran - 1) / gran;
+	memset(bitmap, 0, (bitc + 63) / 64 * sizeof(*bitmap));
+
+	probe = gran > MP_HOTSET_SCAN_PROBE;
+
+	for (pg = 0; pg < pagec; pg += probe ? gran : n) {
+		n = min_t(size_t, pagec - pg, probe ? MP_HOTSET_SCAN_PROBE : MP_RSS_CHUNK);
+
+		if (mincore((void *)(base + pg * PAGE_SIZE), n * PAGE_SIZE, vec))
+			return 0;
+
+		for (i = 0; i < n; i++)
+			if (vec[i] & 1)
+				bitmap[(pg + i) / gran / 64] |= 1ull << ((pg + i) / gran % 64);
+	}
+
+	*granp = gran;
+
+	return bitc;
+}
+
+void mp_hotset_record(struct mp_hotset *hs, u64 mbid, const void *addr, size_t pagec, u64 heat)
+{
+	struct mp_hotset_run    runv[MP_HOTSET_RUNS_MAX];
+	struct mp_hotset_rec   *rec, *recv;
+	u64                     bitmap[MP_HOTSET_SCAN_BITS / 64];
+	u64                     pages;
+	u32                     max, runc, gap, gran, bitc, i;
+
+	if (!hs || !pagec || pagec > U32_MAX)
+		return;
+
+	mutex_lock(&hs->hs_lock);
+	max = hs->hs_max;
+	mutex_unlock(&hs->hs_lock);
+
+	if (!max)
+		return;
+
+	bitc = mp_hotset_scan(addr, pagec, bitmap, &gran);
+	if (!bitc)
+		return;
+
+	gap = max_t(u32, MP_HOTSET_GAP / gran, 1);
+	while ((runc = mp_hotset_runs(bitmap, bitc, gap, runv, &pages)) > MP_HOTSET_RUNS_MAX)
+		gap *= 2;
+
+	if (!pages)
+		return;
+
+	/* Turn granules back into pages. */
+	for (i = 0; i < runc; i++) {
+		runv[i].hu_pgoff *= gran;
+		runv[i].hu_pgcnt = min_t(u64, (u64)runv[i].hu_pgcnt * gran,
+					 pagec - runv[i].hu_pgoff);
+	}
+
+	pages = min_t(u64, pages * gran, pagec);
+
+	mutex_lock(&hs->hs_lock);
+	if (hs->hs_rec.mh_recc >= max * 2)
+		mp_hotset_compact(&hs->hs_rec, hs->hs_max);
+
+	if (hs->hs_rec.mh_recc == hs->hs_rec.mh_recmax) {
+		u32 n = max_t(u32, hs->hs_rec.mh_recmax * 2, 64);
+
+		recv = realloc(hs->hs_rec.mh_recv, n * sizeof(*recv));
+		if (!recv) {
+			mutex_unlock(&hs->hs_lock);
+			return;
+		}
+
+		hs->hs_rec.mh_recv = recv;
+		hs->hs_rec.mh_recmax = n;
+	}
+
+	rec = hs->hs_rec.mh_recv + hs->hs_rec.mh_recc;
+	rec->hr_runv = malloc(runc * sizeof(*runv));
+	if (rec->hr_runv) {
+		memcpy(rec->hr_runv, runv, runc * sizeof(*runv));
+		rec->hr_mbid = mbid;
+		rec->hr_seq = hs->hs_seq++;
+		rec->hr_pages = pages;
+		rec->hr_heat = min_t(u64, heat, U32_MAX);
+		rec->hr_runc = runc;
+		hs->hs_rec.mh_recc++;
+	}
+	mutex_unlock(&hs->hs_lock);
+}
+
+static merr_t mp_hotset_write(const char *path, const void *buf, size_t len)
+{
+	const char *p = buf;
+	char        tmp[PATH_MAX];
+	ssize_t     cc;
+	merr_t      err = 0;
+	int         fd, rc;
+
+	rc = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (rc < 0 || rc >= sizeof(tmp))
+		return merr(ENAMETOOLONG);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+	if (fd == -1)
+		return merr(errno);
+
+	while (len > 0) {
+		cc = write(fd, p, len);
+		if (cc == -1 && errno == EINTR)
+			continue;
+
+		if (cc == -1) {
+			err = merr(errno);
+			break;
+		}
+
+		p += cc;
+		len -= cc;
+	}
+
+	close(fd);
+
+	/* Replace the previous descriptor only with a complete one. */
+	if (!err && rename(tmp, path))
+		err = merr(errno);
+
+	if (err)
+		unlink(tmp);
+
+	return err;
+}
+
+merr_t mp_hotset_save(struct mp_hotset *hs, const char *path)
+{
+	struct hotset_hdr_omf  *hdr;
+	struct hotset_rec_omf  *omf;
+	struct hotset_run_omf  *run;
+	struct mp_hotset_rec   *rec;
+	size_t                  len;
+	char                   *buf;
+	merr_t                  err;
+	u32                     i, j;
+
+	if (!hs)
+		return 0;
+
+	mutex_lock(&hs->hs_lock);
+	if (!hs->hs_rec.mh_recc || !hs->hs_max) {
+		mutex_unlock(&hs->hs_lock);
+		return 0;
+	}
+
+	mp_hotset_compact(&hs->hs_rec, hs->hs_max);
+
+	len = sizeof(*hdr);
+	for (i = 0; i < hs->hs_rec.mh_recc; i++)
+		len += sizeof(*omf) + hs->hs_rec.mh_recv[i].hr_runc * sizeof(*run);
+
+	buf = malloc(len);
+	if (!buf) {
+		mutex_unlock(&hs->hs_lock);
+		return merr(ENOMEM);
+	}
+
+	hdr = (void *)buf;
+	omf = (void *)(hdr + 1);
+
+	for (i = 0; i < hs->hs_rec.mh_recc; i++) {
+		rec = hs->hs_rec.mh_recv + i;
+
+		omf_set_hsr_mbid(omf, rec->hr_mbid);
+		omf_set_hsr_heat(omf, rec->hr_heat);
+		omf_set_hsr_runc(omf, rec->hr_runc);
+
+		run = (void *)(omf + 1);
+		for (j = 0; j < rec->hr_runc; j++, run++) {
+			omf_set_hsu_pgoff(run, rec->hr_runv[j].hu_pgoff);
+			omf_set_hsu_pgcnt(run, rec->hr_runv[j].hu_pgcnt);
+		}
+
+		omf = (void *)run;
+	}
+
+	omf_set_hsh_magic(hdr, HOTSET_MAGIC);
+	omf_set_hsh_vers(hdr, HOTSET_VERSION);
+	omf_set_hsh_recc(hdr, hs->hs_rec.mh_recc);
+	omf_set_hsh_crc(hdr, crc32c(0, hdr + 1, len - sizeof(*hdr)));
+	mutex_unlock(&hs->hs_lock);
+
+	err = mp_hotset_write(path, buf, len);
+
+	free(buf);
+
+	return err;
+}
+
+static merr_t mp_hotset_read(const char *path, char **bufp, size_t *lenp)
+{
+	struct stat st;
+	ssize_t     cc;
+	size_t      off = 0;
+	merr_t      err = 0;
+	char       *buf;
+	int         fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return merr(errno);
+
+	if (fstat(fd, &st)) {
+		err = merr(errno);
+		close(fd);
+		return err;
+	}
+
+	buf = malloc(st.st_size ?: 1);
+	if (!buf) {
+		close(fd);
+		return merr(ENOMEM);
+	}
+
+	while (off < st.st_size) {
+		cc = read(fd, buf + off, st.st_size - off);
+		if (cc == -1 && errno == EINTR)
+			continue;
+
+		if (cc <= 0) {
+			err = merr(cc ? errno : EBADMSG);
+			break;
+		}
+
+		off += cc;
+	}
+
+	close(fd);
+
+	if (err) {
+		free(buf);
+		return err;
+	}
+
+	*bufp = buf;
+	*lenp = off;
+
+	return 0;
+}
+
+merr_t mp_hotset_load(const char *path, struct mpool_mcache_hotset **hotsetp)
+{
+	struct mpool_mcache_hotset *set;
+	struct hotset_hdr_omf      *hdr;
+	struct hotset_rec_omf      *omf;
+	struct hotset_run_omf      *run;
+	struct mp_hotset_rec       *rec;
+	size_t                      len = 0, off;
+	char                       *buf = NULL;
+	merr_t                      err;
+	u32                         recc, i, j;
+
+	err = mp_hotset_read(path, &buf, &len);
+	if (err)
+		return err;
+
+	hdr = (void *)buf;
+	if (len < sizeof(*hdr) || omf_hsh_magic(hdr) != HOTSET_MAGIC ||
+	    omf_hsh_vers(hdr) != HOTSET_VERSION ||
+	    omf_hsh_crc(hdr) != crc32c(0, hdr + 1, len - sizeof(*hdr)) ||
+	    omf_hsh_recc(hdr) > (len - sizeof(*hdr)) / sizeof(*omf)) {
+		free(buf);
+		return merr(EBADMSG);
+	}
+
+	recc = omf_hsh_recc(hdr);
+
+	set = calloc(1, sizeof(*set));
+	if (set)
+		set->mh_recv = calloc(recc ?: 1, sizeof(*set->mh_recv));
+	if (!set || !set->mh_recv) {
+		free(set);
+		free(buf);
+		return merr(ENOMEM);
+	}
+
+	set->mh_recmax = recc;
+	off = sizeof(*hdr);
+
+	for (i = 0; i < recc; i++) {
+		rec = set->mh_recv + i;
+		omf = (void *)(buf + off);
+
+		if (len - off < sizeof(*omf) ||
+		    omf_hsr_runc(omf) > (len - off - sizeof(*omf)) / sizeof(*run)) {
+			err = merr(EBADMSG);
+			break;
+		}
+
+		rec->hr_mbid = omf_hsr_mbid(omf);
+		rec->hr_seq = i;
+		rec->hr_heat = omf_hsr_heat(omf);
+		rec->hr_runc = omf_hsr_runc(omf);
+		rec->hr_runv = malloc((rec->hr_runc ?: 1) * sizeof(*rec->hr_runv));
+		if (!rec->hr_runv) {
+			err = merr(ENOMEM);
+			break;
+		}
+
+		set->mh_recc++;
+
+		run = (void *)(omf + 1);
+		for (j = 0; j < rec->hr_runc; j++, run++) {
+			rec->hr_runv[j].hu_pgoff = omf_hsu_pgoff(run);
+			rec->hr_runv[j].hu_pgcnt = omf_hsu_pgcnt(run);
+			rec->hr_pages += rec->hr_runv[j].hu_pgcnt;
+		}
+
+		off = (char *)run - buf;
+	}
+
+	free(buf);
+
+	if (err) {
+		mpool_mcache_hotset_free(set);
+		return err;
+	}
+
+	qsort(set->mh_recv, set->mh_recc, sizeof(*set->mh_recv), mp_hotset_mbid_cmp);
+
+	*hotsetp = set;
+
+	return 0;
+}
+
+void mpool_mcache_hotset_free(struct mpool_mcache_hotset *hotset)
+{
+	if (!hotset)
+		return;
+
+	mp_hotset_free_recs(hotset);
+	free(hotset);
+}
+
+static void mp_warmup_populate(struct mp_hotset *hs, char *addr, size_t len)
+{
+	if (!hs->hs_nopopulate && !madvise(addr, len, MADV_POPULATE_READ))
+		return;
+
+	if (!hs->hs_nopopulate && errno != EINVAL)
+		return;
+
+	hs->hs_nopopulate = true;
+	madvise(addr, len, MADV_WILLNEED);
+}
+
+static void *mp_warmup_main(void *arg)
+{
+	struct mp_hotset       *hs = arg;
+	struct mp_warmup_item   item;
+	size_t                  off, len;
+
+	mutex_lock(&hs->hs_wlock);
+	while (!hs->hs_stop) {
+		if (!hs->hs_itemc) {
+			pthread_cond_wait(&hs->hs_wcv, &hs->hs_wlock.pth_mutex);
+			continue;
+		}
+
+		item = hs->hs_itemv[--hs->hs_itemc];
+		hs->hs_busy = item.wi_key;
+
+		for (off = 0; off < item.wi_len; off += len) {
+			if (hs->hs_stop || hs->hs_cancel == item.wi_key)
+				break;
+
+			len = min_t(size_t, item.wi_len - off, MP_WARMUP_CHUNK);
+
+			mutex_unlock(&hs->hs_wlock);
+			mp_warmup_populate(hs, item.wi_addr + off, len);
+			mutex_lock(&hs->hs_wlock);
+		}
+
+		hs->hs_busy = NULL;
+		pthread_cond_broadcast(&hs->hs_wcv);
+	}
+	mutex_unlock(&hs->hs_wlock);
+
+	return NULL;
+}
+
+static int mp_hotset_find_cmp(const void *key, const void *elem)
+{
+	const struct mp_hotset_rec *rec = elem;
+	u64                         mbid = *(const u64 *)key;
+
+	if (mbid != rec->hr_mbid)
+		return mbid < rec->hr_mbid ? -1 : 1;
+
+	return 0;
+}
+
+static const struct mp_hotset_rec *
+mp_hotset_find(const struct mpool_mcache_hotset *set, u64 mbid)
+{
+	return bsearch(&mbid, set->mh_recv, set->mh_recc, sizeof(*set->mh_recv),
+		       mp_hotset_find_cmp);
+}
+
+merr_t
+mp_hotset_warmup(
+	struct mp_hotset                   *hs,
+	const void                         *key,
+	char                               *addr,
+	size_t                              bktsz,
+	const u64                          *mbidv,
+	u32                                 mbidc,
+	const struct mpool_mcache_hotset   *hotset)
+{
+	const struct mp_hotset_rec *rec;
+	struct mp_warmup_item      *itemv, *item;
+	size_t                      pagec, pgoff, pgcnt;
+	u32                         need = 0, i, j;
+	merr_t                      err = 0;
+	int                         rc;
+
+	pagec = bktsz / PAGE_SIZE;
+
+	for (i = 0; i < mbidc; i++) {
+		rec = mp_hotset_find(hotset, mbidv[i]);
+		if (rec)
+			need += rec->hr_runc;
+	}
+
+	if (!need)
+		return 0;
+
+	mutex_lock(&hs->hs_wlock);
+	if (hs->hs_itemc + need > hs->hs_itemmax) {
+		u32 n = max_t(u32, (hs->hs_itemc + need) * 2, 64);
+
+		itemv = realloc(hs->hs_itemv, n * sizeof(*itemv));
+		if (!itemv) {
+			mutex_unlock(&hs->hs_wlock);
+			return merr(ENOMEM);
+		}
+
+		hs->hs_itemv = itemv;
+		hs->hs_itemmax = n;
+	}
+
+	for (i = 0; i < mbidc; i++) {
+		rec = mp_hotset_find(hotset, mbidv[i]);
+
+		for (j = 0; rec && j < rec->hr_runc; j++) {
+			pgoff = rec->hr_runv[j].hu_pgoff;
+			pgcnt = rec->hr_runv[j].hu_pgcnt;
+
+			/* The mblock may have been recorded from a map with larger buckets. */
+			if (pgoff >= pagec)
+				continue;
+
+			item = hs->hs_itemv + hs->hs_itemc++;
+			item->wi_key = key;
+			item->wi_addr = addr + i * bktsz + pgoff * PAGE_SIZE;
+			item->wi_len = min_t(size_t, pgcnt, pagec - pgoff) * PAGE_SIZE;
+			item->wi_heat = rec->hr_heat;
+			item->wi_seq = hs->hs_wseq++;
+		}
+	}
+
+	qsort(hs->hs_itemv, hs->hs_itemc, sizeof(*hs->hs_itemv), mp_warmup_item_cmp);
+
+	if (!hs->hs_started) {
+		hs->hs_stop = false;
+
+		rc = pthread_create(&hs->hs_tid, NULL, mp_warmup_main, hs);
+		if (rc) {
+			hs->hs_itemc = 0;
+			err = merr(rc);
+		} else {
+			hs->hs_started = true;
+		}
+	}
+
+	pthread_cond_broadcast(&hs->hs_wcv);
+	mutex_unlock(&hs->hs_wlock);
+
+	return err;
+}
+
+void mp_hotset_cancel(struct mp_hotset *hs, const void *key)
+{
+	u32 i, n = 0;
+
+	if (!hs)
+		return;
+
+	mutex_lock(&hs->hs_wlock);
+	for (i = 0; i < hs->hs_itemc; i++)
+		if (hs->hs_itemv[i].wi_key != key)
+			hs->hs_itemv[n++] = hs->hs_itemv[i];
+	hs->hs_itemc = n;
+
+	while (hs->hs_busy == key) {
+		hs->hs_cancel = key;
+		pthread_cond_wait(&hs->hs_wcv, &hs->hs_wlock.pth_mutex);
+	}
+
+	if (hs->hs_cancel == key)
+		hs->hs_cancel = NULL;
+	mutex_unlock(&hs->hs_wlock);
+}
+
+void mp_hotset_cap_set(struct mp_hotset *hs, u32 max)
+{
+	mutex_lock(&hs->hs_lock);
+	hs->hs_max = max;
+	if (!max)
+		mp_hotset_free_recs(&hs->hs_rec);
+	mutex_unlock(&hs->hs_lock);
+}
+
+merr_t mp_hotset_create(u32 max, struct mp_hotset **hsp)
+{
+	struct mp_hotset *hs;
+
+	if (!hsp)
+		return merr(EINVAL);
+
+	hs = calloc(1, sizeof(*hs));
+	if (!hs)
+		return merr(ENOMEM);
+
+	mutex_init(&hs->hs_lock);
+	mutex_init(&hs->hs_wlock);
+	pthread_cond_init(&hs->hs_wcv, NULL);
+	hs->hs_max = max;
+
+	*hsp = hs;
+
+	return 0;
+}
+
+void mp_hotset_destroy(struct mp_hotset *hs)
+{
+	if (!hs)
+		return;
+
+	mutex_lock(&hs->hs_wlock);
+	hs->hs_stop = true;
+	hs->hs_itemc = 0;
+	pthread_cond_broadcast(&hs->hs_wcv);
+	mutex_unlock(&hs->hs_wlock);
+
+	if (hs->hs_started)
+		pthread_join(hs->hs_tid, NULL);
+
+	mp_hotset_free_recs(&hs->hs_rec);
+	free(hs->hs_itemv);
+	pthread_cond_destroy(&hs->hs_wcv);
+	mutex_destroy(&hs->hs_wlock);
+	mutex_destroy(&hs->hs_lock);
+	free(hs);
+}
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_HOTSET_H
+#define MPOOL_HOTSET_H
+
+/*
+ * Warm-restart snapshot of the mcache hot set.
+ *
+ * When an mcache map is unmapped, or its mpool handle closed, the resident
+ * page ranges of each of its mblocks are recorded along with the heat of
+ * the map.  mpool_close() saves
+ * the hottest records in a descriptor in the run directory of the mpool,
+ * and after a restart mpool_mcache_warmup() replays the descriptor on new
+ * maps of the same mblocks from a background thread, hottest ranges first,
+ * so that the working set comes back in large sequential requests rather
+ * than one page fault at a time.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_HOTSET_FILE          "mcache.hotset"
+#define MP_HOTSET_GAP           16              /* pages of a gap merged into a range */
+#define MP_HOTSET_RUNS_MAX      32              /* ranges recorded per mblock */
+#define MP_HOTSET_SCAN_BITS     4096            /* granules per mblock in a residency scan */
+#define MP_HOTSET_SCAN_PROBE    16              /* pages probed per granule of a large mblock */
+#define MP_WARMUP_CHUNK         (4ul << 20)     /* bytes populated at a time */
+
+struct mp_hotset;
+
+/**
+ * mp_hotset_create() - Create a hot set recorder and warmup engine
+ * @max: maximum number of mblocks in the saved descriptor, 0 to record nothing
+ * @hsp: recorder (output)
+ */
+merr_t mp_hotset_create(u32 max, struct mp_hotset **hsp);
+
+/**
+ * mp_hotset_destroy() - Stop the warmup thread and destroy a recorder
+ * @hs: recorder (may be NULL)
+ */
+void mp_hotset_destroy(struct mp_hotset *hs);
+
+/**
+ * mp_hotset_cap_set() - Change the maximum number of mblocks saved
+ * @hs:  recorder
+ * @max: maximum number of mblocks, 0 to record nothing
+ */
+void mp_hotset_cap_set(struct mp_hotset *hs, u32 max);
+
+/**
+ * mp_hotset_record() - Record the resident ranges of a mapped mblock
+ * @hs:    recorder (may be NULL)
+ * @mbid:  mblock object ID
+ * @addr:  base address of the mblock in its map
+ * @pagec: number of pages of the mblock in the map
+ * @heat:  heat of the map
+ *
+ * Supersedes an earlier record of the same mblock.  The residency of an
+ * mblock is tracked in at most MP_HOTSET_SCAN_BITS granules of a power of
+ * 2 pages.  Mblocks of up to MP_HOTSET_SCAN_BITS * MP_HOTSET_SCAN_PROBE
+ * pages are scanned in full, only the first MP_HOTSET_SCAN_PROBE pages of
+ * each granule of larger ones are, so that the cost of a record is bounded.
+ */
+void mp_hotset_record(struct mp_hotset *hs, u64 mbid, const void *addr, size_t pagec, u64 heat);
+
+/**
+ * mp_hotset_save() - Save the hottest records to a descriptor file
+ * @hs:   recorder (may be NULL)
+ * @path: descriptor file
+ *
+ * Leaves the file alone if nothing was recorded.
+ */
+merr_t mp_hotset_save(struct mp_hotset *hs, const char *path);
+
+/**
+ * mp_hotset_load() - Load a descriptor file
+ * @path:    descriptor file
+ * @hotsetp: descriptor (output)
+ */
+merr_t mp_hotset_load(const char *path, struct mpool_mcache_hotset **hotsetp);
+
+/**
+ * mp_hotset_warmup() - Queue the recorded ranges of the mblocks of a map
+ * @hs:     warmup engine
+ * @key:    map handle
+ * @addr:   base address of the map
+ * @bktsz:  size of the map bucket of each mblock
+ * @mbidv:  mblock object IDs, in map order
+ * @mbidc:  number of mblock object IDs
+ * @hotset: descriptor
+ */
+merr_t
+mp_hotset_warmup(
+	struct mp_hotset                   *hs,
+	const void                         *key,
+	char                               *addr,
+	size_t                              bktsz,
+	const u64                          *mbidv,
+	u32                                 mbidc,
+	const struct mpool_mcache_hotset   *hotset);
+
+/**
+ * mp_hotset_cancel() - Drop the queued ranges of a map before unmapping it
+ * @hs:  warmup engine (may be NULL)
+ * @key: map handle
+ *
+ * Waits for the warmup thread to be done with the map.
+ */
+void mp_hotset_cancel(struct mp_hotset *hs, const void *key);
+
+#endif /* MPOOL_HOTSET_H */
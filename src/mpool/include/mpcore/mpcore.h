@@ -185,7 +185,7 @@ mpool_sb_magic_check(char *dpath, struct pd_prop *pd_prop, struct mpool_devrpt *
  * space mlogs support
  * @mpname:
  */
-struct mpool_descriptor *mpool_user_desc_alloc(char *mpname);
+struct mpool_descriptor *mpool_user_desc_alloc(const char *mpname);
 
 /**
  * mpool_user_desc_free() - Free the mpool descriptor used for user space mlog
@@ -34,25 +34,34 @@ enum mp_status;
  */
 
 /*
- * This will be scaled down to something like 256 after KVDB consolidates to a
- * total of 2 MDCs.
+ * The mlog handle map is split into MLOG_HMAP_STRIPES independently locked
+ * stripes so that mlog open and close on different objects do not contend.
+ * Each stripe is a chained hash table whose bucket vector doubles in size
+ * whenever its load factor exceeds MLOG_HMAP_LOAD_MAX, hence the number of
+ * concurrently open mlogs is limited only by available memory.
  */
-#define MAX_OPEN_MLOGS     516
+#define MLOG_HMAP_STRIPES_SHIFT 6
+#define MLOG_HMAP_STRIPES       (1u << MLOG_HMAP_STRIPES_SHIFT)
+#define MLOG_HMAP_BKTC_MIN      16
+#define MLOG_HMAP_LOAD_MAX      2
 
 /**
  * struct mpool_mlog:
  *
  * @ml_lock:   Lock to protect concurrent operations on an mlog
- * @ml_mpdesc: Minimal mpool descriptor initialized for user-space mlogs
+ * @ml_mp:     mpool handle
+ * @ml_mpdesc: Minimal mpool descriptor shared by all user-space mlogs of ml_mp
  * @ml_mldesc: Minimal mlog descriptor initialized for user-space mlogs
+ * @ml_hnext:  Next handle in the same mlog map hash chain
  * @ml_objid:  Object ID
+ * @ml_refcnt: tracks gets and puts to know when to release the handle
  * @ml_magic:  Magic no., initialized by get and reset by put
  * @ml_mpfd:   mpool fd
- * @ml_idx:    Index where this handle is stored in mpool lookup map
  * @ml_flags:  Mlog flags
  *
  * Ordering:
  *     mlog handle lock (ml_lock)
+ *     mlog map stripe lock (mlm_lock)
  *     mpool handle lock
  *     mpool core locks
  */
@@ -61,47 +70,92 @@ struct mpool_mlog {
 	struct mpool               *ml_mp;
 	struct mpool_descriptor    *ml_mpdesc;
 	struct mlog_descriptor     *ml_mldesc;
+	struct mpool_mlog          *ml_hnext;
 	u64                         ml_objid;
+	int                         ml_refcnt;
 	int                         ml_magic;
 	int                         ml_mpfd;
-	u16                         ml_idx;
 	u8                          ml_flags;
 };
 
 /*
  * struct mp_mloghmap:
- * Used for user-space lookup from object ID to mlog handle
+ * One stripe of the user-space lookup map from object ID to mlog handle
  *
- * @mlm_objid:     Object ID
- * @mlm_hdl:       Mlog handle
- * @mlm_refcnt:    tracks gets and put to know when to release the handle
+ * @mlm_lock:  protects all fields of the stripe and ml_hnext/ml_refcnt
+ *             of the handles hashed to it
+ * @mlm_bktv:  vector of hash chains (allocated on first insert)
+ * @mlm_bktc:  number of hash chains in mlm_bktv (power of 2)
+ * @mlm_cnt:   number of handles in the stripe
  */
 struct mp_mloghmap {
-	u64                 mlm_objid;
-	struct mpool_mlog  *mlm_hdl;
-	int                 mlm_refcnt;
-};
+	struct mutex        mlm_lock;
+	struct mpool_mlog **mlm_bktv;
+	u32                 mlm_bktc;
+	u32                 mlm_cnt;
+} __aligned(SMP_CACHE_BYTES);
+
+struct mp_advisor;
+struct mp_delq;
+struct mp_hotset;
+struct mp_mapcache;
+struct mp_objcache;
+struct mp_mbio;
+struct mp_mbpool;
+struct mp_ra;
+struct mp_rdcache;
+struct mp_tier;
 
 /**
  * struct mpool:
- * @mp_mlmap:  fixed size map from object ID to mlog handle
+ * @mp_mlmap:        lock-striped map from object ID to mlog handle
+ * @mp_desc:         mpool descriptor shared by all mlog handles
+ * @mp_mltot:        total number of open mlog handles
+ * @mp_maptot:       total number of mcache map references held by the client
+ * @mp_objcache:     object properties cache, NULL if disabled
+ * @mp_mbio:         async mblock I/O engine
+ * @mp_mbpool:       pool of pre-allocated mblocks, NULL if disabled
+ * @mp_ra:           mblock read-ahead context, NULL if disabled
+ * @mp_rdcache:      mblock page cache, NULL if disabled
+ * @mp_delq:         deferred mblock delete queue
+ * @mp_tier:         media class tiering engine
+ * @mp_mapcache:     cache of mcache maps
+ * @mp_advisor:      mcache advisor
+ * @mp_hotset:       mcache hot set recorder and warmup engine
+ * @mp_cparams:      client params of this handle
+ * @mp_params:       cached mpool params, protected by mp_lock
+ * @mp_params_valid: true if mp_params is valid
+ * @mp_params_gen:   bumped, under mp_lock, each time mp_params is invalidated
  * @mp_magic:
  * @mp_fd:
  * @mp_flags:
- * @mp_name: Mpool name
- * @mp_mlidx: next free index in mp_mlmap
- * @mp_mltot:  total occupied slots in mp_mlmap
+ * @mp_name:         Mpool name
  * @mp_lock:
  */
 struct mpool {
-	struct mp_mloghmap   mp_mlmap[MAX_OPEN_MLOGS];
-	int                  mp_magic;
-	int                  mp_fd;
-	int                  mp_flags;
-	char                 mp_name[MPOOL_NAMESZ_MAX]; /* mpool name */
-	u16                  mp_mlidx;
-	u16                  mp_mltot;
-	struct mutex         mp_lock;
+	struct mp_mloghmap          mp_mlmap[MLOG_HMAP_STRIPES];
+	struct mpool_descriptor    *mp_desc;
+	atomic_t                    mp_mltot;
+	atomic_t                    mp_maptot;
+	struct mp_objcache         *mp_objcache;
+	struct mp_mbio             *mp_mbio;
+	struct mp_mbpool           *mp_mbpool;
+	struct mp_ra               *mp_ra;
+	struct mp_rdcache          *mp_rdcache;
+	struct mp_delq             *mp_delq;
+	struct mp_tier             *mp_tier;
+	struct mp_mapcache         *mp_mapcache;
+	struct mp_advisor          *mp_advisor;
+	struct mp_hotset           *mp_hotset;
+	struct mpool_client_params  mp_cparams;
+	struct mpool_params         mp_params;
+	bool                        mp_params_valid;
+	u64                         mp_params_gen;
+	int                         mp_magic;
+	int                         mp_fd;
+	int                         mp_flags;
+	char                        mp_name[MPOOL_NAMESZ_MAX]; /* mpool name */
+	struct mutex                mp_lock;
 };
 
 /**
@@ -130,6 +184,29 @@ mp_sb_erase(
  */
 mpool_err_t mp_sb_magic_check(char *device, struct mpool_devrpt *devrpt);
 
+/**
+ * enum mp_trim_policy - how to trim a device whose discard zeroes data
+ * @MP_TRIM_DISCARD: discard it like any other device
+ * @MP_TRIM_ZEROOUT: zero it out, which the kernel turns into zeroing discards
+ * @MP_TRIM_SKIP:    leave it alone
+ */
+enum mp_trim_policy {
+	MP_TRIM_DISCARD = 0,
+	MP_TRIM_ZEROOUT = 1,
+	MP_TRIM_SKIP    = 2,
+};
+
+/**
+ * typedef mp_trim_progress_fn - Trim progress callback
+ * @arg:   callback argument
+ * @dev:   device path
+ * @done:  bytes trimmed so far
+ * @total: bytes to trim
+ *
+ * Called concurrently for different devices.
+ */
+typedef void mp_trim_progress_fn(void *arg, const char *dev, u64 done, u64 total);
+
 /**
  * mp_trim_device() -
  * @devicec: Number of devices
@@ -140,6 +217,56 @@ mpool_err_t mp_sb_magic_check(char *device, struct mpool_devrpt *devrpt);
  */
 mpool_err_t mp_trim_device(int devicec, char **devicev, struct mpool_devrpt *devrpt);
 
+/**
+ * mp_trim_devices() - Trim devices concurrently
+ * @devicec:  Number of devices
+ * @devicev:  Vector of device names
+ * @policy:   how to trim devices whose discard zeroes data
+ * @progress: progress callback (may be NULL)
+ * @arg:      progress callback argument
+ * @devrpt:   Device error report
+ */
+mpool_err_t
+mp_trim_devices(
+	int                     devicec,
+	char                  **devicev,
+	enum mp_trim_policy     policy,
+	mp_trim_progress_fn    *progress,
+	void                   *arg,
+	struct mpool_devrpt    *devrpt);
+
+/**
+ * mp_mblock_alloc() - Allocate an mblock with MPIOC_MB_ALLOC
+ * @mp:      mpool handle
+ * @mclassp: media class
+ * @spare:   allocate from spare zones
+ * @mbid:    mblock object ID (output)
+ * @props:   properties of the new mblock (output, may be NULL)
+ *
+ * Unlike mpool_mblock_alloc(), never takes the mblock from the mblock pool
+ * and does not populate the object properties cache.
+ */
+mpool_err_t
+mp_mblock_alloc(
+	struct mpool           *mp,
+	enum mp_media_classp    mclassp,
+	bool                    spare,
+	uint64_t               *mbid,
+	struct mblock_props    *props);
+
+/**
+ * mp_mblock_read() - Read from an mblock with a single MPIOC_MB_READ
+ * @mp:     mpool handle
+ * @mbid:   mblock object ID
+ * @iov:    iovec for output data
+ * @iovc:   iovec count
+ * @offset: PAGE aligned offset into the mblock
+ *
+ * Unlike mpool_mblock_read(), never splits the read.
+ */
+mpool_err_t
+mp_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset);
+
 /**
  * mp_dev_activated() - check if a device belongs to a activated mpool.
  * @devpath: device path
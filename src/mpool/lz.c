@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * LZ block codec module.
+ *
+ * The compressor is a greedy single-pass matcher over a hash table of the
+ * most recent position of each 4-byte sequence.  The search step grows
+ * with the length of the current literal run so that incompressible data
+ * is skipped over quickly.
+ */
+
+#include <util/platform.h>
+#include <util/minmax.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS    12
+#define LZ_SKIP_SHIFT   6
+
+static inline u32 lz_load32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline u32 lz_hash(u32 seq)
+{
+	return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static bool lz_put_len(u8 **opp, u8 *oend, size_t len)
+{
+	u8 *op = *opp;
+
+	while (len >= 255) {
+		if (op >= oend)
+			return false;
+		*op++ = 255;
+		len -= 255;
+	}
+
+	if (op >= oend)
+		return false;
+	*op++ = len;
+
+	*opp = op;
+
+	return true;
+}
+
+/**
+ * lz_emit() - Emit a sequence
+ * @opp:  output cursor
+ * @oend: end of the output buffer
+ * @lit:  literals
+ * @llen: number of literals
+ * @off:  match offset, ignored if @mlen is 0
+ * @mlen: match length, 0 for the final literals-only sequence
+ */
+static bool lz_emit(u8 **opp, u8 *oend, const u8 *lit, size_t llen, size_t off, size_t mlen)
+{
+	u8     *op = *opp;
+	size_t  mcode = mlen ? mlen - MP_LZ_MINMATCH : 0;
+
+	if (op >= oend)
+		return false;
+
+	*op++ = (min_t(size_t, llen, 15) << 4) | min_t(size_t, mcode, 15);
+
+	if (llen >= 15 && !lz_put_len(&op, oend, llen - 15))
+		return false;
+
+	if (llen > oend - op)
+		return false;
+	memcpy(op, lit, llen);
+	op += llen;
+
+	if (mlen) {
+		if (oend - op < 2)
+			return false;
+		*op++ = off & 0xff;
+		*op++ = off >> 8;
+
+		if (mcode >= 15 && !lz_put_len(&op, oend, mcode - 15))
+			return false;
+	}
+
+	*opp = op;
+
+	return true;
+}
+
+size_t mp_lz_compress(const void *src, size_t slen, void *dst, size_t dcap)
+{
+	const u8   *base = src, *iend = base + slen;
+	const u8   *ip = base, *anchor = base, *ref, *mp;
+	u8         *op = dst, *oend = op + dcap;
+	u32         htab[1u << LZ_HASH_BITS];
+	u32         seq, h;
+
+	memset(htab, 0, sizeof(htab));
+
+	while (iend - ip >= MP_LZ_MINMATCH) {
+		seq = lz_load32(ip);
+		h = lz_hash(seq);
+		ref = base + htab[h];
+		htab[h] = ip - base;
+
+		if (ref < ip && ip - ref <= MP_LZ_OFFSET_MAX && lz_load32(ref) == seq) {
+			mp = ip + MP_LZ_MINMATCH;
+			ref += MP_LZ_MINMATCH;
+			while (mp < iend && *mp == *ref) {
+				mp++;
+				ref++;
+			}
+
+			if (!lz_emit(&op, oend, anchor, ip - anchor, mp - ref, mp - ip))
+				return 0;
+
+			ip = anchor = mp;
+			continue;
+		}
+
+		ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+	}
+
+	if (!lz_emit(&op, oend, anchor, iend - anchor, 0, 0))
+		return 0;
+
+	return op - (u8 *)dst;
+}
+
+static bool lz_get_len(const u8 **ipp, const u8 *iend, size_t *lenp)
+{
+	const u8   *ip = *ipp;
+	u8          b;
+
+	do {
+		if (ip >= iend)
+			return false;
+		b = *ip++;
+		*lenp += b;
+	} while (b == 255);
+
+	*ipp = ip;
+
+	return true;
+}
+
+merr_t mp_lz_decompress(const void *src, size_t slen, void *dst, size_t dlen)
+{
+	const u8   *ip = src, *iend = ip + slen;
+	u8         *obase = dst, *op = obase, *oend = obase + dlen;
+	size_t      len, off;
+	u8          token;
+
+	while (1) {
+		if (ip >= iend)
+			return merr(EBADMSG);
+
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15 && !lz_get_len(&ip, iend, &len))
+			return merr(EBADMSG);
+
+		if (len > iend - ip || len > oend - op)
+			return merr(EBADMSG);
+
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return merr(EBADMSG);
+
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (off == 0 || off > op - obase)
+			return merr(EBADMSG);
+
+		len = token & 15;
+		if (len == 15 && !lz_get_len(&ip, iend, &len))
+			return merr(EBADMSG);
+		len += MP_LZ_MINMATCH;
+
+		if (len > oend - op)
+			return merr(EBADMSG);
+
+		if (off >= len) {
+			memcpy(op, op - off, len);
+			op += len;
+		} else {
+			while (len-- > 0) {
+				*op = *(op - off);
+				op++;
+			}
+		}
+	}
+
+	return op == oend ? 0 : merr(EBADMSG);
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_LZ_H
+#define MPOOL_LZ_H
+
+/*
+ * Fast LZ77 block codec.
+ *
+ * A compressed block is a sequence of (literals, match) pairs, each
+ * starting with a token byte whose high nibble is the literal length and
+ * whose low nibble is the match length minus MP_LZ_MINMATCH, either of
+ * which is extended by additional bytes when the nibble is 15.  Literals
+ * are followed by the 16-bit little-endian match offset.  The last pair
+ * has literals only.
+ */
+
+#include <util/platform.h>
+
+#include "mpool_err.h"
+
+#define MP_LZ_MINMATCH      4
+#define MP_LZ_OFFSET_MAX    65535
+
+/**
+ * mp_lz_compress() - Compress a block
+ * @src:  data to compress
+ * @slen: length of data
+ * @dst:  output buffer
+ * @dcap: size of the output buffer
+ *
+ * Return: length of the compressed block, or 0 if it does not fit in @dcap.
+ */
+size_t mp_lz_compress(const void *src, size_t slen, void *dst, size_t dcap);
+
+/**
+ * mp_lz_decompress() - Decompress a block
+ * @src:  compressed block
+ * @slen: length of the compressed block
+ * @dst:  output buffer
+ * @dlen: expected length of the decompressed data
+ *
+ * The input is fully validated, a corrupt block never causes a read or
+ * write outside of @src and @dst.
+ *
+ * Return: EBADMSG if the block is corrupt or does not decompress to
+ * exactly @dlen bytes.
+ */
+merr_t mp_lz_decompress(const void *src, size_t slen, void *dst, size_t dlen);
+
+#endif /* MPOOL_LZ_H */
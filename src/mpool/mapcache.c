@@ -0,0 +1,331 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mcache map cache module.
+ *
+ * Valid maps, referenced or idle, are hashed by key.  Idle maps are also
+ * on an LRU list, most recently used first.  A counting filter of the
+ * mblock IDs of the hashed maps lets mp_mapcache_inval() return without
+ * scanning the cache for the vast majority of deleted mblocks, which are
+ * not mapped.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+
+#include "mapcache.h"
+
+/**
+ * struct mp_mapcache - map cache
+ * @mc_lock:    protects all fields
+ * @mc_free:    function to destroy a map that left the cache
+ * @mc_cap:     maximum total length of idle maps
+ * @mc_idle:    total length of idle maps
+ * @mc_head:    most recently used idle map
+ * @mc_tail:    least recently used idle map
+ * @mc_stats:   statistics
+ * @mc_bktv:    hash table of valid maps
+ * @mc_mbfilt:  number of hashed maps per mblock ID hash
+ */
+struct mp_mapcache {
+	struct mutex                mc_lock;
+	mp_mapcache_free_fn        *mc_free;
+	u64                         mc_cap;
+	u64                         mc_idle;
+	struct mp_mapcache_ent     *mc_head;
+	struct mp_mapcache_ent     *mc_tail;
+	struct mpool_mapcache_stats mc_stats;
+	struct mp_mapcache_ent     *mc_bktv[MP_MAPCACHE_BKTS];
+	u32                         mc_mbfilt[MP_MAPCACHE_MBFILTER];
+};
+
+static inline u64 mp_mapcache_mbhash(u64 mbid)
+{
+	return mbid * 0x9e3779b97f4a7c15ull;
+}
+
+static inline u32 *mp_mapcache_mbfilt(struct mp_mapcache *mc, u64 mbid)
+{
+	return &mc->mc_mbfilt[(mp_mapcache_mbhash(mbid) >> 32) % MP_MAPCACHE_MBFILTER];
+}
+
+static u64 mp_mapcache_hash(const u64 *mbidv, u32 mbidc, u32 advice)
+{
+	u64 hash = mp_mapcache_mbhash(((u64)advice << 32) | mbidc);
+	u32 i;
+
+	for (i = 0; i < mbidc; i++)
+		hash = mp_mapcache_mbhash(hash ^ mbidv[i]) ^ (hash >> 29);
+
+	return hash;
+}
+
+static inline struct mp_mapcache_ent **mp_mapcache_bkt(struct mp_mapcache *mc, u64 hash)
+{
+	return &mc->mc_bktv[(hash >> 32) % MP_MAPCACHE_BKTS];
+}
+
+static void mp_mapcache_idle_del(struct mp_mapcache *mc, struct mp_mapcache_ent *ent)
+{
+	if (ent->mce_prev)
+		ent->mce_prev->mce_next = ent->mce_next;
+	else
+		mc->mc_head = ent->mce_next;
+
+	if (ent->mce_next)
+		ent->mce_next->mce_prev = ent->mce_prev;
+	else
+		mc->mc_tail = ent->mce_prev;
+
+	ent->mce_prev = ent->mce_next = NULL;
+	mc->mc_idle -= ent->mce_len;
+}
+
+static void mp_mapcache_idle_add(struct mp_mapcache *mc, struct mp_mapcache_ent *ent)
+{
+	ent->mce_prev = NULL;
+	ent->mce_next = mc->mc_head;
+
+	if (mc->mc_head)
+		mc->mc_head->mce_prev = ent;
+	else
+		mc->mc_tail = ent;
+
+	mc->mc_head = ent;
+	mc->mc_idle += ent->mce_len;
+}
+
+/**
+ * mp_mapcache_unhash() - Remove a map from the hash table and the filter
+ */
+static void mp_mapcache_unhash(struct mp_mapcache *mc, struct mp_mapcache_ent *ent)
+{
+	struct mp_mapcache_ent **pp;
+	u32                      i;
+
+	for (pp = mp_mapcache_bkt(mc, ent->mce_hash); *pp; pp = &(*pp)->mce_hnext) {
+		if (*pp == ent) {
+			*pp = ent->mce_hnext;
+			break;
+		}
+	}
+
+	for (i = 0; i < ent->mce_mbidc; i++)
+		--*mp_mapcache_mbfilt(mc, ent->mce_mbidv[i]);
+
+	ent->mce_hnext = NULL;
+	ent->mce_hashed = false;
+}
+
+/**
+ * mp_mapcache_trim() - Remove idle maps beyond the cap
+ * @mc:    cache
+ * @freep: list of the removed maps, linked by mce_next (output)
+ *
+ * Called with the cache lock held.
+ */
+static void mp_mapcache_trim(struct mp_mapcache *mc, struct mp_mapcache_ent **freep)
+{
+	struct mp_mapcache_ent *ent;
+
+	while (mc->mc_idle > mc->mc_cap && (ent = mc->mc_tail)) {
+		mp_mapcache_idle_del(mc, ent);
+		mp_mapcache_unhash(mc, ent);
+
+		ent->mce_next = *freep;
+		*freep = ent;
+		mc->mc_stats.mms_evictions++;
+	}
+}
+
+static void mp_mapcache_free(struct mp_mapcache *mc, struct mp_mapcache_ent *list)
+{
+	struct mp_mapcache_ent *ent;
+
+	while ((ent = list)) {
+		list = ent->mce_next;
+		mc->mc_free(ent->mce_priv);
+	}
+}
+
+merr_t mp_mapcache_create(u64 cap, mp_mapcache_free_fn *freefn, struct mp_mapcache **mcp)
+{
+	struct mp_mapcache *mc;
+
+	if (!freefn || !mcp)
+		return merr(EINVAL);
+
+	mc = calloc(1, sizeof(*mc));
+	if (!mc)
+		return merr(ENOMEM);
+
+	mutex_init(&mc->mc_lock);
+	mc->mc_free = freefn;
+	mc->mc_cap = cap;
+
+	*mcp = mc;
+
+	return 0;
+}
+
+void mp_mapcache_destroy(struct mp_mapcache *mc)
+{
+	struct mp_mapcache_ent *list = NULL;
+
+	if (!mc)
+		return;
+
+	mutex_lock(&mc->mc_lock);
+	mc->mc_cap = 0;
+	mp_mapcache_trim(mc, &list);
+	mutex_unlock(&mc->mc_lock);
+
+	mp_mapcache_free(mc, list);
+
+	mutex_destroy(&mc->mc_lock);
+	free(mc);
+}
+
+void mp_mapcache_cap_set(struct mp_mapcache *mc, u64 cap)
+{
+	struct mp_mapcache_ent *list = NULL;
+
+	mutex_lock(&mc->mc_lock);
+	mc->mc_cap = cap;
+	mp_mapcache_trim(mc, &list);
+	mutex_unlock(&mc->mc_lock);
+
+	mp_mapcache_free(mc, list);
+}
+
+void *mp_mapcache_get(struct mp_mapcache *mc, const u64 *mbidv, u32 mbidc, u32 advice)
+{
+	struct mp_mapcache_ent *ent;
+	u64                     hash;
+
+	hash = mp_mapcache_hash(mbidv, mbidc, advice);
+
+	mutex_lock(&mc->mc_lock);
+	for (ent = *mp_mapcache_bkt(mc, hash); ent; ent = ent->mce_hnext) {
+		if (ent->mce_hash == hash && ent->mce_mbidc == mbidc &&
+		    ent->mce_advice == advice &&
+		    !memcmp(ent->mce_mbidv, mbidv, mbidc * sizeof(*mbidv)))
+			break;
+	}
+
+	if (!ent) {
+		mc->mc_stats.mms_misses++;
+		mutex_unlock(&mc->mc_lock);
+		return NULL;
+	}
+
+	if (ent->mce_refs++ == 0)
+		mp_mapcache_idle_del(mc, ent);
+
+	mc->mc_stats.mms_hits++;
+	mutex_unlock(&mc->mc_lock);
+
+	return ent->mce_priv;
+}
+
+void mp_mapcache_insert(struct mp_mapcache *mc, struct mp_mapcache_ent *ent)
+{
+	struct mp_mapcache_ent **bkt;
+	u32                      i;
+
+	ent->mce_hash = mp_mapcache_hash(ent->mce_mbidv, ent->mce_mbidc, ent->mce_advice);
+	ent->mce_prev = ent->mce_next = NULL;
+	ent->mce_refs = 1;
+	ent->mce_hashed = true;
+
+	mutex_lock(&mc->mc_lock);
+	bkt = mp_mapcache_bkt(mc, ent->mce_hash);
+	ent->mce_hnext = *bkt;
+	*bkt = ent;
+
+	for (i = 0; i < ent->mce_mbidc; i++)
+		++*mp_mapcache_mbfilt(mc, ent->mce_mbidv[i]);
+	mutex_unlock(&mc->mc_lock);
+}
+
+merr_t mp_mapcache_put(struct mp_mapcache *mc, struct mp_mapcache_ent *ent)
+{
+	struct mp_mapcache_ent *list = NULL;
+
+	mutex_lock(&mc->mc_lock);
+	if (--ent->mce_refs > 0) {
+		mutex_unlock(&mc->mc_lock);
+		return 0;
+	}
+
+	if (ent->mce_hashed && ent->mce_len <= mc->mc_cap) {
+		mp_mapcache_idle_add(mc, ent);
+		mp_mapcache_trim(mc, &list);
+		mutex_unlock(&mc->mc_lock);
+
+		mp_mapcache_free(mc, list);
+
+		return 0;
+	}
+
+	if (ent->mce_hashed)
+		mp_mapcache_unhash(mc, ent);
+	mutex_unlock(&mc->mc_lock);
+
+	return mc->mc_free(ent->mce_priv);
+}
+
+void mp_mapcache_inval(struct mp_mapcache *mc, u64 mbid)
+{
+	struct mp_mapcache_ent *list = NULL, *ent, *next;
+	u32                     b, i;
+
+	if (!mc)
+		return;
+
+	mutex_lock(&mc->mc_lock);
+	if (*mp_mapcache_mbfilt(mc, mbid) == 0) {
+		mutex_unlock(&mc->mc_lock);
+		return;
+	}
+
+	for (b = 0; b < MP_MAPCACHE_BKTS; b++) {
+		for (ent = mc->mc_bktv[b]; ent; ent = next) {
+			next = ent->mce_hnext;
+
+			for (i = 0; i < ent->mce_mbidc; i++)
+				if (ent->mce_mbidv[i] == mbid)
+					break;
+
+			if (i == ent->mce_mbidc)
+				continue;
+
+			mp_mapcache_unhash(mc, ent);
+			mc->mc_stats.mms_invals++;
+
+			if (ent->mce_refs == 0) {
+				mp_mapcache_idle_del(mc, ent);
+				ent->mce_next = list;
+				list = ent;
+			}
+		}
+	}
+	mutex_unlock(&mc->mc_lock);
+
+	mp_mapcache_free(mc, list);
+}
+
+void mp_mapcache_stats_get(struct mp_mapcache *mc, struct mpool_mapcache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!mc)
+		return;
+
+	mutex_lock(&mc->mc_lock);
+	*stats = mc->mc_stats;
+	stats->mms_idle = mc->mc_idle;
+	mutex_unlock(&mc->mc_lock);
+}
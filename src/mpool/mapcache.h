@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MAPCACHE_H
+#define MPOOL_MAPCACHE_H
+
+/*
+ * Cache of mcache maps, keyed by (mblock ID vector, advice).
+ *
+ * Maps are reference counted: mapping a vector of mblocks that is already
+ * mapped returns the same map, and unmapping a map only drops a reference.
+ * A map whose last reference is dropped is kept idle on an LRU list, up to
+ * a cap on the total length of the idle maps, so that mapping the same
+ * immutable mblocks again costs a hash lookup rather than a VMA creation
+ * and an mmap().  Maps are dropped from the cache as soon as one of their
+ * mblocks is deleted through the same handle.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_MAPCACHE_BKTS        1024
+#define MP_MAPCACHE_MBFILTER    4096
+
+struct mp_mapcache;
+
+/**
+ * struct mp_mapcache_ent - cache entry, embedded in the cached object
+ * @mce_hnext:  hash chain
+ * @mce_prev:   previous entry in the idle list
+ * @mce_next:   next entry in the idle list
+ * @mce_priv:   cached object
+ * @mce_mbidv:  mblock IDs, owned by the cached object
+ * @mce_hash:   hash of the key
+ * @mce_len:    length of the map
+ * @mce_mbidc:  number of mblock IDs
+ * @mce_advice: map advice
+ * @mce_refs:   number of references, 0 if idle
+ * @mce_hashed: true until the entry is invalidated or evicted
+ */
+struct mp_mapcache_ent {
+	struct mp_mapcache_ent *mce_hnext;
+	struct mp_mapcache_ent *mce_prev;
+	struct mp_mapcache_ent *mce_next;
+	void                   *mce_priv;
+	const u64              *mce_mbidv;
+	u64                     mce_hash;
+	size_t                  mce_len;
+	u32                     mce_mbidc;
+	u32                     mce_advice;
+	u32                     mce_refs;
+	bool                    mce_hashed;
+};
+
+/**
+ * mp_mapcache_free_fn - destroy a cached object that left the cache
+ */
+typedef merr_t mp_mapcache_free_fn(void *priv);
+
+/**
+ * mp_mapcache_create() - Create a map cache
+ * @cap:    maximum total length of idle maps in bytes, 0 to keep no idle map
+ * @freefn: function to destroy a map that left the cache
+ * @mcp:    cache (output)
+ */
+merr_t mp_mapcache_create(u64 cap, mp_mapcache_free_fn *freefn, struct mp_mapcache **mcp);
+
+/**
+ * mp_mapcache_destroy() - Destroy the idle maps and the cache
+ * @mc: cache (may be NULL)
+ *
+ * Maps still referenced must have been unmapped by the caller.
+ */
+void mp_mapcache_destroy(struct mp_mapcache *mc);
+
+/**
+ * mp_mapcache_cap_set() - Change the cap on the length of idle maps
+ * @mc:  cache
+ * @cap: maximum total length of idle maps in bytes
+ */
+void mp_mapcache_cap_set(struct mp_mapcache *mc, u64 cap);
+
+/**
+ * mp_mapcache_get() - Look up and reference a map
+ * @mc:     cache
+ * @mbidv:  mblock IDs
+ * @mbidc:  number of mblock IDs
+ * @advice: map advice
+ *
+ * Return: the cached object, or NULL if there is no such map
+ */
+void *mp_mapcache_get(struct mp_mapcache *mc, const u64 *mbidv, u32 mbidc, u32 advice);
+
+/**
+ * mp_mapcache_insert() - Insert a new map, with one reference
+ * @mc:  cache
+ * @ent: entry, all fields of which but the links and the hash must be set
+ */
+void mp_mapcache_insert(struct mp_mapcache *mc, struct mp_mapcache_ent *ent);
+
+/**
+ * mp_mapcache_put() - Drop a reference to a map
+ * @mc:  cache
+ * @ent: entry
+ *
+ * Return: the error of destroying the map if it left the cache, else %0
+ */
+merr_t mp_mapcache_put(struct mp_mapcache *mc, struct mp_mapcache_ent *ent);
+
+/**
+ * mp_mapcache_inval() - Drop the maps of an mblock from the cache
+ * @mc:   cache (may be NULL)
+ * @mbid: mblock object ID
+ *
+ * Idle maps of the mblock are destroyed, referenced ones when they are
+ * unmapped.
+ */
+void mp_mapcache_inval(struct mp_mapcache *mc, u64 mbid);
+
+/**
+ * mp_mapcache_stats_get() - Retrieve cache statistics
+ * @mc:    cache (may be NULL)
+ * @stats: cache statistics (output)
+ */
+void mp_mapcache_stats_get(struct mp_mapcache *mc, struct mpool_mapcache_stats *stats);
+
+#endif /* MPOOL_MAPCACHE_H */
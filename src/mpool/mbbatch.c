@@ -0,0 +1,462 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Batched mblock operations module.
+ *
+ * There is no vectored commit/abort/delete ioctl, so a batch is carried
+ * out by submitting one internal op per mblock to the async mblock I/O
+ * engine on a private completion queue, which overlaps the ioctls and
+ * keeps the caller's thread out of the kernel.  The index of each mblock
+ * rides in the completion argument so that errors are reported per mblock.
+ *
+ * The deferred delete queue is a growable ring of mblock IDs drained by a
+ * thread in batches of up to MP_DELQ_BATCH deletes.  Rate limiting paces
+ * the batches against a monotonic deadline advanced by 1/rate second per
+ * delete, so that bursts are smoothed over time without drifting.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/minmax.h>
+
+#include <mpctl/impool.h>
+
+#include <time.h>
+
+#include "logging.h"
+#include "mbio.h"
+#include "mbbatch.h"
+
+#define NSEC_PER_SEC    1000000000ull
+
+/**
+ * struct mp_delq - deferred delete queue
+ * @dq_mp:      mpool handle
+ * @dq_lock:    protects all fields below
+ * @dq_cv:      signaled when deletes are queued or the queue is stopped
+ * @dq_idlecv:  signaled when the drain thread is done with a batch
+ * @dq_tid:     drain thread
+ * @dq_started: drain thread is running
+ * @dq_stop:    drain thread must issue all queued deletes and exit
+ * @dq_pause:   drain thread must not start a batch
+ * @dq_busy:    drain thread is issuing a batch
+ * @dq_rate:    maximum number of deletes per second, 0 for no limit
+ * @dq_next:    CLOCK_MONOTONIC time in ns before which not to issue a batch
+ * @dq_head:    index of the oldest queued mblock ID
+ * @dq_cnt:     number of queued mblock IDs
+ * @dq_cap:     size of dq_mbidv
+ * @dq_mbidv:   ring of queued mblock IDs
+ * @dq_err:     error of the first failed delete since the last drain
+ * @dq_failc:   number of failed deletes since the last drain
+ */
+struct mp_delq {
+	struct mpool           *dq_mp;
+	struct mutex            dq_lock;
+	pthread_cond_t          dq_cv;
+	pthread_cond_t          dq_idlecv;
+	pthread_t               dq_tid;
+	bool                    dq_started;
+	bool                    dq_stop;
+	bool                    dq_pause;
+	bool                    dq_busy;
+	u32                     dq_rate;
+	u64                     dq_next;
+	size_t                  dq_head;
+	size_t                  dq_cnt;
+	size_t                  dq_cap;
+	u64                    *dq_mbidv;
+	merr_t                  dq_err;
+	u64                     dq_failc;
+};
+
+static merr_t mp_mblock_op(struct mpool *mp, int op, u64 mbid)
+{
+	switch (op) {
+	case MP_MBIO_COMMIT:
+		return mpool_mblock_commit(mp, mbid);
+
+	case MP_MBIO_ABORT:
+		return mpool_mblock_abort(mp, mbid);
+
+	default:
+		return mpool_mblock_delete(mp, mbid);
+	}
+}
+
+/**
+ * mp_mblock_opv() - Apply an internal op to a vector of mblocks
+ * @mp:    mpool handle
+ * @op:    MP_MBIO_COMMIT, MP_MBIO_ABORT or MP_MBIO_DELETE
+ * @mbidv: mblock IDs
+ * @mbidc: number of mblock IDs
+ * @errv:  per mblock errors (output, may be NULL)
+ *
+ * Return: the error of the lowest-indexed mblock that failed, if any.
+ */
+static merr_t mp_mblock_opv(struct mpool *mp, int op, const u64 *mbidv, int mbidc, merr_t *errv)
+{
+	struct mpool_mbio_cqe   cqev[64];
+	struct mpool_mbio_cq   *cq;
+	merr_t                  err, first = 0;
+	int                     firstidx = mbidc;
+	int                     i = 0, inflight = 0, n, j, idx;
+
+	if (!mp || (!mbidv && mbidc > 0) || mbidc < 0)
+		return merr(EINVAL);
+
+	/* Issue single ops, or all ops if there is no cq, synchronously. */
+	if (mbidc == 1 || mpool_mbio_cq_create(&cq)) {
+		for (i = 0; i < mbidc; i++) {
+			err = mp_mblock_op(mp, op, mbidv[i]);
+			if (errv)
+				errv[i] = err;
+			if (err && !first)
+				first = err;
+		}
+
+		return first;
+	}
+
+	while (i < mbidc || inflight > 0) {
+		while (i < mbidc && inflight < MP_MBBATCH_INFLIGHT) {
+			err = mp_mbio_submit(mp->mp_mbio, op, mbidv[i], NULL, 0, 0, cq, NULL,
+					     (void *)(intptr_t)i);
+			if (err)
+				err = mp_mblock_op(mp, op, mbidv[i]);
+			else
+				inflight++;
+
+			if (errv)
+				errv[i] = err;
+			if (err && i < firstidx) {
+				first = err;
+				firstidx = i;
+			}
+			i++;
+		}
+
+		if (inflight == 0)
+			break;
+
+		/*
+		 * The cq must not be destroyed with ops in flight.  On a reap
+		 * failure, give up on the ops not yet issued and keep reaping.
+		 */
+		err = mpool_mbio_cq_reap(cq, cqev, NELEM(cqev), 1, &n);
+		if (err) {
+			for (; i < mbidc; i++) {
+				if (errv)
+					errv[i] = err;
+				if (i < firstidx) {
+					first = err;
+					firstidx = i;
+				}
+			}
+			continue;
+		}
+
+		for (j = 0; j < n; j++) {
+			idx = (intptr_t)cqev[j].mce_arg;
+
+			if (errv)
+				errv[idx] = cqev[j].mce_err;
+			if (cqev[j].mce_err && idx < firstidx) {
+				first = cqev[j].mce_err;
+				firstidx = idx;
+			}
+		}
+
+		inflight -= n;
+	}
+
+	mpool_mbio_cq_destroy(cq);
+
+	return first;
+}
+
+mpool_err_t
+mpool_mblock_commitv(struct mpool *mp, const uint64_t *mbidv, int mbidc, mpool_err_t *errv)
+{
+	return mp_mblock_opv(mp, MP_MBIO_COMMIT, mbidv, mbidc, errv);
+}
+
+mpool_err_t
+mpool_mblock_abortv(struct mpool *mp, const uint64_t *mbidv, int mbidc, mpool_err_t *errv)
+{
+	return mp_mblock_opv(mp, MP_MBIO_ABORT, mbidv, mbidc, errv);
+}
+
+mpool_err_t
+mpool_mblock_deletev(struct mpool *mp, const uint64_t *mbidv, int mbidc, mpool_err_t *errv)
+{
+	return mp_mblock_opv(mp, MP_MBIO_DELETE, mbidv, mbidc, errv);
+}
+
+static u64 mp_delq_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * mp_delq_pace() - Wait until the rate limit allows the next batch
+ *
+ * Called with the queue lock held.  Returns early if the queue is stopped
+ * or paused.
+ */
+static void mp_delq_pace(struct mp_delq *delq, u32 n)
+{
+	struct timespec ts;
+	u64             now = mp_delq_now();
+
+	if (!delq->dq_rate)
+		return;
+
+	/* Do not let an idle period build up credit. */
+	if (delq->dq_next < now)
+		delq->dq_next = now;
+
+	while (!delq->dq_stop && !delq->dq_pause && delq->dq_next > now) {
+		ts.tv_sec = delq->dq_next / NSEC_PER_SEC;
+		ts.tv_nsec = delq->dq_next % NSEC_PER_SEC;
+		pthread_cond_timedwait(&delq->dq_cv, &delq->dq_lock.pth_mutex, &ts);
+		now = mp_delq_now();
+	}
+
+	/* The rate may have been changed while waiting. */
+	if (delq->dq_rate)
+		delq->dq_next += n * NSEC_PER_SEC / delq->dq_rate;
+}
+
+static void *mp_delq_main(void *arg)
+{
+	struct mp_delq *delq = arg;
+	merr_t          errv[MP_DELQ_BATCH];
+	u64             mbidv[MP_DELQ_BATCH];
+	u32             n, i;
+
+	mutex_lock(&delq->dq_lock);
+	while (true) {
+		while ((!delq->dq_cnt || delq->dq_pause) && !delq->dq_stop)
+			pthread_cond_wait(&delq->dq_cv, &delq->dq_lock.pth_mutex);
+
+		if (!delq->dq_cnt)
+			break;
+
+		/* Size batches to about 1/10th of a second worth of deletes. */
+		n = min_t(size_t, delq->dq_cnt, MP_DELQ_BATCH);
+		if (delq->dq_rate && !delq->dq_stop)
+			n = clamp_t(u32, delq->dq_rate / 10, 1, n);
+
+		mp_delq_pace(delq, n);
+
+		if (delq->dq_pause && !delq->dq_stop)
+			continue;
+
+		for (i = 0; i < n; i++)
+			mbidv[i] = delq->dq_mbidv[(delq->dq_head + i) % delq->dq_cap];
+
+		delq->dq_head = (delq->dq_head + n) % delq->dq_cap;
+		delq->dq_cnt -= n;
+		delq->dq_busy = true;
+		mutex_unlock(&delq->dq_lock);
+
+		mp_mblock_opv(delq->dq_mp, MP_MBIO_DELETE, mbidv, n, errv);
+
+		mutex_lock(&delq->dq_lock);
+		for (i = 0; i < n; i++) {
+			if (!errv[i])
+				continue;
+
+			mse_log(MPOOL_ERR "Deferred delete of mblock 0x%lx failed, errno %d",
+				(ulong)mbidv[i], merr_errno(errv[i]));
+
+			if (!delq->dq_failc++)
+				delq->dq_err = errv[i];
+		}
+
+		delq->dq_busy = false;
+		pthread_cond_broadcast(&delq->dq_idlecv);
+	}
+	mutex_unlock(&delq->dq_lock);
+
+	return NULL;
+}
+
+/**
+ * mp_delq_grow() - Make room for @cnt more mblock IDs in the ring
+ *
+ * Called with the queue lock held.
+ */
+static merr_t mp_delq_grow(struct mp_delq *delq, size_t cnt)
+{
+	size_t  cap, i;
+	u64    *mbidv;
+
+	if (delq->dq_cnt + cnt <= delq->dq_cap)
+		return 0;
+
+	cap = max_t(size_t, delq->dq_cap * 2, delq->dq_cnt + cnt);
+	cap = max_t(size_t, cap, 1024);
+
+	mbidv = malloc(cap * sizeof(*mbidv));
+	if (!mbidv)
+		return merr(ENOMEM);
+
+	for (i = 0; i < delq->dq_cnt; i++)
+		mbidv[i] = delq->dq_mbidv[(delq->dq_head + i) % delq->dq_cap];
+
+	free(delq->dq_mbidv);
+	delq->dq_mbidv = mbidv;
+	delq->dq_cap = cap;
+	delq->dq_head = 0;
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_delete_defer(struct mpool *mp, const uint64_t *mbidv, int mbidc)
+{
+	struct mp_delq *delq;
+	merr_t          err;
+	int             i;
+
+	if (!mp || (!mbidv && mbidc > 0) || mbidc < 0)
+		return merr(EINVAL);
+
+	delq = mp->mp_delq;
+
+	mutex_lock(&delq->dq_lock);
+	if (!delq->dq_started) {
+		if (pthread_create(&delq->dq_tid, NULL, mp_delq_main, delq)) {
+			mutex_unlock(&delq->dq_lock);
+
+			/* Without a drain thread, delete synchronously. */
+			return mpool_mblock_deletev(mp, mbidv, mbidc, NULL);
+		}
+
+		delq->dq_started = true;
+	}
+
+	err = mp_delq_grow(delq, mbidc);
+	if (!err) {
+		for (i = 0; i < mbidc; i++)
+			delq->dq_mbidv[(delq->dq_head + delq->dq_cnt++) % delq->dq_cap] = mbidv[i];
+
+		pthread_cond_signal(&delq->dq_cv);
+	}
+	mutex_unlock(&delq->dq_lock);
+
+	return err;
+}
+
+mpool_err_t mpool_mblock_delete_drain(struct mpool *mp, uint64_t *failc)
+{
+	struct mp_delq *delq;
+	merr_t          err;
+
+	if (!mp)
+		return merr(EINVAL);
+
+	delq = mp->mp_delq;
+
+	mutex_lock(&delq->dq_lock);
+	while (delq->dq_cnt > 0 || delq->dq_busy)
+		pthread_cond_wait(&delq->dq_idlecv, &delq->dq_lock.pth_mutex);
+
+	err = delq->dq_err;
+	if (failc)
+		*failc = delq->dq_failc;
+
+	delq->dq_err = 0;
+	delq->dq_failc = 0;
+	mutex_unlock(&delq->dq_lock);
+
+	return err;
+}
+
+void mp_delq_pause(struct mp_delq *delq)
+{
+	if (!delq)
+		return;
+
+	mutex_lock(&delq->dq_lock);
+	delq->dq_pause = true;
+	pthread_cond_signal(&delq->dq_cv);
+
+	while (delq->dq_busy)
+		pthread_cond_wait(&delq->dq_idlecv, &delq->dq_lock.pth_mutex);
+	mutex_unlock(&delq->dq_lock);
+}
+
+void mp_delq_resume(struct mp_delq *delq)
+{
+	if (!delq)
+		return;
+
+	mutex_lock(&delq->dq_lock);
+	delq->dq_pause = false;
+	pthread_cond_signal(&delq->dq_cv);
+	mutex_unlock(&delq->dq_lock);
+}
+
+void mp_delq_rate_set(struct mp_delq *delq, u32 rate)
+{
+	mutex_lock(&delq->dq_lock);
+	delq->dq_rate = rate;
+	pthread_cond_signal(&delq->dq_cv);
+	mutex_unlock(&delq->dq_lock);
+}
+
+merr_t mp_delq_create(struct mpool *mp, u32 rate, struct mp_delq **delqp)
+{
+	pthread_condattr_t  attr;
+	struct mp_delq     *delq;
+
+	if (!mp || !delqp)
+		return merr(EINVAL);
+
+	delq = calloc(1, sizeof(*delq));
+	if (!delq)
+		return merr(ENOMEM);
+
+	delq->dq_mp = mp;
+	delq->dq_rate = rate;
+	mutex_init(&delq->dq_lock);
+
+	/* The rate limit deadline is in CLOCK_MONOTONIC time. */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&delq->dq_cv, &attr);
+	pthread_condattr_destroy(&attr);
+
+	pthread_cond_init(&delq->dq_idlecv, NULL);
+
+	*delqp = delq;
+
+	return 0;
+}
+
+void mp_delq_destroy(struct mp_delq *delq)
+{
+	if (!delq)
+		return;
+
+	mutex_lock(&delq->dq_lock);
+	delq->dq_stop = true;
+	pthread_cond_signal(&delq->dq_cv);
+	mutex_unlock(&delq->dq_lock);
+
+	if (delq->dq_started)
+		pthread_join(delq->dq_tid, NULL);
+
+	pthread_cond_destroy(&delq->dq_idlecv);
+	pthread_cond_destroy(&delq->dq_cv);
+	mutex_destroy(&delq->dq_lock);
+	free(delq->dq_mbidv);
+	free(delq);
+}
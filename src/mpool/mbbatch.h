@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MBBATCH_H
+#define MPOOL_MBBATCH_H
+
+/*
+ * Batched mblock commit/abort/delete and the deferred delete queue.
+ *
+ * Each mblock of a batch still costs one ioctl, but up to MP_MBBATCH_INFLIGHT
+ * of them are issued concurrently by the async mblock I/O engine.  Deferred
+ * deletes are queued and issued in batches by a background thread, at a rate
+ * of at most mcp_delq_rate deletes per second.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_MBBATCH_INFLIGHT     256
+#define MP_DELQ_BATCH           64
+
+struct mp_delq;
+
+/**
+ * mp_delq_create() - Create a deferred delete queue
+ * @mp:    mpool handle on which mblocks are deleted
+ * @rate:  maximum number of deletes per second, 0 for no limit
+ * @delqp: queue (output)
+ *
+ * The background thread is started on first use.
+ */
+merr_t mp_delq_create(struct mpool *mp, u32 rate, struct mp_delq **delqp);
+
+/**
+ * mp_delq_destroy() - Destroy a deferred delete queue
+ * @delq: queue (may be NULL)
+ *
+ * Issues all queued deletes, without rate limit, before returning.
+ */
+void mp_delq_destroy(struct mp_delq *delq);
+
+/**
+ * mp_delq_pause() - Wait for the drain thread to be idle and keep it so
+ * @delq: queue (may be NULL)
+ *
+ * Deletes are still queued while the queue is paused, they are issued
+ * after mp_delq_resume().
+ */
+void mp_delq_pause(struct mp_delq *delq);
+
+/**
+ * mp_delq_resume() - Let the drain thread issue deletes again
+ * @delq: queue (may be NULL)
+ */
+void mp_delq_resume(struct mp_delq *delq);
+
+/**
+ * mp_delq_rate_set() - Change the rate limit of a deferred delete queue
+ * @delq: queue
+ * @rate: maximum number of deletes per second, 0 for no limit
+ */
+void mp_delq_rate_set(struct mp_delq *delq, u32 rate);
+
+#endif /* MPOOL_MBBATCH_H */
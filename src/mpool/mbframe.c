@@ -0,0 +1,666 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Framed mblock module.
+ *
+ * Layout of a framed mblock:
+ *
+ *   frame 0 | frame 1 | ... | frame N-1 | index | zero pad | trailer
+ *
+ * Frames are packed back to back without alignment and are written
+ * through a streaming mblock writer.  Each frame holds framesz bytes of
+ * data (the last frame may hold fewer), either LZ compressed or raw.  The
+ * index has one entry per frame giving its offset, stored length, data
+ * length, flags and the CRC32C of its stored bytes.  The trailer ends on
+ * the last byte of the mblock, which is always a page boundary, and
+ * locates the index.  All fields are little-endian.
+ *
+ * Readers load the trailer and index once at open, after which a frame
+ * is fetched with a single mblock read and checked before it is inflated.
+ */
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/omf.h>
+
+#include <stddef.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "crc32c.h"
+#include "lz.h"
+
+#define MBFRAME_MAGIC               0x5246424du     /* "MBFR" */
+#define MBFRAME_VERSION             1
+#define MBFRAME_FRAMESZ_DEFAULT     (64 * 1024)
+#define MBFRAME_FRAMESZ_MAX         (4 * 1024 * 1024)
+#define MBFRAME_RDFRAMES            8
+
+#define MBFRAME_F_LZ                0x0001          /* frame is LZ compressed */
+
+/**
+ * struct mbframe_entry_omf - frame index entry
+ * @pfe_off:   offset of the frame in the mblock
+ * @pfe_slen:  stored length of the frame
+ * @pfe_ulen:  length of the data held by the frame
+ * @pfe_crc:   CRC32C of the pfe_slen stored bytes
+ * @pfe_flags: MBFRAME_F_* flags
+ */
+struct mbframe_entry_omf {
+	__le64 pfe_off;
+	__le32 pfe_slen;
+	__le32 pfe_ulen;
+	__le32 pfe_crc;
+	__le32 pfe_flags;
+} __packed;
+
+OMF_SETGET(struct mbframe_entry_omf, pfe_off, 64)
+OMF_SETGET(struct mbframe_entry_omf, pfe_slen, 32)
+OMF_SETGET(struct mbframe_entry_omf, pfe_ulen, 32)
+OMF_SETGET(struct mbframe_entry_omf, pfe_crc, 32)
+OMF_SETGET(struct mbframe_entry_omf, pfe_flags, 32)
+
+/**
+ * struct mbframe_trailer_omf - framed mblock trailer
+ * @pft_magic:   MBFRAME_MAGIC
+ * @pft_vers:    MBFRAME_VERSION
+ * @pft_flags:   MPOOL_MBFRAME_* flags the mblock was written with
+ * @pft_framesz: frame size
+ * @pft_framec:  number of frames
+ * @pft_len:     length of the data stored in the frames
+ * @pft_idxoff:  offset of the index in the mblock
+ * @pft_idxcrc:  CRC32C of the index
+ * @pft_crc:     CRC32C of the trailer up to this field
+ */
+struct mbframe_trailer_omf {
+	__le32 pft_magic;
+	__le16 pft_vers;
+	__le16 pft_flags;
+	__le32 pft_framesz;
+	__le32 pft_framec;
+	__le64 pft_len;
+	__le64 pft_idxoff;
+	__le32 pft_idxcrc;
+	__le32 pft_crc;
+} __packed;
+
+OMF_SETGET(struct mbframe_trailer_omf, pft_magic, 32)
+OMF_SETGET(struct mbframe_trailer_omf, pft_vers, 16)
+OMF_SETGET(struct mbframe_trailer_omf, pft_flags, 16)
+OMF_SETGET(struct mbframe_trailer_omf, pft_framesz, 32)
+OMF_SETGET(struct mbframe_trailer_omf, pft_framec, 32)
+OMF_SETGET(struct mbframe_trailer_omf, pft_len, 64)
+OMF_SETGET(struct mbframe_trailer_omf, pft_idxoff, 64)
+OMF_SETGET(struct mbframe_trailer_omf, pft_idxcrc, 32)
+OMF_SETGET(struct mbframe_trailer_omf, pft_crc, 32)
+
+/**
+ * struct mbframe_ent - in-memory frame index entry
+ */
+struct mbframe_ent {
+	u64     mfe_off;
+	u32     mfe_slen;
+	u32     mfe_ulen;
+	u32     mfe_crc;
+	u32     mfe_flags;
+};
+
+/**
+ * struct mpool_mbframe_writer - framed mblock writer
+ * @mfw_w:        underlying streaming mblock writer
+ * @mfw_wroff:    number of bytes appended to mfw_w
+ * @mfw_len:      number of bytes appended
+ * @mfw_err:      first error encountered, sticky
+ * @mfw_framesz:  frame size
+ * @mfw_flags:    MPOOL_MBFRAME_* flags
+ * @mfw_fill:     number of bytes in the current frame
+ * @mfw_framec:   number of frames written
+ * @mfw_framemax: number of entries allocated in mfw_framev
+ * @mfw_framev:   frame index
+ * @mfw_frame:    current frame
+ * @mfw_cbuf:     compression buffer
+ */
+struct mpool_mbframe_writer {
+	struct mpool_mblock_writer *mfw_w;
+	u64                         mfw_wroff;
+	size_t                      mfw_len;
+	merr_t                      mfw_err;
+	u32                         mfw_framesz;
+	u32                         mfw_flags;
+	u32                         mfw_fill;
+	u32                         mfw_framec;
+	u32                         mfw_framemax;
+	struct mbframe_ent         *mfw_framev;
+	char                       *mfw_frame;
+	char                       *mfw_cbuf;
+};
+
+/**
+ * struct mpool_mbframe_reader - framed mblock reader
+ * @mfr_mp:      mpool handle
+ * @mfr_mbid:    mblock object ID
+ * @mfr_len:     length of the data stored in the frames
+ * @mfr_framesz: frame size
+ * @mfr_framec:  number of frames
+ * @mfr_framev:  frame index
+ * @mfr_rbufsz:  size of mfr_rbuf
+ * @mfr_rbuf:    page-aligned buffer for reading stored frames
+ * @mfr_dbuf:    buffer for decompressing partially read frames
+ */
+struct mpool_mbframe_reader {
+	struct mpool               *mfr_mp;
+	u64                         mfr_mbid;
+	size_t                      mfr_len;
+	u32                         mfr_framesz;
+	u32                         mfr_framec;
+	struct mbframe_ent         *mfr_framev;
+	size_t                      mfr_rbufsz;
+	char                       *mfr_rbuf;
+	char                       *mfr_dbuf;
+};
+
+static merr_t mbframe_writer_put(struct mpool_mbframe_writer *w, const void *data, size_t len)
+{
+	merr_t err;
+
+	err = mpool_mblock_writer_append(w->mfw_w, data, len);
+	if (err) {
+		w->mfw_err = err;
+		return err;
+	}
+
+	w->mfw_wroff += len;
+
+	return 0;
+}
+
+/**
+ * mbframe_writer_flush() - Compress, checksum and write the current frame
+ */
+static merr_t mbframe_writer_flush(struct mpool_mbframe_writer *w)
+{
+	struct mbframe_ent *e;
+	const char         *data = w->mfw_frame;
+	size_t              slen = 0;
+	u32                 flags = 0;
+	merr_t              err;
+
+	if (w->mfw_framec == w->mfw_framemax) {
+		u32 max = w->mfw_framemax ? w->mfw_framemax * 2 : 64;
+
+		e = realloc(w->mfw_framev, max * sizeof(*e));
+		if (!e) {
+			w->mfw_err = merr(ENOMEM);
+			return w->mfw_err;
+		}
+
+		w->mfw_framev = e;
+		w->mfw_framemax = max;
+	}
+
+	if (w->mfw_flags & MPOOL_MBFRAME_COMPRESS)
+		slen = mp_lz_compress(w->mfw_frame, w->mfw_fill, w->mfw_cbuf, w->mfw_fill - 1);
+
+	if (slen > 0) {
+		data = w->mfw_cbuf;
+		flags |= MBFRAME_F_LZ;
+	} else {
+		slen = w->mfw_fill;
+	}
+
+	e = w->mfw_framev + w->mfw_framec;
+	e->mfe_off = w->mfw_wroff;
+	e->mfe_slen = slen;
+	e->mfe_ulen = w->mfw_fill;
+	e->mfe_crc = crc32c(0, data, slen);
+	e->mfe_flags = flags;
+
+	err = mbframe_writer_put(w, data, slen);
+	if (err)
+		return err;
+
+	w->mfw_framec++;
+	w->mfw_fill = 0;
+
+	return 0;
+}
+
+static void mbframe_writer_free(struct mpool_mbframe_writer *w)
+{
+	free(w->mfw_framev);
+	free(w->mfw_frame);
+	free(w->mfw_cbuf);
+	free(w);
+}
+
+mpool_err_t
+mpool_mbframe_writer_open(
+	struct mpool                 *mp,
+	uint64_t                      mbid,
+	uint32_t                      framesz,
+	uint32_t                      flags,
+	struct mpool_mbframe_writer **wp)
+{
+	struct mpool_mbframe_writer *w;
+	merr_t                       err;
+
+	if (!mp || !wp || framesz > MBFRAME_FRAMESZ_MAX || (flags & ~MPOOL_MBFRAME_COMPRESS))
+		return merr(EINVAL);
+
+	*wp = NULL;
+
+	framesz = roundup(framesz ?: MBFRAME_FRAMESZ_DEFAULT, PAGE_SIZE);
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return merr(ENOMEM);
+
+	w->mfw_framesz = framesz;
+	w->mfw_flags = flags;
+
+	w->mfw_frame = malloc(framesz);
+	if (flags & MPOOL_MBFRAME_COMPRESS)
+		w->mfw_cbuf = malloc(framesz);
+
+	if (!w->mfw_frame || ((flags & MPOOL_MBFRAME_COMPRESS) && !w->mfw_cbuf)) {
+		mbframe_writer_free(w);
+		return merr(ENOMEM);
+	}
+
+	err = mpool_mblock_writer_open(mp, mbid, 0, &w->mfw_w);
+	if (err) {
+		mbframe_writer_free(w);
+		return err;
+	}
+
+	*wp = w;
+
+	return 0;
+}
+
+mpool_err_t mpool_mbframe_writer_append(struct mpool_mbframe_writer *w, const void *data, size_t len)
+{
+	const char *src = data;
+	merr_t      err;
+	size_t      n;
+
+	if (!w || (!data && len > 0))
+		return merr(EINVAL);
+
+	if (w->mfw_err)
+		return w->mfw_err;
+
+	w->mfw_len += len;
+
+	while (len > 0) {
+		n = min_t(size_t, len, w->mfw_framesz - w->mfw_fill);
+
+		memcpy(w->mfw_frame + w->mfw_fill, src, n);
+		w->mfw_fill += n;
+		src += n;
+		len -= n;
+
+		if (w->mfw_fill == w->mfw_framesz) {
+			err = mbframe_writer_flush(w);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * mbframe_writer_finish() - Write the last frame, the index and the trailer
+ */
+static merr_t mbframe_writer_finish(struct mpool_mbframe_writer *w)
+{
+	struct mbframe_trailer_omf *trailer;
+	struct mbframe_entry_omf   *idx;
+	size_t                      idxlen, padlen, buflen;
+	char                       *buf;
+	merr_t                      err;
+	u32                         i;
+
+	if (w->mfw_fill > 0) {
+		err = mbframe_writer_flush(w);
+		if (err)
+			return err;
+	}
+
+	idxlen = w->mfw_framec * sizeof(*idx);
+	buflen = idxlen + sizeof(*trailer);
+	padlen = roundup(w->mfw_wroff + buflen, PAGE_SIZE) - (w->mfw_wroff + buflen);
+	buflen += padlen;
+
+	buf = calloc(1, buflen);
+	if (!buf)
+		return merr(ENOMEM);
+
+	idx = (struct mbframe_entry_omf *)buf;
+	for (i = 0; i < w->mfw_framec; i++) {
+		struct mbframe_ent *e = w->mfw_framev + i;
+
+		omf_set_pfe_off(idx + i, e->mfe_off);
+		omf_set_pfe_slen(idx + i, e->mfe_slen);
+		omf_set_pfe_ulen(idx + i, e->mfe_ulen);
+		omf_set_pfe_crc(idx + i, e->mfe_crc);
+		omf_set_pfe_flags(idx + i, e->mfe_flags);
+	}
+
+	trailer = (struct mbframe_trailer_omf *)(buf + buflen - sizeof(*trailer));
+	omf_set_pft_magic(trailer, MBFRAME_MAGIC);
+	omf_set_pft_vers(trailer, MBFRAME_VERSION);
+	omf_set_pft_flags(trailer, w->mfw_flags);
+	omf_set_pft_framesz(trailer, w->mfw_framesz);
+	omf_set_pft_framec(trailer, w->mfw_framec);
+	omf_set_pft_len(trailer, w->mfw_len);
+	omf_set_pft_idxoff(trailer, w->mfw_wroff);
+	omf_set_pft_idxcrc(trailer, crc32c(0, idx, idxlen));
+	omf_set_pft_crc(trailer, crc32c(0, trailer, offsetof(struct mbframe_trailer_omf, pft_crc)));
+
+	err = mbframe_writer_put(w, buf, buflen);
+
+	free(buf);
+
+	return err;
+}
+
+mpool_err_t
+mpool_mbframe_writer_close(struct mpool_mbframe_writer *w, size_t *len, size_t *wrlen)
+{
+	merr_t err;
+
+	if (!w)
+		return merr(EINVAL);
+
+	err = w->mfw_err ?: mbframe_writer_finish(w);
+	if (!err)
+		err = mpool_mblock_writer_close(w->mfw_w, wrlen);
+	else
+		mpool_mblock_writer_abort(w->mfw_w);
+
+	if (len)
+		*len = w->mfw_len;
+
+	mbframe_writer_free(w);
+
+	return err;
+}
+
+mpool_err_t mpool_mbframe_writer_abort(struct mpool_mbframe_writer *w)
+{
+	merr_t err;
+
+	if (!w)
+		return merr(EINVAL);
+
+	err = mpool_mblock_writer_abort(w->mfw_w);
+
+	mbframe_writer_free(w);
+
+	return err;
+}
+
+/**
+ * mbframe_read_range() - Read an arbitrary byte range of the mblock
+ * @r:     reader
+ * @off:   offset of the range
+ * @len:   length of the range
+ * @datap: start of the range in r->mfr_rbuf (output)
+ *
+ * The enclosing page-aligned range must fit in r->mfr_rbuf.
+ */
+static merr_t mbframe_read_range(struct mpool_mbframe_reader *r, u64 off, size_t len, char **datap)
+{
+	struct iovec    iov;
+	u64             aoff = off & ~(u64)(PAGE_SIZE - 1);
+	merr_t          err;
+
+	iov.iov_base = r->mfr_rbuf;
+	iov.iov_len = roundup(off + len, PAGE_SIZE) - aoff;
+
+	if (iov.iov_len > r->mfr_rbufsz)
+		return merr(EINVAL);
+
+	err = mpool_mblock_read(r->mfr_mp, r->mfr_mbid, &iov, 1, aoff);
+	if (err)
+		return err;
+
+	*datap = r->mfr_rbuf + (off - aoff);
+
+	return 0;
+}
+
+/**
+ * mbframe_reader_load() - Read and verify the trailer and frame index
+ * @r:     reader
+ * @wrlen: mblock write length
+ */
+static merr_t mbframe_reader_load(struct mpool_mbframe_reader *r, size_t wrlen)
+{
+	struct mbframe_trailer_omf  trailer_omf, *trailer = &trailer_omf;
+	struct mbframe_entry_omf   *idx;
+	struct mbframe_ent         *e;
+	u64                         idxoff, expect = 0;
+	size_t                      idxlen;
+	char                       *data;
+	merr_t                      err;
+	u32                         i;
+
+	err = mbframe_read_range(r, wrlen - sizeof(*trailer), sizeof(*trailer), &data);
+	if (err)
+		return err;
+
+	/* Copy it out as the read buffer is reused to read the index. */
+	memcpy(trailer, data, sizeof(*trailer));
+
+	if (omf_pft_magic(trailer) != MBFRAME_MAGIC || omf_pft_vers(trailer) != MBFRAME_VERSION ||
+	    omf_pft_crc(trailer) != crc32c(0, trailer, offsetof(struct mbframe_trailer_omf, pft_crc)))
+		return merr(EBADMSG);
+
+	r->mfr_framesz = omf_pft_framesz(trailer);
+	r->mfr_framec = omf_pft_framec(trailer);
+	r->mfr_len = omf_pft_len(trailer);
+	idxoff = omf_pft_idxoff(trailer);
+	idxlen = (size_t)r->mfr_framec * sizeof(*idx);
+
+	if (r->mfr_framesz == 0 || r->mfr_framesz > MBFRAME_FRAMESZ_MAX ||
+	    !PAGE_ALIGNED(r->mfr_framesz) || idxoff + idxlen + sizeof(*trailer) > wrlen ||
+	    r->mfr_len > (u64)r->mfr_framec * r->mfr_framesz ||
+	    r->mfr_len + r->mfr_framesz <= (u64)r->mfr_framec * r->mfr_framesz)
+		return merr(EBADMSG);
+
+	r->mfr_framev = malloc(max_t(size_t, r->mfr_framec, 1) * sizeof(*e));
+	idx = malloc(max_t(size_t, idxlen, 1));
+	if (!r->mfr_framev || !idx) {
+		free(idx);
+		return merr(ENOMEM);
+	}
+
+	/* The index can be larger than the read buffer, read it in pieces. */
+	for (i = 0; i < idxlen; i += r->mfr_rbufsz / 2) {
+		size_t n = min_t(size_t, idxlen - i, r->mfr_rbufsz / 2);
+
+		err = mbframe_read_range(r, idxoff + i, n, &data);
+		if (err) {
+			free(idx);
+			return err;
+		}
+
+		memcpy((char *)idx + i, data, n);
+	}
+
+	if (crc32c(0, idx, idxlen) != omf_pft_idxcrc(trailer)) {
+		free(idx);
+		return merr(EBADMSG);
+	}
+
+	for (i = 0; i < r->mfr_framec; i++) {
+		e = r->mfr_framev + i;
+
+		e->mfe_off = omf_pfe_off(idx + i);
+		e->mfe_slen = omf_pfe_slen(idx + i);
+		e->mfe_ulen = omf_pfe_ulen(idx + i);
+		e->mfe_crc = omf_pfe_crc(idx + i);
+		e->mfe_flags = omf_pfe_flags(idx + i);
+
+		if (e->mfe_off != expect || e->mfe_slen == 0 || e->mfe_slen > r->mfr_framesz ||
+		    e->mfe_ulen != min_t(u64, r->mfr_framesz, r->mfr_len - (u64)i * r->mfr_framesz))
+			break;
+
+		expect += e->mfe_slen;
+	}
+
+	free(idx);
+
+	return (i < r->mfr_framec || expect != idxoff) ? merr(EBADMSG) : 0;
+}
+
+mpool_err_t
+mpool_mbframe_reader_open(
+	struct mpool                 *mp,
+	uint64_t                      mbid,
+	struct mpool_mbframe_reader **rp,
+	size_t                       *len)
+{
+	struct mpool_mbframe_reader *r;
+	struct mblock_props          props;
+	merr_t                       err;
+
+	if (!mp || !rp)
+		return merr(EINVAL);
+
+	*rp = NULL;
+
+	err = mpool_mblock_props_get(mp, mbid, &props);
+	if (err)
+		return err;
+
+	if (!props.mpr_iscommitted)
+		return merr(EINVAL);
+
+	if (props.mpr_write_len < PAGE_SIZE || !PAGE_ALIGNED(props.mpr_write_len))
+		return merr(EBADMSG);
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return merr(ENOMEM);
+
+	r->mfr_mp = mp;
+	r->mfr_mbid = mbid;
+
+	/* Sized for reading the trailer and the index, until the frame size is known. */
+	r->mfr_rbufsz = 32 * PAGE_SIZE;
+	r->mfr_rbuf = aligned_alloc(PAGE_SIZE, r->mfr_rbufsz);
+	if (!r->mfr_rbuf) {
+		free(r);
+		return merr(ENOMEM);
+	}
+
+	err = mbframe_reader_load(r, props.mpr_write_len);
+	if (err)
+		goto errout;
+
+	free(r->mfr_rbuf);
+
+	r->mfr_rbufsz = MBFRAME_RDFRAMES * r->mfr_framesz + 2 * PAGE_SIZE;
+	r->mfr_rbuf = aligned_alloc(PAGE_SIZE, r->mfr_rbufsz);
+	r->mfr_dbuf = malloc(r->mfr_framesz);
+	if (!r->mfr_rbuf || !r->mfr_dbuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	if (len)
+		*len = r->mfr_len;
+
+	*rp = r;
+
+	return 0;
+
+errout:
+	mpool_mbframe_reader_close(r);
+
+	return err;
+}
+
+mpool_err_t
+mpool_mbframe_read(struct mpool_mbframe_reader *r, void *buf, size_t len, off_t offset)
+{
+	struct mbframe_ent *e;
+	char               *dst = buf, *data, *src;
+	size_t              lo, hi, start;
+	merr_t              err;
+	u32                 f, fend, flast;
+
+	if (!r || (!buf && len > 0) || offset < 0 || len > r->mfr_len ||
+	    offset > r->mfr_len - len)
+		return merr(EINVAL);
+
+	if (len == 0)
+		return 0;
+
+	f = offset / r->mfr_framesz;
+	flast = (offset + len - 1) / r->mfr_framesz;
+
+	while (f <= flast) {
+		/* Read as many consecutive frames as fit in the read buffer. */
+		start = r->mfr_framev[f].mfe_off;
+		for (fend = f; fend < flast; fend++) {
+			e = r->mfr_framev + fend + 1;
+			if (e->mfe_off + e->mfe_slen - start + 2 * PAGE_SIZE > r->mfr_rbufsz)
+				break;
+		}
+
+		e = r->mfr_framev + fend;
+		err = mbframe_read_range(r, start, e->mfe_off + e->mfe_slen - start, &data);
+		if (err)
+			return err;
+
+		for (; f <= fend; f++) {
+			e = r->mfr_framev + f;
+			src = data + (e->mfe_off - start);
+
+			if (crc32c(0, src, e->mfe_slen) != e->mfe_crc)
+				return merr(EBADMSG);
+
+			lo = max_t(u64, offset, (u64)f * r->mfr_framesz) - (u64)f * r->mfr_framesz;
+			hi = min_t(u64, offset + len, (u64)f * r->mfr_framesz + e->mfe_ulen) -
+				(u64)f * r->mfr_framesz;
+
+			if (!(e->mfe_flags & MBFRAME_F_LZ)) {
+				memcpy(dst, src + lo, hi - lo);
+			} else if (lo == 0 && hi == e->mfe_ulen) {
+				err = mp_lz_decompress(src, e->mfe_slen, dst, e->mfe_ulen);
+				if (err)
+					return err;
+			} else {
+				err = mp_lz_decompress(src, e->mfe_slen, r->mfr_dbuf, e->mfe_ulen);
+				if (err)
+					return err;
+
+				memcpy(dst, r->mfr_dbuf + lo, hi - lo);
+			}
+
+			dst += hi - lo;
+		}
+	}
+
+	return 0;
+}
+
+void mpool_mbframe_reader_close(struct mpool_mbframe_reader *r)
+{
+	if (!r)
+		return;
+
+	free(r->mfr_framev);
+	free(r->mfr_rbuf);
+	free(r->mfr_dbuf);
+	free(r);
+}
@@ -0,0 +1,757 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Async mblock I/O module.
+ *
+ * Requests are dispatched to per-worker FIFOs.  Writes are routed by mblock
+ * ID so that writes to a given mblock are issued in submission order, as
+ * required by the append-only mblock write semantics.  Reads have no such
+ * constraint and are spread round-robin over all workers.
+ *
+ * Completions are delivered to a callback and/or posted to a completion
+ * queue.  A completion queue reuses the request itself as its entry, so
+ * each I/O costs exactly one allocation.
+ */
+
+#include <util/platform.h>
+#include <util/atomic.h>
+#include <util/mutex.h>
+#include <util/minmax.h>
+#include <util/page.h>
+
+#include <mpctl/impool.h>
+
+#include "mbio.h"
+#include "tier.h"
+
+/**
+ * struct mp_mbio_req - async mblock I/O request
+ * @mr_next:   next request in a worker or completion queue
+ * @mr_iov:    iovec
+ * @mr_iovc:   iovec count
+ * @mr_offset: read offset
+ * @mr_cq:     completion queue (may be NULL)
+ * @mr_cb:     completion callback (may be NULL)
+ * @mr_cqe:    completion
+ */
+struct mp_mbio_req {
+	struct mp_mbio_req     *mr_next;
+	const struct iovec     *mr_iov;
+	int                     mr_iovc;
+	off_t                   mr_offset;
+	struct mpool_mbio_cq   *mr_cq;
+	mpool_mbio_cb          *mr_cb;
+	struct mpool_mbio_cqe   mr_cqe;
+};
+
+/**
+ * struct mpool_mbio_cq - async mblock I/O completion queue
+ * @cq_lock:  protects all fields
+ * @cq_cv:    signaled on each completion
+ * @cq_head:  oldest completed request
+ * @cq_tail:  newest completed request
+ * @cq_donec: number of completed requests not yet reaped
+ * @cq_pendc: number of submitted requests not yet completed
+ */
+struct mpool_mbio_cq {
+	struct mutex            cq_lock;
+	pthread_cond_t          cq_cv;
+	struct mp_mbio_req     *cq_head;
+	struct mp_mbio_req     *cq_tail;
+	int                     cq_donec;
+	int                     cq_pendc;
+};
+
+/**
+ * struct mp_mbio_worker - async mblock I/O worker
+ * @mw_lock: protects mw_head, mw_tail and mw_stop
+ * @mw_cv:   signaled on submission and on stop
+ * @mw_head: oldest queued request
+ * @mw_tail: newest queued request
+ * @mw_stop: exit once the queue is empty
+ * @mw_tid:  worker thread
+ * @mw_mbio: engine
+ */
+struct mp_mbio_worker {
+	struct mutex            mw_lock;
+	pthread_cond_t          mw_cv;
+	struct mp_mbio_req     *mw_head;
+	struct mp_mbio_req     *mw_tail;
+	bool                    mw_stop;
+	pthread_t               mw_tid;
+	struct mp_mbio         *mw_mbio;
+} __aligned(SMP_CACHE_BYTES);
+
+/**
+ * struct mp_mbio - async mblock I/O engine
+ * @mb_mp:      mpool handle on which I/Os are issued
+ * @mb_lock:    serializes worker start
+ * @mb_started: true once all workers are running
+ * @mb_rr:      round-robin cursor for reads
+ * @mb_workc:   number of workers
+ * @mb_workv:   vector of workers
+ */
+struct mp_mbio {
+	struct mpool           *mb_mp;
+	struct mutex            mb_lock;
+	atomic_t                mb_started;
+	atomic_t                mb_rr;
+	u32                     mb_workc;
+	struct mp_mbio_worker   mb_workv[];
+};
+
+static void mp_mbio_complete(struct mp_mbio_req *req)
+{
+	struct mpool_mbio_cq *cq = req->mr_cq;
+
+	if (req->mr_cb)
+		req->mr_cb(&req->mr_cqe);
+
+	if (!cq) {
+		free(req);
+		return;
+	}
+
+	req->mr_next = NULL;
+
+	mutex_lock(&cq->cq_lock);
+	if (cq->cq_tail)
+		cq->cq_tail->mr_next = req;
+	else
+		cq->cq_head = req;
+	cq->cq_tail = req;
+	cq->cq_donec++;
+	cq->cq_pendc--;
+	pthread_cond_broadcast(&cq->cq_cv);
+	mutex_unlock(&cq->cq_lock);
+}
+
+static void *mp_mbio_worker_main(void *arg)
+{
+	struct mp_mbio_worker  *worker = arg;
+	struct mpool           *mp = worker->mw_mbio->mb_mp;
+	struct mp_mbio_req     *req;
+
+	while (true) {
+		mutex_lock(&worker->mw_lock);
+		while (!worker->mw_head && !worker->mw_stop)
+			pthread_cond_wait(&worker->mw_cv, &worker->mw_lock.pth_mutex);
+
+		req = worker->mw_head;
+		if (req) {
+			worker->mw_head = req->mr_next;
+			if (!worker->mw_head)
+				worker->mw_tail = NULL;
+		}
+		mutex_unlock(&worker->mw_lock);
+
+		if (!req)
+			break;
+
+		switch (req->mr_cqe.mce_op) {
+		case MPOOL_MBIO_WRITE:
+			req->mr_cqe.mce_err = mpool_mblock_write(mp, req->mr_cqe.mce_mbid,
+								 req->mr_iov, req->mr_iovc);
+			break;
+
+		case MP_MBIO_COMMIT:
+			req->mr_cqe.mce_err = mpool_mblock_commit(mp, req->mr_cqe.mce_mbid);
+			break;
+
+		case MP_MBIO_ABORT:
+			req->mr_cqe.mce_err = mpool_mblock_abort(mp, req->mr_cqe.mce_mbid);
+			break;
+
+		case MP_MBIO_DELETE:
+			req->mr_cqe.mce_err = mpool_mblock_delete(mp, req->mr_cqe.mce_mbid);
+			break;
+
+		default:
+			req->mr_cqe.mce_err = mp_mblock_read(mp, req->mr_cqe.mce_mbid,
+							     req->mr_iov, req->mr_iovc,
+							     req->mr_offset);
+			break;
+		}
+
+		mp_mbio_complete(req);
+	}
+
+	return NULL;
+}
+
+static void mp_mbio_stop(struct mp_mbio *mbio, u32 workc)
+{
+	u32 i;
+
+	for (i = 0; i < workc; i++) {
+		struct mp_mbio_worker *worker = mbio->mb_workv + i;
+
+		mutex_lock(&worker->mw_lock);
+		worker->mw_stop = true;
+		pthread_cond_signal(&worker->mw_cv);
+		mutex_unlock(&worker->mw_lock);
+
+		pthread_join(worker->mw_tid, NULL);
+		worker->mw_stop = false;
+	}
+}
+
+static merr_t mp_mbio_start(struct mp_mbio *mbio)
+{
+	merr_t  err = 0;
+	u32     i;
+	int     rc;
+
+	mutex_lock(&mbio->mb_lock);
+	if (atomic_read(&mbio->mb_started))
+		goto unlock;
+
+	for (i = 0; i < mbio->mb_workc; i++) {
+		rc = pthread_create(&mbio->mb_workv[i].mw_tid, NULL, mp_mbio_worker_main,
+				    mbio->mb_workv + i);
+		if (rc) {
+			err = merr(rc);
+			mp_mbio_stop(mbio, i);
+			goto unlock;
+		}
+	}
+
+	atomic_set(&mbio->mb_started, 1);
+
+unlock:
+	mutex_unlock(&mbio->mb_lock);
+
+	return err;
+}
+
+merr_t mp_mbio_create(struct mpool *mp, u32 depth, struct mp_mbio **mbiop)
+{
+	struct mp_mbio *mbio;
+	size_t          sz;
+	u32             i;
+
+	if (!mp || !mbiop)
+		return merr(EINVAL);
+
+	depth = clamp_t(u32, depth ?: MP_MBIO_DEPTH_DEFAULT, 1, MP_MBIO_DEPTH_MAX);
+
+	sz = sizeof(*mbio) + depth * sizeof(mbio->mb_workv[0]);
+
+	mbio = aligned_alloc(__alignof__(*mbio), sz);
+	if (!mbio)
+		return merr(ENOMEM);
+
+	memset(mbio, 0, sz);
+
+	mbio->mb_mp = mp;
+	mbio->mb_workc = depth;
+	mutex_init(&mbio->mb_lock);
+
+	for (i = 0; i < depth; i++) {
+		struct mp_mbio_worker *worker = mbio->mb_workv + i;
+
+		mutex_init(&worker->mw_lock);
+		pthread_cond_init(&worker->mw_cv, NULL);
+		worker->mw_mbio = mbio;
+	}
+
+	*mbiop = mbio;
+
+	return 0;
+}
+
+void mp_mbio_destroy(struct mp_mbio *mbio)
+{
+	u32 i;
+
+	if (!mbio)
+		return;
+
+	if (atomic_read(&mbio->mb_started))
+		mp_mbio_stop(mbio, mbio->mb_workc);
+
+	for (i = 0; i < mbio->mb_workc; i++) {
+		pthread_cond_destroy(&mbio->mb_workv[i].mw_cv);
+		mutex_destroy(&mbio->mb_workv[i].mw_lock);
+	}
+
+	mutex_destroy(&mbio->mb_lock);
+	free(mbio);
+}
+
+merr_t
+mp_mbio_submit(
+	struct mp_mbio         *mbio,
+	enum mpool_mbio_op      op,
+	u64                     mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg)
+{
+	struct mp_mbio_worker  *worker;
+	struct mp_mbio_req     *req;
+	merr_t                  err;
+	u32                     idx;
+
+	if (!mbio || (!cq && !cb))
+		return merr(EINVAL);
+
+	switch ((int)op) {
+	case MPOOL_MBIO_READ:
+	case MPOOL_MBIO_WRITE:
+		if (!iov || iovc < 1)
+			return merr(EINVAL);
+		break;
+
+	case MP_MBIO_COMMIT:
+	case MP_MBIO_ABORT:
+	case MP_MBIO_DELETE:
+		break;
+
+	default:
+		return merr(EINVAL);
+	}
+
+	if (unlikely(!atomic_read_acq(&mbio->mb_started))) {
+		err = mp_mbio_start(mbio);
+		if (err)
+			return err;
+	}
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return merr(ENOMEM);
+
+	req->mr_next = NULL;
+	req->mr_iov = iov;
+	req->mr_iovc = iovc;
+	req->mr_offset = offset;
+	req->mr_cq = cq;
+	req->mr_cb = cb;
+
+	memset(&req->mr_cqe, 0, sizeof(req->mr_cqe));
+	req->mr_cqe.mce_mbid = mbid;
+	req->mr_cqe.mce_arg = arg;
+	req->mr_cqe.mce_op = op;
+
+	if (op != MPOOL_MBIO_READ)
+		idx = (mbid * 0x9e3779b97f4a7c15ull) >> 32;
+	else
+		idx = atomic_inc_return(&mbio->mb_rr);
+
+	worker = mbio->mb_workv + (idx % mbio->mb_workc);
+
+	if (cq) {
+		mutex_lock(&cq->cq_lock);
+		cq->cq_pendc++;
+		mutex_unlock(&cq->cq_lock);
+	}
+
+	mutex_lock(&worker->mw_lock);
+	if (worker->mw_tail)
+		worker->mw_tail->mr_next = req;
+	else
+		worker->mw_head = req;
+	worker->mw_tail = req;
+	pthread_cond_signal(&worker->mw_cv);
+	mutex_unlock(&worker->mw_lock);
+
+	return 0;
+}
+
+mpool_err_t mpool_mbio_cq_create(struct mpool_mbio_cq **cqp)
+{
+	struct mpool_mbio_cq *cq;
+
+	if (!cqp)
+		return merr(EINVAL);
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return merr(ENOMEM);
+
+	mutex_init(&cq->cq_lock);
+	pthread_cond_init(&cq->cq_cv, NULL);
+
+	*cqp = cq;
+
+	return 0;
+}
+
+mpool_err_t mpool_mbio_cq_destroy(struct mpool_mbio_cq *cq)
+{
+	bool busy;
+
+	if (!cq)
+		return 0;
+
+	mutex_lock(&cq->cq_lock);
+	busy = cq->cq_pendc > 0 || cq->cq_donec > 0;
+	mutex_unlock(&cq->cq_lock);
+
+	if (busy)
+		return merr(EBUSY);
+
+	pthread_cond_destroy(&cq->cq_cv);
+	mutex_destroy(&cq->cq_lock);
+	free(cq);
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mbio_cq_reap(
+	struct mpool_mbio_cq   *cq,
+	struct mpool_mbio_cqe  *cqev,
+	int                     cqec,
+	int                     min,
+	int                    *reaped)
+{
+	struct mp_mbio_req *head;
+	int                 n;
+
+	if (!cq || !cqev || cqec < 1 || !reaped)
+		return merr(EINVAL);
+
+	min = min_t(int, min, cqec);
+
+	mutex_lock(&cq->cq_lock);
+	while (cq->cq_donec < min && cq->cq_pendc > 0)
+		pthread_cond_wait(&cq->cq_cv, &cq->cq_lock.pth_mutex);
+
+	head = cq->cq_head;
+
+	for (n = 0; n < cqec && cq->cq_head; n++)
+		cq->cq_head = cq->cq_head->mr_next;
+
+	if (!cq->cq_head)
+		cq->cq_tail = NULL;
+	cq->cq_donec -= n;
+	mutex_unlock(&cq->cq_lock);
+
+	*reaped = n;
+
+	/* The first n requests are now private to this caller. */
+	while (n-- > 0) {
+		struct mp_mbio_req *req = head;
+
+		head = req->mr_next;
+		*cqev++ = req->mr_cqe;
+		free(req);
+	}
+
+	return 0;
+}
+
+/**
+ * struct mp_mbio_rdgrp - coalesced run of reads from one mblock
+ * @mrg_iov:   iovecs of all reads in the run, in offset order
+ * @mrg_iovc:  iovec count
+ * @mrg_first: index of the first read of the run in the sorted vector
+ * @mrg_cnt:   number of reads in the run
+ */
+struct mp_mbio_rdgrp {
+	struct iovec   *mrg_iov;
+	int             mrg_iovc;
+	int             mrg_first;
+	int             mrg_cnt;
+};
+
+static int mp_mbio_rdreq_cmp(const void *lhs, const void *rhs)
+{
+	const struct mpool_mblock_rdreq *a = *(const struct mpool_mblock_rdreq **)lhs;
+	const struct mpool_mblock_rdreq *b = *(const struct mpool_mblock_rdreq **)rhs;
+
+	if (a->mrr_mbid != b->mrr_mbid)
+		return a->mrr_mbid < b->mrr_mbid ? -1 : 1;
+
+	if (a->mrr_offset != b->mrr_offset)
+		return a->mrr_offset < b->mrr_offset ? -1 : 1;
+
+	return 0;
+}
+
+static size_t mp_mbio_iov_len(const struct iovec *iov, int iovc)
+{
+	size_t len = 0;
+
+	while (iovc-- > 0)
+		len += iov[iovc].iov_len;
+
+	return len;
+}
+
+mpool_err_t mpool_mblock_readv_multi(struct mpool *mp, struct mpool_mblock_rdreq *reqv, int nreq)
+{
+	struct mpool_mblock_rdreq **sortv, *req;
+	struct mp_mbio_rdgrp       *grpv, *grp;
+	struct mpool_mbio_cqe       cqev[32];
+	struct mpool_mbio_cq       *cq;
+	struct iovec               *iovv;
+	merr_t                      err;
+	size_t                      sz, len, grplen;
+	off_t                       end;
+	int                         iovc, grpc, pend, n, i, j;
+
+	if (!mp || !reqv || nreq < 0)
+		return merr(EINVAL);
+
+	if (nreq == 1) {
+		req = reqv;
+		req->mrr_err = mpool_mblock_read(mp, req->mrr_mbid, req->mrr_iov, req->mrr_iovc,
+						 req->mrr_offset);
+		return req->mrr_err;
+	}
+
+	/*
+	 * Unlike mpool_mblock_read(), the reads of a gather read skip the read
+	 * cache and read-ahead and go straight to media from the mbio workers.
+	 * Filling the cache may split a read over those same workers (see
+	 * mcp_rdsplit), which a worker cannot wait for without risking that
+	 * all of them wait on sub-reads queued behind each other.  Read-ahead
+	 * tracks back-to-back reads per thread, whereas the reads of a gather
+	 * read are already merged and are issued from whichever worker is
+	 * free.  Both stay coherent since neither is changed by a read.  The
+	 * tiering engine still sees every read.
+	 */
+	for (i = iovc = 0; i < nreq; i++) {
+		if (!reqv[i].mrr_iov || reqv[i].mrr_iovc < 1)
+			return merr(EINVAL);
+		iovc += reqv[i].mrr_iovc;
+		reqv[i].mrr_err = 0;
+	}
+
+	for (i = 0; i < nreq; i++)
+		mp_tier_touch(mp->mp_tier, reqv[i].mrr_mbid, 1);
+
+	if (nreq == 0)
+		return 0;
+
+	sz = nreq * (sizeof(*sortv) + sizeof(*grpv)) + iovc * sizeof(*iovv);
+
+	sortv = malloc(sz);
+	if (!sortv)
+		return merr(ENOMEM);
+
+	grpv = (void *)(sortv + nreq);
+	iovv = (void *)(grpv + nreq);
+
+	err = mpool_mbio_cq_create(&cq);
+	if (err) {
+		free(sortv);
+		return err;
+	}
+
+	for (i = 0; i < nreq; i++)
+		sortv[i] = reqv + i;
+
+	qsort(sortv, nreq, sizeof(*sortv), mp_mbio_rdreq_cmp);
+
+	/*
+	 * Coalesce reads of adjacent ranges of an mblock, up to a limit on the
+	 * size and iovec count of the merged read so as to retain parallelism.
+	 */
+	grp = NULL;
+	grpc = 0;
+	grplen = 0;
+	end = 0;
+
+	for (i = 0; i < nreq; i++) {
+		req = sortv[i];
+		len = mp_mbio_iov_len(req->mrr_iov, req->mrr_iovc);
+
+		if (!grp || req->mrr_mbid != sortv[grp->mrg_first]->mrr_mbid ||
+		    req->mrr_offset != end || grplen + len > MP_MBIO_COALESCE_MAX ||
+		    grp->mrg_iovc + req->mrr_iovc > MP_MBIO_IOV_MAX) {
+			grp = grpv + grpc++;
+			grp->mrg_iov = iovv;
+			grp->mrg_iovc = 0;
+			grp->mrg_first = i;
+			grp->mrg_cnt = 0;
+			grplen = 0;
+		}
+
+		memcpy(iovv, req->mrr_iov, req->mrr_iovc * sizeof(*iovv));
+		iovv += req->mrr_iovc;
+
+		grp->mrg_iovc += req->mrr_iovc;
+		grp->mrg_cnt++;
+		grplen += len;
+		end = req->mrr_offset + len;
+	}
+
+	for (i = pend = 0; i < grpc; i++) {
+		grp = grpv + i;
+		req = sortv[grp->mrg_first];
+
+		err = mpool_mblock_read_async(mp, req->mrr_mbid, grp->mrg_iov, grp->mrg_iovc,
+					      req->mrr_offset, cq, NULL, grp);
+		if (err) {
+			for (j = 0; j < grp->mrg_cnt; j++)
+				sortv[grp->mrg_first + j]->mrr_err = err;
+			continue;
+		}
+
+		pend++;
+	}
+
+	while (pend > 0) {
+		mpool_mbio_cq_reap(cq, cqev, NELEM(cqev), 1, &n);
+
+		for (i = 0; i < n; i++) {
+			grp = cqev[i].mce_arg;
+
+			for (j = 0; j < grp->mrg_cnt; j++)
+				sortv[grp->mrg_first + j]->mrr_err = cqev[i].mce_err;
+		}
+
+		pend -= n;
+	}
+
+	/*
+	 * The status of a coalesced read does not tell which of its ranges
+	 * failed, so reissue the reads of each failed run one by one.
+	 */
+	for (i = 0; i < grpc; i++) {
+		grp = grpv + i;
+
+		if (grp->mrg_cnt < 2 || !sortv[grp->mrg_first]->mrr_err)
+			continue;
+
+		for (j = 0; j < grp->mrg_cnt; j++) {
+			req = sortv[grp->mrg_first + j];
+
+			err = mpool_mblock_read_async(mp, req->mrr_mbid, req->mrr_iov,
+						      req->mrr_iovc, req->mrr_offset, cq, NULL, req);
+			if (err) {
+				req->mrr_err = err;
+				continue;
+			}
+
+			pend++;
+		}
+	}
+
+	while (pend > 0) {
+		mpool_mbio_cq_reap(cq, cqev, NELEM(cqev), 1, &n);
+
+		for (i = 0; i < n; i++) {
+			req = cqev[i].mce_arg;
+			req->mrr_err = cqev[i].mce_err;
+		}
+
+		pend -= n;
+	}
+
+	mpool_mbio_cq_destroy(cq);
+	free(sortv);
+
+	for (i = 0; i < nreq; i++)
+		if (reqv[i].mrr_err)
+			return reqv[i].mrr_err;
+
+	return 0;
+}
+
+merr_t
+mp_mbio_read_split(
+	struct mp_mbio     *mbio,
+	u64                 mbid,
+	const struct iovec *iov,
+	int                 iovc,
+	off_t               offset,
+	size_t              split,
+	u32                 par)
+{
+	struct mpool_mbio_cqe   cqev[32];
+	struct mpool_mbio_cq   *cq;
+	struct iovec           *iovv, *slice;
+	merr_t                  err;
+	size_t                  resid, need, cur;
+	int                     chunkc, inflight, pos, idx, n, i;
+
+	split = roundup(split, PAGE_SIZE);
+	resid = mp_mbio_iov_len(iov, iovc);
+
+	for (i = 0; i < iovc && resid > split; i++) {
+		if (!PAGE_ALIGNED(iov[i].iov_base) || !IS_ALIGNED(iov[i].iov_len, PAGE_SIZE))
+			break;
+	}
+
+	if (resid <= split || i < iovc)
+		return mp_mblock_read(mbio->mb_mp, mbid, iov, iovc, offset);
+
+	par = clamp_t(u32, par ?: MP_MBIO_RDPAR_DEFAULT, 1, mbio->mb_workc);
+	chunkc = (resid + split - 1) / split;
+
+	/* Each sub-read cuts at most one of the caller's iovecs in two. */
+	iovv = malloc((iovc + chunkc) * sizeof(*iovv));
+	if (!iovv)
+		return merr(ENOMEM);
+
+	err = mpool_mbio_cq_create(&cq);
+	if (err) {
+		free(iovv);
+		return err;
+	}
+
+	inflight = pos = idx = 0;
+	cur = 0;
+
+	while (inflight > 0 || (resid > 0 && !err)) {
+		while (resid > 0 && inflight < par && !err) {
+			merr_t serr;
+
+			slice = iovv + pos;
+			need = min_t(size_t, split, resid);
+			resid -= need;
+
+			while (need > 0) {
+				size_t len = min_t(size_t, iov[idx].iov_len - cur, need);
+
+				iovv[pos].iov_base = (char *)iov[idx].iov_base + cur;
+				iovv[pos].iov_len = len;
+				pos++;
+
+				cur += len;
+				need -= len;
+				if (cur == iov[idx].iov_len) {
+					idx++;
+					cur = 0;
+				}
+			}
+
+			serr = mp_mbio_submit(mbio, MPOOL_MBIO_READ, mbid, slice, iovv + pos - slice,
+					      offset, cq, NULL, NULL);
+			if (serr) {
+				err = serr;
+				break;
+			}
+
+			offset += split;
+			inflight++;
+		}
+
+		if (inflight == 0)
+			break;
+
+		mpool_mbio_cq_reap(cq, cqev, NELEM(cqev), 1, &n);
+
+		for (i = 0; i < n; i++) {
+			if (cqev[i].mce_err && !err)
+				err = cqev[i].mce_err;
+		}
+
+		inflight -= n;
+	}
+
+	mpool_mbio_cq_destroy(cq);
+	free(iovv);
+
+	return err;
+}
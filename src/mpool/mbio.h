@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MBIO_H
+#define MPOOL_MBIO_H
+
+/*
+ * Async mblock I/O engine.
+ *
+ * Each mpool handle owns an engine made of up to mcp_iodepth worker threads,
+ * each with its own submission queue, which issue the blocking mblock
+ * read/write ioctls on behalf of the caller.  Workers are started on first
+ * use so that handles which never issue async I/O do not pay for them.
+ *
+ * All the writes of an mblock go to the worker its ID hashes to, hence an
+ * mblock, and the streaming writer of an mblock, never has more than one
+ * write in flight.  This is deliberate: the mblock write ioctl takes no
+ * offset and appends at the write position of the mblock, so that writes
+ * issued concurrently could land in any order.  Write concurrency comes
+ * from writing several mblocks at once, reads are spread over all workers.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_MBIO_DEPTH_DEFAULT   16
+#define MP_MBIO_DEPTH_MAX       256
+#define MP_MBIO_COALESCE_MAX    (1024 * 1024)
+#define MP_MBIO_IOV_MAX         256
+#define MP_MBIO_RDPAR_DEFAULT   8
+
+/*
+ * Internal ops, not accepted by the public async API.  They are routed by
+ * mblock ID like writes, so that they are ordered after the writes to the
+ * same mblock submitted before them.
+ */
+#define MP_MBIO_COMMIT          16
+#define MP_MBIO_ABORT           17
+#define MP_MBIO_DELETE          18
+
+struct mp_mbio;
+
+/**
+ * mp_mbio_create() - Create an async mblock I/O engine
+ * @mp:    mpool handle on which I/Os are issued
+ * @depth: number of worker threads
+ * @mbiop: engine (output)
+ */
+merr_t mp_mbio_create(struct mpool *mp, u32 depth, struct mp_mbio **mbiop);
+
+/**
+ * mp_mbio_destroy() - Destroy an async mblock I/O engine
+ * @mbio: engine (may be NULL)
+ *
+ * Waits for all queued I/Os to complete before stopping the workers.
+ */
+void mp_mbio_destroy(struct mp_mbio *mbio);
+
+/**
+ * mp_mbio_submit() - Queue an async mblock I/O
+ * @mbio:   engine
+ * @op:     enum mpool_mbio_op or MP_MBIO_COMMIT/ABORT/DELETE
+ * @mbid:   mblock object ID
+ * @iov:    iovec, ignored by internal ops
+ * @iovc:   iovec count, ignored by internal ops
+ * @offset: read offset, ignored for writes
+ * @cq:     completion queue (may be NULL)
+ * @cb:     completion callback (may be NULL)
+ * @arg:    caller argument
+ */
+merr_t
+mp_mbio_submit(
+	struct mp_mbio         *mbio,
+	enum mpool_mbio_op      op,
+	u64                     mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg);
+
+/**
+ * mp_mbio_read_split() - Read from an mblock in concurrent sub-reads
+ * @mbio:   engine
+ * @mbid:   mblock object ID
+ * @iov:    iovec for output data
+ * @iovc:   iovec count
+ * @offset: PAGE aligned offset into the mblock
+ * @split:  size of each sub-read
+ * @par:    maximum number of sub-reads in flight
+ *
+ * Falls back to a single read from the calling thread if the read is not
+ * larger than @split or if any of its iovecs is not page aligned.
+ */
+merr_t
+mp_mbio_read_split(
+	struct mp_mbio     *mbio,
+	u64                 mbid,
+	const struct iovec *iov,
+	int                 iovc,
+	off_t               offset,
+	size_t              split,
+	u32                 par);
+
+#endif /* MPOOL_MBIO_H */
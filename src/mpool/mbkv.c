@@ -0,0 +1,1149 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Indexed sorted mblock module.
+ *
+ * Layout of an indexed sorted mblock:
+ *
+ *   data block 0 | ... | data block D-1 | index block 0 | ... |
+ *   index block I-1 | bloom filter | root | zero pad | trailer
+ *
+ * Data and index blocks are blksz bytes each, a multiple of PAGE_SIZE, so
+ * that with the default block size a lookup reads one filter page, one
+ * index page and one data page.  Each block holds records packed from its
+ * start and an array of record offsets, followed by the record count, at
+ * its end.  The records of the data blocks are the key/value pairs in key
+ * order.  Each record of an index block is a fence: the last key of a data
+ * block and the number of that block.  The root, which is loaded in memory
+ * by readers, holds the last key of each index block.
+ *
+ * The bloom filter starts on a page boundary and is made of 64-byte lines,
+ * all the bits of a key being set in a single line, so that probing it
+ * touches one cache line of one page.  The trailer ends on the last byte
+ * of the mblock, which is always a page boundary, and locates the index,
+ * the filter and the root.  All fields are little-endian.
+ *
+ * Readers copy only the root; with MPOOL_MBKV_MMAP the filter, index and
+ * data blocks are then accessed in place through an mcache map.
+ */
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/omf.h>
+
+#include <stddef.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "crc32c.h"
+
+#define MBKV_MAGIC                  0x564b424du     /* "MBKV" */
+#define MBKV_VERSION                1
+#define MBKV_BLKSZ_MAX              (1024 * 1024)
+#define MBKV_BLOOM_LINE             64
+#define MBKV_BLOOM_BITS_MAX         32
+#define MBKV_BLOOM_PROBES_MAX       16
+
+/**
+ * struct mbkv_rec_omf - block record header, followed by the key and the value
+ * @mbkv_klen: key length
+ * @mbkv_vlen: value length
+ */
+struct mbkv_rec_omf {
+	__le16 mbkv_klen;
+	__le32 mbkv_vlen;
+} __packed;
+
+OMF_SETGET(struct mbkv_rec_omf, mbkv_klen, 16)
+OMF_SETGET(struct mbkv_rec_omf, mbkv_vlen, 32)
+
+/**
+ * struct mbkv_trailer_omf - indexed sorted mblock trailer
+ * @mbkv_magic:    MBKV_MAGIC
+ * @mbkv_vers:     MBKV_VERSION
+ * @mbkv_probes:   number of bits set per key in the bloom filter
+ * @mbkv_blksz:    block size
+ * @mbkv_datac:    number of data blocks
+ * @mbkv_idxc:     number of index blocks, which follow the data blocks
+ * @mbkv_rootlen:  length of the root
+ * @mbkv_nkeys:    number of keys
+ * @mbkv_bloomoff: offset of the bloom filter in the mblock
+ * @mbkv_bloomlen: length of the bloom filter, 0 if there is none
+ * @mbkv_rootoff:  offset of the root in the mblock
+ * @mbkv_rootcrc:  CRC32C of the root
+ * @mbkv_crc:      CRC32C of the trailer up to this field
+ */
+struct mbkv_trailer_omf {
+	__le32 mbkv_magic;
+	__le16 mbkv_vers;
+	__le16 mbkv_probes;
+	__le32 mbkv_blksz;
+	__le32 mbkv_datac;
+	__le32 mbkv_idxc;
+	__le32 mbkv_rootlen;
+	__le64 mbkv_nkeys;
+	__le64 mbkv_bloomoff;
+	__le64 mbkv_bloomlen;
+	__le64 mbkv_rootoff;
+	__le32 mbkv_rootcrc;
+	__le32 mbkv_crc;
+} __packed;
+
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_magic, 32)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_vers, 16)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_probes, 16)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_blksz, 32)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_datac, 32)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_idxc, 32)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_rootlen, 32)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_nkeys, 64)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_bloomoff, 64)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_bloomlen, 64)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_rootoff, 64)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_rootcrc, 32)
+OMF_SETGET(struct mbkv_trailer_omf, mbkv_crc, 32)
+
+/* Space taken in a block by the record count and by each record offset. */
+#define MBKV_BLK_TAIL       sizeof(__le32)
+#define MBKV_REC_OVH        (sizeof(struct mbkv_rec_omf) + sizeof(__le32))
+
+/**
+ * struct mbkv_blk - block builder
+ * @mkb_buf:  block being built
+ * @mkb_offv: record offsets
+ * @mkb_fill: number of bytes of records in mkb_buf
+ * @mkb_recc: number of records
+ */
+struct mbkv_blk {
+	char   *mkb_buf;
+	u32    *mkb_offv;
+	u32     mkb_fill;
+	u32     mkb_recc;
+};
+
+/**
+ * struct mbkv_keybuf - growable buffer of length-prefixed keys
+ */
+struct mbkv_keybuf {
+	char   *mkk_buf;
+	size_t  mkk_len;
+	size_t  mkk_max;
+};
+
+/**
+ * struct mpool_mbkv_writer - indexed sorted mblock writer
+ * @mkw_w:       underlying streaming mblock writer
+ * @mkw_wroff:   number of bytes appended to mkw_w
+ * @mkw_err:     first error encountered, sticky
+ * @mkw_blksz:   block size
+ * @mkw_bits:    bloom filter bits per key, 0 for no filter
+ * @mkw_datac:   number of data blocks written
+ * @mkw_nkeys:   number of keys added
+ * @mkw_blk:     current data block
+ * @mkw_fences:  last key of each data block written
+ * @mkw_lastlen: length of the last key added
+ * @mkw_last:    last key added
+ * @mkw_hashc:   number of entries allocated in mkw_hashv
+ * @mkw_hashv:   hash of each key added
+ */
+struct mpool_mbkv_writer {
+	struct mpool_mblock_writer *mkw_w;
+	u64                         mkw_wroff;
+	merr_t                      mkw_err;
+	u32                         mkw_blksz;
+	u32                         mkw_bits;
+	u32                         mkw_datac;
+	u64                         mkw_nkeys;
+	struct mbkv_blk             mkw_blk;
+	struct mbkv_keybuf          mkw_fences;
+	u32                         mkw_lastlen;
+	char                        mkw_last[MPOOL_MBKV_KLEN_MAX];
+	u64                         mkw_hashc;
+	u64                        *mkw_hashv;
+};
+
+/**
+ * struct mpool_mbkv_reader - indexed sorted mblock reader
+ * @mkr_mp:       mpool handle
+ * @mkr_mbid:     mblock object ID
+ * @mkr_map:      mcache map of the mblock, if mapped
+ * @mkr_base:     base address of the mblock in mkr_map
+ * @mkr_blksz:    block size
+ * @mkr_datac:    number of data blocks
+ * @mkr_idxc:     number of index blocks
+ * @mkr_probes:   number of bits set per key in the bloom filter
+ * @mkr_nkeys:    number of keys
+ * @mkr_bloomoff: offset of the bloom filter
+ * @mkr_bloomc:   number of bloom filter lines, 0 if there is no filter
+ * @mkr_root:     root
+ * @mkr_rootv:    offset of each key in mkr_root
+ * @mkr_rbuf:     page-aligned buffer for reading blocks, if not mapped
+ */
+struct mpool_mbkv_reader {
+	struct mpool               *mkr_mp;
+	u64                         mkr_mbid;
+	struct mpool_mcache_map    *mkr_map;
+	const char                 *mkr_base;
+	u32                         mkr_blksz;
+	u32                         mkr_datac;
+	u32                         mkr_idxc;
+	u32                         mkr_probes;
+	u64                         mkr_nkeys;
+	u64                         mkr_bloomoff;
+	u64                         mkr_bloomc;
+	char                       *mkr_root;
+	u32                        *mkr_rootv;
+	char                       *mkr_rbuf;
+};
+
+static inline u64 mbkv_rotl(u64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 mbkv_mix(u64 h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/**
+ * mbkv_hash() - Hash a key for the bloom filter
+ *
+ * Words are read little-endian so that the filter does not depend on the
+ * byte order of the host that wrote it.
+ */
+static u64 mbkv_hash(const void *key, size_t klen)
+{
+	const u8   *p = key;
+	u64         h = 0x9e3779b97f4a7c15ull ^ (klen * 0x87c37b91114253d5ull);
+	u64         w;
+
+	for (; klen >= 8; klen -= 8, p += 8) {
+		memcpy(&w, p, sizeof(w));
+		h = mbkv_rotl(h ^ mbkv_mix(le64_to_cpu(w)), 27) * 0x4cf5ad432745937full;
+	}
+
+	w = 0;
+	while (klen-- > 0)
+		w = (w << 8) | p[klen];
+
+	return mbkv_mix(h ^ w);
+}
+
+/**
+ * mbkv_bloom_line() - Get the filter line of a key
+ * @hash:   key hash
+ * @linec:  number of lines in the filter
+ */
+static inline u64 mbkv_bloom_line(u64 hash, u64 linec)
+{
+	/* The high half of the hash picks the line, the low half the bits. */
+	return ((hash >> 32) * linec) >> 32;
+}
+
+/**
+ * mbkv_bloom_bits() - Set or test the bits of a key in its filter line
+ * @line:   filter line
+ * @hash:   key hash
+ * @probes: number of bits per key
+ * @set:    set the bits rather than test them
+ *
+ * Return: true if all the bits of the key are set
+ */
+static bool mbkv_bloom_bits(u8 *line, u64 hash, u32 probes, bool set)
+{
+	u32 h = (u32)hash;
+	u32 delta = (h >> 17) | (h << 15);
+	u32 i, bit;
+
+	for (i = 0; i < probes; i++, h += delta) {
+		bit = h % (MBKV_BLOOM_LINE * 8);
+
+		if (set)
+			line[bit / 8] |= 1u << (bit % 8);
+		else if (!(line[bit / 8] & (1u << (bit % 8))))
+			return false;
+	}
+
+	return true;
+}
+
+static inline u32 mbkv_bloom_probes(u32 bits)
+{
+	/* ln(2) * bits per key minimizes the false positive rate. */
+	return clamp_t(u32, bits * 69 / 100, 1, MBKV_BLOOM_PROBES_MAX);
+}
+
+static int mbkv_keycmp(const void *k1, size_t l1, const void *k2, size_t l2)
+{
+	int rc = memcmp(k1, k2, min_t(size_t, l1, l2));
+
+	if (rc)
+		return rc;
+
+	return (l1 > l2) - (l1 < l2);
+}
+
+/*
+ * Block builder
+ */
+
+static inline bool mbkv_blk_fits(const struct mbkv_blk *b, u32 blksz, size_t reclen)
+{
+	return b->mkb_fill + reclen + MBKV_REC_OVH * (b->mkb_recc + 1) + MBKV_BLK_TAIL <= blksz;
+}
+
+static void
+mbkv_blk_add(struct mbkv_blk *b, const void *key, u32 klen, const void *val, u32 vlen)
+{
+	struct mbkv_rec_omf *rec = (void *)(b->mkb_buf + b->mkb_fill);
+
+	omf_set_mbkv_klen(rec, klen);
+	omf_set_mbkv_vlen(rec, vlen);
+	memcpy(rec + 1, key, klen);
+	memcpy((char *)(rec + 1) + klen, val, vlen);
+
+	b->mkb_offv[b->mkb_recc++] = b->mkb_fill;
+	b->mkb_fill += sizeof(*rec) + klen + vlen;
+}
+
+/**
+ * mbkv_blk_finish() - Write the offsets and the record count of a block
+ */
+static void mbkv_blk_finish(struct mbkv_blk *b, u32 blksz)
+{
+	__le32 *tail = (__le32 *)(b->mkb_buf + blksz - MBKV_BLK_TAIL);
+	u32     i;
+
+	memset(b->mkb_buf + b->mkb_fill, 0, blksz - b->mkb_fill);
+
+	*tail = cpu_to_le32(b->mkb_recc);
+	tail -= b->mkb_recc;
+
+	for (i = 0; i < b->mkb_recc; i++)
+		tail[i] = cpu_to_le32(b->mkb_offv[i]);
+}
+
+static inline void mbkv_blk_reset(struct mbkv_blk *b)
+{
+	b->mkb_fill = 0;
+	b->mkb_recc = 0;
+}
+
+/**
+ * mbkv_blk_rec() - Decode a record of a block
+ * @blk:   block
+ * @blksz: block size
+ * @idx:   record index, which must be less than the record count
+ *
+ * Return: EBADMSG if the record does not lie within the block
+ */
+static merr_t
+mbkv_blk_rec(
+	const char     *blk,
+	u32             blksz,
+	u32             idx,
+	const char    **keyp,
+	u32            *klenp,
+	const char    **valp,
+	u32            *vlenp)
+{
+	const struct mbkv_rec_omf  *rec;
+	const __le32               *tail = (const void *)(blk + blksz - MBKV_BLK_TAIL);
+	u32                         recc = le32_to_cpu(*tail);
+	u32                         off, end;
+
+	end = blksz - MBKV_BLK_TAIL - recc * sizeof(*tail);
+	off = le32_to_cpu(tail[(int)idx - (int)recc]);
+
+	if (off > end || end - off < sizeof(*rec))
+		return merr(EBADMSG);
+
+	rec = (const void *)(blk + off);
+	*klenp = omf_mbkv_klen(rec);
+	*vlenp = omf_mbkv_vlen(rec);
+
+	if (*klenp > end - off - sizeof(*rec) || *vlenp > end - off - sizeof(*rec) - *klenp)
+		return merr(EBADMSG);
+
+	*keyp = (const char *)(rec + 1);
+	*valp = *keyp + *klenp;
+
+	return 0;
+}
+
+/**
+ * mbkv_blk_search() - Search a block for a key
+ * @blk:   block
+ * @blksz: block size
+ * @key:   key
+ * @klen:  key length
+ * @exact: find the key rather than the first key not less than it
+ * @valp:  value of the record found (output)
+ * @vlenp: value length of the record found (output)
+ *
+ * Return: ENOENT if there is no such record, EBADMSG if the block is corrupt
+ */
+static merr_t
+mbkv_blk_search(
+	const char     *blk,
+	u32             blksz,
+	const void     *key,
+	u32             klen,
+	bool            exact,
+	const char    **valp,
+	u32            *vlenp)
+{
+	const __le32   *tail = (const void *)(blk + blksz - MBKV_BLK_TAIL);
+	const char     *rkey, *rval;
+	u32             recc, rklen, rvlen;
+	u32             lo, hi, mid;
+	merr_t          err;
+	int             rc;
+
+	recc = le32_to_cpu(*tail);
+	if (recc == 0 || recc > (blksz - MBKV_BLK_TAIL) / MBKV_REC_OVH)
+		return merr(EBADMSG);
+
+	/* Find the first record whose key is not less than the given key. */
+	lo = 0;
+	hi = recc;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		err = mbkv_blk_rec(blk, blksz, mid, &rkey, &rklen, &rval, &rvlen);
+		if (err)
+			return err;
+
+		rc = mbkv_keycmp(rkey, rklen, key, klen);
+		if (rc < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == recc)
+		return merr(ENOENT);
+
+	err = mbkv_blk_rec(blk, blksz, lo, &rkey, &rklen, &rval, &rvlen);
+	if (err)
+		return err;
+
+	if (exact && mbkv_keycmp(rkey, rklen, key, klen))
+		return merr(ENOENT);
+
+	*valp = rval;
+	*vlenp = rvlen;
+
+	return 0;
+}
+
+static merr_t mbkv_keybuf_add(struct mbkv_keybuf *kb, const void *key, u32 klen)
+{
+	__le16 len = cpu_to_le16(klen);
+
+	if (kb->mkk_len + sizeof(len) + klen > kb->mkk_max) {
+		size_t  max = max_t(size_t, kb->mkk_max * 2, kb->mkk_len + sizeof(len) + klen);
+		char   *buf;
+
+		max = max_t(size_t, max, PAGE_SIZE);
+
+		buf = realloc(kb->mkk_buf, max);
+		if (!buf)
+			return merr(ENOMEM);
+
+		kb->mkk_buf = buf;
+		kb->mkk_max = max;
+	}
+
+	memcpy(kb->mkk_buf + kb->mkk_len, &len, sizeof(len));
+	memcpy(kb->mkk_buf + kb->mkk_len + sizeof(len), key, klen);
+	kb->mkk_len += sizeof(len) + klen;
+
+	return 0;
+}
+
+/*
+ * Writer
+ */
+
+static merr_t mbkv_writer_put(struct mpool_mbkv_writer *w, const void *data, size_t len)
+{
+	merr_t err;
+
+	err = mpool_mblock_writer_append(w->mkw_w, data, len);
+	if (err) {
+		w->mkw_err = err;
+		return err;
+	}
+
+	w->mkw_wroff += len;
+
+	return 0;
+}
+
+/**
+ * mbkv_writer_flush() - Write the current data block and remember its fence
+ */
+static merr_t mbkv_writer_flush(struct mpool_mbkv_writer *w)
+{
+	merr_t err;
+
+	if (w->mkw_datac == U32_MAX) {
+		w->mkw_err = merr(ENOSPC);
+		return w->mkw_err;
+	}
+
+	err = mbkv_keybuf_add(&w->mkw_fences, w->mkw_last, w->mkw_lastlen);
+	if (err) {
+		w->mkw_err = err;
+		return err;
+	}
+
+	mbkv_blk_finish(&w->mkw_blk, w->mkw_blksz);
+
+	err = mbkv_writer_put(w, w->mkw_blk.mkb_buf, w->mkw_blksz);
+	if (err)
+		return err;
+
+	mbkv_blk_reset(&w->mkw_blk);
+	w->mkw_datac++;
+
+	return 0;
+}
+
+static void mbkv_writer_free(struct mpool_mbkv_writer *w)
+{
+	free(w->mkw_blk.mkb_buf);
+	free(w->mkw_blk.mkb_offv);
+	free(w->mkw_fences.mkk_buf);
+	free(w->mkw_hashv);
+	free(w);
+}
+
+mpool_err_t
+mpool_mbkv_writer_open(
+	struct mpool               *mp,
+	uint64_t                    mbid,
+	uint32_t                    blksz,
+	uint32_t                    bits,
+	struct mpool_mbkv_writer  **wp)
+{
+	struct mpool_mbkv_writer   *w;
+	merr_t                      err;
+
+	if (!mp || !wp || blksz > MBKV_BLKSZ_MAX || bits > MBKV_BLOOM_BITS_MAX)
+		return merr(EINVAL);
+
+	*wp = NULL;
+
+	blksz = roundup(blksz ?: PAGE_SIZE, PAGE_SIZE);
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return merr(ENOMEM);
+
+	w->mkw_blksz = blksz;
+	w->mkw_bits = bits;
+
+	w->mkw_blk.mkb_buf = malloc(blksz);
+	w->mkw_blk.mkb_offv = malloc(blksz / MBKV_REC_OVH * sizeof(u32));
+	if (!w->mkw_blk.mkb_buf || !w->mkw_blk.mkb_offv) {
+		mbkv_writer_free(w);
+		return merr(ENOMEM);
+	}
+
+	err = mpool_mblock_writer_open(mp, mbid, 0, &w->mkw_w);
+	if (err) {
+		mbkv_writer_free(w);
+		return err;
+	}
+
+	*wp = w;
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mbkv_writer_add(
+	struct mpool_mbkv_writer   *w,
+	const void                 *key,
+	size_t                      klen,
+	const void                 *val,
+	size_t                      vlen)
+{
+	merr_t err;
+
+	if (!w || !key || klen == 0 || klen > MPOOL_MBKV_KLEN_MAX || (!val && vlen > 0))
+		return merr(EINVAL);
+
+	if (w->mkw_err)
+		return w->mkw_err;
+
+	if (vlen > w->mkw_blksz || klen + vlen + MBKV_REC_OVH + MBKV_BLK_TAIL > w->mkw_blksz)
+		return merr(EMSGSIZE);
+
+	if (w->mkw_nkeys > 0 && mbkv_keycmp(w->mkw_last, w->mkw_lastlen, key, klen) >= 0)
+		return merr(EINVAL);
+
+	if (w->mkw_bits > 0 && w->mkw_nkeys == w->mkw_hashc) {
+		u64    max = max_t(u64, w->mkw_hashc * 2, 1024);
+		u64   *hashv;
+
+		hashv = realloc(w->mkw_hashv, max * sizeof(*hashv));
+		if (!hashv) {
+			w->mkw_err = merr(ENOMEM);
+			return w->mkw_err;
+		}
+
+		w->mkw_hashv = hashv;
+		w->mkw_hashc = max;
+	}
+
+	/* The fence of a data block is its last key, which is known only now. */
+	if (!mbkv_blk_fits(&w->mkw_blk, w->mkw_blksz, klen + vlen)) {
+		err = mbkv_writer_flush(w);
+		if (err)
+			return err;
+	}
+
+	mbkv_blk_add(&w->mkw_blk, key, klen, val, vlen);
+
+	if (w->mkw_bits > 0)
+		w->mkw_hashv[w->mkw_nkeys] = mbkv_hash(key, klen);
+
+	memcpy(w->mkw_last, key, klen);
+	w->mkw_lastlen = klen;
+	w->mkw_nkeys++;
+
+	return 0;
+}
+
+/**
+ * mbkv_writer_index() - Write the index blocks and build the root
+ * @w:    writer
+ * @root: last key of each index block (output)
+ * @idxc: number of index blocks (output)
+ */
+static merr_t
+mbkv_writer_index(struct mpool_mbkv_writer *w, struct mbkv_keybuf *root, u32 *idxc)
+{
+	struct mbkv_blk    *b = &w->mkw_blk;
+	const char         *key = NULL;
+	size_t              off = 0;
+	merr_t              err;
+	__le32              blkno;
+	u32                 klen = 0, i;
+	__le16              len;
+
+	*idxc = 0;
+
+	for (i = 0; i < w->mkw_datac; i++) {
+		memcpy(&len, w->mkw_fences.mkk_buf + off, sizeof(len));
+
+		if (!mbkv_blk_fits(b, w->mkw_blksz, le16_to_cpu(len) + sizeof(blkno))) {
+			mbkv_blk_finish(b, w->mkw_blksz);
+
+			err = mbkv_writer_put(w, b->mkb_buf, w->mkw_blksz);
+			if (!err)
+				err = mbkv_keybuf_add(root, key, klen);
+			if (err)
+				return err;
+
+			mbkv_blk_reset(b);
+			++*idxc;
+		}
+
+		key = w->mkw_fences.mkk_buf + off + sizeof(len);
+		klen = le16_to_cpu(len);
+		blkno = cpu_to_le32(i);
+
+		mbkv_blk_add(b, key, klen, &blkno, sizeof(blkno));
+		off += sizeof(len) + klen;
+	}
+
+	if (b->mkb_recc > 0) {
+		mbkv_blk_finish(b, w->mkw_blksz);
+
+		err = mbkv_writer_put(w, b->mkb_buf, w->mkw_blksz);
+		if (!err)
+			err = mbkv_keybuf_add(root, key, klen);
+		if (err)
+			return err;
+
+		mbkv_blk_reset(b);
+		++*idxc;
+	}
+
+	return 0;
+}
+
+/**
+ * mbkv_writer_bloom() - Write the bloom filter
+ * @w:      writer
+ * @probes: number of bits set per key
+ * @lenp:   length of the filter (output)
+ */
+static merr_t mbkv_writer_bloom(struct mpool_mbkv_writer *w, u32 probes, u64 *lenp)
+{
+	u64     linec, i;
+	u8     *bloom;
+	merr_t  err;
+
+	*lenp = 0;
+
+	if (w->mkw_bits == 0 || w->mkw_nkeys == 0)
+		return 0;
+
+	linec = (w->mkw_nkeys * w->mkw_bits + MBKV_BLOOM_LINE * 8 - 1) / (MBKV_BLOOM_LINE * 8);
+
+	bloom = calloc(linec, MBKV_BLOOM_LINE);
+	if (!bloom)
+		return merr(ENOMEM);
+
+	for (i = 0; i < w->mkw_nkeys; i++) {
+		u64 hash = w->mkw_hashv[i];
+
+		mbkv_bloom_bits(bloom + mbkv_bloom_line(hash, linec) * MBKV_BLOOM_LINE,
+				hash, probes, true);
+	}
+
+	err = mbkv_writer_put(w, bloom, linec * MBKV_BLOOM_LINE);
+
+	free(bloom);
+
+	*lenp = linec * MBKV_BLOOM_LINE;
+
+	return err;
+}
+
+/**
+ * mbkv_writer_finish() - Write the last data block, the index, the filter and the trailer
+ */
+static merr_t mbkv_writer_finish(struct mpool_mbkv_writer *w)
+{
+	struct mbkv_trailer_omf    *trailer;
+	struct mbkv_keybuf          root = { };
+	size_t                      padlen, buflen;
+	u64                         bloomoff, bloomlen, rootoff;
+	u32                         probes, idxc;
+	char                       *buf;
+	merr_t                      err;
+
+	if (w->mkw_blk.mkb_recc > 0) {
+		err = mbkv_writer_flush(w);
+		if (err)
+			return err;
+	}
+
+	err = mbkv_writer_index(w, &root, &idxc);
+	if (err)
+		goto out;
+
+	probes = mbkv_bloom_probes(w->mkw_bits);
+	bloomoff = w->mkw_wroff;
+
+	err = mbkv_writer_bloom(w, probes, &bloomlen);
+	if (err)
+		goto out;
+
+	rootoff = w->mkw_wroff;
+	buflen = root.mkk_len + sizeof(*trailer);
+	padlen = roundup(w->mkw_wroff + buflen, PAGE_SIZE) - (w->mkw_wroff + buflen);
+	buflen += padlen;
+
+	buf = calloc(1, buflen);
+	if (!buf) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	if (root.mkk_len > 0)
+		memcpy(buf, root.mkk_buf, root.mkk_len);
+
+	trailer = (struct mbkv_trailer_omf *)(buf + buflen - sizeof(*trailer));
+	omf_set_mbkv_magic(trailer, MBKV_MAGIC);
+	omf_set_mbkv_vers(trailer, MBKV_VERSION);
+	omf_set_mbkv_probes(trailer, bloomlen ? probes : 0);
+	omf_set_mbkv_blksz(trailer, w->mkw_blksz);
+	omf_set_mbkv_datac(trailer, w->mkw_datac);
+	omf_set_mbkv_idxc(trailer, idxc);
+	omf_set_mbkv_rootlen(trailer, root.mkk_len);
+	omf_set_mbkv_nkeys(trailer, w->mkw_nkeys);
+	omf_set_mbkv_bloomoff(trailer, bloomoff);
+	omf_set_mbkv_bloomlen(trailer, bloomlen);
+	omf_set_mbkv_rootoff(trailer, rootoff);
+	omf_set_mbkv_rootcrc(trailer, crc32c(0, buf, root.mkk_len));
+	omf_set_mbkv_crc(trailer, crc32c(0, trailer, offsetof(struct mbkv_trailer_omf, mbkv_crc)));
+
+	err = mbkv_writer_put(w, buf, buflen);
+
+	free(buf);
+
+out:
+	free(root.mkk_buf);
+
+	return err;
+}
+
+mpool_err_t
+mpool_mbkv_writer_close(struct mpool_mbkv_writer *w, uint64_t *nkeys, size_t *wrlen)
+{
+	merr_t err;
+
+	if (!w)
+		return merr(EINVAL);
+
+	err = w->mkw_err ?: mbkv_writer_finish(w);
+	if (!err)
+		err = mpool_mblock_writer_close(w->mkw_w, wrlen);
+	else
+		mpool_mblock_writer_abort(w->mkw_w);
+
+	if (nkeys)
+		*nkeys = w->mkw_nkeys;
+
+	mbkv_writer_free(w);
+
+	return err;
+}
+
+mpool_err_t mpool_mbkv_writer_abort(struct mpool_mbkv_writer *w)
+{
+	merr_t err;
+
+	if (!w)
+		return merr(EINVAL);
+
+	err = mpool_mblock_writer_abort(w->mkw_w);
+
+	mbkv_writer_free(w);
+
+	return err;
+}
+
+/*
+ * Reader
+ */
+
+/**
+ * mbkv_read_range() - Access a page-aligned byte range of the mblock
+ * @r:     reader
+ * @off:   page-aligned offset of the range
+ * @len:   length of the range, at most the block size
+ * @datap: start of the range (output)
+ *
+ * A mapped range is accessed in place, otherwise it is read into
+ * r->mkr_rbuf.
+ */
+static merr_t mbkv_read_range(struct mpool_mbkv_reader *r, u64 off, size_t len, const char **datap)
+{
+	struct iovec    iov;
+	merr_t          err;
+
+	if (r->mkr_base) {
+		*datap = r->mkr_base + off;
+		return 0;
+	}
+
+	iov.iov_base = r->mkr_rbuf;
+	iov.iov_len = roundup(len, PAGE_SIZE);
+
+	err = mpool_mblock_read(r->mkr_mp, r->mkr_mbid, &iov, 1, off);
+	if (err)
+		return err;
+
+	*datap = r->mkr_rbuf;
+
+	return 0;
+}
+
+/**
+ * mbkv_reader_load() - Read and verify the trailer and load the root
+ * @r:     reader
+ * @wrlen: mblock write length
+ */
+static merr_t mbkv_reader_load(struct mpool_mbkv_reader *r, size_t wrlen)
+{
+	struct mbkv_trailer_omf     trailer_omf, *trailer = &trailer_omf;
+	struct iovec                iov;
+	const char                 *data;
+	u64                         rootoff, aoff, bloomlen, blkend;
+	u32                         rootlen, off, i;
+	merr_t                      err;
+	char                       *buf;
+	__le16                      len;
+
+	err = mbkv_read_range(r, wrlen - PAGE_SIZE, PAGE_SIZE, &data);
+	if (err)
+		return err;
+
+	memcpy(trailer, data + PAGE_SIZE - sizeof(*trailer), sizeof(*trailer));
+
+	if (omf_mbkv_magic(trailer) != MBKV_MAGIC || omf_mbkv_vers(trailer) != MBKV_VERSION ||
+	    omf_mbkv_crc(trailer) != crc32c(0, trailer, offsetof(struct mbkv_trailer_omf, mbkv_crc)))
+		return merr(EBADMSG);
+
+	r->mkr_blksz = omf_mbkv_blksz(trailer);
+	r->mkr_datac = omf_mbkv_datac(trailer);
+	r->mkr_idxc = omf_mbkv_idxc(trailer);
+	r->mkr_probes = omf_mbkv_probes(trailer);
+	r->mkr_nkeys = omf_mbkv_nkeys(trailer);
+	r->mkr_bloomoff = omf_mbkv_bloomoff(trailer);
+	bloomlen = omf_mbkv_bloomlen(trailer);
+	rootoff = omf_mbkv_rootoff(trailer);
+	rootlen = omf_mbkv_rootlen(trailer);
+	blkend = ((u64)r->mkr_datac + r->mkr_idxc) * r->mkr_blksz;
+
+	if (r->mkr_blksz == 0 || r->mkr_blksz > MBKV_BLKSZ_MAX || !PAGE_ALIGNED(r->mkr_blksz) ||
+	    r->mkr_idxc > r->mkr_datac || (r->mkr_datac > 0) != (r->mkr_idxc > 0) ||
+	    r->mkr_bloomoff != blkend || bloomlen % MBKV_BLOOM_LINE ||
+	    (bloomlen > 0) != (r->mkr_probes > 0) || r->mkr_probes > MBKV_BLOOM_PROBES_MAX ||
+	    rootoff != r->mkr_bloomoff + bloomlen || rootoff + rootlen + sizeof(*trailer) > wrlen)
+		return merr(EBADMSG);
+
+	r->mkr_bloomc = bloomlen / MBKV_BLOOM_LINE;
+
+	r->mkr_root = malloc(max_t(size_t, rootlen, 1));
+	r->mkr_rootv = malloc(max_t(size_t, r->mkr_idxc, 1) * sizeof(*r->mkr_rootv));
+	if (!r->mkr_root || !r->mkr_rootv)
+		return merr(ENOMEM);
+
+	if (rootlen > 0) {
+		aoff = rootoff & ~(u64)(PAGE_SIZE - 1);
+
+		if (r->mkr_base) {
+			memcpy(r->mkr_root, r->mkr_base + rootoff, rootlen);
+		} else {
+			iov.iov_len = roundup(rootoff + rootlen, PAGE_SIZE) - aoff;
+			iov.iov_base = buf = aligned_alloc(PAGE_SIZE, iov.iov_len);
+			if (!buf)
+				return merr(ENOMEM);
+
+			err = mpool_mblock_read(r->mkr_mp, r->mkr_mbid, &iov, 1, aoff);
+			if (!err)
+				memcpy(r->mkr_root, buf + (rootoff - aoff), rootlen);
+
+			free(buf);
+
+			if (err)
+				return err;
+		}
+	}
+
+	if (crc32c(0, r->mkr_root, rootlen) != omf_mbkv_rootcrc(trailer))
+		return merr(EBADMSG);
+
+	for (i = 0, off = 0; i < r->mkr_idxc; i++) {
+		if (rootlen - off < sizeof(len))
+			return merr(EBADMSG);
+
+		memcpy(&len, r->mkr_root + off, sizeof(len));
+		r->mkr_rootv[i] = off;
+		off += sizeof(len) + le16_to_cpu(len);
+
+		if (le16_to_cpu(len) > MPOOL_MBKV_KLEN_MAX || off > rootlen)
+			return merr(EBADMSG);
+	}
+
+	return off == rootlen ? 0 : merr(EBADMSG);
+}
+
+mpool_err_t
+mpool_mbkv_reader_open(
+	struct mpool               *mp,
+	uint64_t                    mbid,
+	uint32_t                    flags,
+	struct mpool_mbkv_reader  **rp,
+	uint64_t                   *nkeys)
+{
+	struct mpool_mbkv_reader   *r;
+	struct mblock_props         props;
+	merr_t                      err;
+
+	if (!mp || !rp || (flags & ~MPOOL_MBKV_MMAP))
+		return merr(EINVAL);
+
+	*rp = NULL;
+
+	err = mpool_mblock_props_get(mp, mbid, &props);
+	if (err)
+		return err;
+
+	if (!props.mpr_iscommitted)
+		return merr(EINVAL);
+
+	if (props.mpr_write_len < PAGE_SIZE || !PAGE_ALIGNED(props.mpr_write_len))
+		return merr(EBADMSG);
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return merr(ENOMEM);
+
+	r->mkr_mp = mp;
+	r->mkr_mbid = mbid;
+
+	if (flags & MPOOL_MBKV_MMAP) {
+		err = mpool_mcache_mmap(mp, 1, &r->mkr_mbid, MPC_VMA_WARM, &r->mkr_map);
+		if (err)
+			goto errout;
+
+		r->mkr_base = mpool_mcache_getbase(r->mkr_map, 0);
+		if (!r->mkr_base) {
+			mpool_mcache_munmap(r->mkr_map);
+			r->mkr_map = NULL;
+		}
+	}
+
+	/* Read blocks through a buffer if the map is not contiguous. */
+	if (!r->mkr_base) {
+		r->mkr_rbuf = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+		if (!r->mkr_rbuf) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
+	}
+
+	err = mbkv_reader_load(r, props.mpr_write_len);
+	if (err)
+		goto errout;
+
+	if (!r->mkr_base && r->mkr_blksz > PAGE_SIZE) {
+		free(r->mkr_rbuf);
+
+		r->mkr_rbuf = aligned_alloc(PAGE_SIZE, r->mkr_blksz);
+		if (!r->mkr_rbuf) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
+	}
+
+	if (nkeys)
+		*nkeys = r->mkr_nkeys;
+
+	*rp = r;
+
+	return 0;
+
+errout:
+	mpool_mbkv_reader_close(r);
+
+	return err;
+}
+
+/**
+ * mbkv_root_search() - Find the first index block whose last key is not less than a key
+ *
+ * Return: the index block number, or r->mkr_idxc if there is none
+ */
+static u32 mbkv_root_search(struct mpool_mbkv_reader *r, const void *key, size_t klen)
+{
+	u32     lo = 0, hi = r->mkr_idxc, mid;
+	__le16  len;
+
+	while (lo < hi) {
+		const char *rkey;
+
+		mid = lo + (hi - lo) / 2;
+		rkey = r->mkr_root + r->mkr_rootv[mid];
+		memcpy(&len, rkey, sizeof(len));
+
+		if (mbkv_keycmp(rkey + sizeof(len), le16_to_cpu(len), key, klen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+mpool_err_t
+mpool_mbkv_get(
+	struct mpool_mbkv_reader   *r,
+	const void                 *key,
+	size_t                      klen,
+	void                       *vbuf,
+	size_t                      vbufsz,
+	size_t                     *vlenp)
+{
+	const char *data, *val;
+	merr_t      err;
+	__le32      blkno;
+	u32         idx, vlen;
+
+	if (!r || !key || klen == 0 || klen > MPOOL_MBKV_KLEN_MAX || (!vbuf && vbufsz > 0))
+		return merr(EINVAL);
+
+	if (r->mkr_bloomc > 0) {
+		u64 hash = mbkv_hash(key, klen);
+		u64 off = r->mkr_bloomoff + mbkv_bloom_line(hash, r->mkr_bloomc) * MBKV_BLOOM_LINE;
+		u64 aoff = off & ~(u64)(PAGE_SIZE - 1);
+
+		/* Lines never straddle pages as the filter starts on a page boundary. */
+		err = mbkv_read_range(r, aoff, PAGE_SIZE, &data);
+		if (err)
+			return err;
+
+		if (!mbkv_bloom_bits((u8 *)data + (off - aoff), hash, r->mkr_probes, false))
+			return merr(ENOENT);
+	}
+
+	idx = mbkv_root_search(r, key, klen);
+	if (idx == r->mkr_idxc)
+		return merr(ENOENT);
+
+	err = mbkv_read_range(r, ((u64)r->mkr_datac + idx) * r->mkr_blksz, r->mkr_blksz, &data);
+	if (err)
+		return err;
+
+	err = mbkv_blk_search(data, r->mkr_blksz, key, klen, false, &val, &vlen);
+	if (err)
+		return merr_errno(err) == ENOENT ? merr(EBADMSG) : err;
+
+	if (vlen != sizeof(blkno))
+		return merr(EBADMSG);
+
+	memcpy(&blkno, val, sizeof(blkno));
+	if (le32_to_cpu(blkno) >= r->mkr_datac)
+		return merr(EBADMSG);
+
+	err = mbkv_read_range(r, (u64)le32_to_cpu(blkno) * r->mkr_blksz, r->mkr_blksz, &data);
+	if (err)
+		return err;
+
+	err = mbkv_blk_search(data, r->mkr_blksz, key, klen, true, &val, &vlen);
+	if (err)
+		return err;
+
+	if (vbufsz > 0)
+		memcpy(vbuf, val, min_t(size_t, vlen, vbufsz));
+
+	if (vlenp)
+		*vlenp = vlen;
+
+	return 0;
+}
+
+void mpool_mbkv_reader_close(struct mpool_mbkv_reader *r)
+{
+	if (!r)
+		return;
+
+	if (r->mkr_map)
+		mpool_mcache_munmap(r->mkr_map);
+
+	free(r->mkr_root);
+	free(r->mkr_rootv);
+	free(r->mkr_rbuf);
+	free(r);
+}
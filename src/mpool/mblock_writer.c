@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Streaming mblock writer module.
+ *
+ * Mblock writes must be issued in page-aligned buffers whose length is a
+ * multiple of the optimal write size, except for the last write which need
+ * only be a multiple of PAGE_SIZE.  The writer hides these constraints by
+ * copying appends into a ring of optimal-size buffers, each of which is
+ * written asynchronously as soon as it fills.
+ *
+ * When every buffer of the ring has a write in flight, the writer reaps the
+ * oldest completion from its own mbio completion queue before going on.
+ *
+ * The writes of the ring are queued to one mbio worker, which issues them
+ * one at a time since mblock writes append (see mbio.h).  The ring thus
+ * overlaps the copying of appends with the write of the previous buffer,
+ * it does not add device queue depth.
+ */
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MBLOCK_WRITER_DEPTH_DEFAULT 4
+#define MBLOCK_WRITER_DEPTH_MAX     64
+#define MBLOCK_WRITER_WRSZ_DEFAULT  (128 * 1024)
+
+/**
+ * struct mpool_mblock_writer - streaming mblock writer
+ * @mbw_mp:       mpool handle
+ * @mbw_cq:       completion queue of this writer's writes
+ * @mbw_mbid:     mblock object ID
+ * @mbw_cap:      mblock capacity
+ * @mbw_wrsz:     size of each buffer, i.e., of each full write
+ * @mbw_len:      number of bytes appended
+ * @mbw_fill:     number of bytes in the current buffer
+ * @mbw_err:      first error encountered, sticky
+ * @mbw_bufc:     number of buffers
+ * @mbw_cur:      index of the buffer being filled
+ * @mbw_inflight: number of buffers being written
+ * @mbw_arena:    mbw_bufc * mbw_wrsz page-aligned bytes
+ * @mbw_iovv:     one iovec per buffer, valid while its write is in flight
+ *
+ * Writes to an mblock complete in submission order, hence the buffers
+ * in flight are always the mbw_inflight buffers preceding mbw_cur.
+ */
+struct mpool_mblock_writer {
+	struct mpool           *mbw_mp;
+	struct mpool_mbio_cq   *mbw_cq;
+	u64                     mbw_mbid;
+	size_t                  mbw_cap;
+	size_t                  mbw_wrsz;
+	size_t                  mbw_len;
+	size_t                  mbw_fill;
+	merr_t                  mbw_err;
+	int                     mbw_bufc;
+	int                     mbw_cur;
+	int                     mbw_inflight;
+	char                   *mbw_arena;
+	struct iovec            mbw_iovv[];
+};
+
+/**
+ * mblock_writer_reap() - Reap completed writes
+ * @w:   writer
+ * @min: minimum number of writes to wait for
+ */
+static void mblock_writer_reap(struct mpool_mblock_writer *w, int min)
+{
+	struct mpool_mbio_cqe   cqev[MBLOCK_WRITER_DEPTH_MAX];
+	merr_t                  err;
+	int                     n, i;
+
+	err = mpool_mbio_cq_reap(w->mbw_cq, cqev, w->mbw_bufc, min, &n);
+	if (err) {
+		w->mbw_err = w->mbw_err ?: err;
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (cqev[i].mce_err && !w->mbw_err)
+			w->mbw_err = cqev[i].mce_err;
+	}
+
+	w->mbw_inflight -= n;
+}
+
+static void mblock_writer_drain(struct mpool_mblock_writer *w)
+{
+	while (w->mbw_inflight > 0)
+		mblock_writer_reap(w, w->mbw_inflight);
+}
+
+/**
+ * mblock_writer_flush() - Write the current buffer and advance to the next
+ * @w:   writer
+ * @len: number of bytes to write from the current buffer
+ */
+static merr_t mblock_writer_flush(struct mpool_mblock_writer *w, size_t len)
+{
+	struct iovec   *iov = w->mbw_iovv + w->mbw_cur;
+	merr_t          err;
+
+	iov->iov_base = w->mbw_arena + w->mbw_cur * w->mbw_wrsz;
+	iov->iov_len = len;
+
+	err = mpool_mblock_write_async(w->mbw_mp, w->mbw_mbid, iov, 1, w->mbw_cq, NULL, NULL);
+	if (err) {
+		w->mbw_err = err;
+		return err;
+	}
+
+	w->mbw_inflight++;
+	w->mbw_cur = (w->mbw_cur + 1) % w->mbw_bufc;
+	w->mbw_fill = 0;
+
+	/* Wait for the oldest write to free up the next buffer. */
+	if (w->mbw_inflight == w->mbw_bufc)
+		mblock_writer_reap(w, 1);
+
+	return w->mbw_err;
+}
+
+static void mblock_writer_free(struct mpool_mblock_writer *w)
+{
+	mpool_mbio_cq_destroy(w->mbw_cq);
+	free(w->mbw_arena);
+	free(w);
+}
+
+mpool_err_t
+mpool_mblock_writer_open(
+	struct mpool                *mp,
+	uint64_t                     mbid,
+	int                          depth,
+	struct mpool_mblock_writer **wp)
+{
+	struct mpool_mblock_writer *w;
+	struct mblock_props         props;
+	merr_t                      err;
+	size_t                      wrsz;
+
+	if (!mp || !wp || depth < 0)
+		return merr(EINVAL);
+
+	*wp = NULL;
+
+	err = mpool_mblock_props_get(mp, mbid, &props);
+	if (err)
+		return err;
+
+	if (props.mpr_iscommitted || props.mpr_write_len > 0)
+		return merr(EINVAL);
+
+	depth = clamp_t(int, depth ?: MBLOCK_WRITER_DEPTH_DEFAULT, 2, MBLOCK_WRITER_DEPTH_MAX);
+	wrsz = roundup(props.mpr_optimal_wrsz ?: MBLOCK_WRITER_WRSZ_DEFAULT, PAGE_SIZE);
+
+	w = calloc(1, sizeof(*w) + depth * sizeof(w->mbw_iovv[0]));
+	if (!w)
+		return merr(ENOMEM);
+
+	w->mbw_arena = aligned_alloc(PAGE_SIZE, depth * wrsz);
+	if (!w->mbw_arena) {
+		free(w);
+		return merr(ENOMEM);
+	}
+
+	err = mpool_mbio_cq_create(&w->mbw_cq);
+	if (err) {
+		free(w->mbw_arena);
+		free(w);
+		return err;
+	}
+
+	w->mbw_mp = mp;
+	w->mbw_mbid = mbid;
+	w->mbw_cap = props.mpr_alloc_cap;
+	w->mbw_wrsz = wrsz;
+	w->mbw_bufc = depth;
+
+	*wp = w;
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_writer_append(struct mpool_mblock_writer *w, const void *data, size_t len)
+{
+	const char *src = data;
+	merr_t      err;
+
+	if (!w || (!data && len > 0))
+		return merr(EINVAL);
+
+	if (w->mbw_err)
+		return w->mbw_err;
+
+	if (w->mbw_cap && roundup(w->mbw_len + len, PAGE_SIZE) > w->mbw_cap)
+		return merr(ENOSPC);
+
+	w->mbw_len += len;
+
+	while (len > 0) {
+		size_t n = min_t(size_t, len, w->mbw_wrsz - w->mbw_fill);
+
+		memcpy(w->mbw_arena + w->mbw_cur * w->mbw_wrsz + w->mbw_fill, src, n);
+		w->mbw_fill += n;
+		src += n;
+		len -= n;
+
+		if (w->mbw_fill == w->mbw_wrsz) {
+			err = mblock_writer_flush(w, w->mbw_wrsz);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_writer_close(struct mpool_mblock_writer *w, size_t *len)
+{
+	merr_t  err;
+	size_t  padded;
+
+	if (!w)
+		return merr(EINVAL);
+
+	if (!w->mbw_err && w->mbw_fill > 0) {
+		padded = roundup(w->mbw_fill, PAGE_SIZE);
+
+		memset(w->mbw_arena + w->mbw_cur * w->mbw_wrsz + w->mbw_fill, 0,
+		       padded - w->mbw_fill);
+		mblock_writer_flush(w, padded);
+	}
+
+	mblock_writer_drain(w);
+
+	err = w->mbw_err;
+	if (!err)
+		err = mpool_mblock_commit(w->mbw_mp, w->mbw_mbid);
+	else
+		mpool_mblock_abort(w->mbw_mp, w->mbw_mbid);
+
+	if (len)
+		*len = w->mbw_len;
+
+	mblock_writer_free(w);
+
+	return err;
+}
+
+mpool_err_t mpool_mblock_writer_abort(struct mpool_mblock_writer *w)
+{
+	merr_t err;
+
+	if (!w)
+		return merr(EINVAL);
+
+	mblock_writer_drain(w);
+
+	err = mpool_mblock_abort(w->mbw_mp, w->mbw_mbid);
+
+	mblock_writer_free(w);
+
+	return err;
+}
@@ -0,0 +1,319 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mblock pool module.
+ *
+ * Each media class has a ring of pooled mblocks.  When a get leaves fewer
+ * than mbp_lowat mblocks in a class, the class is marked for refill and
+ * the refill thread allocates mblocks into it, one ioctl at a time and
+ * without holding the pool lock, until it holds mbp_hiwat mblocks.  If an
+ * allocation fails, e.g., because the media class is full or absent, the
+ * refill stops, the class is not refilled again until a get after
+ * MP_MBPOOL_RETRY_MS, and gets fall back to allocating synchronously,
+ * which reports the error to the caller.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+
+#include <mpctl/impool.h>
+
+#include <time.h>
+
+#include "mbpool.h"
+
+/**
+ * struct mp_mbpool_ent - pooled mblock
+ */
+struct mp_mbpool_ent {
+	u64                     mpe_mbid;
+	struct mblock_props     mpe_props;
+};
+
+/**
+ * struct mp_mbpool_class - pooled mblocks of one media class
+ * @mpc_refill: class is being refilled up to the high watermark
+ * @mpc_head:   index of the oldest pooled mblock
+ * @mpc_cnt:    number of pooled mblocks
+ * @mpc_retry:  CLOCK_MONOTONIC time before which not to refill, in ms
+ * @mpc_entv:   ring of mbp_hiwat pooled mblocks
+ */
+struct mp_mbpool_class {
+	bool                    mpc_refill;
+	u32                     mpc_head;
+	u32                     mpc_cnt;
+	u64                     mpc_retry;
+	struct mp_mbpool_ent   *mpc_entv;
+};
+
+/**
+ * struct mp_mbpool - mblock pool
+ * @mbp_mp:      mpool handle
+ * @mbp_lock:    protects all fields below
+ * @mbp_cv:      signaled when a class needs a refill, when the pool is
+ *               stopped or paused, and after each refill allocation
+ * @mbp_tid:     refill thread
+ * @mbp_started: refill thread is running
+ * @mbp_stop:    refill thread must exit
+ * @mbp_pause:   refill thread must not allocate
+ * @mbp_busy:    refill thread is allocating an mblock
+ * @mbp_lowat:   low watermark
+ * @mbp_hiwat:   high watermark
+ * @mbp_classv:  per media class pools
+ */
+struct mp_mbpool {
+	struct mpool           *mbp_mp;
+	struct mutex            mbp_lock;
+	pthread_cond_t          mbp_cv;
+	pthread_t               mbp_tid;
+	bool                    mbp_started;
+	bool                    mbp_stop;
+	bool                    mbp_pause;
+	bool                    mbp_busy;
+	u32                     mbp_lowat;
+	u32                     mbp_hiwat;
+	struct mp_mbpool_class  mbp_classv[MP_MED_NUMBER];
+};
+
+static u64 mp_mbpool_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+/**
+ * mp_mbpool_next() - Find a media class to refill
+ * @mbpool: pool
+ * @now:    current time in ms
+ * @wakep:  earliest retry time of a class waiting to be retried (output)
+ */
+static int mp_mbpool_next(struct mp_mbpool *mbpool, u64 now, u64 *wakep)
+{
+	struct mp_mbpool_class *mpc;
+	int                     i;
+
+	*wakep = 0;
+
+	for (i = 0; i < MP_MED_NUMBER; i++) {
+		mpc = mbpool->mbp_classv + i;
+
+		if (!mpc->mpc_refill)
+			continue;
+
+		if (mpc->mpc_cnt >= mbpool->mbp_hiwat) {
+			mpc->mpc_refill = false;
+			continue;
+		}
+
+		if (mpc->mpc_retry <= now)
+			return i;
+
+		if (!*wakep || mpc->mpc_retry < *wakep)
+			*wakep = mpc->mpc_retry;
+	}
+
+	return -1;
+}
+
+static void *mp_mbpool_main(void *arg)
+{
+	struct mp_mbpool       *mbpool = arg;
+	struct mp_mbpool_class *mpc;
+	struct mp_mbpool_ent    ent;
+	struct timespec         ts;
+	merr_t                  err;
+	u64                     wake;
+	int                     i;
+
+	mutex_lock(&mbpool->mbp_lock);
+	while (!mbpool->mbp_stop) {
+		if (mbpool->mbp_pause) {
+			pthread_cond_wait(&mbpool->mbp_cv, &mbpool->mbp_lock.pth_mutex);
+			continue;
+		}
+
+		i = mp_mbpool_next(mbpool, mp_mbpool_now_ms(), &wake);
+		if (i < 0) {
+			if (!wake) {
+				pthread_cond_wait(&mbpool->mbp_cv, &mbpool->mbp_lock.pth_mutex);
+				continue;
+			}
+
+			/* Wait on CLOCK_REALTIME for the retry delay. */
+			wake -= mp_mbpool_now_ms();
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += wake / 1000;
+			ts.tv_nsec += (wake % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&mbpool->mbp_cv, &mbpool->mbp_lock.pth_mutex, &ts);
+			continue;
+		}
+
+		mbpool->mbp_busy = true;
+		mutex_unlock(&mbpool->mbp_lock);
+
+		err = mp_mblock_alloc(mbpool->mbp_mp, i, false, &ent.mpe_mbid, &ent.mpe_props);
+
+		mutex_lock(&mbpool->mbp_lock);
+		mbpool->mbp_busy = false;
+		pthread_cond_broadcast(&mbpool->mbp_cv);
+		mpc = mbpool->mbp_classv + i;
+
+		if (err) {
+			mpc->mpc_retry = mp_mbpool_now_ms() + MP_MBPOOL_RETRY_MS;
+			mpc->mpc_refill = false;
+			continue;
+		}
+
+		/* The class cannot be full, gets only remove mblocks. */
+		mpc->mpc_entv[(mpc->mpc_head + mpc->mpc_cnt) % mbpool->mbp_hiwat] = ent;
+		mpc->mpc_cnt++;
+	}
+	mutex_unlock(&mbpool->mbp_lock);
+
+	return NULL;
+}
+
+bool
+mp_mbpool_get(
+	struct mp_mbpool       *mbpool,
+	enum mp_media_classp    mclassp,
+	u64                    *mbid,
+	struct mblock_props    *props)
+{
+	struct mp_mbpool_class *mpc;
+	struct mp_mbpool_ent   *ent;
+	bool                    served = false;
+
+	if (!mbpool || mclassp >= MP_MED_NUMBER)
+		return false;
+
+	mpc = mbpool->mbp_classv + mclassp;
+
+	mutex_lock(&mbpool->mbp_lock);
+	if (!mbpool->mbp_started) {
+		if (pthread_create(&mbpool->mbp_tid, NULL, mp_mbpool_main, mbpool))
+			goto unlock;
+
+		mbpool->mbp_started = true;
+	}
+
+	if (mpc->mpc_cnt > 0) {
+		ent = mpc->mpc_entv + mpc->mpc_head;
+		*mbid = ent->mpe_mbid;
+		*props = ent->mpe_props;
+
+		mpc->mpc_head = (mpc->mpc_head + 1) % mbpool->mbp_hiwat;
+		mpc->mpc_cnt--;
+		served = true;
+	}
+
+	if (mpc->mpc_cnt < mbpool->mbp_lowat && !mpc->mpc_refill) {
+		mpc->mpc_refill = true;
+		pthread_cond_broadcast(&mbpool->mbp_cv);
+	}
+
+unlock:
+	mutex_unlock(&mbpool->mbp_lock);
+
+	return served;
+}
+
+void mp_mbpool_pause(struct mp_mbpool *mbpool)
+{
+	if (!mbpool)
+		return;
+
+	mutex_lock(&mbpool->mbp_lock);
+	mbpool->mbp_pause = true;
+	pthread_cond_broadcast(&mbpool->mbp_cv);
+
+	while (mbpool->mbp_busy)
+		pthread_cond_wait(&mbpool->mbp_cv, &mbpool->mbp_lock.pth_mutex);
+	mutex_unlock(&mbpool->mbp_lock);
+}
+
+void mp_mbpool_resume(struct mp_mbpool *mbpool)
+{
+	if (!mbpool)
+		return;
+
+	mutex_lock(&mbpool->mbp_lock);
+	mbpool->mbp_pause = false;
+	pthread_cond_broadcast(&mbpool->mbp_cv);
+	mutex_unlock(&mbpool->mbp_lock);
+}
+
+merr_t mp_mbpool_create(struct mpool *mp, u32 lowat, u32 hiwat, struct mp_mbpool **mbpoolp)
+{
+	struct mp_mbpool   *mbpool;
+	int                 i;
+
+	if (!mp || !mbpoolp || hiwat == 0 || hiwat > MP_MBPOOL_MAX || lowat > hiwat)
+		return merr(EINVAL);
+
+	mbpool = calloc(1, sizeof(*mbpool));
+	if (!mbpool)
+		return merr(ENOMEM);
+
+	for (i = 0; i < MP_MED_NUMBER; i++) {
+		mbpool->mbp_classv[i].mpc_entv = calloc(hiwat, sizeof(struct mp_mbpool_ent));
+		if (!mbpool->mbp_classv[i].mpc_entv) {
+			while (i-- > 0)
+				free(mbpool->mbp_classv[i].mpc_entv);
+			free(mbpool);
+			return merr(ENOMEM);
+		}
+	}
+
+	mbpool->mbp_mp = mp;
+	mbpool->mbp_lowat = lowat ?: (hiwat + 1) / 2;
+	mbpool->mbp_hiwat = hiwat;
+	mutex_init(&mbpool->mbp_lock);
+	pthread_cond_init(&mbpool->mbp_cv, NULL);
+
+	*mbpoolp = mbpool;
+
+	return 0;
+}
+
+void mp_mbpool_destroy(struct mp_mbpool *mbpool)
+{
+	struct mp_mbpool_class *mpc;
+	int                     i;
+
+	if (!mbpool)
+		return;
+
+	mutex_lock(&mbpool->mbp_lock);
+	mbpool->mbp_stop = true;
+	pthread_cond_signal(&mbpool->mbp_cv);
+	mutex_unlock(&mbpool->mbp_lock);
+
+	if (mbpool->mbp_started)
+		pthread_join(mbpool->mbp_tid, NULL);
+
+	for (i = 0; i < MP_MED_NUMBER; i++) {
+		mpc = mbpool->mbp_classv + i;
+
+		while (mpc->mpc_cnt > 0) {
+			mpool_mblock_abort(mbpool->mbp_mp, mpc->mpc_entv[mpc->mpc_head].mpe_mbid);
+			mpc->mpc_head = (mpc->mpc_head + 1) % mbpool->mbp_hiwat;
+			mpc->mpc_cnt--;
+		}
+
+		free(mpc->mpc_entv);
+	}
+
+	pthread_cond_destroy(&mbpool->mbp_cv);
+	mutex_destroy(&mbpool->mbp_lock);
+	free(mbpool);
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MBPOOL_H
+#define MPOOL_MBPOOL_H
+
+/*
+ * Pool of allocated but uncommitted mblocks.
+ *
+ * mpool_mblock_alloc() of a non-spare mblock is served from a per-media
+ * class pool kept between a low and a high watermark by a background
+ * thread, which takes the MPIOC_MB_ALLOC ioctl off the caller's path.
+ * A media class is only pooled once an mblock has been allocated from it,
+ * and the thread is started on first use.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_MBPOOL_MAX           1024
+#define MP_MBPOOL_RETRY_MS      1000
+
+struct mp_mbpool;
+
+/**
+ * mp_mbpool_create() - Create an mblock pool
+ * @mp:      mpool handle on which mblocks are allocated
+ * @lowat:   refill a media class when it holds fewer mblocks than this
+ * @hiwat:   number of mblocks per media class after a refill
+ * @mbpoolp: pool (output)
+ */
+merr_t mp_mbpool_create(struct mpool *mp, u32 lowat, u32 hiwat, struct mp_mbpool **mbpoolp);
+
+/**
+ * mp_mbpool_destroy() - Destroy an mblock pool
+ * @mbpool: pool (may be NULL)
+ *
+ * Stops the refill thread and aborts all pooled mblocks.
+ */
+void mp_mbpool_destroy(struct mp_mbpool *mbpool);
+
+/**
+ * mp_mbpool_pause() - Wait for the refill thread to be idle and keep it so
+ * @mbpool: pool (may be NULL)
+ *
+ * Gets are still served from the pooled mblocks while the pool is paused.
+ */
+void mp_mbpool_pause(struct mp_mbpool *mbpool);
+
+/**
+ * mp_mbpool_resume() - Let the refill thread allocate again
+ * @mbpool: pool (may be NULL)
+ */
+void mp_mbpool_resume(struct mp_mbpool *mbpool);
+
+/**
+ * mp_mbpool_get() - Take an mblock from the pool
+ * @mbpool:  pool (may be NULL)
+ * @mclassp: media class
+ * @mbid:    mblock object ID (output)
+ * @props:   mblock properties (output)
+ *
+ * Return: true if an mblock was taken from the pool, false if the caller
+ * must allocate one itself.
+ */
+bool
+mp_mbpool_get(
+	struct mp_mbpool       *mbpool,
+	enum mp_media_classp    mclassp,
+	u64                    *mbid,
+	struct mblock_props    *props);
+
+#endif /* MPOOL_MBPOOL_H */
@@ -0,0 +1,1261 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Small object slab store module.
+ *
+ * Objects are appended back to back, without headers or alignment, into
+ * the open slab, an mblock written through a streaming mblock writer.  When
+ * the next object does not fit, the open slab is sealed, i.e., its writer
+ * is closed, which commits the mblock, and a new slab is opened.  Objects
+ * are read in place through a single-mblock mcache map per sealed slab,
+ * created on first read.
+ *
+ * The store only keeps in memory, per slab, a vector of the (offset,
+ * length) of its objects in offset order, each flagged dead once deleted.
+ * Clients keep the object handles; after reopening a store they attach the
+ * handles of their live objects, and hand over the IDs of the slabs they
+ * used so that those left without live objects are deleted.  A sealed slab
+ * with no live objects left is deleted.  Compaction picks the sealed slabs
+ * with at least msp_dead_pct percent of dead bytes, copies their live
+ * objects into new slabs of its own, seals them, and offers each new handle
+ * to the client through the remap callback.  The compacted slab is then
+ * deleted, but only after msp_period_ms, so that readers of the old handles
+ * are not cut off.
+ *
+ * Nothing about the layout of a slab is persisted: the object handles held
+ * by the client are the only index of its contents.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/page.h>
+#include <util/minmax.h>
+
+#include <mpool/mpool.h>
+
+#include <time.h>
+
+#include "mpool_err.h"
+
+#define MP_SLAB_BKTS                256
+#define MP_SLAB_DEAD                (1u << 31)
+#define MP_SLAB_DEAD_PCT_DEFAULT    50
+#define MP_SLAB_PERIOD_MS_DEFAULT   1000
+
+/**
+ * struct mp_slab_ent - object of a slab
+ * @se_off: offset of the object in the slab
+ * @se_len: length of the object, or'ed with MP_SLAB_DEAD once deleted
+ */
+struct mp_slab_ent {
+	u32                         se_off;
+	u32                         se_len;
+};
+
+/**
+ * struct mp_slab - slab mblock
+ * @sl_next:     next slab in the hash bucket, or in the graveyard
+ * @sl_mbid:     mblock object ID
+ * @sl_cap:      mblock capacity
+ * @sl_len:      number of bytes appended
+ * @sl_live:     number of live bytes
+ * @sl_livec:    number of live objects
+ * @sl_entc:     number of objects
+ * @sl_entmax:   size of sl_entv
+ * @sl_sealed:   mblock is committed
+ * @sl_busy:     slab is being compacted
+ * @sl_unsorted: objects were attached out of order
+ * @sl_expire:   CLOCK_MONOTONIC time in ms after which a buried slab is deleted
+ * @sl_entv:     objects, in offset order
+ * @sl_map:      mcache map of the slab, NULL until first read
+ */
+struct mp_slab {
+	struct mp_slab             *sl_next;
+	u64                         sl_mbid;
+	u32                         sl_cap;
+	u32                         sl_len;
+	u64                         sl_live;
+	u32                         sl_livec;
+	u32                         sl_entc;
+	u32                         sl_entmax;
+	bool                        sl_sealed;
+	bool                        sl_busy;
+	bool                        sl_unsorted;
+	u64                         sl_expire;
+	struct mp_slab_ent         *sl_entv;
+	struct mpool_mcache_map    *sl_map;
+};
+
+/**
+ * struct mpool_slab - slab store
+ * @ms_mp:      mpool handle
+ * @ms_mclassp: media class of the slabs
+ * @ms_params:  store parameters
+ * @ms_remap:   remap callback, NULL if compaction is disabled
+ * @ms_arg:     remap callback argument
+ * @ms_cmlock:  serializes compaction passes and mpool_slab_reclaim()
+ * @ms_lock:    protects all fields below
+ * @ms_cv:      signaled when the store is closed
+ * @ms_tid:     compaction thread
+ * @ms_started: compaction thread is running
+ * @ms_stop:    compaction thread must exit
+ * @ms_slabcap: capacity of the slabs, 0 until the first slab is opened
+ * @ms_w:       writer of the open slab
+ * @ms_open:    open slab, or NULL
+ * @ms_graves:  compacted slabs waiting to be deleted
+ * @ms_stats:   statistics
+ * @ms_bktv:    hash table of the slabs but for those in ms_graves
+ */
+struct mpool_slab {
+	struct mpool               *ms_mp;
+	enum mp_media_classp        ms_mclassp;
+	struct mpool_slab_params    ms_params;
+	mpool_slab_remap_fn        *ms_remap;
+	void                       *ms_arg;
+	struct mutex                ms_cmlock;
+	struct mutex                ms_lock;
+	pthread_cond_t              ms_cv;
+	pthread_t                   ms_tid;
+	bool                        ms_started;
+	bool                        ms_stop;
+	u32                         ms_slabcap;
+	struct mpool_mblock_writer *ms_w;
+	struct mp_slab             *ms_open;
+	struct mp_slab             *ms_graves;
+	struct mpool_slab_stats     ms_stats;
+	struct mp_slab             *ms_bktv[MP_SLAB_BKTS];
+};
+
+/**
+ * struct mp_slab_reloc - object relocated by compaction
+ * @sr_old: handle in the compacted slab
+ * @sr_new: handle in the slab it was copied into
+ * @sr_src: data of the object in the map of the compacted slab
+ */
+struct mp_slab_reloc {
+	struct mpool_slab_obj       sr_old;
+	struct mpool_slab_obj       sr_new;
+	const char                 *sr_src;
+};
+
+/**
+ * struct mp_slab_cw - slab written by compaction
+ * @cw_w:    writer of the slab
+ * @cw_slab: slab, private to the compaction until it is sealed
+ */
+struct mp_slab_cw {
+	struct mpool_mblock_writer *cw_w;
+	struct mp_slab             *cw_slab;
+};
+
+static u64 mp_slab_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static struct mp_slab **mp_slab_bkt(struct mpool_slab *ms, u64 mbid)
+{
+	return ms->ms_bktv + (((mbid * 0x9e3779b97f4a7c15ull) >> 32) & (MP_SLAB_BKTS - 1));
+}
+
+static struct mp_slab *mp_slab_lookup(struct mpool_slab *ms, u64 mbid)
+{
+	struct mp_slab *slab;
+
+	for (slab = *mp_slab_bkt(ms, mbid); slab; slab = slab->sl_next)
+		if (slab->sl_mbid == mbid)
+			return slab;
+
+	return NULL;
+}
+
+static struct mp_slab *mp_slab_alloc(u64 mbid, u32 cap)
+{
+	struct mp_slab *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	slab->sl_mbid = mbid;
+	slab->sl_cap = cap;
+
+	return slab;
+}
+
+/**
+ * mp_slab_hash() - Add a slab and its objects to the store
+ *
+ * Called with the store lock held.
+ */
+static void mp_slab_hash(struct mpool_slab *ms, struct mp_slab *slab)
+{
+	struct mp_slab **bkt = mp_slab_bkt(ms, slab->sl_mbid);
+
+	slab->sl_next = *bkt;
+	*bkt = slab;
+
+	ms->ms_stats.mss_slabs++;
+	ms->ms_stats.mss_capacity += slab->sl_cap;
+	ms->ms_stats.mss_objects += slab->sl_livec;
+	ms->ms_stats.mss_bytes += slab->sl_live;
+}
+
+/**
+ * mp_slab_create() - Create and hash a slab
+ *
+ * Called with the store lock held.
+ */
+static struct mp_slab *mp_slab_create(struct mpool_slab *ms, u64 mbid, u32 cap)
+{
+	struct mp_slab *slab;
+
+	slab = mp_slab_alloc(mbid, cap);
+	if (slab)
+		mp_slab_hash(ms, slab);
+
+	return slab;
+}
+
+/**
+ * mp_slab_unhash() - Remove a slab and its objects from the store
+ *
+ * Called with the store lock held.
+ */
+static void mp_slab_unhash(struct mpool_slab *ms, struct mp_slab *slab)
+{
+	struct mp_slab **pp = mp_slab_bkt(ms, slab->sl_mbid);
+
+	while (*pp != slab)
+		pp = &(*pp)->sl_next;
+
+	*pp = slab->sl_next;
+
+	ms->ms_stats.mss_slabs--;
+	ms->ms_stats.mss_capacity -= slab->sl_cap;
+	ms->ms_stats.mss_objects -= slab->sl_livec;
+	ms->ms_stats.mss_bytes -= slab->sl_live;
+}
+
+static void mp_slab_free(struct mp_slab *slab)
+{
+	mpool_mcache_munmap(slab->sl_map);
+	free(slab->sl_entv);
+	free(slab);
+}
+
+/**
+ * mp_slab_release() - Delete a slab without live objects
+ * @ms:    slab store
+ * @slab:  slab
+ * @grace: leave the slab mapped for msp_period_ms
+ *
+ * Called with the store lock held.
+ */
+static void mp_slab_release(struct mpool_slab *ms, struct mp_slab *slab, bool grace)
+{
+	mp_slab_unhash(ms, slab);
+
+	if (grace) {
+		slab->sl_expire = mp_slab_now_ms() + ms->ms_params.msp_period_ms;
+		slab->sl_next = ms->ms_graves;
+		ms->ms_graves = slab;
+		return;
+	}
+
+	mpool_mcache_munmap(slab->sl_map);
+	slab->sl_map = NULL;
+
+	mpool_mblock_delete_defer(ms->ms_mp, &slab->sl_mbid, 1);
+	mp_slab_free(slab);
+}
+
+/**
+ * mp_slab_bury() - Delete the compacted slabs whose grace period expired
+ * @ms:  slab store
+ * @all: ignore the grace period
+ *
+ * Called with the store lock held.
+ */
+static void mp_slab_bury(struct mpool_slab *ms, bool all)
+{
+	struct mp_slab    **pp = &ms->ms_graves;
+	struct mp_slab     *slab;
+	u64                 now = mp_slab_now_ms();
+
+	while ((slab = *pp)) {
+		if (!all && slab->sl_expire > now) {
+			pp = &slab->sl_next;
+			continue;
+		}
+
+		*pp = slab->sl_next;
+
+		mpool_mcache_munmap(slab->sl_map);
+		slab->sl_map = NULL;
+
+		mpool_mblock_delete_defer(ms->ms_mp, &slab->sl_mbid, 1);
+		mp_slab_free(slab);
+	}
+}
+
+static int mp_slab_ent_cmp(const void *lhs, const void *rhs)
+{
+	const struct mp_slab_ent *l = lhs, *r = rhs;
+
+	if (l->se_off != r->se_off)
+		return l->se_off < r->se_off ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * mp_slab_ent_push() - Add a live object to a slab that is not hashed
+ */
+static merr_t mp_slab_ent_push(struct mp_slab *slab, u32 off, u32 len)
+{
+	struct mp_slab_ent *entv;
+	u32                 max;
+
+	if (slab->sl_entc == slab->sl_entmax) {
+		max = max_t(u32, slab->sl_entmax * 2, 64);
+
+		entv = realloc(slab->sl_entv, max * sizeof(*entv));
+		if (!entv)
+			return merr(ENOMEM);
+
+		slab->sl_entv = entv;
+		slab->sl_entmax = max;
+	}
+
+	slab->sl_entv[slab->sl_entc].se_off = off;
+	slab->sl_entv[slab->sl_entc++].se_len = len;
+	slab->sl_live += len;
+	slab->sl_livec++;
+
+	return 0;
+}
+
+/**
+ * mp_slab_ent_add() - Add a live object to a slab
+ *
+ * Called with the store lock held.
+ */
+static merr_t mp_slab_ent_add(struct mpool_slab *ms, struct mp_slab *slab, u32 off, u32 len)
+{
+	merr_t err;
+
+	err = mp_slab_ent_push(slab, off, len);
+	if (err)
+		return err;
+
+	ms->ms_stats.mss_objects++;
+	ms->ms_stats.mss_bytes += len;
+
+	return 0;
+}
+
+/**
+ * mp_slab_ent_find() - Find the live object a handle refers to
+ *
+ * Called with the store lock held.
+ */
+static struct mp_slab_ent *mp_slab_ent_find(struct mp_slab *slab, const struct mpool_slab_obj *obj)
+{
+	struct mp_slab_ent  key = { .se_off = obj->mso_off };
+	struct mp_slab_ent *ent;
+
+	ent = bsearch(&key, slab->sl_entv, slab->sl_entc, sizeof(key), mp_slab_ent_cmp);
+	if (!ent || ent->se_len != obj->mso_len)
+		return NULL;
+
+	return ent;
+}
+
+/**
+ * mp_slab_sort() - Sort the objects attached to a slab and drop duplicates
+ *
+ * Called with the store lock held.
+ */
+static void mp_slab_sort(struct mpool_slab *ms, struct mp_slab *slab)
+{
+	struct mp_slab_ent *entv = slab->sl_entv;
+	u32                 i, n;
+
+	qsort(entv, slab->sl_entc, sizeof(*entv), mp_slab_ent_cmp);
+
+	for (i = 1, n = min_t(u32, slab->sl_entc, 1); i < slab->sl_entc; i++) {
+		struct mp_slab_ent dup = entv[i];
+
+		if (dup.se_off != entv[n - 1].se_off) {
+			entv[n++] = dup;
+			continue;
+		}
+
+		/* Keep the live copy of an object attached twice. */
+		if ((entv[n - 1].se_len & MP_SLAB_DEAD) && !(dup.se_len & MP_SLAB_DEAD)) {
+			dup = entv[n - 1];
+			entv[n - 1] = entv[i];
+		}
+
+		if (dup.se_len & MP_SLAB_DEAD)
+			continue;
+
+		slab->sl_live -= dup.se_len;
+		slab->sl_livec--;
+		ms->ms_stats.mss_objects--;
+		ms->ms_stats.mss_bytes -= dup.se_len;
+	}
+
+	slab->sl_entc = n;
+	slab->sl_unsorted = false;
+}
+
+/**
+ * mp_slab_kill() - Mark the object a handle refers to as dead
+ * @ms:  slab store
+ * @obj: object handle
+ *
+ * Deletes the slab of the object if this leaves it without live objects,
+ * unless it is the open slab or it is being compacted.
+ *
+ * Called with the store lock held.
+ */
+static merr_t mp_slab_kill(struct mpool_slab *ms, const struct mpool_slab_obj *obj)
+{
+	struct mp_slab     *slab;
+	struct mp_slab_ent *ent;
+
+	slab = mp_slab_lookup(ms, obj->mso_mbid);
+	if (!slab)
+		return merr(ENOENT);
+
+	ent = mp_slab_ent_find(slab, obj);
+	if (!ent)
+		return merr(ENOENT);
+
+	ent->se_len |= MP_SLAB_DEAD;
+	slab->sl_live -= obj->mso_len;
+	slab->sl_livec--;
+
+	ms->ms_stats.mss_objects--;
+	ms->ms_stats.mss_bytes -= obj->mso_len;
+
+	if (!slab->sl_livec && slab->sl_sealed && !slab->sl_busy)
+		mp_slab_release(ms, slab, false);
+
+	return 0;
+}
+
+/**
+ * mp_slab_seal() - Commit the open slab
+ *
+ * If the commit fails, the objects of the open slab are lost.
+ *
+ * Called with the store lock held.
+ */
+static merr_t mp_slab_seal(struct mpool_slab *ms)
+{
+	struct mp_slab *slab = ms->ms_open;
+	merr_t          err;
+
+	if (!slab)
+		return 0;
+
+	err = mpool_mblock_writer_close(ms->ms_w, NULL);
+
+	ms->ms_w = NULL;
+	ms->ms_open = NULL;
+
+	if (err) {
+		mp_slab_unhash(ms, slab);
+		mp_slab_free(slab);
+		return err;
+	}
+
+	slab->sl_sealed = true;
+
+	if (!slab->sl_livec)
+		mp_slab_release(ms, slab, false);
+
+	return 0;
+}
+
+/**
+ * mp_slab_open() - Allocate a new open slab
+ *
+ * Called with the store lock held.
+ */
+static merr_t mp_slab_open(struct mpool_slab *ms)
+{
+	struct mblock_props props;
+	struct mp_slab     *slab;
+	merr_t              err;
+	u64                 mbid;
+
+	err = mpool_mblock_alloc(ms->ms_mp, ms->ms_mclassp, false, &mbid, &props);
+	if (err)
+		return err;
+
+	err = mpool_mblock_writer_open(ms->ms_mp, mbid, 0, &ms->ms_w);
+	if (err) {
+		mpool_mblock_abort(ms->ms_mp, mbid);
+		return err;
+	}
+
+	slab = mp_slab_create(ms, mbid, min_t(u64, props.mpr_alloc_cap, MP_SLAB_DEAD));
+	if (!slab) {
+		mpool_mblock_writer_abort(ms->ms_w);
+		ms->ms_w = NULL;
+		return merr(ENOMEM);
+	}
+
+	ms->ms_open = slab;
+	ms->ms_slabcap = slab->sl_cap;
+
+	return 0;
+}
+
+/**
+ * mp_slab_append() - Append an object to the open slab
+ *
+ * Called with the store lock held.
+ */
+static merr_t
+mp_slab_append(struct mpool_slab *ms, const void *data, size_t len, struct mpool_slab_obj *obj)
+{
+	struct mp_slab *slab;
+	merr_t          err;
+
+	if (!len || (ms->ms_slabcap && roundup(len, PAGE_SIZE) > ms->ms_slabcap))
+		return merr(len ? EFBIG : EINVAL);
+
+	/* The writer pads the last write to a page boundary. */
+	slab = ms->ms_open;
+	if (slab && roundup(slab->sl_len + len, PAGE_SIZE) > slab->sl_cap) {
+		err = mp_slab_seal(ms);
+		if (err)
+			return err;
+	}
+
+	if (!ms->ms_open) {
+		err = mp_slab_open(ms);
+		if (err)
+			return err;
+
+		if (roundup(len, PAGE_SIZE) > ms->ms_slabcap)
+			return merr(EFBIG);
+	}
+
+	slab = ms->ms_open;
+
+	err = mpool_mblock_writer_append(ms->ms_w, data, len);
+	if (!err)
+		err = mp_slab_ent_add(ms, slab, slab->sl_len, len);
+	if (err) {
+		/* The writer error is sticky, give up on the open slab. */
+		mp_slab_seal(ms);
+		return err;
+	}
+
+	obj->mso_mbid = slab->sl_mbid;
+	obj->mso_off = slab->sl_len;
+	obj->mso_len = len;
+
+	slab->sl_len += len;
+
+	return 0;
+}
+
+/**
+ * mp_slab_base() - Get the base address of a sealed slab
+ *
+ * Called with the store lock held.
+ */
+static merr_t mp_slab_base(struct mpool_slab *ms, struct mp_slab *slab, const char **basep)
+{
+	merr_t err;
+
+	if (!slab->sl_map) {
+		err = mpool_mcache_mmap(ms->ms_mp, 1, &slab->sl_mbid, MPC_VMA_WARM, &slab->sl_map);
+		if (err)
+			return err;
+	}
+
+	*basep = mpool_mcache_getbase(slab->sl_map, 0);
+
+	return *basep ? 0 : merr(EINVAL);
+}
+
+/**
+ * mp_slab_victim() - Pick the sealed slab with the highest dead ratio
+ *
+ * Called with the store lock held.
+ */
+static struct mp_slab *mp_slab_victim(struct mpool_slab *ms)
+{
+	struct mp_slab *slab, *victim = NULL;
+	u64             dead, vdead = 0;
+	int             i;
+
+	for (i = 0; i < MP_SLAB_BKTS; i++) {
+		for (slab = ms->ms_bktv[i]; slab; slab = slab->sl_next) {
+			if (!slab->sl_sealed || slab->sl_busy || !slab->sl_len)
+				continue;
+
+			/* Dead bytes per 2^32 bytes of slab. */
+			dead = ((slab->sl_len - slab->sl_live) << 32) / slab->sl_len;
+
+			if (dead * 100 >= ((u64)ms->ms_params.msp_dead_pct << 32) && dead > vdead) {
+				victim = slab;
+				vdead = dead;
+			}
+		}
+	}
+
+	return victim;
+}
+
+/**
+ * mp_slab_cw_seal() - Commit a slab written by compaction and hash it
+ * @ms: slab store
+ * @cw: compaction writer
+ *
+ * If the commit fails, the objects of the slab are lost.
+ */
+static merr_t mp_slab_cw_seal(struct mpool_slab *ms, struct mp_slab_cw *cw)
+{
+	struct mp_slab *slab = cw->cw_slab;
+	merr_t          err;
+
+	if (!slab)
+		return 0;
+
+	err = mpool_mblock_writer_close(cw->cw_w, NULL);
+
+	cw->cw_w = NULL;
+	cw->cw_slab = NULL;
+
+	if (err) {
+		mp_slab_free(slab);
+		return err;
+	}
+
+	slab->sl_sealed = true;
+
+	mutex_lock(&ms->ms_lock);
+	mp_slab_hash(ms, slab);
+	mutex_unlock(&ms->ms_lock);
+
+	return 0;
+}
+
+/**
+ * mp_slab_cw_abort() - Abort the slab being written by compaction
+ */
+static void mp_slab_cw_abort(struct mp_slab_cw *cw)
+{
+	if (!cw->cw_slab)
+		return;
+
+	mpool_mblock_writer_abort(cw->cw_w);
+	mp_slab_free(cw->cw_slab);
+
+	cw->cw_w = NULL;
+	cw->cw_slab = NULL;
+}
+
+/**
+ * mp_slab_cw_append() - Copy an object into a slab written by compaction
+ * @ms:   slab store
+ * @cw:   compaction writer
+ * @data: object data
+ * @len:  object length
+ * @obj:  handle of the copy (output)
+ *
+ * Called without the store lock held.
+ */
+static merr_t
+mp_slab_cw_append(
+	struct mpool_slab      *ms,
+	struct mp_slab_cw      *cw,
+	const void             *data,
+	u32                     len,
+	struct mpool_slab_obj  *obj)
+{
+	struct mblock_props props;
+	struct mp_slab     *slab = cw->cw_slab;
+	merr_t              err;
+	u64                 mbid;
+
+	/* The writer pads the last write to a page boundary. */
+	if (slab && roundup(slab->sl_len + len, PAGE_SIZE) > slab->sl_cap) {
+		err = mp_slab_cw_seal(ms, cw);
+		if (err)
+			return err;
+	}
+
+	if (!cw->cw_slab) {
+		err = mpool_mblock_alloc(ms->ms_mp, ms->ms_mclassp, false, &mbid, &props);
+		if (err)
+			return err;
+
+		err = mpool_mblock_writer_open(ms->ms_mp, mbid, 0, &cw->cw_w);
+		if (err) {
+			mpool_mblock_abort(ms->ms_mp, mbid);
+			return err;
+		}
+
+		cw->cw_slab = mp_slab_alloc(mbid, min_t(u64, props.mpr_alloc_cap, MP_SLAB_DEAD));
+		if (!cw->cw_slab) {
+			mpool_mblock_writer_abort(cw->cw_w);
+			cw->cw_w = NULL;
+			return merr(ENOMEM);
+		}
+	}
+
+	slab = cw->cw_slab;
+
+	if (roundup(len, PAGE_SIZE) > slab->sl_cap)
+		return merr(EFBIG);
+
+	err = mpool_mblock_writer_append(cw->cw_w, data, len);
+	if (!err)
+		err = mp_slab_ent_push(slab, slab->sl_len, len);
+	if (err)
+		return err;
+
+	obj->mso_mbid = slab->sl_mbid;
+	obj->mso_off = slab->sl_len;
+	obj->mso_len = len;
+
+	slab->sl_len += len;
+
+	return 0;
+}
+
+/**
+ * mp_slab_collect() - Pick the compaction victims and list their live objects
+ * @ms:        slab store
+ * @victimvp:  victims, grown as needed (input/output)
+ * @victimcp:  number of victims (input/output)
+ * @relocvp:   relocations, grown as needed (input/output)
+ * @reloccp:   number of relocations (input/output)
+ *
+ * The victims are marked busy, which keeps them and their maps around
+ * until the end of the compaction, so that their objects can be copied
+ * without the store lock.
+ *
+ * Called with the store lock held.
+ */
+static merr_t
+mp_slab_collect(
+	struct mpool_slab      *ms,
+	struct mp_slab       ***victimvp,
+	u32                    *victimcp,
+	struct mp_slab_reloc  **relocvp,
+	u32                    *reloccp)
+{
+	struct mp_slab_reloc   *relocv = NULL, *r;
+	struct mp_slab        **victimv = NULL, **vv;
+	struct mp_slab         *victim;
+	struct mp_slab_ent      ent;
+	const char             *base;
+	merr_t                  err = 0;
+	u32                     victimc = 0, victimmax = 0;
+	u32                     relocc = 0, relocmax = 0, i;
+
+	/* Busy victims are not picked again. */
+	while ((victim = mp_slab_victim(ms))) {
+		if (victimc == victimmax) {
+			u32 n = max_t(u32, victimmax * 2, 16);
+
+			vv = realloc(victimv, n * sizeof(*victimv));
+			if (!vv) {
+				err = merr(ENOMEM);
+				break;
+			}
+			victimv = vv;
+			victimmax = n;
+		}
+
+		err = mp_slab_base(ms, victim, &base);
+		if (err)
+			break;
+
+		victim->sl_busy = true;
+		victimv[victimc++] = victim;
+
+		for (i = 0; i < victim->sl_entc; i++) {
+			ent = victim->sl_entv[i];
+			if (ent.se_len & MP_SLAB_DEAD)
+				continue;
+
+			if (relocc == relocmax) {
+				u32 n = max_t(u32, relocmax * 2, 256);
+
+				r = realloc(relocv, n * sizeof(*relocv));
+				if (!r) {
+					err = merr(ENOMEM);
+					break;
+				}
+				relocv = r;
+				relocmax = n;
+			}
+
+			r = relocv + relocc++;
+			r->sr_old.mso_mbid = victim->sl_mbid;
+			r->sr_old.mso_off = ent.se_off;
+			r->sr_old.mso_len = ent.se_len;
+			r->sr_src = base + ent.se_off;
+		}
+
+		if (err)
+			break;
+	}
+
+	*victimvp = victimv;
+	*victimcp = victimc;
+	*relocvp = relocv;
+	*reloccp = relocc;
+
+	return err;
+}
+
+/**
+ * mp_slab_compact_locked() - Compact all slabs that are dead enough
+ * @ms: slab store
+ *
+ * The live objects of the victims are listed under the store lock, then
+ * copied without it into slabs of their own, which are all sealed before
+ * any new handle is handed over.  The copies of all victims are packed
+ * together, so that compaction does not itself leave behind partially
+ * filled slabs, nor holds up mpool_slab_put() while it writes.
+ *
+ * Called with ms_cmlock held.
+ */
+static merr_t mp_slab_compact_locked(struct mpool_slab *ms)
+{
+	struct mp_slab_reloc   *relocv = NULL;
+	struct mp_slab        **victimv = NULL;
+	struct mp_slab         *victim;
+	struct mp_slab_cw       cw = { };
+	merr_t                  err;
+	bool                    accepted;
+	u32                     relocc = 0, victimc = 0, copyc = 0, i;
+
+	mutex_lock(&ms->ms_lock);
+	err = mp_slab_collect(ms, &victimv, &victimc, &relocv, &relocc);
+	mutex_unlock(&ms->ms_lock);
+
+	/* The new handle of a failed copy is not set, it must not be killed. */
+	while (!err && copyc < relocc) {
+		err = mp_slab_cw_append(ms, &cw, relocv[copyc].sr_src,
+					relocv[copyc].sr_old.mso_len, &relocv[copyc].sr_new);
+		if (!err)
+			copyc++;
+	}
+
+	/* The copies must be readable before they are handed over. */
+	if (!err)
+		err = mp_slab_cw_seal(ms, &cw);
+	if (err) {
+		mp_slab_cw_abort(&cw);
+
+		/* Copies in slabs that were not sealed are not found. */
+		mutex_lock(&ms->ms_lock);
+		for (i = 0; i < copyc; i++)
+			mp_slab_kill(ms, &relocv[i].sr_new);
+
+		for (i = 0; i < victimc; i++)
+			victimv[i]->sl_busy = false;
+		mutex_unlock(&ms->ms_lock);
+
+		free(victimv);
+		free(relocv);
+
+		return err;
+	}
+
+	for (i = 0; i < relocc; i++) {
+		mutex_lock(&ms->ms_lock);
+		victim = mp_slab_lookup(ms, relocv[i].sr_old.mso_mbid);
+		accepted = victim && mp_slab_ent_find(victim, &relocv[i].sr_old);
+		mutex_unlock(&ms->ms_lock);
+
+		/* The client may have deleted the object while it was copied. */
+		if (accepted)
+			accepted = ms->ms_remap(ms->ms_arg, &relocv[i].sr_old, &relocv[i].sr_new);
+
+		mutex_lock(&ms->ms_lock);
+		if (accepted)
+			ms->ms_stats.mss_relocated++;
+		else
+			mp_slab_kill(ms, &relocv[i].sr_new);
+
+		/* A rejected object is not referenced by the client anymore. */
+		mp_slab_kill(ms, &relocv[i].sr_old);
+		mutex_unlock(&ms->ms_lock);
+	}
+
+	mutex_lock(&ms->ms_lock);
+	for (i = 0; i < victimc; i++) {
+		victim = victimv[i];
+		victim->sl_busy = false;
+		ms->ms_stats.mss_compacted++;
+		if (!victim->sl_livec)
+			mp_slab_release(ms, victim, true);
+	}
+	mutex_unlock(&ms->ms_lock);
+
+	free(victimv);
+	free(relocv);
+
+	return 0;
+}
+
+static merr_t mp_slab_compact(struct mpool_slab *ms)
+{
+	merr_t err;
+
+	mutex_lock(&ms->ms_cmlock);
+	err = mp_slab_compact_locked(ms);
+	mutex_unlock(&ms->ms_cmlock);
+
+	return err;
+}
+
+static void *mp_slab_main(void *arg)
+{
+	struct mpool_slab  *ms = arg;
+	struct timespec     ts;
+	u64                 deadline;
+
+	mutex_lock(&ms->ms_lock);
+	while (!ms->ms_stop) {
+		deadline = mp_slab_now_ms() + ms->ms_params.msp_period_ms;
+		ts.tv_sec = deadline / 1000;
+		ts.tv_nsec = (deadline % 1000) * 1000000;
+
+		while (!ms->ms_stop && mp_slab_now_ms() < deadline)
+			pthread_cond_timedwait(&ms->ms_cv, &ms->ms_lock.pth_mutex, &ts);
+
+		if (ms->ms_stop)
+			break;
+
+		mp_slab_bury(ms, false);
+		mutex_unlock(&ms->ms_lock);
+
+		mp_slab_compact(ms);
+
+		mutex_lock(&ms->ms_lock);
+	}
+	mutex_unlock(&ms->ms_lock);
+
+	return NULL;
+}
+
+void mpool_slab_params_init(struct mpool_slab_params *params)
+{
+	memset(params, 0, sizeof(*params));
+
+	params->msp_dead_pct = MP_SLAB_DEAD_PCT_DEFAULT;
+	params->msp_period_ms = MP_SLAB_PERIOD_MS_DEFAULT;
+}
+
+mpool_err_t
+mpool_slab_open(
+	struct mpool                   *mp,
+	enum mp_media_classp            mclassp,
+	const struct mpool_slab_params *params,
+	mpool_slab_remap_fn            *remap,
+	void                           *arg,
+	struct mpool_slab             **msp)
+{
+	pthread_condattr_t  attr;
+	struct mpool_slab  *ms;
+	int                 rc;
+
+	if (!mp || !msp || mclassp >= MP_MED_NUMBER)
+		return merr(EINVAL);
+
+	if (params && (params->msp_dead_pct > 100 || !params->msp_period_ms))
+		return merr(EINVAL);
+
+	*msp = NULL;
+
+	ms = calloc(1, sizeof(*ms));
+	if (!ms)
+		return merr(ENOMEM);
+
+	ms->ms_mp = mp;
+	ms->ms_mclassp = mclassp;
+	ms->ms_remap = remap;
+	ms->ms_arg = arg;
+
+	if (params)
+		ms->ms_params = *params;
+	else
+		mpool_slab_params_init(&ms->ms_params);
+
+	mutex_init(&ms->ms_cmlock);
+	mutex_init(&ms->ms_lock);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ms->ms_cv, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (remap && ms->ms_params.msp_dead_pct > 0) {
+		rc = pthread_create(&ms->ms_tid, NULL, mp_slab_main, ms);
+		if (rc) {
+			pthread_cond_destroy(&ms->ms_cv);
+			mutex_destroy(&ms->ms_lock);
+			mutex_destroy(&ms->ms_cmlock);
+			free(ms);
+			return merr(rc);
+		}
+
+		ms->ms_started = true;
+	}
+
+	*msp = ms;
+
+	return 0;
+}
+
+mpool_err_t mpool_slab_close(struct mpool_slab *ms)
+{
+	struct mp_slab *slab;
+	merr_t          err;
+	int             i;
+
+	if (!ms)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	ms->ms_stop = true;
+	pthread_cond_signal(&ms->ms_cv);
+	mutex_unlock(&ms->ms_lock);
+
+	if (ms->ms_started)
+		pthread_join(ms->ms_tid, NULL);
+
+	mutex_lock(&ms->ms_lock);
+	err = mp_slab_seal(ms);
+	mp_slab_bury(ms, true);
+
+	for (i = 0; i < MP_SLAB_BKTS; i++) {
+		while ((slab = ms->ms_bktv[i])) {
+			ms->ms_bktv[i] = slab->sl_next;
+			mp_slab_free(slab);
+		}
+	}
+	mutex_unlock(&ms->ms_lock);
+
+	pthread_cond_destroy(&ms->ms_cv);
+	mutex_destroy(&ms->ms_lock);
+	mutex_destroy(&ms->ms_cmlock);
+	free(ms);
+
+	return err;
+}
+
+mpool_err_t
+mpool_slab_putv(struct mpool_slab *ms, const struct iovec *iov, int iovc, struct mpool_slab_obj *objv)
+{
+	merr_t  err = 0;
+	int     i;
+
+	if (!ms || !objv || (!iov && iovc > 0) || iovc < 0)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	for (i = 0; i < iovc && !err; i++)
+		err = mp_slab_append(ms, iov[i].iov_base, iov[i].iov_len, objv + i);
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+mpool_err_t
+mpool_slab_put(struct mpool_slab *ms, const void *data, size_t len, struct mpool_slab_obj *obj)
+{
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+
+	return mpool_slab_putv(ms, &iov, 1, obj);
+}
+
+mpool_err_t mpool_slab_flush(struct mpool_slab *ms)
+{
+	merr_t err;
+
+	if (!ms)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	err = mp_slab_seal(ms);
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+mpool_err_t mpool_slab_get(struct mpool_slab *ms, const struct mpool_slab_obj *obj, const void **datap)
+{
+	struct mp_slab *slab;
+	const char     *base;
+	merr_t          err;
+
+	if (!ms || !obj || !datap)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	slab = mp_slab_lookup(ms, obj->mso_mbid);
+	if (!slab || !mp_slab_ent_find(slab, obj)) {
+		err = merr(ENOENT);
+	} else if (!slab->sl_sealed) {
+		err = merr(EAGAIN);
+	} else {
+		err = mp_slab_base(ms, slab, &base);
+		if (!err)
+			*datap = base + obj->mso_off;
+	}
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+mpool_err_t mpool_slab_del(struct mpool_slab *ms, const struct mpool_slab_obj *obj)
+{
+	merr_t err;
+
+	if (!ms || !obj)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	err = mp_slab_kill(ms, obj);
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+mpool_err_t mpool_slab_attach(struct mpool_slab *ms, const struct mpool_slab_obj *objv, int objc)
+{
+	const struct mpool_slab_obj    *obj;
+	struct mblock_props             props;
+	struct mp_slab                 *slab;
+	merr_t                          err = 0;
+	int                             i;
+
+	if (!ms || (!objv && objc > 0) || objc < 0)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	for (i = 0; i < objc && !err; i++) {
+		obj = objv + i;
+
+		slab = mp_slab_lookup(ms, obj->mso_mbid);
+		if (!slab) {
+			err = mpool_mblock_find(ms->ms_mp, obj->mso_mbid, &props);
+			if (!err && !props.mpr_iscommitted)
+				err = merr(EINVAL);
+			if (err)
+				break;
+
+			slab = mp_slab_create(ms, obj->mso_mbid,
+					      min_t(u64, props.mpr_alloc_cap, MP_SLAB_DEAD));
+			if (!slab) {
+				err = merr(ENOMEM);
+				break;
+			}
+
+			slab->sl_len = props.mpr_write_len;
+			slab->sl_sealed = true;
+		}
+
+		if (!slab->sl_sealed || !obj->mso_len || obj->mso_len >= MP_SLAB_DEAD ||
+		    (u64)obj->mso_off + obj->mso_len > slab->sl_len) {
+			err = merr(EINVAL);
+			break;
+		}
+
+		err = mp_slab_ent_add(ms, slab, obj->mso_off, obj->mso_len);
+		slab->sl_unsorted = true;
+	}
+
+	for (i = 0; i < MP_SLAB_BKTS; i++)
+		for (slab = ms->ms_bktv[i]; slab; slab = slab->sl_next)
+			if (slab->sl_unsorted)
+				mp_slab_sort(ms, slab);
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+mpool_err_t mpool_slab_reclaim(struct mpool_slab *ms, const uint64_t *mbidv, int mbidc)
+{
+	struct mblock_props props;
+	struct mp_slab     *slab;
+	merr_t              err = 0;
+	int                 i;
+
+	if (!ms || (!mbidv && mbidc > 0) || mbidc < 0)
+		return merr(EINVAL);
+
+	/* Slabs written by compaction are not hashed until they are sealed. */
+	mutex_lock(&ms->ms_cmlock);
+	mutex_lock(&ms->ms_lock);
+	for (i = 0; i < mbidc; i++) {
+		slab = mp_slab_lookup(ms, mbidv[i]);
+		if (slab) {
+			if (!slab->sl_livec && slab->sl_sealed && !slab->sl_busy)
+				mp_slab_release(ms, slab, false);
+			continue;
+		}
+
+		for (slab = ms->ms_graves; slab; slab = slab->sl_next)
+			if (slab->sl_mbid == mbidv[i])
+				break;
+
+		if (slab)
+			continue;
+
+		/* The mblock may have been deleted already. */
+		if (mpool_mblock_find(ms->ms_mp, mbidv[i], &props) || !props.mpr_iscommitted)
+			continue;
+
+		err = mpool_mblock_delete_defer(ms->ms_mp, mbidv + i, 1);
+		if (err)
+			break;
+	}
+	mutex_unlock(&ms->ms_lock);
+	mutex_unlock(&ms->ms_cmlock);
+
+	return err;
+}
+
+mpool_err_t mpool_slab_compact(struct mpool_slab *ms)
+{
+	if (!ms || !ms->ms_remap)
+		return merr(EINVAL);
+
+	return mp_slab_compact(ms);
+}
+
+mpool_err_t mpool_slab_stats_get(struct mpool_slab *ms, struct mpool_slab_stats *stats)
+{
+	if (!ms || !stats)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	*stats = ms->ms_stats;
+	mutex_unlock(&ms->ms_lock);
+
+	return 0;
+}
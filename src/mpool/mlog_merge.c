@@ -0,0 +1,348 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mlog merge iterator module.
+ *
+ * Replays the records of several mlogs in a single global order defined by
+ * a caller supplied key (typically an embedded sequence number).  Each input
+ * is read through a small read-ahead window, and the inputs are ordered by
+ * a binary min-heap keyed on the record at the head of each window.  Memory
+ * usage is therefore O(N * window) rather than O(total records).
+ *
+ * The inputs are rewound on open and then only read with mpool_mlog_read(),
+ * so a merge never changes the state of the mlogs beyond their read cursor.
+ */
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MLOG_MERGE_WINDOW_DEFAULT   (64 * 1024)
+
+/*
+ * Records are staged in the read-ahead window prefixed by their length,
+ * and padded so that each header is naturally aligned.
+ */
+#define MLOG_MERGE_HDRSZ            sizeof(u64)
+#define MLOG_MERGE_RECSZ(_len)      (MLOG_MERGE_HDRSZ + roundup((_len), MLOG_MERGE_HDRSZ))
+
+/**
+ * struct mlog_merge_src - per-input state
+ * @ms_mlogh: mlog handle
+ * @ms_buf:   read-ahead window
+ * @ms_bufsz: size of the read-ahead window
+ * @ms_head:  offset of the next buffered record in ms_buf
+ * @ms_tail:  offset of the end of buffered records in ms_buf
+ * @ms_key:   key of the record at ms_head
+ * @ms_eof:   true if all records have been read from the mlog
+ */
+struct mlog_merge_src {
+	struct mpool_mlog  *ms_mlogh;
+	char               *ms_buf;
+	size_t              ms_bufsz;
+	size_t              ms_head;
+	size_t              ms_tail;
+	u64                 ms_key;
+	bool                ms_eof;
+};
+
+/**
+ * struct mpool_mlog_merge - mlog merge iterator
+ * @mm_keyfn:  caller supplied key extractor
+ * @mm_arg:    opaque argument passed to mm_keyfn
+ * @mm_heapc:  number of inputs in the heap that have a buffered record
+ * @mm_heapv:  min-heap of input indices ordered by (ms_key, index)
+ * @mm_srcc:   number of inputs
+ * @mm_srcv:   vector of inputs
+ */
+struct mpool_mlog_merge {
+	mpool_mlog_key_fn      *mm_keyfn;
+	void                   *mm_arg;
+	int                     mm_heapc;
+	int                    *mm_heapv;
+	int                     mm_srcc;
+	struct mlog_merge_src   mm_srcv[];
+};
+
+static inline bool
+mlog_merge_before(struct mpool_mlog_merge *mm, int a, int b)
+{
+	u64 ka = mm->mm_srcv[a].ms_key;
+	u64 kb = mm->mm_srcv[b].ms_key;
+
+	/* Ties are broken by input index so that the merge is stable. */
+	return ka < kb || (ka == kb && a < b);
+}
+
+static void mlog_merge_sift_down(struct mpool_mlog_merge *mm, int i)
+{
+	int *heapv = mm->mm_heapv;
+	int  n = mm->mm_heapc;
+
+	while (true) {
+		int l = 2 * i + 1;
+		int r = l + 1;
+		int m = i;
+		int tmp;
+
+		if (l < n && mlog_merge_before(mm, heapv[l], heapv[m]))
+			m = l;
+		if (r < n && mlog_merge_before(mm, heapv[r], heapv[m]))
+			m = r;
+		if (m == i)
+			break;
+
+		tmp = heapv[i];
+		heapv[i] = heapv[m];
+		heapv[m] = tmp;
+		i = m;
+	}
+}
+
+/**
+ * mlog_merge_fill() - Refill the read-ahead window of an input
+ * @src: input to refill
+ *
+ * Reads as many records as will fit into the window.  A record larger
+ * than the (empty) window causes the window to be grown to fit it.
+ */
+static merr_t mlog_merge_fill(struct mlog_merge_src *src)
+{
+	merr_t  err;
+	size_t  rdlen;
+	char   *rec;
+
+	src->ms_head = src->ms_tail = 0;
+
+	while (!src->ms_eof) {
+		size_t avail = 0;
+
+		if (src->ms_bufsz > src->ms_tail + MLOG_MERGE_HDRSZ)
+			avail = src->ms_bufsz - src->ms_tail - MLOG_MERGE_HDRSZ;
+
+		if (avail == 0)
+			break;
+
+		rec = src->ms_buf + src->ms_tail;
+
+		err = mpool_mlog_read(src->ms_mlogh, rec + MLOG_MERGE_HDRSZ, avail, &rdlen);
+		if (err) {
+			size_t  bufsz;
+			char   *buf;
+
+			if (merr_errno(err) != EOVERFLOW)
+				return err;
+
+			/* The record stays put until read with a larger buffer. */
+			if (src->ms_tail > 0)
+				break;
+
+			bufsz = roundup(MLOG_MERGE_RECSZ(rdlen), PAGE_SIZE);
+
+			buf = aligned_alloc(PAGE_SIZE, bufsz);
+			if (!buf)
+				return merr(ENOMEM);
+
+			free(src->ms_buf);
+			src->ms_buf = buf;
+			src->ms_bufsz = bufsz;
+			continue;
+		}
+
+		/* mpool_mlog_read() returns a zero length at end of log. */
+		if (rdlen == 0) {
+			src->ms_eof = true;
+			break;
+		}
+
+		*(u64 *)rec = rdlen;
+		src->ms_tail += MLOG_MERGE_RECSZ(rdlen);
+	}
+
+	return 0;
+}
+
+/**
+ * mlog_merge_advance() - Position an input on its next record
+ * @mm:  merge iterator
+ * @idx: input index
+ * @more: set to true if the input has a record (output)
+ */
+static merr_t mlog_merge_advance(struct mpool_mlog_merge *mm, int idx, bool *more)
+{
+	struct mlog_merge_src  *src = mm->mm_srcv + idx;
+	merr_t                  err;
+	char                   *rec;
+
+	*more = false;
+
+	if (src->ms_head >= src->ms_tail) {
+		err = mlog_merge_fill(src);
+		if (err)
+			return err;
+
+		if (src->ms_head >= src->ms_tail)
+			return 0;
+	}
+
+	rec = src->ms_buf + src->ms_head;
+	src->ms_key = mm->mm_keyfn(rec + MLOG_MERGE_HDRSZ, *(u64 *)rec, mm->mm_arg);
+
+	*more = true;
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mlog_merge_open(
+	struct mpool_mlog         **mlogv,
+	int                         mlogc,
+	mpool_mlog_key_fn          *keyfn,
+	void                       *arg,
+	size_t                      winsz,
+	struct mpool_mlog_merge   **mmp)
+{
+	struct mpool_mlog_merge    *mm;
+	merr_t                      err = 0;
+	int                         i;
+
+	if (!mlogv || mlogc < 1 || !keyfn || !mmp)
+		return merr(EINVAL);
+
+	*mmp = NULL;
+
+	winsz = roundup(winsz ?: MLOG_MERGE_WINDOW_DEFAULT, PAGE_SIZE);
+
+	mm = calloc(1, sizeof(*mm) + mlogc * sizeof(mm->mm_srcv[0]));
+	if (!mm)
+		return merr(ENOMEM);
+
+	mm->mm_heapv = calloc(mlogc, sizeof(*mm->mm_heapv));
+	if (!mm->mm_heapv) {
+		free(mm);
+		return merr(ENOMEM);
+	}
+
+	mm->mm_keyfn = keyfn;
+	mm->mm_arg = arg;
+	mm->mm_srcc = mlogc;
+
+	for (i = 0; i < mlogc; i++) {
+		struct mlog_merge_src *src = mm->mm_srcv + i;
+
+		if (!mlogv[i]) {
+			err = merr(EINVAL);
+			break;
+		}
+
+		src->ms_mlogh = mlogv[i];
+		src->ms_bufsz = winsz;
+
+		src->ms_buf = aligned_alloc(PAGE_SIZE, winsz);
+		if (!src->ms_buf) {
+			err = merr(ENOMEM);
+			break;
+		}
+
+		err = mpool_mlog_rewind(src->ms_mlogh);
+		if (err)
+			break;
+	}
+
+	/* Prime each input and build the heap from those that have records. */
+	for (i = 0; !err && i < mlogc; i++) {
+		bool more;
+
+		err = mlog_merge_advance(mm, i, &more);
+		if (!err && more)
+			mm->mm_heapv[mm->mm_heapc++] = i;
+	}
+
+	if (err) {
+		mpool_mlog_merge_close(mm);
+		return err;
+	}
+
+	for (i = mm->mm_heapc / 2 - 1; i >= 0; i--)
+		mlog_merge_sift_down(mm, i);
+
+	*mmp = mm;
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mlog_merge_next(
+	struct mpool_mlog_merge    *mm,
+	void                       *data,
+	size_t                      len,
+	size_t                     *rdlen,
+	int                        *srcp)
+{
+	struct mlog_merge_src  *src;
+	merr_t                  err;
+	size_t                  reclen;
+	char                   *rec;
+	bool                    more;
+	int                     idx;
+
+	if (!mm || !rdlen)
+		return merr(EINVAL);
+
+	if (mm->mm_heapc == 0) {
+		*rdlen = 0;
+		if (srcp)
+			*srcp = -1;
+		return 0;
+	}
+
+	idx = mm->mm_heapv[0];
+	src = mm->mm_srcv + idx;
+
+	rec = src->ms_buf + src->ms_head;
+	reclen = *(u64 *)rec;
+
+	*rdlen = reclen;
+	if (len < reclen)
+		return merr(EOVERFLOW);
+
+	if (reclen > 0 && !data)
+		return merr(EINVAL);
+
+	memcpy(data, rec + MLOG_MERGE_HDRSZ, reclen);
+	if (srcp)
+		*srcp = idx;
+
+	src->ms_head += MLOG_MERGE_RECSZ(reclen);
+
+	err = mlog_merge_advance(mm, idx, &more);
+	if (err)
+		return err;
+
+	if (!more)
+		mm->mm_heapv[0] = mm->mm_heapv[--mm->mm_heapc];
+
+	mlog_merge_sift_down(mm, 0);
+
+	return 0;
+}
+
+void mpool_mlog_merge_close(struct mpool_mlog_merge *mm)
+{
+	int i;
+
+	if (!mm)
+		return;
+
+	for (i = 0; i < mm->mm_srcc; i++)
+		free(mm->mm_srcv[i].ms_buf);
+
+	free(mm->mm_heapv);
+	free(mm);
+}
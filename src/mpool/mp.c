@@ -54,7 +54,7 @@ mpool_dev_init_all(
 		return merr(EINVAL);
 
 	for (idx = 0; idx < dcnt; idx++, pd_prop++) {
-		err = pd_file_open(dpaths[idx], &pdv[idx].pdi_parm);
+		err = pd_file_open(dpaths[idx], 0, &pdv[idx].pdi_parm);
 		if (err) {
 			mpool_devrpt(devrpt, MPOOL_RC_ERRMSG, -1,
 				     "Getting device %s params, open failed %d",
@@ -184,7 +184,7 @@ void mpool_devrpt(struct mpool_devrpt *devrpt, enum mpool_rc rcode, int off, con
 	}
 }
 
-struct mpool_descriptor *mpool_user_desc_alloc(char *mpname)
+struct mpool_descriptor *mpool_user_desc_alloc(const char *mpname)
 {
 	struct mpool_descriptor    *mp;
 
@@ -27,7 +27,20 @@
 #include "device_table.h"
 #include <mpcore/mpcore_defs.h>
 
+#include "advisor.h"
+#include "hotset.h"
 #include "logging.h"
+#include "mapcache.h"
+#include "mbbatch.h"
+#include "mbio.h"
+#include "mbpool.h"
+#include "objcache.h"
+#include "probecache.h"
+#include "rdcache.h"
+#include "readahead.h"
+#include "residency.h"
+#include "tier.h"
+#include "workers.h"
 
 #include <libgen.h>
 #include <dirent.h>
@@ -44,14 +57,23 @@
  * This is the userland metadata for mcachefs maps.
  */
 struct mpool_mcache_map {
+	struct mpool *mh_mp;    /* mpool handle of the map */
 	size_t  mh_bktsz;       /* mcache map file bucket size */
 	void   *mh_addr;        /* mcache map file base mmap addr if mmapped */
 	int     mh_mbidc;       /* number of mblock IDs in mcache map file */
+	u64    *mh_mbidv;       /* mblock IDs of the map, in map order */
 	int     mh_fd;
 	off_t   mh_offset;
 	size_t  mh_len;
+	struct mp_mapcache_ent mh_ent;  /* map cache entry */
+	bool    mh_cached;      /* map is shared through the map cache */
+	struct mp_advisor_ent  mh_adv;  /* mcache advisor entry */
 };
 
+static merr_t mcache_map_free(void *priv);
+static void mcache_map_record(struct mp_advisor_ent *ent, void *arg);
+static void mcache_hotset_save(struct mpool *mp);
+
 struct devrpt_tab {
 	enum mpool_rc   rcode;
 	const char     *msg;
@@ -299,6 +321,7 @@ mp_sb_erase(int devicec, char **devicev, struct mpool_devrpt *devrpt, char *pool
 		goto exit;
 
 	err = mpool_sb_erase(devicec, devicev, pd_prop, devrpt);
+	mp_probe_cache_purge();
 	if (err)
 		goto exit;
 
@@ -534,6 +557,7 @@ mpool_mclass_add(
 		return err;
 
 	err = mpool_ioctl(mp->mp_fd, MPIOC_DRV_ADD, &drv);
+	mp_probe_cache_purge();
 
 out:
 	mpool_close(mp);
@@ -675,6 +699,7 @@ mpool_create(
 	}
 
 	err = mpool_ioctl(fd, MPIOC_MP_CREATE, &mp);
+	mp_probe_cache_purge();
 	if (!err) {
 		if (!params || params->mp_mode != -1 ||
 		    params->mp_uid != -1 || params->mp_gid != -1)
@@ -739,6 +764,7 @@ mpool_err_t mpool_destroy(const char *mpname, uint32_t flags, struct mpool_devrp
 	mp.mp_flags = flags;
 
 	err = mpool_ioctl(fd, MPIOC_MP_DESTROY, &mp);
+	mp_probe_cache_purge();
 
 errout:
 	free(mp.mp_pd_prop);
@@ -908,18 +934,40 @@ mpool_err_t mpool_params_get(struct mpool *mp, struct mpool_params *params, stru
 {
 	struct mpioc_params get = { };
 	merr_t              err;
+	u64                 gen = 0;
 
 	mpool_devrpt_init(ei);
 
 	if (!mp || !params)
 		return merr(EINVAL);
 
+	if (mp->mp_objcache) {
+		mutex_lock(&mp->mp_lock);
+		if (mp->mp_params_valid) {
+			*params = mp->mp_params;
+			mutex_unlock(&mp->mp_lock);
+			return 0;
+		}
+		gen = mp->mp_params_gen;
+		mutex_unlock(&mp->mp_lock);
+	}
+
 	err = mpool_ioctl(mp->mp_fd, MPIOC_PARAMS_GET, &get);
 	if (err) {
 		mpool_devrpt(ei, MPOOL_RC_PARM, -1, mp->mp_name);
 		return err;
 	}
 
+	/* Params set since they were read must not be cached. */
+	if (mp->mp_objcache) {
+		mutex_lock(&mp->mp_lock);
+		if (gen == mp->mp_params_gen) {
+			mp->mp_params = get.mps_params;
+			mp->mp_params_valid = true;
+		}
+		mutex_unlock(&mp->mp_lock);
+	}
+
 	*params = get.mps_params;
 
 	return 0;
@@ -942,6 +990,13 @@ mpool_err_t mpool_params_set(struct mpool *mp, struct mpool_params *params, stru
 	set.mps_params = *params;
 
 	err = mpool_ioctl(mp->mp_fd, MPIOC_PARAMS_SET, &set);
+
+	/* Even a failed set may have changed some params. */
+	mutex_lock(&mp->mp_lock);
+	mp->mp_params_valid = false;
+	mp->mp_params_gen++;
+	mutex_unlock(&mp->mp_lock);
+
 	if (err) {
 		mpool_devrpt(ei, MPOOL_RC_PARM, -1, mp->mp_name);
 		return err;
@@ -1013,6 +1068,72 @@ mpool_err_t mpool_dev_props_get(struct mpool *mp, const char *devname, struct mp
 	return err;
 }
 
+/**
+ * mp_activate_entries() - Activate an mpool from its discovered member devices
+ * @fd:        mpool control device
+ * @mp:        activate request, of which mp_params is initialized
+ * @entry:     member devices
+ * @entry_cnt: number of member devices
+ * @dpaths:    device paths of the member devices, separated by '\n'
+ * @flags:     mpool management flags
+ * @params:    mpool parameters of the activated mpool (output, may be NULL)
+ * @ei:        error detail
+ */
+static merr_t
+mp_activate_entries(
+	int                     fd,
+	struct mpioc_mpool     *mp,
+	struct imp_entry       *entry,
+	int                     entry_cnt,
+	char                  **dpaths,
+	u32                     flags,
+	struct mpool_params    *params,
+	struct mpool_devrpt    *ei)
+{
+	merr_t  err;
+	int     i;
+
+	/* Turn off write throttling on the PDs */
+	for (i = 0; i < entry_cnt; i++) {
+		err = sysfs_pd_disable_wbt(entry[i].mp_path);
+		if (err)
+			return err;
+	}
+
+	/*
+	 * If that fail for a device, this device is removed from the devices
+	 * used to activate the mpool.
+	 */
+	mp->mp_pd_prop = imp_entries2pd_prop(entry_cnt, entry);
+	if (!mp->mp_pd_prop) {
+		mpool_devrpt(ei, MPOOL_RC_ENOMEM, -1, "imp_entries2pd_prop");
+		return merr(ENOMEM);
+	}
+
+	mp->mp_dpathc = entry_cnt;
+	mp->mp_dpaths = dpaths[0];
+	mp->mp_dpathssz = strlen(dpaths[0]) + 1; /* trailing NUL */
+	mp->mp_flags = flags;
+
+	strlcpy(mp->mp_params.mp_name, entry->mp_name, sizeof(mp->mp_params.mp_name));
+
+	err = mpool_ioctl(fd, MPIOC_MP_ACTIVATE, mp);
+	if (!err) {
+		err = mpool_ugm_check(entry->mp_name, -1, &mp->mp_params);
+
+		if (params)
+			*params = mp->mp_params;
+
+		if (!err)
+			mpool_rundir_create(entry->mp_name);
+	}
+
+	free(mp->mp_pd_prop);
+	mp->mp_pd_prop = NULL;
+
+	return err;
+}
+
 mpool_err_t
 mpool_activate(const char *mpname, struct mpool_params *params, u32 flags, struct mpool_devrpt *ei)
 {
@@ -1020,7 +1141,7 @@ mpool_activate(const char *mpname, struct mpool_params *params, u32 flags, struc
 	struct imp_entry   *entry;
 
 	char   **dpaths;
-	int      fd, i;
+	int      fd;
 	merr_t   err;
 	int      entry_cnt;
 
@@ -1050,49 +1171,180 @@ mpool_activate(const char *mpname, struct mpool_params *params, u32 flags, struc
 		return err;
 	}
 
-	/* Turn off write throttling on the PDs */
-	for (i = 0; i < entry_cnt; i++) {
-		err = sysfs_pd_disable_wbt(entry[i].mp_path);
-		if (err)
-			goto errout;
+	err = mp_activate_entries(fd, &mp, entry, entry_cnt, dpaths, flags, params, ei);
+
+	free(entry);
+	free(dpaths);
+	close(fd);
+
+	return err;
+}
+
+#define MP_ACTIVATE_THREADS_MAX 8
+#define NSEC_PER_SEC            1000000000ull
+
+/**
+ * struct mp_activate_work - pools shared by the activation threads
+ * @maw_fd:     mpool control device
+ * @maw_flags:  mpool management flags
+ * @maw_entryv: member devices of all the pools, grouped by pool
+ * @maw_offv:   index in maw_entryv of the first device of each pool
+ * @maw_resv:   per-pool results, indexed like maw_offv
+ * @maw_resc:   number of pools
+ * @maw_next:   index of the next pool to activate
+ */
+struct mp_activate_work {
+	int                             maw_fd;
+	u32                             maw_flags;
+	struct imp_entry               *maw_entryv;
+	int                            *maw_offv;
+	struct mpool_activate_result   *maw_resv;
+	int                             maw_resc;
+	atomic_t                        maw_next;
+};
+
+static u64 mp_activate_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int mp_activate_cmp(const void *lhs, const void *rhs)
+{
+	const struct imp_entry *l = lhs, *r = rhs;
+	int                     rc;
+
+	rc = memcmp(&l->mp_uuid, &r->mp_uuid, sizeof(l->mp_uuid));
+
+	return rc ?: strcmp(l->mp_path, r->mp_path);
+}
+
+static void mp_activate_one(struct mp_activate_work *work, int i)
+{
+	struct mpool_activate_result   *res = work->maw_resv + i;
+	struct imp_entry               *entry = work->maw_entryv + work->maw_offv[i];
+	struct mpioc_mpool              mp = { };
+
+	char  **dpaths;
+	u64     start;
+	merr_t  err;
+
+	if (imp_mpool_activated(res->mar_name)) {
+		res->mar_active = true;
+		return;
 	}
 
-	/*
-	 * If that fail for a device, this device is removed from the devices
-	 * used to activate the mpool.
-	 */
-	mp.mp_pd_prop = imp_entries2pd_prop(entry_cnt, entry);
-	if (!mp.mp_pd_prop) {
-		mpool_devrpt(ei, MPOOL_RC_ENOMEM, -1, "imp_entries2pd_prop");
+	if (res->mar_devc > MPOOL_DRIVES_MAX) {
+		res->mar_err = merr(E2BIG);
+		return;
+	}
+
+	start = mp_activate_now();
+
+	mpool_params_init(&mp.mp_params);
+
+	err = mpool_transmogrify(&dpaths, entry, '\n', res->mar_devc);
+	if (!err) {
+		err = mp_activate_entries(work->maw_fd, &mp, entry, res->mar_devc, dpaths,
+					  work->maw_flags, NULL, &res->mar_devrpt);
+		free(dpaths);
+	}
+
+	res->mar_err = err;
+	res->mar_nsec = mp_activate_now() - start;
+}
+
+static void *mp_activate_worker(void *arg)
+{
+	struct mp_activate_work    *work = arg;
+	int                         i;
+
+	while ((i = atomic_inc_return(&work->maw_next) - 1) < work->maw_resc)
+		mp_activate_one(work, i);
+
+	return NULL;
+}
+
+mpool_err_t
+mpool_activate_all(
+	u32                             flags,
+	int                            *rescp,
+	struct mpool_activate_result  **resvp,
+	struct mpool_devrpt            *ei)
+{
+	struct mpool_activate_result   *resv = NULL, *res;
+	struct mp_activate_work         work = { };
+	struct imp_entry               *entryv = NULL;
+
+	int    *offv = NULL;
+	int     entryc = 0, resc = 0, i;
+	merr_t  err;
+
+	mpool_devrpt_init(ei);
+
+	if (!rescp || !resvp)
+		return merr(EINVAL);
+
+	*rescp = 0;
+	*resvp = NULL;
+
+	/* Discover the member devices of all the mpools at once. */
+	err = imp_entries_get(NULL, NULL, NULL, &flags, &entryv, &entryc);
+	if (err || entryc == 0)
+		return err;
+
+	qsort(entryv, entryc, sizeof(*entryv), mp_activate_cmp);
+
+	resv = calloc(entryc, sizeof(*resv));
+	offv = calloc(entryc, sizeof(*offv));
+	if (!resv || !offv) {
+		mpool_devrpt(ei, MPOOL_RC_ENOMEM, -1, __func__);
 		err = merr(ENOMEM);
 		goto errout;
 	}
 
-	mp.mp_dpathc = entry_cnt;
-	mp.mp_dpaths = dpaths[0];
-	mp.mp_dpathssz = strlen(dpaths[0]) + 1; /* trailing NUL */
-	mp.mp_flags = flags;
+	for (i = 0; i < entryc; i++) {
+		if (i == 0 || memcmp(&entryv[i].mp_uuid, &entryv[i - 1].mp_uuid,
+				     sizeof(entryv[i].mp_uuid))) {
+			res = resv + resc;
+			offv[resc++] = i;
 
-	strlcpy(mp.mp_params.mp_name, entry->mp_name, sizeof(mp.mp_params.mp_name));
+			strlcpy(res->mar_name, entryv[i].mp_name, sizeof(res->mar_name));
+			memcpy(&res->mar_poolid, &entryv[i].mp_uuid, MPOOL_UUID_SIZE);
+		}
 
-	err = mpool_ioctl(fd, MPIOC_MP_ACTIVATE, &mp);
-	if (err)
+		resv[resc - 1].mar_devc++;
+	}
+
+	work.maw_fd = open(MPC_DEV_CTLPATH, O_RDWR | O_CLOEXEC);
+	if (-1 == work.maw_fd) {
+		err = merr(errno);
+		mpool_devrpt(ei, MPOOL_RC_OPEN, -1, MPC_DEV_CTLPATH);
 		goto errout;
+	}
 
-	err = mpool_ugm_check(entry->mp_name, -1, &mp.mp_params);
+	work.maw_flags = flags;
+	work.maw_entryv = entryv;
+	work.maw_offv = offv;
+	work.maw_resv = resv;
+	work.maw_resc = resc;
+	atomic_set(&work.maw_next, 0);
 
-	if (params)
-		*params = mp.mp_params;
+	mp_run_workers(mp_activate_worker, &work, mp_workers_io(MP_ACTIVATE_THREADS_MAX, resc));
 
-	if (!err)
-		mpool_rundir_create(entry->mp_name);
+	close(work.maw_fd);
+
+	*rescp = resc;
+	*resvp = resv;
+	resv = NULL;
 
 errout:
-	if (mp.mp_pd_prop)
-		free(mp.mp_pd_prop);
-	free(entry);
-	free(dpaths);
-	close(fd);
+	free(offv);
+	free(resv);
+	free(entryv);
 
 	return err;
 }
@@ -1215,6 +1467,7 @@ mpool_rename(const char *oldmp, const char *newmp, uint32_t flags, struct mpool_
 	mp.mp_flags = flags;
 
 	err = mpool_ioctl(fd, MPIOC_MP_RENAME, &mp);
+	mp_probe_cache_purge();
 
 	close(fd);
 
@@ -1278,7 +1531,7 @@ mpool_open(const char *mp_name, uint32_t flags, struct mpool **mpp, struct mpool
 
 	char    path[PATH_MAX];
 	merr_t  err;
-	int     rc;
+	int     rc, i;
 
 	if (!mp_name || !mpp)
 		return merr(EINVAL);
@@ -1288,10 +1541,19 @@ mpool_open(const char *mp_name, uint32_t flags, struct mpool **mpp, struct mpool
 	if (rc < 0 || rc >= sizeof(path))
 		return merr(ENAMETOOLONG);
 
-	mp = calloc(1, sizeof(*mp));
+	mp = aligned_alloc(__alignof__(*mp), sizeof(*mp));
 	if (!mp)
 		return merr(ENOMEM);
 
+	memset(mp, 0, sizeof(*mp));
+
+	/* Allocate and init mpool descriptor shared by all user space mlogs */
+	mp->mp_desc = mpool_user_desc_alloc(mp_name);
+	if (!mp->mp_desc) {
+		free(mp);
+		return merr(ENOMEM);
+	}
+
 	if (!flags)
 		flags = O_RDWR;
 
@@ -1301,10 +1563,53 @@ mpool_open(const char *mp_name, uint32_t flags, struct mpool **mpp, struct mpool
 	if (-1 == mp->mp_fd) {
 		err = merr(errno);
 		mpool_devrpt(ei, MPOOL_RC_OPEN, -1, path);
+		mpool_user_desc_free(mp->mp_desc);
+		free(mp);
+		return err;
+	}
+
+	mpool_client_params_init(&mp->mp_cparams);
+
+	err = mp_objcache_create(mp->mp_cparams.mcp_objcache_max, &mp->mp_objcache);
+	if (!err)
+		err = mp_mbio_create(mp, mp->mp_cparams.mcp_iodepth, &mp->mp_mbio);
+	if (!err && mp->mp_cparams.mcp_mbpool_hiwat > 0)
+		err = mp_mbpool_create(mp, mp->mp_cparams.mcp_mbpool_lowat,
+				       mp->mp_cparams.mcp_mbpool_hiwat, &mp->mp_mbpool);
+	if (!err && mp->mp_cparams.mcp_ra_max > 0)
+		err = mp_ra_create(mp, mp->mp_cparams.mcp_ra_max, &mp->mp_ra);
+	if (!err && mp->mp_cparams.mcp_rdcache_sz > 0)
+		err = mp_rdcache_create(mp->mp_cparams.mcp_rdcache_sz, &mp->mp_rdcache);
+	if (!err)
+		err = mp_delq_create(mp, mp->mp_cparams.mcp_delq_rate, &mp->mp_delq);
+	if (!err)
+		err = mp_tier_create(mp, &mp->mp_tier);
+	if (!err)
+		err = mp_mapcache_create(mp->mp_cparams.mcp_mapcache_sz, mcache_map_free,
+					 &mp->mp_mapcache);
+	if (!err)
+		err = mp_advisor_create(mp, &mp->mp_advisor);
+	if (!err)
+		err = mp_hotset_create(mp->mp_cparams.mcp_hotset_max, &mp->mp_hotset);
+	if (err) {
+		mp_advisor_destroy(mp->mp_advisor);
+		mp_mapcache_destroy(mp->mp_mapcache);
+		mp_tier_destroy(mp->mp_tier);
+		mp_delq_destroy(mp->mp_delq);
+		mp_rdcache_destroy(mp->mp_rdcache);
+		mp_ra_destroy(mp->mp_ra);
+		mp_mbpool_destroy(mp->mp_mbpool);
+		mp_mbio_destroy(mp->mp_mbio);
+		mp_objcache_destroy(mp->mp_objcache);
+		close(mp->mp_fd);
+		mpool_user_desc_free(mp->mp_desc);
 		free(mp);
 		return err;
 	}
 
+	for (i = 0; i < MLOG_HMAP_STRIPES; i++)
+		mutex_init(&mp->mp_mlmap[i].mlm_lock);
+
 	mp->mp_magic = MPC_MPOOL_MAGIC;
 	mutex_init(&mp->mp_lock);
 	mp->mp_flags = flags;
@@ -1327,170 +1632,426 @@ mpool_err_t mpool_close(struct mpool *mp)
 	if (err)
 		return err;
 
-	for (i = 0; i < MAX_OPEN_MLOGS; i++) {
-		if (mp->mp_mlmap[i].mlm_hdl) {
-			mp_release(mp);
-			return merr(EBUSY);
-		}
+	/* Mlogs and mcache maps still in use refer to the handle. */
+	if (atomic_read(&mp->mp_mltot) > 0 || atomic_read(&mp->mp_maptot) > 0) {
+		mp_release(mp);
+		return merr(EBUSY);
 	}
 
 	mp->mp_magic = MPC_NO_MAGIC;
 
+	mp_release(mp);
+
+	/*
+	 * Unmap idle cached maps, save the hot set, stop advising and tiering,
+	 * finish deferred deletes, and abort pooled mblocks while the handle
+	 * is usable.  Unmapping a map records it in the hot set and
+	 * unregisters it from the advisor and from tiering, and tiering
+	 * queues deferred deletes.  Maps still registered with the advisor
+	 * are recorded too, so that the saved hot set does not depend on
+	 * every map having been unmapped first.
+	 */
+	mp_mapcache_destroy(mp->mp_mapcache);
+	mp_advisor_map_walk(mp->mp_advisor, mcache_map_record, NULL);
+	mcache_hotset_save(mp);
+	mp_hotset_destroy(mp->mp_hotset);
+	mp_advisor_destroy(mp->mp_advisor);
+	mp_tier_destroy(mp->mp_tier);
+	mp_delq_destroy(mp->mp_delq);
+	mp_mbpool_destroy(mp->mp_mbpool);
+
+	/* Async I/O completion callbacks may call back into this mpool. */
+	mp_mbio_destroy(mp->mp_mbio);
+
 	close(mp->mp_fd);
 	mp->mp_fd = -1;
 
-	mp_release(mp);
+	for (i = 0; i < MLOG_HMAP_STRIPES; i++)
+		free(mp->mp_mlmap[i].mlm_bktv);
+
+	mp_ra_destroy(mp->mp_ra);
+	mp_rdcache_destroy(mp->mp_rdcache);
+	mp_objcache_destroy(mp->mp_objcache);
+	mpool_user_desc_free(mp->mp_desc);
 	free(mp);
 
 	return 0;
 }
 
-/*
- * Mpctl Mlog interface implementation
- */
-
-/**
- * mlog_hmap_find() - Lookup mlog map for the handle given an object ID
- *
- * @mp:      mpool handle
- * @objid:   object ID
- * @needref: if true, increment refcount on the mlog handle
- * @locked:  is the mp_lock already acquired?
- */
-static struct mpool_mlog *mlog_hmap_find(struct mpool *mp, u64 objid, bool needref, bool locked)
+mpool_err_t mpool_client_params_get(struct mpool *mp, struct mpool_client_params *params)
 {
-	struct mpool_mlog  *mlh;
-	struct mp_mloghmap *mlmap;
-	int                 i;
-
-	mlh = NULL;
-
-	if (!locked && mp_acquire(mp))
-		return NULL;
+	merr_t err;
 
-	for (i = 0; i < MAX_OPEN_MLOGS; i++) {
-		mlmap = &mp->mp_mlmap[i];
-		if (objid == mlmap->mlm_objid) {
-			assert(mlmap->mlm_refcnt > 0);
+	if (!params)
+		return merr(EINVAL);
 
-			if (needref)
-				++mlmap->mlm_refcnt;
+	err = mp_acquire(mp);
+	if (err)
+		return err;
 
-			mlh = mp->mp_mlmap[i].mlm_hdl;
-			assert(mlh != NULL);
-			break;
-		}
-	}
+	*params = mp->mp_cparams;
 
-	if (!locked)
-		mp_release(mp);
+	mp_release(mp);
 
-	return mlh;
+	return 0;
 }
 
-/**
- * mlog_hmap_put_locked() - drop a reference on given mlog handle
- * @mp:      mpool handle
- * @mlogh:   mlog handle
- * @lastref: set to true if the last reference was dropped (output)
+/*
+ * The background threads of an mpool handle use mp_mbio, mp_objcache and
+ * mp_mbpool without mp_lock.  They are kept idle while
+ * mpool_client_params_set() replaces those and destroys the old ones.  The
+ * refill thread of a replaced mblock pool stays paused until the pool is
+ * destroyed.
  */
-static void mlog_hmap_put_locked(struct mpool *mp, struct mpool_mlog *mlogh, bool *lastref)
+static void mp_threads_pause(struct mpool *mp)
 {
-	struct mp_mloghmap *mlmap;
-
-	if (!mp || !mlogh)
-		return;
-
-	mlmap = &mp->mp_mlmap[mlogh->ml_idx];
-	assert(mlmap->mlm_hdl == mlogh);
-	assert(mlmap->mlm_refcnt > 0);
-
-	if (--mlmap->mlm_refcnt > 0)
-		return;
-
-	mp->mp_mlidx = mlogh->ml_idx;
-	--mp->mp_mltot;
-
-	memset(mlmap, 0, sizeof(*mlmap));
-
-	if (lastref)
-		*lastref = true;
+	mp_delq_pause(mp->mp_delq);
+	mp_tier_pause(mp->mp_tier);
+	mp_mbpool_pause(mp->mp_mbpool);
 }
 
-static void mlog_hmap_put(struct mpool *mp, struct mpool_mlog *mlogh, bool *lastref)
+static void mp_threads_resume(struct mpool *mp)
 {
-	if (!mp || !mlogh || mp_acquire(mp))
-		return;
-
-	mlog_hmap_put_locked(mp, mlogh, lastref);
-
-	mp_release(mp);
+	mp_mbpool_resume(mp->mp_mbpool);
+	mp_tier_resume(mp->mp_tier);
+	mp_delq_resume(mp->mp_delq);
 }
 
-/**
- * mlog_hmap_insert() - Insert <objid, mlogh> pair into mlog map
- * @mp:    mpool handle
- * @objid: object ID
- * @mlogh: mlog handle
- */
-static merr_t mlog_hmap_insert(struct mpool *mp, u64 objid, struct mpool_mlog *mlogh)
+mpool_err_t mpool_client_params_set(struct mpool *mp, const struct mpool_client_params *params)
 {
-	struct mp_mloghmap *mlmap;
-	struct mpool_mlog  *dup;
-
-	merr_t err = 0;
-	int    i;
-	u16    nidx;
+	struct mp_objcache *oc = NULL, *old_oc;
+	struct mp_mbio     *mbio = NULL, *old_mbio = NULL;
+	struct mp_rdcache  *rc = NULL, *old_rc = NULL;
+	struct mp_ra       *ra = NULL, *old_ra = NULL;
+	struct mp_mbpool   *mbpool = NULL, *old_mbpool = NULL;
+	bool                mbpool_changed;
+	merr_t              err;
 
-	if (!mp || !mlogh)
+	if (!mp || !params)
 		return merr(EINVAL);
 
-	err = mp_acquire(mp);
-	if (err)
-		return err;
+	mbpool_changed = params->mcp_mbpool_lowat != mp->mp_cparams.mcp_mbpool_lowat ||
+		params->mcp_mbpool_hiwat != mp->mp_cparams.mcp_mbpool_hiwat;
 
-	if (mp->mp_mltot >= MAX_OPEN_MLOGS) {
-		err = merr(ENOSPC);
-		goto exit;
+	if (mbpool_changed && params->mcp_mbpool_hiwat) {
+		err = mp_mbpool_create(mp, params->mcp_mbpool_lowat, params->mcp_mbpool_hiwat,
+				       &mbpool);
+		if (err)
+			return err;
 	}
 
-	dup = mlog_hmap_find(mp, objid, true, true);
-	if (dup) {
-		mlog_hmap_put_locked(mp, dup, NULL);
-		err = merr(EEXIST);
-		goto exit;
+	if (params->mcp_objcache) {
+		err = mp_objcache_create(params->mcp_objcache_max, &oc);
+		if (err) {
+			mp_mbpool_destroy(mbpool);
+			return err;
+		}
 	}
 
-	/* Cache the map in the next free index */
-	nidx  = mp->mp_mlidx;
-	mlmap = &mp->mp_mlmap[nidx];
-	assert(mlmap->mlm_hdl == NULL);
+	if (params->mcp_iodepth != mp->mp_cparams.mcp_iodepth) {
+		err = mp_mbio_create(mp, params->mcp_iodepth, &mbio);
+		if (err) {
+			mp_objcache_destroy(oc);
+			mp_mbpool_destroy(mbpool);
+			return err;
+		}
+	}
 
-	mlmap->mlm_objid  = objid;
-	mlmap->mlm_hdl    = mlogh;
-	mlmap->mlm_refcnt = 1;
+	if (params->mcp_rdcache_sz != mp->mp_cparams.mcp_rdcache_sz && params->mcp_rdcache_sz) {
+		err = mp_rdcache_create(params->mcp_rdcache_sz, &rc);
+		if (err) {
+			mp_mbio_destroy(mbio);
+			mp_objcache_destroy(oc);
+			mp_mbpool_destroy(mbpool);
+			return err;
+		}
+	}
 
-	mlogh->ml_idx = nidx;
+	if (params->mcp_ra_max != mp->mp_cparams.mcp_ra_max && params->mcp_ra_max) {
+		err = mp_ra_create(mp, params->mcp_ra_max, &ra);
+		if (err) {
+			mp_rdcache_destroy(rc);
+			mp_mbio_destroy(mbio);
+			mp_objcache_destroy(oc);
+			mp_mbpool_destroy(mbpool);
+			return err;
+		}
+	}
 
-	if (++mp->mp_mltot == MAX_OPEN_MLOGS)
-		goto exit;
+	mp_threads_pause(mp);
 
-	/* Find next free index */
-	for (i = nidx + 1; ; i++) {
-		i %= MAX_OPEN_MLOGS;
-		if (i == nidx)
-			break;
+	err = mp_acquire(mp);
+	if (err) {
+		mp_threads_resume(mp);
+		mp_ra_destroy(ra);
+		mp_rdcache_destroy(rc);
+		mp_mbio_destroy(mbio);
+		mp_objcache_destroy(oc);
+		mp_mbpool_destroy(mbpool);
+		return err;
+	}
 
-		mlmap = &mp->mp_mlmap[i];
-		if (!mlmap->mlm_hdl) {
-			mp->mp_mlidx = i;
-			goto exit;
-		}
+	old_oc = mp->mp_objcache;
+	mp->mp_objcache = oc;
+	if (mbio) {
+		old_mbio = mp->mp_mbio;
+		mp->mp_mbio = mbio;
 	}
-exit:
+	if (params->mcp_rdcache_sz != mp->mp_cparams.mcp_rdcache_sz) {
+		old_rc = mp->mp_rdcache;
+		mp->mp_rdcache = rc;
+	}
+	if (params->mcp_ra_max != mp->mp_cparams.mcp_ra_max) {
+		old_ra = mp->mp_ra;
+		mp->mp_ra = ra;
+	}
+	if (mbpool_changed) {
+		old_mbpool = mp->mp_mbpool;
+		mp->mp_mbpool = mbpool;
+	}
+	mp->mp_params_valid = false;
+	mp->mp_params_gen++;
+	mp->mp_cparams = *params;
+	mp_delq_rate_set(mp->mp_delq, params->mcp_delq_rate);
+
 	mp_release(mp);
 
-	return err;
+	mp_mapcache_cap_set(mp->mp_mapcache, params->mcp_mapcache_sz);
+	mp_hotset_cap_set(mp->mp_hotset, params->mcp_hotset_max);
+
+	mp_mbpool_destroy(old_mbpool);
+	mp_ra_destroy(old_ra);
+	mp_rdcache_destroy(old_rc);
+	mp_mbio_destroy(old_mbio);
+	mp_objcache_destroy(old_oc);
+
+	mp_threads_resume(mp);
+
+	return 0;
+}
+
+mpool_err_t mpool_objcache_stats_get(struct mpool *mp, struct mpool_objcache_stats *stats)
+{
+	if (!mp || !stats)
+		return merr(EINVAL);
+
+	mp_objcache_stats_get(mp->mp_objcache, stats);
+
+	return 0;
+}
+
+mpool_err_t mpool_rdcache_stats_get(struct mpool *mp, struct mpool_rdcache_stats *stats)
+{
+	if (!mp || !stats)
+		return merr(EINVAL);
+
+	mp_rdcache_stats_get(mp->mp_rdcache, stats);
+
+	return 0;
+}
+
+mpool_err_t mpool_mapcache_stats_get(struct mpool *mp, struct mpool_mapcache_stats *stats)
+{
+	if (!mp || !stats)
+		return merr(EINVAL);
+
+	mp_mapcache_stats_get(mp->mp_mapcache, stats);
+
+	return 0;
+}
+
+/*
+ * Mpctl Mlog interface implementation
+ */
+
+static inline u64 mlog_hmap_hash(u64 objid)
+{
+	return objid * 0x9e3779b97f4a7c15ull;
+}
+
+static inline struct mp_mloghmap *mlog_hmap_stripe(struct mpool *mp, u64 hash)
+{
+	return &mp->mp_mlmap[hash >> (64 - MLOG_HMAP_STRIPES_SHIFT)];
+}
+
+static inline struct mpool_mlog **mlog_hmap_bucket(struct mp_mloghmap *mlmap, u64 hash)
+{
+	return &mlmap->mlm_bktv[(hash >> 16) & (mlmap->mlm_bktc - 1)];
+}
+
+/**
+ * mlog_hmap_grow() - Double the number of hash chains in a map stripe
+ * @mlmap: map stripe (must be locked)
+ *
+ * Failure to grow is not fatal, the stripe simply keeps its longer chains.
+ */
+static void mlog_hmap_grow(struct mp_mloghmap *mlmap)
+{
+	struct mpool_mlog **bktv, **oldv;
+	u32                 bktc, oldc, i;
+
+	oldc = mlmap->mlm_bktc;
+	oldv = mlmap->mlm_bktv;
+	bktc = oldc ? oldc * 2 : MLOG_HMAP_BKTC_MIN;
+
+	bktv = calloc(bktc, sizeof(*bktv));
+	if (!bktv)
+		return;
+
+	mlmap->mlm_bktv = bktv;
+	mlmap->mlm_bktc = bktc;
+
+	for (i = 0; i < oldc; i++) {
+		struct mpool_mlog *mlh, *next, **bkt;
+
+		for (mlh = oldv[i]; mlh; mlh = next) {
+			next = mlh->ml_hnext;
+
+			bkt = mlog_hmap_bucket(mlmap, mlog_hmap_hash(mlh->ml_objid));
+			mlh->ml_hnext = *bkt;
+			*bkt = mlh;
+		}
+	}
+
+	free(oldv);
+}
+
+/**
+ * mlog_hmap_find() - Lookup mlog map for the handle given an object ID
+ *
+ * @mp:      mpool handle
+ * @objid:   object ID
+ * @needref: if true, increment refcount on the mlog handle
+ *
+ * Only the map stripe to which objid hashes is locked, mp_lock is not taken.
+ */
+static struct mpool_mlog *mlog_hmap_find(struct mpool *mp, u64 objid, bool needref)
+{
+	struct mp_mloghmap *mlmap;
+	struct mpool_mlog  *mlh;
+	u64                 hash;
+
+	if (!mp || mp->mp_magic != MPC_MPOOL_MAGIC)
+		return NULL;
+
+	hash = mlog_hmap_hash(objid);
+	mlmap = mlog_hmap_stripe(mp, hash);
+
+	mutex_lock(&mlmap->mlm_lock);
+
+	mlh = NULL;
+	if (mlmap->mlm_cnt > 0)
+		mlh = *mlog_hmap_bucket(mlmap, hash);
+
+	while (mlh && mlh->ml_objid != objid)
+		mlh = mlh->ml_hnext;
+
+	if (mlh) {
+		assert(mlh->ml_refcnt > 0);
+
+		if (needref)
+			++mlh->ml_refcnt;
+	}
+
+	mutex_unlock(&mlmap->mlm_lock);
+
+	return mlh;
+}
+
+/**
+ * mlog_hmap_put() - drop a reference on given mlog handle
+ * @mp:      mpool handle
+ * @mlogh:   mlog handle
+ * @lastref: set to true if the last reference was dropped (output)
+ */
+static void mlog_hmap_put(struct mpool *mp, struct mpool_mlog *mlogh, bool *lastref)
+{
+	struct mp_mloghmap *mlmap;
+	struct mpool_mlog **pp;
+	u64                 hash;
+
+	if (!mp || !mlogh)
+		return;
+
+	hash = mlog_hmap_hash(mlogh->ml_objid);
+	mlmap = mlog_hmap_stripe(mp, hash);
+
+	mutex_lock(&mlmap->mlm_lock);
+
+	assert(mlogh->ml_refcnt > 0);
+
+	if (--mlogh->ml_refcnt > 0) {
+		mutex_unlock(&mlmap->mlm_lock);
+		return;
+	}
+
+	pp = mlog_hmap_bucket(mlmap, hash);
+	while (*pp != mlogh)
+		pp = &(*pp)->ml_hnext;
+
+	*pp = mlogh->ml_hnext;
+	mlogh->ml_hnext = NULL;
+	--mlmap->mlm_cnt;
+
+	mutex_unlock(&mlmap->mlm_lock);
+
+	atomic_dec(&mp->mp_mltot);
+
+	if (lastref)
+		*lastref = true;
+}
+
+/**
+ * mlog_hmap_insert() - Insert <objid, mlogh> pair into mlog map
+ * @mp:    mpool handle
+ * @objid: object ID
+ * @mlogh: mlog handle
+ */
+static merr_t mlog_hmap_insert(struct mpool *mp, u64 objid, struct mpool_mlog *mlogh)
+{
+	struct mp_mloghmap *mlmap;
+	struct mpool_mlog  *dup, **bkt;
+	u64                 hash;
+
+	if (!mp || !mlogh)
+		return merr(EINVAL);
+
+	if (mp->mp_magic != MPC_MPOOL_MAGIC)
+		return merr(EINVAL);
+
+	hash = mlog_hmap_hash(objid);
+	mlmap = mlog_hmap_stripe(mp, hash);
+
+	mutex_lock(&mlmap->mlm_lock);
+
+	if (mlmap->mlm_cnt >= mlmap->mlm_bktc * MLOG_HMAP_LOAD_MAX)
+		mlog_hmap_grow(mlmap);
+
+	if (!mlmap->mlm_bktv) {
+		mutex_unlock(&mlmap->mlm_lock);
+		return merr(ENOMEM);
+	}
+
+	bkt = mlog_hmap_bucket(mlmap, hash);
+
+	for (dup = *bkt; dup; dup = dup->ml_hnext) {
+		if (dup->ml_objid == objid) {
+			mutex_unlock(&mlmap->mlm_lock);
+			return merr(EEXIST);
+		}
+	}
+
+	mlogh->ml_objid = objid;
+	mlogh->ml_refcnt = 1;
+	mlogh->ml_hnext = *bkt;
+	*bkt = mlogh;
+	++mlmap->mlm_cnt;
+
+	mutex_unlock(&mlmap->mlm_lock);
+
+	atomic_inc(&mp->mp_mltot);
+
+	return 0;
 }
 
 /**
@@ -1535,7 +2096,6 @@ static merr_t
 mlog_handle_alloc_impl(
 	struct mpool            *mp,
 	struct mlog_props_ex    *props,
-	char                    *mpname,
 	struct mpool_mlog      **mlogh)
 {
 	struct mpool_mlog          *mlh;
@@ -1545,7 +2105,7 @@ mlog_handle_alloc_impl(
 	merr_t err;
 	u64    objid;
 
-	if (!mlogh || !mp || !props || !mpname)
+	if (!mlogh || !mp || !props)
 		return merr(EINVAL);
 
 	*mlogh = NULL;
@@ -1554,18 +2114,13 @@ mlog_handle_alloc_impl(
 	if (!mlh)
 		return merr(ENOMEM);
 
-	/* Allocate and init mpool descriptor for user space mlogs */
-	mpdesc = mpool_user_desc_alloc(mpname);
-	if (!mpdesc) {
-		free(mlh);
-		return merr(ENOMEM);
-	}
+	/* All user space mlogs of an mpool share its mpool descriptor */
+	mpdesc = mp->mp_desc;
 	mlh->ml_mpdesc = mpdesc;
 
 	/* Allocate and init mlog descriptor for user space mlogs */
 	mldesc = mlog_user_desc_alloc(mpdesc, props, mlh);
 	if (!mldesc) {
-		mpool_user_desc_free(mpdesc);
 		free(mlh);
 
 		return merr(ENOMEM);
@@ -1605,16 +2160,20 @@ static merr_t mlog_handle_alloc(struct mpool *mp, u64 objid, struct mpool_mlog *
 		return merr(EINVAL);
 
 	*mlogh = NULL;
-
-	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_FIND, &ml);
-	if (err)
-		return err;
 	px = &ml.ml_props;
 
+	if (!mp_objcache_mlog_get(mp->mp_objcache, objid, px)) {
+		err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_FIND, &ml);
+		if (err)
+			return err;
+
+		mp_objcache_mlog_put(mp->mp_objcache, px);
+	}
+
 again:
-	mlh = mlog_hmap_find(mp, objid, true, false);
+	mlh = mlog_hmap_find(mp, objid, true);
 	if (!mlh) {
-		err = mlog_handle_alloc_impl(mp, px, mp->mp_name, &mlh);
+		err = mlog_handle_alloc_impl(mp, px, &mlh);
 		if (err) {
 			if (merr_errno(err) == EEXIST)
 				goto again;
@@ -1636,8 +2195,6 @@ static void mlog_handle_free(struct mpool_mlog *mlogh)
 {
 	mlog_user_desc_free(mlogh->ml_mldesc);
 
-	mpool_user_desc_free(mlogh->ml_mpdesc);
-
 	free(mlogh);
 }
 
@@ -1698,6 +2255,8 @@ mpool_mlog_alloc(
 
 	*mlogid = ml.ml_props.lpx_props.lpr_objid;
 
+	mp_objcache_mlog_put(mp->mp_objcache, &ml.ml_props);
+
 	if (props)
 		*props = ml.ml_props.lpx_props;
 
@@ -1707,6 +2266,7 @@ mpool_mlog_alloc(
 mpool_err_t mpool_mlog_commit(struct mpool *mp, uint64_t mlogid)
 {
 	struct mpioc_mlog_id   mi = { .mi_objid = mlogid };
+	merr_t                 err;
 
 	if (!mp)
 		return merr(EINVAL);
@@ -1714,13 +2274,19 @@ mpool_err_t mpool_mlog_commit(struct mpool *mp, uint64_t mlogid)
 	if (!mpool_is_writable(mp))
 		return merr(EPERM);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MLOG_COMMIT, &mi);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_COMMIT, &mi);
+
+	/* Committing changes the mlog state, refetch it on next use. */
+	mp_objcache_inval(mp->mp_objcache, mlogid);
+
+	return err;
 }
 
 mpool_err_t mpool_mlog_abort(struct mpool *mp, uint64_t mlogid)
 {
 	struct mpioc_mlog_id    mi = { .mi_objid = mlogid };
 	struct mpool_mlog      *mlh;
+	merr_t                  err;
 
 	if (!mp)
 		return merr(EINVAL);
@@ -1728,17 +2294,21 @@ mpool_err_t mpool_mlog_abort(struct mpool *mp, uint64_t mlogid)
 	if (!mpool_is_writable(mp))
 		return merr(EPERM);
 
-	mlh = mlog_hmap_find(mp, mlogid, false, false);
+	mlh = mlog_hmap_find(mp, mlogid, false);
 	if (mlh)
 		return merr(EBUSY);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MLOG_ABORT, &mi);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_ABORT, &mi);
+	mp_objcache_inval(mp->mp_objcache, mlogid);
+
+	return err;
 }
 
 mpool_err_t mpool_mlog_delete(struct mpool *mp, uint64_t mlogid)
 {
 	struct mpioc_mlog_id    mi = { .mi_objid = mlogid };
 	struct mpool_mlog      *mlh;
+	merr_t                  err;
 
 	if (!mp)
 		return merr(EINVAL);
@@ -1746,11 +2316,14 @@ mpool_err_t mpool_mlog_delete(struct mpool *mp, uint64_t mlogid)
 	if (!mpool_is_writable(mp))
 		return merr(EPERM);
 
-	mlh = mlog_hmap_find(mp, mlogid, false, false);
+	mlh = mlog_hmap_find(mp, mlogid, false);
 	if (mlh)
 		return merr(EBUSY);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MLOG_DELETE, &mi);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_DELETE, &mi);
+	mp_objcache_inval(mp->mp_objcache, mlogid);
+
+	return err;
 }
 
 mpool_err_t
@@ -1955,6 +2528,7 @@ mpool_err_t mpool_mlog_erase(struct mpool_mlog *mlogh, uint64_t mingen)
 		return err;
 
 	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_ERASE, &mi);
+	mp_objcache_inval(mp->mp_objcache, mlogh->ml_objid);
 	if (err)
 		goto exit;
 
@@ -2012,8 +2586,10 @@ merr_t mpool_mlog_xprops_get(struct mpool_mlog *mlogh, struct mlog_props_ex *pro
 
 	mp = mlogh->ml_mp;
 	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_PROPS, &ml);
-	if (!err)
+	if (!err) {
+		mp_objcache_mlog_put(mp->mp_objcache, &ml.ml_props);
 		*props_ex = ml.ml_props;
+	}
 
 	mlog_release(mlogh, rw);
 
@@ -2149,6 +2725,7 @@ merr_t mpool_mlog_gen(struct mpool_mlog *mlogh, u64 *gen)
 merr_t mpool_mlog_erase_byoid(struct mpool *mp, u64 mlogid, uint64_t mingen)
 {
 	struct mpioc_mlog_id   mi = { .mi_gen = mingen };
+	merr_t                 err;
 
 	if (!mp)
 		return merr(EINVAL);
@@ -2158,13 +2735,16 @@ merr_t mpool_mlog_erase_byoid(struct mpool *mp, u64 mlogid, uint64_t mingen)
 
 	mi.mi_objid = mlogid;
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MLOG_ERASE, &mi);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MLOG_ERASE, &mi);
+	mp_objcache_inval(mp->mp_objcache, mlogid);
+
+	return err;
 }
 
 /* Mpctl Mblock Interfaces */
 
 mpool_err_t
-mpool_mblock_alloc(
+mp_mblock_alloc(
 	struct mpool           *mp,
 	enum mp_media_classp    mclassp,
 	bool                    spare,
@@ -2174,9 +2754,6 @@ mpool_mblock_alloc(
 	struct mpioc_mblock mb = { .mb_mclassp = mclassp };
 	merr_t              err;
 
-	if (!mp || !mbid)
-		return merr(EINVAL);
-
 	mb.mb_spare = spare;
 
 	err = mpool_ioctl(mp->mp_fd, MPIOC_MB_ALLOC, &mb);
@@ -2191,6 +2768,34 @@ mpool_mblock_alloc(
 	return 0;
 }
 
+mpool_err_t
+mpool_mblock_alloc(
+	struct mpool           *mp,
+	enum mp_media_classp    mclassp,
+	bool                    spare,
+	uint64_t               *mbid,
+	struct mblock_props    *props)
+{
+	struct mblock_props mbprops;
+	merr_t              err;
+
+	if (!mp || !mbid)
+		return merr(EINVAL);
+
+	if (spare || !mp_mbpool_get(mp->mp_mbpool, mclassp, mbid, &mbprops)) {
+		err = mp_mblock_alloc(mp, mclassp, spare, mbid, &mbprops);
+		if (err)
+			return err;
+	}
+
+	mp_objcache_mblock_put(mp->mp_objcache, &mbprops);
+
+	if (props)
+		*props = mbprops;
+
+	return 0;
+}
+
 mpool_err_t mpool_mblock_find(struct mpool *mp, uint64_t objid, struct mblock_props *props)
 {
 	struct mpioc_mblock mb = { .mb_objid = objid };
@@ -2199,10 +2804,15 @@ mpool_err_t mpool_mblock_find(struct mpool *mp, uint64_t objid, struct mblock_pr
 	if (!mp)
 		return merr(EINVAL);
 
+	if (mp_objcache_mblock_get(mp->mp_objcache, objid, props))
+		return 0;
+
 	err = mpool_ioctl(mp->mp_fd, MPIOC_MB_FIND, &mb);
 	if (err)
 		return err;
 
+	mp_objcache_mblock_put(mp->mp_objcache, &mb.mb_props.mbx_props);
+
 	if (props)
 		*props = mb.mb_props.mbx_props;
 
@@ -2212,31 +2822,61 @@ mpool_err_t mpool_mblock_find(struct mpool *mp, uint64_t objid, struct mblock_pr
 mpool_err_t mpool_mblock_commit(struct mpool *mp, uint64_t mbid)
 {
 	struct mpioc_mblock_id  mi = { .mi_objid = mbid };
+	merr_t                  err;
 
 	if (!mp)
 		return merr(EINVAL);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MB_COMMIT, &mi);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MB_COMMIT, &mi);
+	if (err) {
+		mp_objcache_inval(mp->mp_objcache, mbid);
+	} else {
+		mp_objcache_mblock_committed(mp->mp_objcache, mbid);
+		mp_tier_touch(mp->mp_tier, mbid, 0);
+	}
+
+	return err;
 }
 
 mpool_err_t mpool_mblock_abort(struct mpool *mp, uint64_t mbid)
 {
 	struct mpioc_mblock_id  mi = { .mi_objid = mbid };
+	merr_t                  err;
 
 	if (!mp)
 		return merr(EINVAL);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MB_ABORT, &mi);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MB_ABORT, &mi);
+
+	/* Invalidate even on failure as the state of the mblock is unknown. */
+	mp_objcache_inval(mp->mp_objcache, mbid);
+	mp_ra_inval(mp->mp_ra, mbid);
+	mp_rdcache_inval(mp->mp_rdcache, mbid);
+	mp_tier_forget(mp->mp_tier, mbid);
+
+	return err;
 }
 
 mpool_err_t mpool_mblock_delete(struct mpool *mp, uint64_t mbid)
 {
 	struct mpioc_mblock_id  mi = { .mi_objid = mbid };
+	merr_t                  err;
 
 	if (!mp)
 		return merr(EINVAL);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MB_DELETE, &mi);
+	/* Idle cached maps of the mblock would keep it from being deleted. */
+	mp_mapcache_inval(mp->mp_mapcache, mbid);
+
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MB_DELETE, &mi);
+
+	/* Invalidate even on failure as the state of the mblock is unknown. */
+	mp_objcache_inval(mp->mp_objcache, mbid);
+	mp_ra_inval(mp->mp_ra, mbid);
+	mp_rdcache_inval(mp->mp_rdcache, mbid);
+	mp_tier_forget(mp->mp_tier, mbid);
+
+	return err;
 }
 
 mpool_err_t mpool_mblock_props_get(struct mpool *mp, uint64_t mbid, struct mblock_props *props)
@@ -2254,11 +2894,68 @@ mpool_err_t mpool_mblock_write(struct mpool *mp, uint64_t mbid, const struct iov
 		.mb_iov_cnt = iovc,
 		.mb_iov     = iov,
 	};
+	merr_t  err;
+	size_t  len = 0;
+	int     i;
 
 	if (!mp || !iov)
 		return merr(EINVAL);
 
-	return mpool_ioctl(mp->mp_fd, MPIOC_MB_WRITE, &mbrw);
+	err = mpool_ioctl(mp->mp_fd, MPIOC_MB_WRITE, &mbrw);
+	if (err) {
+		mp_objcache_inval(mp->mp_objcache, mbid);
+		return err;
+	}
+
+	for (i = 0; i < iovc; i++)
+		len += iov[i].iov_len;
+
+	mp_objcache_mblock_written(mp->mp_objcache, mbid, len);
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mblock_write_async(
+	struct mpool           *mp,
+	uint64_t                mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg)
+{
+	if (!mp)
+		return merr(EINVAL);
+
+	return mp_mbio_submit(mp->mp_mbio, MPOOL_MBIO_WRITE, mbid, iov, iovc, 0, cq, cb, arg);
+}
+
+mpool_err_t
+mpool_mblock_read_async(
+	struct mpool           *mp,
+	uint64_t                mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg)
+{
+	if (!mp)
+		return merr(EINVAL);
+
+	return mp_mbio_submit(mp->mp_mbio, MPOOL_MBIO_READ, mbid, iov, iovc, offset, cq, cb, arg);
+}
+
+static merr_t
+mblock_read_media(struct mpool *mp, u64 mbid, const struct iovec *iov, int iovc, off_t offset)
+{
+	if (mp->mp_cparams.mcp_rdsplit > 0)
+		return mp_mbio_read_split(mp->mp_mbio, mbid, iov, iovc, offset,
+					  mp->mp_cparams.mcp_rdsplit, mp->mp_cparams.mcp_rdpar);
+
+	return mp_mblock_read(mp, mbid, iov, iovc, offset);
 }
 
 #ifndef NVALGRIND
@@ -2296,8 +2993,32 @@ I_WRAP_SONAME_FNNAME_ZU(NONE, mpool_mblock_read)(
 }
 #endif
 
-mpool_err_t
-mpool_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset)
+static merr_t
+mblock_read_cached(struct mpool *mp, u64 mbid, const struct iovec *iov, int iovc, off_t offset)
+{
+	if (mp->mp_rdcache)
+		return mp_rdcache_read(mp->mp_rdcache, mp, mblock_read_media, mbid, iov, iovc,
+				       offset);
+
+	return mblock_read_media(mp, mbid, iov, iovc, offset);
+}
+
+mpool_err_t
+mpool_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset)
+{
+	if (!mp || !iov)
+		return merr(EINVAL);
+
+	mp_tier_touch(mp->mp_tier, mbid, 1);
+
+	if (mp->mp_ra)
+		return mp_ra_read(mp->mp_ra, mblock_read_cached, mbid, iov, iovc, offset);
+
+	return mblock_read_cached(mp, mbid, iov, iovc, offset);
+}
+
+mpool_err_t
+mp_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset)
 {
 	struct mpioc_mblock_rw mbrw = {
 		.mb_objid   = mbid,
@@ -2306,9 +3027,6 @@ mpool_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int
 		.mb_iov     = iov,
 	};
 
-	if (!mp || !iov)
-		return merr(EINVAL);
-
 	return mpool_ioctl(mp->mp_fd, MPIOC_MB_READ, &mbrw);
 }
 
@@ -2324,15 +3042,35 @@ mpool_mcache_mmap(
 	struct mpioc_vma            vma;
 
 	int     flags, prot, fd;
+	bool    cached;
 	merr_t  err;
 
 	fd = mp->mp_fd;
 	*mapp = NULL;
 
+	/* Maps are only shared while the map cache is enabled. */
+	cached = mp->mp_cparams.mcp_mapcache_sz > 0;
+	if (cached) {
+		map = mp_mapcache_get(mp->mp_mapcache, mbidv, mbidc, advice);
+		if (map) {
+			atomic_inc(&mp->mp_maptot);
+			*mapp = map;
+			return 0;
+		}
+	}
+
 	map = calloc(1, sizeof(*map));
 	if (!map)
 		return merr(ENOMEM);
 
+	map->mh_mbidv = malloc(mbidc * sizeof(*map->mh_mbidv));
+	if (!map->mh_mbidv) {
+		free(map);
+		return merr(ENOMEM);
+	}
+
+	memcpy(map->mh_mbidv, mbidv, mbidc * sizeof(*map->mh_mbidv));
+
 	memset(&vma, 0, sizeof(vma));
 	vma.im_advice = advice;
 	vma.im_mbidc = mbidc;
@@ -2340,6 +3078,7 @@ mpool_mcache_mmap(
 
 	err = mpool_ioctl(fd, MPIOC_VMA_CREATE, &vma);
 	if (err) {
+		free(map->mh_mbidv);
 		free(map);
 		return err;
 	}
@@ -2347,6 +3086,7 @@ mpool_mcache_mmap(
 	flags = MAP_SHARED | MAP_NORESERVE;
 	prot = PROT_READ;
 
+	map->mh_mp = mp;
 	map->mh_bktsz = vma.im_bktsz;
 	map->mh_mbidc = vma.im_mbidc;
 	map->mh_offset = vma.im_offset;
@@ -2358,31 +3098,168 @@ mpool_mcache_mmap(
 	if (map->mh_addr == MAP_FAILED) {
 		err = merr(errno);
 		mpool_ioctl(fd, MPIOC_VMA_DESTROY, &vma);
+		free(map->mh_mbidv);
 		free(map);
 		return err;
 	}
 
+	/* A map that cannot be registered is only left out of residency sampling. */
+	mp_tier_map_add(mp->mp_tier, map, map->mh_addr, map->mh_bktsz, mbidv, map->mh_mbidc);
+
+	map->mh_adv.ae_map = map;
+	map->mh_adv.ae_addr = map->mh_addr;
+	map->mh_adv.ae_pagec = (map->mh_bktsz * map->mh_mbidc + PAGE_SIZE - 1) / PAGE_SIZE;
+	map->mh_adv.ae_advice = advice;
+	mp_advisor_map_add(mp->mp_advisor, &map->mh_adv);
+
+	map->mh_cached = cached;
+	if (cached) {
+		map->mh_ent.mce_priv = map;
+		map->mh_ent.mce_mbidv = map->mh_mbidv;
+		map->mh_ent.mce_mbidc = mbidc;
+		map->mh_ent.mce_advice = advice;
+		map->mh_ent.mce_len = map->mh_len;
+		mp_mapcache_insert(mp->mp_mapcache, &map->mh_ent);
+	}
+
+	atomic_inc(&mp->mp_maptot);
 	*mapp = map;
 
 	return 0;
 }
 
-mpool_err_t mpool_mcache_munmap(struct mpool_mcache_map *map)
+/**
+ * mcache_map_record() - Record what is resident in a map for a warm restart
+ * @ent: advisor entry of the map
+ * @arg: unused
+ */
+static void mcache_map_record(struct mp_advisor_ent *ent, void *arg)
 {
-	int     rc;
+	struct mpool_mcache_map    *map = ent->ae_map;
+	struct mpool               *mp = map->mh_mp;
+	size_t                      pagec;
+	u64                         heat;
+	int                         i;
 
-	if (!map)
-		return 0;
+	pagec = (map->mh_bktsz + PAGE_SIZE - 1) / PAGE_SIZE;
+	heat = ent->ae_heat + (u32)atomic_read(&ent->ae_hits);
+
+	for (i = 0; i < map->mh_mbidc; i++)
+		mp_hotset_record(mp->mp_hotset, map->mh_mbidv[i],
+				 (char *)map->mh_addr + i * map->mh_bktsz, pagec, heat);
+}
+
+/**
+ * mcache_map_free() - Unmap and free a private map or one that left the map cache
+ */
+static merr_t mcache_map_free(void *priv)
+{
+	struct mpool_mcache_map    *map = priv;
+	struct mpool               *mp = map->mh_mp;
+	int                         rc;
+
+	mp_advisor_map_remove(mp->mp_advisor, &map->mh_adv);
+	mp_hotset_cancel(mp->mp_hotset, map);
+	mp_tier_map_remove(mp->mp_tier, map);
+
+	mcache_map_record(&map->mh_adv, NULL);
 
 	rc = munmap(map->mh_addr, map->mh_len);
 	if (rc)
 		return merr(errno);
 
+	free(map->mh_mbidv);
 	free(map);
 
 	return 0;
 }
 
+mpool_err_t mpool_mcache_munmap(struct mpool_mcache_map *map)
+{
+	struct mpool   *mp;
+	merr_t          err;
+
+	if (!map)
+		return 0;
+
+	mp = map->mh_mp;
+
+	if (map->mh_cached)
+		err = mp_mapcache_put(mp->mp_mapcache, &map->mh_ent);
+	else
+		err = mcache_map_free(map);
+
+	atomic_dec(&mp->mp_maptot);
+
+	return err;
+}
+
+mpool_err_t mpool_mcache_access(struct mpool_mcache_map *map, uint32_t hits)
+{
+	if (!map)
+		return merr(EINVAL);
+
+	mp_advisor_access(&map->mh_adv, hits);
+
+	return 0;
+}
+
+/**
+ * mcache_hotset_path() - Get the path of the hot set descriptor of an mpool
+ */
+static merr_t mcache_hotset_path(struct mpool *mp, char *path, size_t pathsz)
+{
+	int rc;
+
+	rc = snprintf(path, pathsz, "%s/%s/%s", MPOOL_RUNDIR_ROOT, mp->mp_name, MP_HOTSET_FILE);
+	if (rc < 0 || rc >= pathsz)
+		return merr(ENAMETOOLONG);
+
+	return 0;
+}
+
+/**
+ * mcache_hotset_save() - Save the hot set descriptor of a closing mpool handle
+ */
+static void mcache_hotset_save(struct mpool *mp)
+{
+	char    path[PATH_MAX];
+	merr_t  err;
+
+	err = mcache_hotset_path(mp, path, sizeof(path));
+	if (!err)
+		err = mp_hotset_save(mp->mp_hotset, path);
+
+	/* An mpool that is not activated on this host has no run directory. */
+	if (err && merr_errno(err) != ENOENT)
+		mse_log(MPOOL_WARNING "%s: save %s: %s", __func__, path, strerror(merr_errno(err)));
+}
+
+mpool_err_t mpool_mcache_hotset_load(struct mpool *mp, struct mpool_mcache_hotset **hotsetp)
+{
+	char    path[PATH_MAX];
+	merr_t  err;
+
+	if (!mp || !hotsetp)
+		return merr(EINVAL);
+
+	err = mcache_hotset_path(mp, path, sizeof(path));
+	if (err)
+		return err;
+
+	return mp_hotset_load(path, hotsetp);
+}
+
+mpool_err_t
+mpool_mcache_warmup(struct mpool_mcache_map *map, const struct mpool_mcache_hotset *hotset)
+{
+	if (!map || map->mh_addr == MAP_FAILED || !hotset)
+		return merr(EINVAL);
+
+	return mp_hotset_warmup(map->mh_mp->mp_hotset, map, map->mh_addr, map->mh_bktsz,
+				map->mh_mbidv, map->mh_mbidc, hotset);
+}
+
 mpool_err_t
 mpool_mcache_madvise(
 	struct mpool_mcache_map    *map,
@@ -2456,42 +3333,23 @@ mpool_mcache_mincore(
 	size_t                     *rssp,
 	size_t                     *vssp)
 {
-	unsigned char  *vec;
-	size_t          segsz;
-	size_t          vecsz;
-	merr_t          err;
-	int             rc;
+	size_t  segsz;
+	merr_t  err;
+	u64     rss;
 
 	/* We *could* handle unmapped mcache maps; write some code? */
 	if (map->mh_addr == MAP_FAILED)
-		merr(EINVAL);
+		return merr(EINVAL);
 
 	if (!mpool_mcache_vrss_get(map, mp, rssp, vssp))
 		return 0;
 
 	segsz = map->mh_bktsz * map->mh_mbidc;
-	vecsz = (segsz + PAGE_SIZE - 1) / PAGE_SIZE;
-
-	vec = malloc(vecsz);
-	if (!vec)
-		return merr(ENOMEM);
-
-	rc = mincore(map->mh_addr, segsz, vec);
-	if (rc) {
-		err = merr(errno);
-		free(vec);
-		return err;
-	}
 
 	if (rssp) {
-		const ulong mask = 0x0101010101010101ul;
-
-		ulong  *p = (ulong *)vec;
-		size_t  rss = 0;
-		int     i;
-
-		for (i = 0; i < vecsz / sizeof(*p); ++i)
-			rss += __builtin_popcountl(p[i] & mask);
+		err = mp_rss_scan(map->mh_addr, (segsz + PAGE_SIZE - 1) / PAGE_SIZE, 1, &rss, NULL);
+		if (err)
+			return err;
 
 		*rssp = rss;
 	}
@@ -2502,7 +3360,37 @@ mpool_mcache_mincore(
 	if (vssp)
 		*vssp = segsz;
 
-	free(vec);
+	return 0;
+}
+
+mpool_err_t
+mpool_mcache_residency(
+	struct mpool_mcache_map    *map,
+	const uint                  mbidx,
+	const uint                  mbidc,
+	uint                        stride,
+	struct mpool_mcache_rss    *rssv,
+	uint64_t                   *bitmapv)
+{
+	size_t  pagec, words;
+	merr_t  err;
+	uint    i;
+
+	if (!map || map->mh_addr == MAP_FAILED || !rssv || mbidx > map->mh_mbidc ||
+	    mbidc > map->mh_mbidc - mbidx || (bitmapv && stride > 1))
+		return merr(EINVAL);
+
+	pagec = (map->mh_bktsz + PAGE_SIZE - 1) / PAGE_SIZE;
+	words = (pagec + 63) / 64;
+
+	for (i = 0; i < mbidc; i++) {
+		err = mp_rss_scan((char *)map->mh_addr + (mbidx + i) * map->mh_bktsz, pagec, stride,
+				  &rssv[i].mcr_resident, bitmapv ? bitmapv + i * words : NULL);
+		if (err)
+			return err;
+
+		rssv[i].mcr_pages = pagec;
+	}
 
 	return 0;
 }
@@ -2543,6 +3431,279 @@ mpool_mcache_getpages(
 	return 0;
 }
 
+/**
+ * struct mcache_pfpage - page of a prefetch request
+ * @mpp_pgoff: page offset of the page in the map
+ * @mpp_idx:   index of the page in the request
+ */
+struct mcache_pfpage {
+	u64     mpp_pgoff;
+	u32     mpp_idx;
+};
+
+static int mcache_pfpage_cmp(const void *lhs, const void *rhs)
+{
+	const struct mcache_pfpage *l = lhs, *r = rhs;
+
+	if (l->mpp_pgoff != r->mpp_pgoff)
+		return l->mpp_pgoff < r->mpp_pgoff ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * mcache_prefetch_range() - Sample the residency of a range of pages and prefetch it
+ * @map:       mcache map
+ * @pgv:       pages of the request in the range, sorted
+ * @pgc:       number of pages in pgv
+ * @residentv: residency bitmap of the request (output, may be NULL)
+ *
+ * The range spans from the first to the last page of pgv, which are all
+ * adjacent or duplicates.
+ */
+static merr_t
+mcache_prefetch_range(
+	struct mpool_mcache_map    *map,
+	const struct mcache_pfpage *pgv,
+	u32                         pgc,
+	uint64_t                   *residentv)
+{
+	unsigned char   vec[256];
+	char           *addr;
+	size_t          len;
+	u64             start, pgoff;
+	bool            cold = false;
+	u32             i = 0;
+
+	start = pgv[0].mpp_pgoff;
+	addr = (char *)map->mh_addr + start * PAGE_SIZE;
+	len = (pgv[pgc - 1].mpp_pgoff - start + 1) * PAGE_SIZE;
+
+	while (i < pgc) {
+		size_t  n;
+		u64     base = pgv[i].mpp_pgoff;
+
+		n = min_t(u64, pgv[pgc - 1].mpp_pgoff - base + 1, NELEM(vec));
+
+		if (mincore(addr + (base - start) * PAGE_SIZE, n * PAGE_SIZE, vec))
+			return merr(errno);
+
+		for (; i < pgc && (pgoff = pgv[i].mpp_pgoff) < base + n; i++) {
+			if (!(vec[pgoff - base] & 1)) {
+				cold = true;
+				continue;
+			}
+
+			if (residentv)
+				residentv[pgv[i].mpp_idx / 64] |= 1ull << (pgv[i].mpp_idx % 64);
+		}
+	}
+
+	/* Readahead of the whole range is started without waiting for it. */
+	if (cold && madvise(addr, len, MADV_WILLNEED))
+		return merr(errno);
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mcache_prefetchv(
+	struct mpool_mcache_map    *map,
+	const uint                  pagec,
+	const uint                  mbidxv[],
+	const off_t                 pagenumv[],
+	uint64_t                   *residentv)
+{
+	struct mcache_pfpage    pgbuf[64], *pgv = pgbuf;
+	merr_t                  err = 0;
+	uint                    i, first;
+
+	if (!map || map->mh_addr == MAP_FAILED || (pagec > 0 && (!mbidxv || !pagenumv)))
+		return merr(EINVAL);
+
+	if (pagec > NELEM(pgbuf)) {
+		pgv = malloc(pagec * sizeof(*pgv));
+		if (!pgv)
+			return merr(ENOMEM);
+	}
+
+	for (i = 0; i < pagec; i++) {
+		if (mbidxv[i] >= map->mh_mbidc || pagenumv[i] < 0 ||
+		    pagenumv[i] >= map->mh_bktsz / PAGE_SIZE) {
+			err = merr(EINVAL);
+			goto out;
+		}
+
+		pgv[i].mpp_pgoff = (u64)mbidxv[i] * (map->mh_bktsz / PAGE_SIZE) + pagenumv[i];
+		pgv[i].mpp_idx = i;
+	}
+
+	if (residentv)
+		memset(residentv, 0, ((pagec + 63) / 64) * sizeof(*residentv));
+
+	qsort(pgv, pagec, sizeof(*pgv), mcache_pfpage_cmp);
+
+	/* Coalesce the pages into runs of adjacent pages, one madvise() per run. */
+	for (i = 1, first = 0; i <= pagec && pagec > 0; i++) {
+		if (i < pagec && pgv[i].mpp_pgoff <= pgv[i - 1].mpp_pgoff + 1)
+			continue;
+
+		err = mcache_prefetch_range(map, pgv + first, i - first, residentv);
+		if (err)
+			break;
+
+		first = i;
+	}
+
+out:
+	if (pgv != pgbuf)
+		free(pgv);
+
+	return err;
+}
+
+/* Non-resident pages of a range that mpool_mcache_read() faults in rather than reads. */
+#define MCACHE_READ_COLD_MAX    8
+
+/**
+ * mcache_cold_pages() - Count the non-resident pages of a range of a map
+ * @addr:  page-aligned start of the range
+ * @pagec: number of pages in the range
+ * @max:   stop counting past this many non-resident pages
+ * @coldp: number of non-resident pages, at most max + 1 (output)
+ */
+static merr_t mcache_cold_pages(const char *addr, size_t pagec, size_t max, size_t *coldp)
+{
+	unsigned char   vec[256];
+	size_t          cold = 0, n, i;
+
+	while (pagec > 0 && cold <= max) {
+		n = min_t(size_t, pagec, NELEM(vec));
+
+		if (mincore((void *)addr, n * PAGE_SIZE, vec))
+			return merr(errno);
+
+		for (i = 0; i < n; i++)
+			cold += !(vec[i] & 1);
+
+		addr += n * PAGE_SIZE;
+		pagec -= n;
+	}
+
+	*coldp = cold;
+
+	return 0;
+}
+
+/**
+ * mcache_read_direct() - Read a range of a mapped mblock with a single MPIOC_MB_READ
+ *
+ * The pages wholly covered by the range are read straight into the caller's
+ * buffer if it is suitably aligned, the partial first and last pages into
+ * bounce pages.  Otherwise the range is read through a bounce buffer.
+ */
+static merr_t
+mcache_read_direct(struct mpool_mcache_map *map, uint mbidx, off_t offset, size_t len, char *buf)
+{
+	char            pages[2 * PAGE_SIZE] __aligned(PAGE_SIZE);
+	struct mpool   *mp = map->mh_mp;
+	struct iovec    iov[3];
+	u64             mbid = map->mh_mbidv[mbidx];
+	off_t           lo, hi, ilo, ihi, aoff;
+	merr_t          err;
+	char           *bounce;
+	int             iovc = 0;
+
+	lo = offset;
+	hi = offset + len;
+	aoff = lo & ~(off_t)(PAGE_SIZE - 1);
+	ilo = roundup(lo, PAGE_SIZE);
+	ihi = hi & ~(off_t)(PAGE_SIZE - 1);
+
+	if (ilo <= ihi && (ilo == ihi || PAGE_ALIGNED((uintptr_t)buf + (ilo - lo)))) {
+		if (lo < ilo) {
+			iov[iovc].iov_base = pages;
+			iov[iovc++].iov_len = PAGE_SIZE;
+		}
+		if (ilo < ihi) {
+			iov[iovc].iov_base = buf + (ilo - lo);
+			iov[iovc++].iov_len = ihi - ilo;
+		}
+		if (ihi < hi) {
+			iov[iovc].iov_base = pages + PAGE_SIZE;
+			iov[iovc++].iov_len = PAGE_SIZE;
+		}
+
+		err = mp_mblock_read(mp, mbid, iov, iovc, aoff);
+		if (err)
+			return err;
+
+		memcpy(buf, pages + (lo - aoff), ilo - lo);
+		memcpy(buf + (ihi - lo), pages + PAGE_SIZE, hi - ihi);
+
+		return 0;
+	}
+
+	iov[0].iov_len = roundup(hi, PAGE_SIZE) - aoff;
+	iov[0].iov_base = bounce = aligned_alloc(PAGE_SIZE, iov[0].iov_len);
+	if (!bounce)
+		return merr(ENOMEM);
+
+	err = mp_mblock_read(mp, mbid, iov, 1, aoff);
+	if (!err)
+		memcpy(buf, bounce + (lo - aoff), len);
+
+	free(bounce);
+
+	return err;
+}
+
+mpool_err_t
+mpool_mcache_read(
+	struct mpool_mcache_map    *map,
+	const uint                  mbidx,
+	off_t                       offset,
+	size_t                      len,
+	void                       *buf,
+	uint                        flags)
+{
+	const char *addr;
+	size_t      cold;
+	off_t       aoff;
+	merr_t      err;
+
+	if (!map || map->mh_addr == MAP_FAILED || mbidx >= map->mh_mbidc || offset < 0 ||
+	    (!buf && len > 0) || len > map->mh_bktsz || offset > map->mh_bktsz - len ||
+	    (flags & ~MPOOL_MCACHE_POPULATE))
+		return merr(EINVAL);
+
+	if (len == 0)
+		return 0;
+
+	addr = (char *)map->mh_addr + mbidx * map->mh_bktsz;
+	aoff = offset & ~(off_t)(PAGE_SIZE - 1);
+
+	err = mcache_cold_pages(addr + aoff, (roundup(offset + len, PAGE_SIZE) - aoff) / PAGE_SIZE,
+				MCACHE_READ_COLD_MAX, &cold);
+	if (err)
+		return err;
+
+	/* A few faults are cheaper than a read system call. */
+	if (cold <= MCACHE_READ_COLD_MAX) {
+		memcpy(buf, addr + offset, len);
+		return 0;
+	}
+
+	err = mcache_read_direct(map, mbidx, offset, len, buf);
+	if (err)
+		return err;
+
+	if (flags & MPOOL_MCACHE_POPULATE)
+		madvise((char *)addr + aoff, roundup(offset + len, PAGE_SIZE) - aoff, MADV_WILLNEED);
+
+	return 0;
+}
+
 struct pd_prop *mp_get_dev_prop(int dcnt, char **devices)
 {
 	struct pd_prop *pdp;
@@ -2564,30 +3725,86 @@ struct pd_prop *mp_get_dev_prop(int dcnt, char **devices)
 	return pdp;
 }
 
-mpool_err_t mp_trim_device(int devicec, char **devicev, struct mpool_devrpt *devrpt)
+/**
+ * struct mp_trim_work - devices trimmed concurrently by a set of workers
+ * @mtw_devicev:  device paths
+ * @mtw_devicec:  number of devices
+ * @mtw_next:     index of the next device to trim
+ * @mtw_policy:   how to trim a device if its discard zeroes data
+ * @mtw_progress: progress callback (may be NULL)
+ * @mtw_arg:      progress callback argument
+ * @mtw_rcodev:   error detail of each device
+ * @mtw_errv:     result of each device
+ */
+struct mp_trim_work {
+	char                  **mtw_devicev;
+	int                     mtw_devicec;
+	atomic_t                mtw_next;
+	enum mp_trim_policy     mtw_policy;
+	mp_trim_progress_fn    *mtw_progress;
+	void                   *mtw_arg;
+	enum mpool_rc           mtw_rcodev[MPOOL_DRIVES_MAX];
+	merr_t                  mtw_errv[MPOOL_DRIVES_MAX];
+};
+
+static void *mp_trim_worker(void *arg)
 {
-	merr_t  err = 0;
-	int     i;
+	struct mp_trim_work    *work = arg;
+	int                     i;
+
+	while ((i = atomic_inc_return(&work->mtw_next) - 1) < work->mtw_devicec)
+		work->mtw_errv[i] = generic_trim_device(work->mtw_devicev[i], work->mtw_policy,
+							work->mtw_progress, work->mtw_arg,
+							work->mtw_rcodev + i);
+
+	return NULL;
+}
+
+mpool_err_t
+mp_trim_devices(
+	int                     devicec,
+	char                  **devicev,
+	enum mp_trim_policy     policy,
+	mp_trim_progress_fn    *progress,
+	void                   *arg,
+	struct mpool_devrpt    *devrpt)
+{
+	struct mp_trim_work     work = { };
+	merr_t                  err = 0;
+	int                     i;
 
 	mpool_devrpt_init(devrpt);
 
 	if (!devicev || !devrpt || devicec < 1 || devicec > MPOOL_DRIVES_MAX)
 		return merr(EINVAL);
 
-	for (i = 0; i < devicec; i++) {
-		enum mpool_rc   rcode;
-		merr_t          err1;
+	work.mtw_devicev = devicev;
+	work.mtw_devicec = devicec;
+	work.mtw_policy = policy;
+	work.mtw_progress = progress;
+	work.mtw_arg = arg;
+	atomic_set(&work.mtw_next, 0);
+
+	/* One thread per device. */
+	mp_run_workers(mp_trim_worker, &work, devicec);
 
-		err1 = generic_trim_device(devicev[i], &rcode);
-		if (err1) {
-			mpool_devrpt(devrpt, rcode, i, NULL);
-			err = err1;
+	for (i = 0; i < devicec; i++) {
+		if (work.mtw_errv[i]) {
+			mpool_devrpt(devrpt, work.mtw_rcodev[i], i, NULL);
+			err = work.mtw_errv[i];
 		}
 	}
 
+	mp_probe_cache_purge();
+
 	return err;
 }
 
+mpool_err_t mp_trim_device(int devicec, char **devicev, struct mpool_devrpt *devrpt)
+{
+	return mp_trim_devices(devicec, devicev, MP_TRIM_DISCARD, NULL, NULL, devrpt);
+}
+
 mpool_err_t mp_sb_magic_check(char *device, struct mpool_devrpt *devrpt)
 {
 	struct pd_prop    pd_prop;
@@ -2601,6 +3818,10 @@ mpool_err_t mp_sb_magic_check(char *device, struct mpool_devrpt *devrpt)
 	if (err)
 		return err;
 
+	/*
+	 * Never answered from the probe cache, as it guards against overwriting
+	 * a device that another tool may have written since it was cached.
+	 */
 	return mpool_sb_magic_check(device, &pd_prop, devrpt);
 }
 
@@ -5,10 +5,14 @@
 
 #include <util/inttypes.h>
 
-#include <mpool/mpool_ioctl.h>
+#include <mpool/mpool.h>
 
 #include <string.h>
 
+#include "mbio.h"
+#include "objcache.h"
+#include "readahead.h"
+
 void mpool_params_init(struct mpool_params *params)
 {
 	memset(params, 0, sizeof(*params));
@@ -24,3 +28,15 @@ void mpool_params_init(struct mpool_params *params)
 	params->mp_mdcnum = 0;
 	strcpy(params->mp_label, MPOOL_LABEL_INVALID);
 }
+
+void mpool_client_params_init(struct mpool_client_params *params)
+{
+	memset(params, 0, sizeof(*params));
+
+	params->mcp_objcache = 1;
+	params->mcp_objcache_max = MP_OBJCACHE_MAX_DEFAULT;
+	params->mcp_iodepth = MP_MBIO_DEPTH_DEFAULT;
+	params->mcp_rdsplit = 0;
+	params->mcp_rdpar = MP_MBIO_RDPAR_DEFAULT;
+	params->mcp_ra_max = MP_RA_MAX_DEFAULT;
+}
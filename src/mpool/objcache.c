@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Object properties cache module.
+ *
+ * Caches the properties of mblocks and mlogs opened through an mpool
+ * handle so that repeated find and props_get calls do not require a
+ * round trip through the mpool driver.
+ *
+ * The object ID hash selects both the shard and the set within the shard.
+ * Each set holds MP_OBJCACHE_WAYS entries, the least recently used of which
+ * is replaced on insert into a full set.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/log2.h>
+#include <util/minmax.h>
+
+#include "objcache.h"
+
+enum mp_objcache_type {
+	OC_TYPE_NONE = 0,
+	OC_TYPE_MBLOCK,
+	OC_TYPE_MLOG,
+};
+
+/**
+ * struct mp_objcache_ent - cached object properties
+ * @oce_objid:  object ID
+ * @oce_type:   object type (enum mp_objcache_type), OC_TYPE_NONE if unused
+ * @oce_stamp:  LRU stamp, updated on every hit
+ * @oce_mblock: mblock properties
+ * @oce_mlog:   extended mlog properties
+ */
+struct mp_objcache_ent {
+	u64                         oce_objid;
+	u32                         oce_type;
+	u32                         oce_stamp;
+	union {
+		struct mblock_props     oce_mblock;
+		struct mlog_props_ex    oce_mlog;
+	};
+};
+
+/**
+ * struct mp_objcache_shard - independently locked partition of the cache
+ * @ocs_lock:   protects all fields of the shard
+ * @ocs_entv:   vector of ocs_setc * MP_OBJCACHE_WAYS entries
+ * @ocs_setc:   number of sets (power of 2)
+ * @ocs_stamp:  LRU clock
+ * @ocs_hits:   lookup hits
+ * @ocs_misses: lookup misses
+ * @ocs_evicts: entries replaced by inserts into a full set
+ * @ocs_invals: entries invalidated
+ */
+struct mp_objcache_shard {
+	struct mutex                ocs_lock;
+	struct mp_objcache_ent     *ocs_entv;
+	u32                         ocs_setc;
+	u32                         ocs_stamp;
+	u64                         ocs_hits;
+	u64                         ocs_misses;
+	u64                         ocs_evicts;
+	u64                         ocs_invals;
+} __aligned(SMP_CACHE_BYTES);
+
+/**
+ * struct mp_objcache - object properties cache
+ * @oc_shardv: vector of shards
+ */
+struct mp_objcache {
+	struct mp_objcache_shard    oc_shardv[MP_OBJCACHE_SHARDS];
+};
+
+static inline u64 mp_objcache_hash(u64 objid)
+{
+	return objid * 0x9e3779b97f4a7c15ull;
+}
+
+/**
+ * mp_objcache_set() - Lock the shard of an object and return its set
+ * @oc:     object cache
+ * @objid:  object ID
+ * @shardp: locked shard (output)
+ *
+ * Return: the first entry of the set to which objid maps
+ */
+static struct mp_objcache_ent *
+mp_objcache_set(struct mp_objcache *oc, u64 objid, struct mp_objcache_shard **shardp)
+{
+	struct mp_objcache_shard   *shard;
+	u64                         hash;
+
+	hash = mp_objcache_hash(objid);
+	shard = oc->oc_shardv + (hash >> (64 - MP_OBJCACHE_SHARDS_SHIFT));
+
+	mutex_lock(&shard->ocs_lock);
+	*shardp = shard;
+
+	return shard->ocs_entv + ((hash >> 16) & (shard->ocs_setc - 1)) * MP_OBJCACHE_WAYS;
+}
+
+static struct mp_objcache_ent *
+mp_objcache_lookup(struct mp_objcache_ent *set, u64 objid, enum mp_objcache_type type)
+{
+	int i;
+
+	for (i = 0; i < MP_OBJCACHE_WAYS; i++)
+		if (set[i].oce_type == type && set[i].oce_objid == objid)
+			return set + i;
+
+	return NULL;
+}
+
+/**
+ * mp_objcache_slot() - Find the entry to (re)use for an object
+ * @shard: locked shard
+ * @set:   set to which objid maps
+ * @objid: object ID
+ *
+ * Returns the entry already holding objid if any, otherwise an unused
+ * entry, otherwise the least recently used entry of the set.
+ */
+static struct mp_objcache_ent *
+mp_objcache_slot(struct mp_objcache_shard *shard, struct mp_objcache_ent *set, u64 objid)
+{
+	struct mp_objcache_ent *victim = NULL;
+	int                     i;
+
+	for (i = 0; i < MP_OBJCACHE_WAYS; i++) {
+		struct mp_objcache_ent *ent = set + i;
+
+		if (ent->oce_type != OC_TYPE_NONE && ent->oce_objid == objid)
+			return ent;
+
+		if (ent->oce_type == OC_TYPE_NONE) {
+			if (!victim || victim->oce_type != OC_TYPE_NONE)
+				victim = ent;
+			continue;
+		}
+
+		/* Stamps wrap, so compare them by distance from the clock. */
+		if (!victim || (victim->oce_type != OC_TYPE_NONE &&
+				shard->ocs_stamp - ent->oce_stamp > shard->ocs_stamp - victim->oce_stamp))
+			victim = ent;
+	}
+
+	if (victim->oce_type != OC_TYPE_NONE)
+		shard->ocs_evicts++;
+
+	return victim;
+}
+
+merr_t mp_objcache_create(u32 entmax, struct mp_objcache **ocp)
+{
+	struct mp_objcache *oc;
+	size_t              setc;
+	int                 i, j;
+
+	if (!ocp)
+		return merr(EINVAL);
+
+	*ocp = NULL;
+
+	setc = max_t(size_t, entmax / (MP_OBJCACHE_SHARDS * MP_OBJCACHE_WAYS), 1);
+	setc = 1ul << ilog2(setc);
+
+	oc = aligned_alloc(__alignof__(*oc), sizeof(*oc));
+	if (!oc)
+		return merr(ENOMEM);
+
+	memset(oc, 0, sizeof(*oc));
+
+	for (i = 0; i < MP_OBJCACHE_SHARDS; i++) {
+		struct mp_objcache_shard *shard = oc->oc_shardv + i;
+
+		shard->ocs_entv = calloc(setc * MP_OBJCACHE_WAYS, sizeof(*shard->ocs_entv));
+		if (!shard->ocs_entv) {
+			for (j = 0; j < i; j++)
+				free(oc->oc_shardv[j].ocs_entv);
+			free(oc);
+			return merr(ENOMEM);
+		}
+
+		shard->ocs_setc = setc;
+		mutex_init(&shard->ocs_lock);
+	}
+
+	*ocp = oc;
+
+	return 0;
+}
+
+void mp_objcache_destroy(struct mp_objcache *oc)
+{
+	int i;
+
+	if (!oc)
+		return;
+
+	for (i = 0; i < MP_OBJCACHE_SHARDS; i++) {
+		mutex_destroy(&oc->oc_shardv[i].ocs_lock);
+		free(oc->oc_shardv[i].ocs_entv);
+	}
+
+	free(oc);
+}
+
+bool mp_objcache_mblock_get(struct mp_objcache *oc, u64 objid, struct mblock_props *props)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *ent;
+
+	if (!oc)
+		return false;
+
+	ent = mp_objcache_set(oc, objid, &shard);
+	ent = mp_objcache_lookup(ent, objid, OC_TYPE_MBLOCK);
+	if (ent) {
+		ent->oce_stamp = ++shard->ocs_stamp;
+		if (props)
+			*props = ent->oce_mblock;
+		shard->ocs_hits++;
+	} else {
+		shard->ocs_misses++;
+	}
+	mutex_unlock(&shard->ocs_lock);
+
+	return !!ent;
+}
+
+void mp_objcache_mblock_put(struct mp_objcache *oc, const struct mblock_props *props)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *ent;
+
+	if (!oc)
+		return;
+
+	ent = mp_objcache_set(oc, props->mpr_objid, &shard);
+	ent = mp_objcache_slot(shard, ent, props->mpr_objid);
+
+	ent->oce_objid = props->mpr_objid;
+	ent->oce_type = OC_TYPE_MBLOCK;
+	ent->oce_stamp = ++shard->ocs_stamp;
+	ent->oce_mblock = *props;
+	mutex_unlock(&shard->ocs_lock);
+}
+
+void mp_objcache_mblock_written(struct mp_objcache *oc, u64 objid, size_t len)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *ent;
+
+	if (!oc)
+		return;
+
+	ent = mp_objcache_set(oc, objid, &shard);
+	ent = mp_objcache_lookup(ent, objid, OC_TYPE_MBLOCK);
+	if (ent)
+		ent->oce_mblock.mpr_write_len += len;
+	mutex_unlock(&shard->ocs_lock);
+}
+
+void mp_objcache_mblock_committed(struct mp_objcache *oc, u64 objid)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *ent;
+
+	if (!oc)
+		return;
+
+	ent = mp_objcache_set(oc, objid, &shard);
+	ent = mp_objcache_lookup(ent, objid, OC_TYPE_MBLOCK);
+	if (ent)
+		ent->oce_mblock.mpr_iscommitted = 1;
+	mutex_unlock(&shard->ocs_lock);
+}
+
+bool mp_objcache_mlog_get(struct mp_objcache *oc, u64 objid, struct mlog_props_ex *props)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *ent;
+
+	if (!oc)
+		return false;
+
+	ent = mp_objcache_set(oc, objid, &shard);
+	ent = mp_objcache_lookup(ent, objid, OC_TYPE_MLOG);
+	if (ent) {
+		ent->oce_stamp = ++shard->ocs_stamp;
+		if (props)
+			*props = ent->oce_mlog;
+		shard->ocs_hits++;
+	} else {
+		shard->ocs_misses++;
+	}
+	mutex_unlock(&shard->ocs_lock);
+
+	return !!ent;
+}
+
+void mp_objcache_mlog_put(struct mp_objcache *oc, const struct mlog_props_ex *props)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *ent;
+	u64                         objid;
+
+	if (!oc)
+		return;
+
+	objid = props->lpx_props.lpr_objid;
+
+	ent = mp_objcache_set(oc, objid, &shard);
+	ent = mp_objcache_slot(shard, ent, objid);
+
+	ent->oce_objid = objid;
+	ent->oce_type = OC_TYPE_MLOG;
+	ent->oce_stamp = ++shard->ocs_stamp;
+	ent->oce_mlog = *props;
+	mutex_unlock(&shard->ocs_lock);
+}
+
+void mp_objcache_inval(struct mp_objcache *oc, u64 objid)
+{
+	struct mp_objcache_shard   *shard;
+	struct mp_objcache_ent     *set;
+	int                         i;
+
+	if (!oc)
+		return;
+
+	set = mp_objcache_set(oc, objid, &shard);
+	for (i = 0; i < MP_OBJCACHE_WAYS; i++) {
+		if (set[i].oce_type != OC_TYPE_NONE && set[i].oce_objid == objid) {
+			set[i].oce_type = OC_TYPE_NONE;
+			shard->ocs_invals++;
+		}
+	}
+	mutex_unlock(&shard->ocs_lock);
+}
+
+void mp_objcache_stats_get(struct mp_objcache *oc, struct mpool_objcache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!oc)
+		return;
+
+	for (i = 0; i < MP_OBJCACHE_SHARDS; i++) {
+		struct mp_objcache_shard *shard = oc->oc_shardv + i;
+
+		mutex_lock(&shard->ocs_lock);
+		stats->mos_hits += shard->ocs_hits;
+		stats->mos_misses += shard->ocs_misses;
+		stats->mos_evictions += shard->ocs_evicts;
+		stats->mos_invals += shard->ocs_invals;
+		mutex_unlock(&shard->ocs_lock);
+	}
+}
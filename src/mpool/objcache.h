@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_OBJCACHE_H
+#define MPOOL_OBJCACHE_H
+
+/*
+ * Client-side cache of mblock and mlog properties, keyed by object ID.
+ *
+ * The cache is split into MP_OBJCACHE_SHARDS independently locked shards,
+ * each of which is a set-associative array of entries with LRU replacement
+ * within a set.  Its memory footprint is therefore bounded, and neither
+ * lookups nor inserts allocate memory.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_OBJCACHE_SHARDS_SHIFT    4
+#define MP_OBJCACHE_SHARDS          (1u << MP_OBJCACHE_SHARDS_SHIFT)
+#define MP_OBJCACHE_WAYS            4
+#define MP_OBJCACHE_MAX_DEFAULT     (16 * 1024)
+
+struct mp_objcache;
+
+/**
+ * mp_objcache_create() - Create an object properties cache
+ * @entmax: maximum number of cached objects
+ * @ocp:    object cache (output)
+ */
+merr_t mp_objcache_create(u32 entmax, struct mp_objcache **ocp);
+
+/**
+ * mp_objcache_destroy() - Destroy an object properties cache
+ * @oc: object cache (may be NULL)
+ */
+void mp_objcache_destroy(struct mp_objcache *oc);
+
+/**
+ * mp_objcache_mblock_get() - Look up mblock properties
+ * @oc:    object cache (may be NULL)
+ * @objid: mblock object ID
+ * @props: mblock properties (output, may be NULL)
+ *
+ * Return: true on cache hit
+ */
+bool mp_objcache_mblock_get(struct mp_objcache *oc, u64 objid, struct mblock_props *props);
+
+/**
+ * mp_objcache_mblock_put() - Insert or update mblock properties
+ * @oc:    object cache (may be NULL)
+ * @props: mblock properties
+ */
+void mp_objcache_mblock_put(struct mp_objcache *oc, const struct mblock_props *props);
+
+/**
+ * mp_objcache_mblock_written() - Account for a successful mblock write
+ * @oc:    object cache (may be NULL)
+ * @objid: mblock object ID
+ * @len:   number of bytes written
+ */
+void mp_objcache_mblock_written(struct mp_objcache *oc, u64 objid, size_t len);
+
+/**
+ * mp_objcache_mblock_committed() - Mark a cached mblock as committed
+ * @oc:    object cache (may be NULL)
+ * @objid: mblock object ID
+ */
+void mp_objcache_mblock_committed(struct mp_objcache *oc, u64 objid);
+
+/**
+ * mp_objcache_mlog_get() - Look up extended mlog properties
+ * @oc:    object cache (may be NULL)
+ * @objid: mlog object ID
+ * @props: extended mlog properties (output, may be NULL)
+ *
+ * Return: true on cache hit
+ */
+bool mp_objcache_mlog_get(struct mp_objcache *oc, u64 objid, struct mlog_props_ex *props);
+
+/**
+ * mp_objcache_mlog_put() - Insert or update extended mlog properties
+ * @oc:    object cache (may be NULL)
+ * @props: extended mlog properties
+ */
+void mp_objcache_mlog_put(struct mp_objcache *oc, const struct mlog_props_ex *props);
+
+/**
+ * mp_objcache_inval() - Remove an object from the cache
+ * @oc:    object cache (may be NULL)
+ * @objid: object ID
+ */
+void mp_objcache_inval(struct mp_objcache *oc, u64 objid);
+
+/**
+ * mp_objcache_stats_get() - Retrieve cache statistics
+ * @oc:    object cache (may be NULL)
+ * @stats: cache statistics (output)
+ */
+void mp_objcache_stats_get(struct mp_objcache *oc, struct mpool_objcache_stats *stats);
+
+#endif /* MPOOL_OBJCACHE_H */
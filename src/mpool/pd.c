@@ -44,6 +44,7 @@
 
 #include "mpcore_defs.h"
 #include "logging.h"
+#include "pd_uring.h"
 
 #include <mpool/mpool.h>
 
@@ -56,18 +57,48 @@ void pd_file_init(struct pd_dev_parm *dparm, struct pd_prop *pd_prop)
 	dparm->dpr_prop = *pd_prop;
 }
 
-merr_t pd_file_open(const char *path, struct pd_dev_parm *dparm)
+/**
+ * pd_file_env_flags() - Get the PD_FILE_* flags requested by PD_FILE_URING_ENV
+ */
+static u32 pd_file_env_flags(void)
+{
+	const char *val = getenv(PD_FILE_URING_ENV);
+
+	if (!val)
+		return 0;
+
+	if (!strcmp(val, "1") || !strcmp(val, "uring"))
+		return PD_FILE_URING;
+
+	if (!strcmp(val, "direct"))
+		return PD_FILE_URING | PD_FILE_DIRECT;
+
+	return 0;
+}
+
+merr_t pd_file_open(const char *path, u32 flags, struct pd_dev_parm *dparm)
 {
 	struct pd_file_private *priv;
+	merr_t                  err;
+	bool                    direct;
 	int                     fd;
 
 	priv = calloc(1, sizeof(*priv));
 	if (!priv)
 		return merr(ENOMEM);
 
-	fd = open(path, O_RDWR);
+	flags |= pd_file_env_flags();
+
+	direct = (flags & PD_FILE_URING) && (flags & PD_FILE_DIRECT);
+
+	fd = open(path, O_RDWR | (direct ? O_DIRECT : 0));
+	if (fd == -1 && direct && errno == EINVAL) {
+		direct = false;
+		fd = open(path, O_RDWR);
+	}
+
 	if (fd == -1) {
-		merr_t err = merr(errno);
+		err = merr(errno);
 
 		free(priv);
 		return err;
@@ -75,6 +106,17 @@ merr_t pd_file_open(const char *path, struct pd_dev_parm *dparm)
 
 	priv->pfp_fd = fd;
 
+	if (flags & PD_FILE_URING) {
+		err = pd_uring_create(fd, direct, &priv->pfp_uring);
+		if (err) {
+			mp_pr_debug("%s: io_uring not available, using synchronous I/O", err, path);
+
+			/* The synchronous engine does not align the buffers of O_DIRECT I/O. */
+			if (direct)
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		}
+	}
+
 	dparm->dpr_dev_private = priv;
 
 	return 0;
@@ -89,6 +131,8 @@ merr_t pd_file_close(struct pd_dev_parm *dparm)
 	if (!priv)
 		return 0;
 
+	pd_uring_destroy(priv->pfp_uring);
+
 	fsync(priv->pfp_fd);
 
 	rc = close(priv->pfp_fd);
@@ -154,6 +198,14 @@ pd_file_pwritev(
 		return err;
 	}
 
+	if (priv->pfp_uring) {
+		err = pd_uring_rw(priv->pfp_uring, true, iov, iovcnt, woff, op_flags);
+		if (err)
+			mp_pr_err("Writing on file %s, io_uring write at 0x%lx length 0x%lx failed",
+				  err, pd->pdi_name, (ulong)woff, (ulong)tiolen);
+		return err;
+	}
+
 	/* The following loop is required to split the iovec into IOV_MAX chunks. */
 	iv_p = iov;
 	ivc_cur = 0;
@@ -241,6 +293,14 @@ pd_file_preadv(
 		return err;
 	}
 
+	if (priv->pfp_uring) {
+		err = pd_uring_rw(priv->pfp_uring, false, iov, iovcnt, roff, 0);
+		if (err)
+			mp_pr_err("File %s, io_uring read at 0x%lx length 0x%lx failed",
+				  err, pd->pdi_name, (ulong)roff, (ulong)tiolen);
+		return err;
+	}
+
 	/*
 	 * The following loop is required to split the iovec in
 	 * IOV_MAX chunks
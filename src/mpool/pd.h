@@ -19,15 +19,34 @@
 #define REQ_FUA       0x02
 #endif
 
+/*
+ * pd_file_open() flags
+ */
+#define PD_FILE_URING   0x01    /* do I/O through io_uring if the kernel has it */
+#define PD_FILE_DIRECT  0x02    /* open O_DIRECT, only with the io_uring engine */
+
+/*
+ * Environment variable that opts all pds into the io_uring engine: "1" or
+ * "uring" for PD_FILE_URING, "direct" for PD_FILE_URING | PD_FILE_DIRECT.
+ */
+#define PD_FILE_URING_ENV   "MPOOL_PD_URING"
+
 struct mpool_dev_info;
 struct pd_dev_parm;
+struct pd_uring;
 
 /*
  * Common defs
  */
 
+/**
+ * struct pd_file_private -
+ * @pfp_fd:    file descriptor
+ * @pfp_uring: io_uring engine, NULL if I/O is done with preadv()/pwritev()
+ */
 struct pd_file_private {
-	int pfp_fd;
+	int                 pfp_fd;
+	struct pd_uring    *pfp_uring;
 };
 
 /**
@@ -57,11 +76,14 @@ void pd_file_init(struct pd_dev_parm *dparm, struct pd_prop *pd_prop);
 /**
  * pd_file_open() -
  * @path:
+ * @flags: PD_FILE_* flags, or'ed with those PD_FILE_URING_ENV asks for
  * @dparm:
  *
+ * The pd falls back to synchronous I/O if io_uring is not available.
+ *
  * Return:
  */
-merr_t pd_file_open(const char *path, struct pd_dev_parm *dparm);
+merr_t pd_file_open(const char *path, u32 flags, struct pd_dev_parm *dparm);
 
 /**
  * pd_file_pwritev() -
@@ -0,0 +1,607 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * io_uring engine of the pd file backend.
+ *
+ * The ring is driven through the raw system calls so that libmpool does not
+ * depend on liburing.  A ring is only used by one request at a time, which
+ * fills the submission queue, enters the kernel once per batch and reaps
+ * all the completions of the batch before it queues more.
+ */
+
+#define _GNU_SOURCE
+
+#include <util/platform.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/page.h>
+
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX __IOV_MAX
+#endif
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define PD_URING_SUPPORTED
+#endif
+#endif
+
+#include "mpcore_defs.h"
+#include "pd_uring.h"
+
+#ifdef PD_URING_SUPPORTED
+
+/**
+ * struct pd_uring_req - I/O in flight in a batch
+ * @urq_iov:    buffers of the caller, for a staged read
+ * @urq_iovcnt: number of buffers in urq_iov
+ * @urq_skip:   bytes of urq_iov before the data of a staged read
+ * @urq_buf:    staging buffer, NULL if the I/O is not staged
+ * @urq_len:    expected transfer length
+ * @urq_sbuf:   staging buffer as an iovec, if fixed buffers are not registered
+ */
+struct pd_uring_req {
+	struct iovec       *urq_iov;
+	int                 urq_iovcnt;
+	size_t              urq_skip;
+	char               *urq_buf;
+	u32                 urq_len;
+	struct iovec        urq_sbuf;
+};
+
+/**
+ * struct pd_uring - io_uring of a pd
+ * @ur_lock:     serializes the requests on the ring
+ * @ur_fd:       ring file descriptor
+ * @ur_direct:   the pd is open O_DIRECT
+ * @ur_fixedbuf: the staging buffers are registered
+ * @ur_sqmask:   submission queue index mask
+ * @ur_cqmask:   completion queue index mask
+ * @ur_sqhead:   submission queue head, advanced by the kernel
+ * @ur_sqtail:   submission queue tail
+ * @ur_sqarray:  submission queue index array
+ * @ur_cqhead:   completion queue head
+ * @ur_cqtail:   completion queue tail, advanced by the kernel
+ * @ur_sqes:     submission queue entries
+ * @ur_cqes:     completion queue entries
+ * @ur_sqring:   submission queue ring mapping
+ * @ur_sqringsz: length of ur_sqring
+ * @ur_cqring:   completion queue ring mapping, may be ur_sqring
+ * @ur_cqringsz: length of ur_cqring
+ * @ur_sqesz:    length of the ur_sqes mapping
+ * @ur_bufs:     PD_URING_DEPTH staging buffers of PD_URING_BUFSZ bytes
+ * @ur_reqc:     number of I/Os queued in the current batch
+ * @ur_bufc:     number of staging buffers used by the current batch
+ * @ur_reqv:     I/Os of the current batch, indexed by user_data
+ */
+struct pd_uring {
+	struct mutex            ur_lock;
+	int                     ur_fd;
+	bool                    ur_direct;
+	bool                    ur_fixedbuf;
+	u32                     ur_sqmask;
+	u32                     ur_cqmask;
+	u32                    *ur_sqhead;
+	u32                    *ur_sqtail;
+	u32                    *ur_sqarray;
+	u32                    *ur_cqhead;
+	u32                    *ur_cqtail;
+	struct io_uring_sqe    *ur_sqes;
+	struct io_uring_cqe    *ur_cqes;
+	void                   *ur_sqring;
+	size_t                  ur_sqringsz;
+	void                   *ur_cqring;
+	size_t                  ur_cqringsz;
+	size_t                  ur_sqesz;
+	char                   *ur_bufs;
+	u32                     ur_reqc;
+	u32                     ur_bufc;
+	struct pd_uring_req     ur_reqv[PD_URING_DEPTH];
+};
+
+static int pd_uring_setup(u32 entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int pd_uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int pd_uring_register(int fd, u32 opcode, const void *arg, u32 nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+merr_t pd_uring_create(int fd, bool direct, struct pd_uring **urp)
+{
+	struct io_uring_params  p = { };
+	struct iovec            iov[PD_URING_DEPTH];
+	struct pd_uring        *ur;
+	char                   *ring;
+	merr_t                  err;
+	int                     rc, i;
+
+	ur = calloc(1, sizeof(*ur));
+	if (!ur)
+		return merr(ENOMEM);
+
+	mutex_init(&ur->ur_lock);
+	ur->ur_direct = direct;
+
+	ur->ur_fd = pd_uring_setup(PD_URING_DEPTH, &p);
+	if (ur->ur_fd == -1) {
+		err = merr(errno);
+		mutex_destroy(&ur->ur_lock);
+		free(ur);
+		return err;
+	}
+
+	ur->ur_sqringsz = p.sq_off.array + p.sq_entries * sizeof(u32);
+	ur->ur_cqringsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->ur_sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->ur_sqringsz = max_t(size_t, ur->ur_sqringsz, ur->ur_cqringsz);
+		ur->ur_cqringsz = ur->ur_sqringsz;
+	}
+
+	ur->ur_sqring = mmap(NULL, ur->ur_sqringsz, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ur->ur_fd, IORING_OFF_SQ_RING);
+	if (ur->ur_sqring == MAP_FAILED) {
+		ur->ur_sqring = NULL;
+		goto errout;
+	}
+
+	ur->ur_cqring = ur->ur_sqring;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		ur->ur_cqring = mmap(NULL, ur->ur_cqringsz, PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ur->ur_fd, IORING_OFF_CQ_RING);
+		if (ur->ur_cqring == MAP_FAILED) {
+			ur->ur_cqring = NULL;
+			goto errout;
+		}
+	}
+
+	ur->ur_sqes = mmap(NULL, ur->ur_sqesz, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->ur_fd, IORING_OFF_SQES);
+	if (ur->ur_sqes == MAP_FAILED) {
+		ur->ur_sqes = NULL;
+		goto errout;
+	}
+
+	ring = ur->ur_sqring;
+	ur->ur_sqhead = (u32 *)(ring + p.sq_off.head);
+	ur->ur_sqtail = (u32 *)(ring + p.sq_off.tail);
+	ur->ur_sqmask = *(u32 *)(ring + p.sq_off.ring_mask);
+	ur->ur_sqarray = (u32 *)(ring + p.sq_off.array);
+
+	ring = ur->ur_cqring;
+	ur->ur_cqhead = (u32 *)(ring + p.cq_off.head);
+	ur->ur_cqtail = (u32 *)(ring + p.cq_off.tail);
+	ur->ur_cqmask = *(u32 *)(ring + p.cq_off.ring_mask);
+	ur->ur_cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	rc = pd_uring_register(ur->ur_fd, IORING_REGISTER_FILES, &fd, 1);
+	if (rc)
+		goto errout;
+
+	ur->ur_bufs = aligned_alloc(PAGE_SIZE, PD_URING_DEPTH * PD_URING_BUFSZ);
+	if (!ur->ur_bufs) {
+		errno = ENOMEM;
+		goto errout;
+	}
+
+	for (i = 0; i < PD_URING_DEPTH; i++) {
+		iov[i].iov_base = ur->ur_bufs + i * PD_URING_BUFSZ;
+		iov[i].iov_len = PD_URING_BUFSZ;
+	}
+
+	/*
+	 * Registered buffers count against RLIMIT_MEMLOCK on older kernels,
+	 * without them staged I/Os are issued as single buffer READV/WRITEV.
+	 */
+	rc = pd_uring_register(ur->ur_fd, IORING_REGISTER_BUFFERS, iov, PD_URING_DEPTH);
+	ur->ur_fixedbuf = !rc;
+
+	*urp = ur;
+
+	return 0;
+
+errout:
+	err = merr(errno);
+	pd_uring_destroy(ur);
+
+	return err;
+}
+
+void pd_uring_destroy(struct pd_uring *ur)
+{
+	if (!ur)
+		return;
+
+	if (ur->ur_sqes)
+		munmap(ur->ur_sqes, ur->ur_sqesz);
+	if (ur->ur_cqring && ur->ur_cqring != ur->ur_sqring)
+		munmap(ur->ur_cqring, ur->ur_cqringsz);
+	if (ur->ur_sqring)
+		munmap(ur->ur_sqring, ur->ur_sqringsz);
+
+	/* Closing the ring also unregisters its files and buffers. */
+	close(ur->ur_fd);
+
+	mutex_destroy(&ur->ur_lock);
+	free(ur->ur_bufs);
+	free(ur);
+}
+
+/**
+ * pd_uring_iov_copy() - Copy between a staging buffer and the caller's buffers
+ * @iov:    buffers of the caller
+ * @iovcnt: number of buffers
+ * @skip:   bytes of @iov to skip
+ * @buf:    staging buffer
+ * @len:    bytes to copy
+ * @out:    copy from @iov to @buf if true, else from @buf to @iov
+ */
+static void
+pd_uring_iov_copy(struct iovec *iov, int iovcnt, size_t skip, char *buf, size_t len, bool out)
+{
+	size_t  n;
+	int     i;
+
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+
+		n = min_t(size_t, iov[i].iov_len - skip, len);
+
+		if (out)
+			memcpy(buf, (char *)iov[i].iov_base + skip, n);
+		else
+			memcpy((char *)iov[i].iov_base + skip, buf, n);
+
+		buf += n;
+		len -= n;
+		skip = 0;
+	}
+}
+
+/**
+ * pd_uring_reap() - Reap the completions posted so far
+ * @ur:    ring
+ * @write: the batch writes
+ * @errp:  first error of the batch (input/output)
+ *
+ * Return: the number of completions reaped
+ */
+static u32 pd_uring_reap(struct pd_uring *ur, bool write, merr_t *errp)
+{
+	struct pd_uring_req    *req;
+	struct io_uring_cqe    *cqe;
+	u32                     head, tail, n = 0;
+
+	head = *ur->ur_cqhead;
+	tail = __atomic_load_n(ur->ur_cqtail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++, n++) {
+		cqe = ur->ur_cqes + (head & ur->ur_cqmask);
+		req = ur->ur_reqv + cqe->user_data;
+
+		if (cqe->res < 0) {
+			if (!*errp)
+				*errp = merr(-cqe->res);
+		} else if (cqe->res != req->urq_len) {
+			if (!*errp)
+				*errp = merr(EIO);
+		} else if (req->urq_buf && !write) {
+			pd_uring_iov_copy(req->urq_iov, req->urq_iovcnt, req->urq_skip,
+					  req->urq_buf, req->urq_len, false);
+		}
+	}
+
+	__atomic_store_n(ur->ur_cqhead, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/**
+ * pd_uring_submit() - Submit the current batch and reap its completions
+ * @ur:    ring
+ * @write: the batch writes
+ *
+ * Never returns before all the submitted I/Os completed, since they refer
+ * to the buffers of the caller and to the staging buffers.
+ *
+ * Return: the first error of the batch
+ */
+static merr_t pd_uring_submit(struct pd_uring *ur, bool write)
+{
+	merr_t  err = 0;
+	u32     tail, done = 0, submitted = 0;
+	int     rc;
+
+	if (!ur->ur_reqc)
+		return 0;
+
+	/* Publish the entries before the tail. */
+	tail = *ur->ur_sqtail + ur->ur_reqc;
+	__atomic_store_n(ur->ur_sqtail, tail, __ATOMIC_RELEASE);
+
+	while (done < ur->ur_reqc) {
+		rc = pd_uring_enter(ur->ur_fd, ur->ur_reqc - submitted, 1, IORING_ENTER_GETEVENTS);
+		if (rc >= 0) {
+			submitted += rc;
+		} else if (errno == EAGAIN || errno == EBUSY) {
+			/*
+			 * The kernel is short of resources, or wants completions
+			 * reaped first.  Retry once some I/Os completed, or after
+			 * a pause if none is in flight.
+			 */
+			if (done == submitted)
+				usleep(1000);
+		} else if (errno != EINTR) {
+			err = merr(errno);
+			break;
+		}
+
+		done += pd_uring_reap(ur, write, &err);
+	}
+
+	if (done < ur->ur_reqc) {
+		/*
+		 * Take back the entries that were not submitted, which the kernel
+		 * only looks at on io_uring_enter(), and wait for the others.
+		 */
+		*ur->ur_sqtail -= ur->ur_reqc - submitted;
+
+		while (done < submitted) {
+			rc = pd_uring_enter(ur->ur_fd, 0, submitted - done, IORING_ENTER_GETEVENTS);
+
+			/* Completions are still posted if the wait itself fails. */
+			if (rc == -1 && errno != EINTR)
+				usleep(1000);
+
+			done += pd_uring_reap(ur, write, &err);
+		}
+	}
+
+	ur->ur_reqc = 0;
+	ur->ur_bufc = 0;
+
+	return err;
+}
+
+/**
+ * pd_uring_queue() - Queue an I/O in the current batch
+ * @ur:       ring
+ * @opcode:   IORING_OP_*
+ * @off:      byte offset in the pd
+ * @iov:      buffers of a vectored I/O
+ * @iovcnt:   number of buffers of a vectored I/O
+ * @len:      transfer length
+ * @rw_flags: RWF_* flags
+ *
+ * Return: the I/O, whose urq_buf is set by the caller for staged I/Os
+ */
+static struct pd_uring_req *
+pd_uring_queue(
+	struct pd_uring    *ur,
+	u8                  opcode,
+	u64                 off,
+	struct iovec       *iov,
+	int                 iovcnt,
+	u32                 len,
+	int                 rw_flags)
+{
+	struct io_uring_sqe    *sqe;
+	struct pd_uring_req    *req;
+	u32                     idx;
+
+	idx = (*ur->ur_sqtail + ur->ur_reqc) & ur->ur_sqmask;
+	sqe = ur->ur_sqes + idx;
+	req = ur->ur_reqv + ur->ur_reqc;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;
+	sqe->off = off;
+	sqe->addr = (u64)(uintptr_t)iov;
+	sqe->len = iovcnt;
+	sqe->rw_flags = rw_flags;
+	sqe->user_data = ur->ur_reqc;
+
+	ur->ur_sqarray[idx] = idx;
+	ur->ur_reqc++;
+
+	memset(req, 0, sizeof(*req));
+	req->urq_len = len;
+
+	return req;
+}
+
+/**
+ * pd_uring_stage() - Queue an I/O through a staging buffer
+ * @ur:       ring
+ * @write:    true to write
+ * @iov:      buffers of the caller
+ * @iovcnt:   number of buffers
+ * @skip:     bytes of @iov before the data of the I/O
+ * @off:      byte offset in the pd
+ * @len:      transfer length, at most PD_URING_BUFSZ
+ * @rw_flags: RWF_* flags
+ */
+static merr_t
+pd_uring_stage(
+	struct pd_uring    *ur,
+	bool                write,
+	struct iovec       *iov,
+	int                 iovcnt,
+	size_t              skip,
+	u64                 off,
+	u32                 len,
+	int                 rw_flags)
+{
+	struct pd_uring_req    *req;
+	struct io_uring_sqe    *sqe;
+	char                   *buf;
+	merr_t                  err;
+	u32                     bufidx;
+	u8                      opcode;
+
+	if (ur->ur_reqc == PD_URING_DEPTH || ur->ur_bufc == PD_URING_DEPTH) {
+		err = pd_uring_submit(ur, write);
+		if (err)
+			return err;
+	}
+
+	bufidx = ur->ur_bufc++;
+	buf = ur->ur_bufs + bufidx * PD_URING_BUFSZ;
+
+	if (write)
+		pd_uring_iov_copy(iov, iovcnt, skip, buf, len, true);
+
+	if (ur->ur_fixedbuf)
+		opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+	else
+		opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+
+	sqe = ur->ur_sqes + ((*ur->ur_sqtail + ur->ur_reqc) & ur->ur_sqmask);
+
+	req = pd_uring_queue(ur, opcode, off, NULL, 1, len, rw_flags);
+	req->urq_iov = iov;
+	req->urq_iovcnt = iovcnt;
+	req->urq_skip = skip;
+	req->urq_buf = buf;
+
+	if (ur->ur_fixedbuf) {
+		sqe->addr = (u64)(uintptr_t)buf;
+		sqe->len = len;
+		sqe->buf_index = bufidx;
+	} else {
+		req->urq_sbuf.iov_base = buf;
+		req->urq_sbuf.iov_len = len;
+		sqe->addr = (u64)(uintptr_t)&req->urq_sbuf;
+	}
+
+	return 0;
+}
+
+static bool pd_uring_aligned(struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!IS_ALIGNED((uintptr_t)iov[i].iov_base, PD_URING_ALIGN) ||
+		    !IS_ALIGNED(iov[i].iov_len, PD_URING_ALIGN))
+			return false;
+	}
+
+	return true;
+}
+
+merr_t
+pd_uring_rw(
+	struct pd_uring    *ur,
+	bool                write,
+	struct iovec       *iov,
+	int                 iovcnt,
+	u64                 off,
+	int                 op_flags)
+{
+	int     rw_flags = 0;
+	merr_t  err = 0;
+	u64     len;
+	size_t  skip;
+	u32     n;
+	int     ivc;
+
+	if (ur->ur_direct && !IS_ALIGNED(off | calc_io_len(iov, iovcnt), PD_URING_ALIGN))
+		return merr(EINVAL);
+
+	mutex_lock(&ur->ur_lock);
+
+	if (write && (op_flags & REQ_PREFLUSH)) {
+		pd_uring_queue(ur, IORING_OP_FSYNC, 0, NULL, 0, 0, 0);
+
+		err = pd_uring_submit(ur, write);
+		if (err)
+			goto out;
+	}
+
+	if (write && (op_flags & REQ_FUA))
+		rw_flags = RWF_DSYNC;
+
+	while (iovcnt > 0) {
+		ivc = min_t(int, iovcnt, IOV_MAX);
+		len = calc_io_len(iov, ivc);
+
+		if (len <= PD_URING_BUFSZ || (ur->ur_direct && !pd_uring_aligned(iov, ivc))) {
+			for (skip = 0; skip < len; skip += n) {
+				n = min_t(u64, len - skip, PD_URING_BUFSZ);
+
+				err = pd_uring_stage(ur, write, iov, ivc, skip, off + skip, n, rw_flags);
+				if (err)
+					goto out;
+			}
+		} else {
+			if (ur->ur_reqc == PD_URING_DEPTH) {
+				err = pd_uring_submit(ur, write);
+				if (err)
+					goto out;
+			}
+
+			pd_uring_queue(ur, write ? IORING_OP_WRITEV : IORING_OP_READV,
+				       off, iov, ivc, len, rw_flags);
+		}
+
+		off += len;
+		iov += ivc;
+		iovcnt -= ivc;
+	}
+
+	err = pd_uring_submit(ur, write);
+
+out:
+	mutex_unlock(&ur->ur_lock);
+
+	return err;
+}
+
+#else /* PD_URING_SUPPORTED */
+
+merr_t pd_uring_create(int fd, bool direct, struct pd_uring **urp)
+{
+	return merr(ENOSYS);
+}
+
+void pd_uring_destroy(struct pd_uring *ur)
+{
+}
+
+merr_t
+pd_uring_rw(
+	struct pd_uring    *ur,
+	bool                write,
+	struct iovec       *iov,
+	int                 iovcnt,
+	u64                 off,
+	int                 op_flags)
+{
+	return merr(ENOSYS);
+}
+
+#endif /* PD_URING_SUPPORTED */
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_PD_URING_H
+#define MPOOL_PD_URING_H
+
+/*
+ * io_uring I/O engine of the pd file backend.
+ *
+ * Each pd opened with PD_FILE_URING gets a ring of its own, with the pd
+ * registered as the only fixed file of the ring and PD_URING_DEPTH page
+ * aligned staging buffers registered as its fixed buffers.  A request is
+ * split into IOV_MAX chunks as in the synchronous engine.  Chunks of at
+ * most PD_URING_BUFSZ bytes are copied through a staging buffer and issued
+ * as READ_FIXED/WRITE_FIXED, larger chunks are issued as READV/WRITEV on
+ * the buffers of the caller, unless the pd is open O_DIRECT and they are
+ * not aligned, in which case they are staged in PD_URING_BUFSZ pieces.
+ * Up to PD_URING_DEPTH chunks or pieces are submitted at once.
+ *
+ * REQ_FUA maps to RWF_DSYNC on each write rather than to an fsync() of the
+ * whole file, and REQ_PREFLUSH to an IORING_OP_FSYNC ahead of the writes.
+ */
+
+#include <util/platform.h>
+
+#include <sys/uio.h>
+
+#include "mpool_err.h"
+
+#define PD_URING_DEPTH          16
+#define PD_URING_BUFSZ          (64u << 10)
+#define PD_URING_ALIGN          4096    /* alignment of O_DIRECT I/O */
+
+struct pd_uring;
+
+/**
+ * pd_uring_create() - Set up a ring for a pd
+ * @fd:     pd file descriptor
+ * @direct: @fd is open O_DIRECT
+ * @urp:    ring (output)
+ *
+ * Return: ENOSYS or EPERM if io_uring is not available
+ */
+merr_t pd_uring_create(int fd, bool direct, struct pd_uring **urp);
+
+/**
+ * pd_uring_destroy() - Tear down the ring of a pd
+ * @ur: ring (may be NULL)
+ */
+void pd_uring_destroy(struct pd_uring *ur);
+
+/**
+ * pd_uring_rw() - Read or write a pd through its ring
+ * @ur:       ring
+ * @write:    true to write, false to read
+ * @iov:      buffers
+ * @iovcnt:   number of buffers
+ * @off:      byte offset in the pd
+ * @op_flags: REQ_PREFLUSH and REQ_FUA, for writes
+ *
+ * Waits for the whole request to complete.  Short transfers fail with EIO.
+ */
+merr_t
+pd_uring_rw(
+	struct pd_uring    *ur,
+	bool                write,
+	struct iovec       *iov,
+	int                 iovcnt,
+	u64                 off,
+	int                 op_flags);
+
+#endif /* MPOOL_PD_URING_H */
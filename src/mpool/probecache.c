@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Probe cache module.
+ *
+ * The cache file is a header followed by an array of records.  It is read
+ * under a shared flock() and rewritten in place under an exclusive one.
+ * mp_probe_cache_purge() empties it and bumps the generation in its header,
+ * and a cache is only saved if the generation did not change since it was
+ * loaded, so that a process that loaded the cache before a purge does not
+ * write its stale records back.  Among concurrent writers of the same
+ * generation the last one wins, which at worst loses the results of the
+ * others.
+ */
+
+#include <util/platform.h>
+#include <util/string.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+
+#include "device_table.h"
+#include "probecache.h"
+
+#define MP_PROBE_MAGIC_HDR      0x45425250u     /* "PRBE" */
+#define MP_PROBE_VERSION        2
+
+/**
+ * struct mp_probe_hdr - probe cache file header
+ * @ph_magic: MP_PROBE_MAGIC_HDR
+ * @ph_vers:  MP_PROBE_VERSION
+ * @ph_recsz: size of a record
+ * @ph_recc:  number of records
+ * @ph_gen:   generation, bumped by each purge
+ */
+struct mp_probe_hdr {
+	u32                     ph_magic;
+	u32                     ph_vers;
+	u32                     ph_recsz;
+	u32                     ph_recc;
+	u64                     ph_gen;
+};
+
+/**
+ * struct mp_probe_cache - probe cache
+ * @pc_now:    CLOCK_REALTIME seconds when the cache was loaded
+ * @pc_gen:    generation of the cache file when the cache was loaded
+ * @pc_dirty:  records were updated
+ * @pc_recc:   number of records
+ * @pc_recmax: size of pc_recv
+ * @pc_recv:   records
+ */
+struct mp_probe_cache {
+	u64                     pc_now;
+	u64                     pc_gen;
+	bool                    pc_dirty;
+	u32                     pc_recc;
+	u32                     pc_recmax;
+	struct mp_probe_rec    *pc_recv;
+};
+
+merr_t mp_probe_key(const char *path, struct mp_probe_rec *rec)
+{
+	struct stat st;
+	char        sysfs_dpath[64];
+	u64         val;
+
+	if (stat(path, &st))
+		return merr(errno);
+
+	if (!S_ISBLK(st.st_mode))
+		return merr(ENOTBLK);
+
+	memset(rec, 0, sizeof(*rec));
+	rec->pr_dev = st.st_rdev;
+
+	snprintf(sysfs_dpath, sizeof(sysfs_dpath), "/sys/dev/block/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+
+	/* diskseq changes whenever the media of the device changes (Linux 5.15+). */
+	if (!sysfs_get_val_u64(sysfs_dpath, "/diskseq", false, &val))
+		rec->pr_gen = val;
+
+	if (!sysfs_get_val_u64(sysfs_dpath, "/size", false, &val))
+		rec->pr_size = val;
+
+	return 0;
+}
+
+static inline bool mp_probe_samekey(const struct mp_probe_rec *a, const struct mp_probe_rec *b)
+{
+	return a->pr_dev == b->pr_dev && a->pr_gen == b->pr_gen && a->pr_size == b->pr_size;
+}
+
+/**
+ * mp_probe_hdr_read() - Read and check the header of the cache file
+ * @fd:  cache file, locked
+ * @hdr: header (output)
+ *
+ * Return: true if the file is a complete cache written by root
+ */
+static bool mp_probe_hdr_read(int fd, struct mp_probe_hdr *hdr)
+{
+	struct stat st;
+
+	return !fstat(fd, &st) && st.st_uid == 0 &&
+		pread(fd, hdr, sizeof(*hdr), 0) == sizeof(*hdr) &&
+		hdr->ph_magic == MP_PROBE_MAGIC_HDR && hdr->ph_vers == MP_PROBE_VERSION &&
+		hdr->ph_recsz == sizeof(struct mp_probe_rec) &&
+		st.st_size == sizeof(*hdr) + (u64)hdr->ph_recc * sizeof(struct mp_probe_rec);
+}
+
+/**
+ * mp_probe_file_write() - Rewrite the cache file
+ * @fd:   cache file, locked exclusively
+ * @gen:  generation
+ * @recv: records
+ * @recc: number of records
+ */
+static void mp_probe_file_write(int fd, u64 gen, struct mp_probe_rec *recv, u32 recc)
+{
+	struct mp_probe_hdr hdr = { };
+	struct iovec        iov[2];
+	ssize_t             cc;
+
+	hdr.ph_magic = MP_PROBE_MAGIC_HDR;
+	hdr.ph_vers = MP_PROBE_VERSION;
+	hdr.ph_recsz = sizeof(*recv);
+	hdr.ph_recc = recc;
+	hdr.ph_gen = gen;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = recv;
+	iov[1].iov_len = recc * sizeof(*recv);
+
+	/* A short write leaves a file of the wrong size, which readers ignore. */
+	cc = pwritev(fd, iov, 2, 0);
+	if (cc == iov[0].iov_len + iov[1].iov_len)
+		(void)ftruncate(fd, cc);
+}
+
+struct mp_probe_cache *mp_probe_cache_open(void)
+{
+	struct mp_probe_cache  *pc;
+	struct mp_probe_hdr     hdr;
+	struct timespec         ts;
+	ssize_t                 cc;
+	size_t                  len;
+	int                     fd;
+
+	pc = calloc(1, sizeof(*pc));
+	if (!pc)
+		return NULL;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	pc->pc_now = ts.tv_sec;
+
+	fd = open(MP_PROBE_CACHE_FILE, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return pc;
+
+	if (flock(fd, LOCK_SH)) {
+		close(fd);
+		return pc;
+	}
+
+	/* Only trust a cache written by root. */
+	if (!mp_probe_hdr_read(fd, &hdr)) {
+		close(fd);
+		return pc;
+	}
+
+	pc->pc_gen = hdr.ph_gen;
+
+	len = hdr.ph_recc * sizeof(*pc->pc_recv);
+
+	pc->pc_recv = malloc(len ?: 1);
+	if (pc->pc_recv) {
+		cc = pread(fd, pc->pc_recv, len, sizeof(hdr));
+		if (cc == len) {
+			pc->pc_recc = hdr.ph_recc;
+			pc->pc_recmax = hdr.ph_recc;
+		}
+	}
+
+	close(fd);
+
+	return pc;
+}
+
+void mp_probe_cache_close(struct mp_probe_cache *pc)
+{
+	struct mp_probe_hdr hdr;
+	u64                 gen = 0;
+	u32                 i, n = 0;
+	int                 fd;
+
+	if (!pc)
+		return;
+
+	if (!pc->pc_dirty || geteuid() != 0)
+		goto out;
+
+	/* Drop the records too old to be used. */
+	for (i = 0; i < pc->pc_recc; i++)
+		if (pc->pc_recv[i].pr_stamp + MP_PROBE_TTL > pc->pc_now)
+			pc->pc_recv[n++] = pc->pc_recv[i];
+
+	fd = open(MP_PROBE_CACHE_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1)
+		goto out;
+
+	if (flock(fd, LOCK_EX))
+		goto unlock;
+
+	if (mp_probe_hdr_read(fd, &hdr))
+		gen = hdr.ph_gen;
+
+	/* The cache was purged since it was loaded, its records are stale. */
+	if (gen != pc->pc_gen)
+		goto unlock;
+
+	mp_probe_file_write(fd, gen, pc->pc_recv, n);
+
+unlock:
+	close(fd);
+
+out:
+	free(pc->pc_recv);
+	free(pc);
+}
+
+const struct mp_probe_rec *
+mp_probe_cache_find(const struct mp_probe_cache *pc, const struct mp_probe_rec *key)
+{
+	const struct mp_probe_rec  *rec;
+	u32                         i;
+
+	for (i = 0; i < pc->pc_recc; i++) {
+		rec = pc->pc_recv + i;
+
+		if (rec->pr_dev != key->pr_dev)
+			continue;
+
+		if (!mp_probe_samekey(rec, key) || rec->pr_stamp + MP_PROBE_TTL <= pc->pc_now ||
+		    rec->pr_stamp > pc->pc_now)
+			return NULL;
+
+		return rec;
+	}
+
+	return NULL;
+}
+
+void mp_probe_cache_update(struct mp_probe_cache *pc, const struct mp_probe_rec *rec)
+{
+	struct mp_probe_rec    *old = NULL, *recv;
+	u32                     i;
+
+	for (i = 0; i < pc->pc_recc && !old; i++)
+		if (pc->pc_recv[i].pr_dev == rec->pr_dev)
+			old = pc->pc_recv + i;
+
+	if (!old) {
+		if (pc->pc_recc == pc->pc_recmax) {
+			u32 n = pc->pc_recmax * 2 ?: 64;
+
+			recv = realloc(pc->pc_recv, n * sizeof(*recv));
+			if (!recv)
+				return;
+
+			pc->pc_recv = recv;
+			pc->pc_recmax = n;
+		}
+
+		old = pc->pc_recv + pc->pc_recc++;
+		memset(old, 0, sizeof(*old));
+	}
+
+	pc->pc_dirty = true;
+
+	/* Results for another key, or too old to be merged with, are replaced. */
+	if (!mp_probe_samekey(old, rec) || !old->pr_flags ||
+	    old->pr_stamp + MP_PROBE_TTL <= pc->pc_now) {
+		*old = *rec;
+		old->pr_stamp = pc->pc_now;
+		return;
+	}
+
+	if (rec->pr_flags & MP_PROBE_BLKID) {
+		old->pr_flags &= ~MP_PROBE_MPOOL;
+		old->pr_uuid = rec->pr_uuid;
+		strlcpy(old->pr_name, rec->pr_name, sizeof(old->pr_name));
+	}
+
+	if (rec->pr_flags & MP_PROBE_PROP)
+		old->pr_prop = rec->pr_prop;
+
+	old->pr_flags |= rec->pr_flags;
+}
+
+void mp_probe_cache_purge(void)
+{
+	struct mp_probe_hdr hdr;
+	u64                 gen = 1;
+	int                 fd;
+
+	/*
+	 * A process may have loaded an empty cache because there was no cache
+	 * file, create one with a new generation so that it does not save it.
+	 */
+	fd = open(MP_PROBE_CACHE_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return;
+
+	if (!flock(fd, LOCK_EX)) {
+		if (mp_probe_hdr_read(fd, &hdr))
+			gen = hdr.ph_gen + 1;
+
+		mp_probe_file_write(fd, gen, NULL, 0);
+	}
+
+	close(fd);
+}
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_PROBECACHE_H
+#define MPOOL_PROBECACHE_H
+
+/*
+ * Persistent cache of block device probe results.
+ *
+ * The results of the libblkid probe and the device properties of a block
+ * device are cached in a file in the mpool run directory, keyed by the
+ * device number, the disk sequence number and the size the kernel reports
+ * for the device, so that device discovery does not have to probe devices
+ * that did not change.  Writes to superblocks through the library drop the
+ * whole cache, and records are otherwise trusted for MP_PROBE_TTL seconds
+ * at most, which bounds how long a change made by other tools can go
+ * unnoticed.  Since the disk sequence number does not change when another
+ * tool writes a superblock, checks that guard against overwriting a device
+ * must not be answered from the cache.
+ */
+
+#include <util/platform.h>
+#include <util/uuid.h>
+
+#include <mpool/mpool.h>
+#include <mpool/mpool_ioctl.h>
+
+#include "mpool_err.h"
+
+#define MP_PROBE_CACHE_FILE     MPOOL_RUNDIR_ROOT "/.probe_cache"
+#define MP_PROBE_TTL            60      /* seconds */
+#define MP_PROBE_THREADS_MAX    16
+
+#define MP_PROBE_BLKID          0x01    /* libblkid probe done */
+#define MP_PROBE_MPOOL          0x02    /* mpool member, pr_uuid and pr_name valid */
+#define MP_PROBE_PROP           0x04    /* pr_prop valid */
+
+struct mp_probe_cache;
+
+/**
+ * struct mp_probe_rec - probe results of a block device
+ * @pr_dev:   device number
+ * @pr_gen:   disk sequence number, 0 on kernels that do not have one
+ * @pr_size:  size of the device in sectors
+ * @pr_stamp: CLOCK_REALTIME seconds of the oldest of the results
+ * @pr_flags: MP_PROBE_* flags of the valid results
+ * @pr_uuid:  mpool UUID
+ * @pr_name:  mpool name
+ * @pr_prop:  device properties
+ *
+ * The cache file is private to the host and to the library version, and
+ * holds records as they are laid out in memory.
+ */
+struct mp_probe_rec {
+	u64                 pr_dev;
+	u64                 pr_gen;
+	u64                 pr_size;
+	u64                 pr_stamp;
+	u32                 pr_flags;
+	u32                 pr_rsvd;
+	struct mpool_uuid   pr_uuid;
+	char                pr_name[MPOOL_NAMESZ_MAX];
+	struct pd_prop      pr_prop;
+};
+
+/**
+ * mp_probe_key() - Initialize a record with the key of a block device
+ * @path: device path
+ * @rec:  record, of which only the key is set (output)
+ *
+ * Return: ENOTBLK if @path is not a block device
+ */
+merr_t mp_probe_key(const char *path, struct mp_probe_rec *rec);
+
+/**
+ * mp_probe_cache_open() - Load the probe cache
+ *
+ * A missing, unreadable or stale cache file yields an empty cache.
+ *
+ * Return: the cache, or NULL if out of memory
+ */
+struct mp_probe_cache *mp_probe_cache_open(void);
+
+/**
+ * mp_probe_cache_close() - Save the probe cache if it was updated and free it
+ * @pc: cache (may be NULL)
+ *
+ * The cache is only saved by processes that may write the run directory,
+ * and only if it was not purged since it was loaded.
+ */
+void mp_probe_cache_close(struct mp_probe_cache *pc);
+
+/**
+ * mp_probe_cache_find() - Look up the results for a device
+ * @pc:  cache
+ * @key: record of which the key is set
+ *
+ * Safe to call concurrently, but not with mp_probe_cache_update().
+ *
+ * Return: the record of the device if its key matches and it is fresh,
+ * else NULL
+ */
+const struct mp_probe_rec *
+mp_probe_cache_find(const struct mp_probe_cache *pc, const struct mp_probe_rec *key);
+
+/**
+ * mp_probe_cache_update() - Add results for a device
+ * @pc:  cache
+ * @rec: record of which the key, pr_flags and the fields they cover are set
+ *
+ * Results are merged into those already cached for the same key, and
+ * replace those cached for another key.
+ */
+void mp_probe_cache_update(struct mp_probe_cache *pc, const struct mp_probe_rec *rec);
+
+/**
+ * mp_probe_cache_purge() - Drop the whole cache
+ *
+ * Called after writing to the superblocks of devices.  Caches loaded before
+ * are not saved, even those loaded when there was no cache file.
+ */
+void mp_probe_cache_purge(void);
+
+#endif /* MPOOL_PROBECACHE_H */
@@ -0,0 +1,643 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mblock page cache module.
+ *
+ * Each shard implements the full 2Q algorithm (Johnson & Shasha, VLDB '94):
+ *
+ *   A1in:  FIFO of pages referenced once, at most rcs_kin pages
+ *   Am:    LRU of pages referenced again after leaving A1in
+ *   A1out: FIFO of the keys (no data) of pages evicted from A1in
+ *
+ * A missed page whose key is found in A1out goes straight to Am, all other
+ * missed pages enter A1in.  Pages of a large scan are thus referenced only
+ * once and cycle through A1in without displacing the working set in Am.
+ *
+ * All pages of an mblock live in the same shard and are linked off a
+ * per-mblock header entry, which is hashed like a page with page number
+ * RC_PGNO_HDR, so that mp_rdcache_inval() does not need to scan the shard.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/page.h>
+#include <util/log2.h>
+#include <util/minmax.h>
+
+#include <stddef.h>
+
+#include "rdcache.h"
+
+#define RC_PGNO_HDR     (~0ull)
+
+enum mp_rdcache_q {
+	RCQ_FREE = 0,
+	RCQ_A1IN,
+	RCQ_AM,
+	RCQ_A1OUT,
+	RCQ_HDR,
+};
+
+struct rc_link {
+	struct rc_link *prev;
+	struct rc_link *next;
+};
+
+static inline void rc_list_init(struct rc_link *head)
+{
+	head->prev = head->next = head;
+}
+
+static inline bool rc_list_empty(const struct rc_link *head)
+{
+	return head->next == head;
+}
+
+static inline void rc_list_add(struct rc_link *head, struct rc_link *node)
+{
+	node->next = head->next;
+	node->prev = head;
+	head->next->prev = node;
+	head->next = node;
+}
+
+static inline void rc_list_del(struct rc_link *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = node->next = node;
+}
+
+/**
+ * struct mp_rdcache_ent - cached page, ghost key, or mblock header
+ * @rce_hnext:  hash chain
+ * @rce_qlink:  link in A1in, Am, A1out or the free list
+ * @rce_mblink: link in the mblock's page list, or list head for a header
+ * @rce_mbid:   mblock object ID
+ * @rce_pgno:   page number within the mblock, RC_PGNO_HDR for a header
+ * @rce_q:      enum mp_rdcache_q
+ * @rce_page:   cached data, NULL for ghosts and headers
+ */
+struct mp_rdcache_ent {
+	struct mp_rdcache_ent  *rce_hnext;
+	struct rc_link          rce_qlink;
+	struct rc_link          rce_mblink;
+	u64                     rce_mbid;
+	u64                     rce_pgno;
+	u32                     rce_q;
+	char                   *rce_page;
+};
+
+#define rce_of_qlink(_l) \
+	((struct mp_rdcache_ent *)((char *)(_l) - offsetof(struct mp_rdcache_ent, rce_qlink)))
+
+#define rce_of_mblink(_l) \
+	((struct mp_rdcache_ent *)((char *)(_l) - offsetof(struct mp_rdcache_ent, rce_mblink)))
+
+/**
+ * struct mp_rdcache_shard - independently locked partition of the cache
+ * @rcs_lock:    protects all fields of the shard
+ * @rcs_bktv:    hash buckets
+ * @rcs_bktmask: number of buckets - 1
+ * @rcs_cap:     maximum number of cached pages
+ * @rcs_kin:     maximum number of pages in A1in
+ * @rcs_kout:    maximum number of keys in A1out
+ * @rcs_nin:     number of pages in A1in
+ * @rcs_nam:     number of pages in Am
+ * @rcs_nout:    number of keys in A1out
+ * @rcs_a1in:    A1in FIFO, newest first
+ * @rcs_am:      Am LRU, most recently used first
+ * @rcs_a1out:   A1out FIFO, newest first
+ * @rcs_free:    free entries
+ * @rcs_entv:    entry pool
+ * @rcs_arena:   rcs_cap pages of page-aligned memory
+ * @rcs_arenac:  number of arena pages handed out
+ * @rcs_pgfreec: number of pages in rcs_pgfreev
+ * @rcs_pgfreev: pages freed by invalidation
+ * @rcs_hits:    pages served from the cache
+ * @rcs_misses:  pages read from media
+ * @rcs_evicts:  pages evicted
+ * @rcs_invals:  pages invalidated
+ */
+struct mp_rdcache_shard {
+	struct mutex            rcs_lock;
+	struct mp_rdcache_ent **rcs_bktv;
+	u32                     rcs_bktmask;
+	u32                     rcs_cap;
+	u32                     rcs_kin;
+	u32                     rcs_kout;
+	u32                     rcs_nin;
+	u32                     rcs_nam;
+	u32                     rcs_nout;
+	struct rc_link          rcs_a1in;
+	struct rc_link          rcs_am;
+	struct rc_link          rcs_a1out;
+	struct rc_link          rcs_free;
+	struct mp_rdcache_ent  *rcs_entv;
+	char                   *rcs_arena;
+	u32                     rcs_arenac;
+	u32                     rcs_pgfreec;
+	char                  **rcs_pgfreev;
+	u64                     rcs_hits;
+	u64                     rcs_misses;
+	u64                     rcs_evicts;
+	u64                     rcs_invals;
+} __aligned(SMP_CACHE_BYTES);
+
+/**
+ * struct mp_rdcache - mblock page cache
+ * @rc_shardv: vector of shards
+ */
+struct mp_rdcache {
+	struct mp_rdcache_shard rc_shardv[MP_RDCACHE_SHARDS];
+};
+
+static inline u64 rc_hash(u64 mbid, u64 pgno)
+{
+	return (mbid ^ (pgno * 0xc2b2ae3d27d4eb4full)) * 0x9e3779b97f4a7c15ull;
+}
+
+static inline struct mp_rdcache_shard *rc_shard(struct mp_rdcache *rc, u64 mbid)
+{
+	return rc->rc_shardv + ((mbid * 0x9e3779b97f4a7c15ull) >> (64 - MP_RDCACHE_SHARDS_SHIFT));
+}
+
+static inline struct mp_rdcache_ent **
+rc_bucket(struct mp_rdcache_shard *shard, u64 mbid, u64 pgno)
+{
+	return shard->rcs_bktv + ((rc_hash(mbid, pgno) >> 32) & shard->rcs_bktmask);
+}
+
+static struct mp_rdcache_ent *rc_lookup(struct mp_rdcache_shard *shard, u64 mbid, u64 pgno)
+{
+	struct mp_rdcache_ent *ent;
+
+	for (ent = *rc_bucket(shard, mbid, pgno); ent; ent = ent->rce_hnext)
+		if (ent->rce_mbid == mbid && ent->rce_pgno == pgno)
+			return ent;
+
+	return NULL;
+}
+
+static void rc_hash_insert(struct mp_rdcache_shard *shard, struct mp_rdcache_ent *ent)
+{
+	struct mp_rdcache_ent **bkt = rc_bucket(shard, ent->rce_mbid, ent->rce_pgno);
+
+	ent->rce_hnext = *bkt;
+	*bkt = ent;
+}
+
+static void rc_hash_remove(struct mp_rdcache_shard *shard, struct mp_rdcache_ent *ent)
+{
+	struct mp_rdcache_ent **pp = rc_bucket(shard, ent->rce_mbid, ent->rce_pgno);
+
+	while (*pp != ent)
+		pp = &(*pp)->rce_hnext;
+
+	*pp = ent->rce_hnext;
+	ent->rce_hnext = NULL;
+}
+
+static struct mp_rdcache_ent *rc_ent_alloc(struct mp_rdcache_shard *shard)
+{
+	struct rc_link *link = shard->rcs_free.next;
+
+	/* The pool is sized so that it cannot run dry, see rc_shard_init(). */
+	assert(link != &shard->rcs_free);
+
+	rc_list_del(link);
+
+	return rce_of_qlink(link);
+}
+
+static void rc_ent_free(struct mp_rdcache_shard *shard, struct mp_rdcache_ent *ent)
+{
+	ent->rce_q = RCQ_FREE;
+	ent->rce_page = NULL;
+	rc_list_add(&shard->rcs_free, &ent->rce_qlink);
+}
+
+/**
+ * rc_page_unlink() - Remove a cached page from its mblock's page list
+ * @shard: locked shard
+ * @ent:   cached page
+ *
+ * Frees the mblock header once its last page is gone.
+ */
+static void rc_page_unlink(struct mp_rdcache_shard *shard, struct mp_rdcache_ent *ent)
+{
+	struct rc_link *next = ent->rce_mblink.next;
+
+	rc_list_del(&ent->rce_mblink);
+
+	if (rc_list_empty(next)) {
+		struct mp_rdcache_ent *hdr = rce_of_mblink(next);
+
+		if (hdr->rce_q == RCQ_HDR) {
+			rc_hash_remove(shard, hdr);
+			rc_ent_free(shard, hdr);
+		}
+	}
+}
+
+static void rc_page_link(struct mp_rdcache_shard *shard, struct mp_rdcache_ent *ent)
+{
+	struct mp_rdcache_ent *hdr;
+
+	hdr = rc_lookup(shard, ent->rce_mbid, RC_PGNO_HDR);
+	if (!hdr) {
+		hdr = rc_ent_alloc(shard);
+		hdr->rce_mbid = ent->rce_mbid;
+		hdr->rce_pgno = RC_PGNO_HDR;
+		hdr->rce_q = RCQ_HDR;
+		rc_list_init(&hdr->rce_mblink);
+		rc_hash_insert(shard, hdr);
+	}
+
+	rc_list_add(&hdr->rce_mblink, &ent->rce_mblink);
+}
+
+/**
+ * rc_page_reclaim() - Obtain a page buffer, evicting a page if needed
+ * @shard: locked shard
+ */
+static char *rc_page_reclaim(struct mp_rdcache_shard *shard)
+{
+	struct mp_rdcache_ent  *ent;
+	char                   *page;
+
+	if (shard->rcs_pgfreec > 0)
+		return shard->rcs_pgfreev[--shard->rcs_pgfreec];
+
+	if (shard->rcs_arenac < shard->rcs_cap)
+		return shard->rcs_arena + (size_t)shard->rcs_arenac++ * PAGE_SIZE;
+
+	shard->rcs_evicts++;
+
+	if (shard->rcs_nin > shard->rcs_kin || shard->rcs_nam == 0) {
+		/* Demote the oldest A1in page to a ghost in A1out. */
+		ent = rce_of_qlink(shard->rcs_a1in.prev);
+		rc_list_del(&ent->rce_qlink);
+		shard->rcs_nin--;
+
+		rc_page_unlink(shard, ent);
+		page = ent->rce_page;
+
+		ent->rce_page = NULL;
+		ent->rce_q = RCQ_A1OUT;
+		rc_list_add(&shard->rcs_a1out, &ent->rce_qlink);
+
+		if (++shard->rcs_nout > shard->rcs_kout) {
+			ent = rce_of_qlink(shard->rcs_a1out.prev);
+			rc_list_del(&ent->rce_qlink);
+			shard->rcs_nout--;
+
+			rc_hash_remove(shard, ent);
+			rc_ent_free(shard, ent);
+		}
+
+		return page;
+	}
+
+	ent = rce_of_qlink(shard->rcs_am.prev);
+	rc_list_del(&ent->rce_qlink);
+	shard->rcs_nam--;
+
+	rc_page_unlink(shard, ent);
+	rc_hash_remove(shard, ent);
+	page = ent->rce_page;
+	rc_ent_free(shard, ent);
+
+	return page;
+}
+
+/**
+ * rc_get() - Copy a cached page out and record the reference
+ * @shard: locked shard
+ * @mbid:  mblock object ID
+ * @pgno:  page number
+ * @dst:   destination buffer
+ *
+ * Return: true on hit
+ */
+static bool rc_get(struct mp_rdcache_shard *shard, u64 mbid, u64 pgno, void *dst)
+{
+	struct mp_rdcache_ent *ent;
+
+	ent = rc_lookup(shard, mbid, pgno);
+	if (!ent || !ent->rce_page)
+		return false;
+
+	if (ent->rce_q == RCQ_AM) {
+		rc_list_del(&ent->rce_qlink);
+		rc_list_add(&shard->rcs_am, &ent->rce_qlink);
+	}
+
+	memcpy(dst, ent->rce_page, PAGE_SIZE);
+
+	return true;
+}
+
+static void rc_put(struct mp_rdcache_shard *shard, u64 mbid, u64 pgno, const void *src)
+{
+	struct mp_rdcache_ent  *ent;
+	char                   *page;
+
+	ent = rc_lookup(shard, mbid, pgno);
+	if (ent && ent->rce_page)
+		return;
+
+	/* Reclaim first as it may recycle the ghost found above. */
+	page = rc_page_reclaim(shard);
+
+	ent = rc_lookup(shard, mbid, pgno);
+	if (ent) {
+		rc_list_del(&ent->rce_qlink);
+		shard->rcs_nout--;
+
+		ent->rce_q = RCQ_AM;
+		rc_list_add(&shard->rcs_am, &ent->rce_qlink);
+		shard->rcs_nam++;
+	} else {
+		ent = rc_ent_alloc(shard);
+		ent->rce_mbid = mbid;
+		ent->rce_pgno = pgno;
+		rc_hash_insert(shard, ent);
+
+		ent->rce_q = RCQ_A1IN;
+		rc_list_add(&shard->rcs_a1in, &ent->rce_qlink);
+		shard->rcs_nin++;
+	}
+
+	ent->rce_page = page;
+	memcpy(page, src, PAGE_SIZE);
+
+	rc_page_link(shard, ent);
+}
+
+static merr_t rc_shard_init(struct mp_rdcache_shard *shard, u32 cap)
+{
+	u32 entc, bktc, i;
+
+	mutex_init(&shard->rcs_lock);
+	rc_list_init(&shard->rcs_a1in);
+	rc_list_init(&shard->rcs_am);
+	rc_list_init(&shard->rcs_a1out);
+	rc_list_init(&shard->rcs_free);
+
+	shard->rcs_cap = cap;
+	shard->rcs_kin = max_t(u32, cap / 4, 1);
+	shard->rcs_kout = max_t(u32, cap / 2, 1);
+
+	/* Pages, ghosts, and at most one header per page. */
+	entc = 2 * cap + shard->rcs_kout + 1;
+	bktc = 1u << (ilog2(entc) + 1);
+
+	shard->rcs_bktmask = bktc - 1;
+	shard->rcs_bktv = calloc(bktc, sizeof(*shard->rcs_bktv));
+	shard->rcs_entv = calloc(entc, sizeof(*shard->rcs_entv));
+	shard->rcs_pgfreev = calloc(cap, sizeof(*shard->rcs_pgfreev));
+	shard->rcs_arena = aligned_alloc(PAGE_SIZE, (size_t)cap * PAGE_SIZE);
+
+	if (!shard->rcs_bktv || !shard->rcs_entv || !shard->rcs_pgfreev || !shard->rcs_arena)
+		return merr(ENOMEM);
+
+	for (i = 0; i < entc; i++)
+		rc_ent_free(shard, shard->rcs_entv + i);
+
+	return 0;
+}
+
+static void rc_shard_fini(struct mp_rdcache_shard *shard)
+{
+	free(shard->rcs_arena);
+	free(shard->rcs_pgfreev);
+	free(shard->rcs_entv);
+	free(shard->rcs_bktv);
+	mutex_destroy(&shard->rcs_lock);
+}
+
+merr_t mp_rdcache_create(u64 size, struct mp_rdcache **rcp)
+{
+	struct mp_rdcache  *rc;
+	merr_t              err = 0;
+	u64                 cap;
+	int                 i;
+
+	if (!rcp)
+		return merr(EINVAL);
+
+	*rcp = NULL;
+
+	cap = max_t(u64, size / PAGE_SIZE / MP_RDCACHE_SHARDS, MP_RDCACHE_SHARD_MIN);
+	if (cap > U32_MAX / 4)
+		return merr(EINVAL);
+
+	rc = aligned_alloc(__alignof__(*rc), sizeof(*rc));
+	if (!rc)
+		return merr(ENOMEM);
+
+	memset(rc, 0, sizeof(*rc));
+
+	for (i = 0; i < MP_RDCACHE_SHARDS && !err; i++)
+		err = rc_shard_init(rc->rc_shardv + i, cap);
+
+	if (err) {
+		while (i-- > 0)
+			rc_shard_fini(rc->rc_shardv + i);
+		free(rc);
+		return err;
+	}
+
+	*rcp = rc;
+
+	return 0;
+}
+
+void mp_rdcache_destroy(struct mp_rdcache *rc)
+{
+	int i;
+
+	if (!rc)
+		return;
+
+	for (i = 0; i < MP_RDCACHE_SHARDS; i++)
+		rc_shard_fini(rc->rc_shardv + i);
+
+	free(rc);
+}
+
+/**
+ * rc_iov_next() - Return the address of the next page of an iovec
+ * @iov:  iovec of whole, page-aligned pages
+ * @idx:  iovec cursor (in/out)
+ * @off:  offset cursor in iov[*idx] (in/out)
+ *
+ * Pages are walked sequentially, starting with *idx = 0 and *off = 0.
+ */
+static char *rc_iov_next(const struct iovec *iov, int *idx, size_t *off)
+{
+	char *page;
+
+	while (*off >= iov[*idx].iov_len) {
+		(*idx)++;
+		*off = 0;
+	}
+
+	page = (char *)iov[*idx].iov_base + *off;
+	*off += PAGE_SIZE;
+
+	return page;
+}
+
+merr_t
+mp_rdcache_read(
+	struct mp_rdcache      *rc,
+	struct mpool           *mp,
+	mp_rdcache_fill_fn     *fill,
+	u64                     mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset)
+{
+	struct mp_rdcache_shard    *shard;
+	struct iovec               *slice;
+	merr_t                      err;
+	size_t                      len = 0, off, skip;
+	u64                         pgno, npages, first, last, i;
+	int                         idx, slicec;
+
+	for (idx = 0; idx < iovc; idx++) {
+		if (!PAGE_ALIGNED(iov[idx].iov_base) || !IS_ALIGNED(iov[idx].iov_len, PAGE_SIZE))
+			return fill(mp, mbid, iov, iovc, offset);
+		len += iov[idx].iov_len;
+	}
+
+	shard = rc_shard(rc, mbid);
+	npages = len / PAGE_SIZE;
+
+	/* Reads that would flush most of A1in are not worth caching. */
+	if (!IS_ALIGNED(offset, PAGE_SIZE) || npages == 0 || npages > shard->rcs_kin / 2)
+		return fill(mp, mbid, iov, iovc, offset);
+
+	pgno = offset / PAGE_SIZE;
+	first = last = npages;
+	idx = 0;
+	off = 0;
+
+	mutex_lock(&shard->rcs_lock);
+	for (i = 0; i < npages; i++) {
+		if (rc_get(shard, mbid, pgno + i, rc_iov_next(iov, &idx, &off)))
+			continue;
+
+		if (first == npages)
+			first = i;
+		last = i;
+	}
+	shard->rcs_hits += npages - (first < npages ? last - first + 1 : 0);
+	shard->rcs_misses += first < npages ? last - first + 1 : 0;
+	mutex_unlock(&shard->rcs_lock);
+
+	if (first == npages)
+		return 0;
+
+	slice = malloc(iovc * sizeof(*slice));
+	if (!slice)
+		return merr(ENOMEM);
+
+	/* Build the iovec for pages first through last. */
+	skip = first * PAGE_SIZE;
+	len = (last - first + 1) * PAGE_SIZE;
+	slicec = 0;
+
+	for (idx = 0; idx < iovc && len > 0; idx++) {
+		size_t n;
+
+		if (skip >= iov[idx].iov_len) {
+			skip -= iov[idx].iov_len;
+			continue;
+		}
+
+		n = min_t(size_t, iov[idx].iov_len - skip, len);
+		slice[slicec].iov_base = (char *)iov[idx].iov_base + skip;
+		slice[slicec].iov_len = n;
+		slicec++;
+
+		len -= n;
+		skip = 0;
+	}
+
+	err = fill(mp, mbid, slice, slicec, offset + first * PAGE_SIZE);
+	if (!err) {
+		idx = 0;
+		off = 0;
+
+		mutex_lock(&shard->rcs_lock);
+		for (i = first; i <= last; i++)
+			rc_put(shard, mbid, pgno + i, rc_iov_next(slice, &idx, &off));
+		mutex_unlock(&shard->rcs_lock);
+	}
+
+	free(slice);
+
+	return err;
+}
+
+void mp_rdcache_inval(struct mp_rdcache *rc, u64 mbid)
+{
+	struct mp_rdcache_shard    *shard;
+	struct mp_rdcache_ent      *hdr, *ent;
+
+	if (!rc)
+		return;
+
+	shard = rc_shard(rc, mbid);
+
+	mutex_lock(&shard->rcs_lock);
+	hdr = rc_lookup(shard, mbid, RC_PGNO_HDR);
+
+	while (hdr && !rc_list_empty(&hdr->rce_mblink)) {
+		ent = rce_of_mblink(hdr->rce_mblink.next);
+
+		rc_list_del(&ent->rce_qlink);
+		if (ent->rce_q == RCQ_A1IN)
+			shard->rcs_nin--;
+		else
+			shard->rcs_nam--;
+
+		/* Unlinking the last page frees the header. */
+		if (hdr->rce_mblink.next->next == &hdr->rce_mblink)
+			hdr = NULL;
+
+		rc_page_unlink(shard, ent);
+		rc_hash_remove(shard, ent);
+
+		shard->rcs_pgfreev[shard->rcs_pgfreec++] = ent->rce_page;
+		rc_ent_free(shard, ent);
+		shard->rcs_invals++;
+	}
+	mutex_unlock(&shard->rcs_lock);
+}
+
+void mp_rdcache_stats_get(struct mp_rdcache *rc, struct mpool_rdcache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!rc)
+		return;
+
+	for (i = 0; i < MP_RDCACHE_SHARDS; i++) {
+		struct mp_rdcache_shard *shard = rc->rc_shardv + i;
+
+		mutex_lock(&shard->rcs_lock);
+		stats->mrs_hits += shard->rcs_hits;
+		stats->mrs_misses += shard->rcs_misses;
+		stats->mrs_evictions += shard->rcs_evicts;
+		stats->mrs_invals += shard->rcs_invals;
+		mutex_unlock(&shard->rcs_lock);
+	}
+}
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_RDCACHE_H
+#define MPOOL_RDCACHE_H
+
+/*
+ * Userspace mblock page cache, keyed by (mblock ID, page number).
+ *
+ * The cache is split into MP_RDCACHE_SHARDS independently locked shards
+ * selected by mblock ID, so that a read never takes more than one shard
+ * lock and so that all pages of an mblock can be dropped in one pass.
+ * Each shard uses 2Q replacement, which keeps a single scan from flushing
+ * pages that are accessed repeatedly.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_RDCACHE_SHARDS_SHIFT 5
+#define MP_RDCACHE_SHARDS       (1u << MP_RDCACHE_SHARDS_SHIFT)
+#define MP_RDCACHE_SHARD_MIN    64
+
+struct mp_rdcache;
+
+/**
+ * mp_rdcache_fill_fn - read pages missing from the cache from media
+ */
+typedef merr_t
+mp_rdcache_fill_fn(struct mpool *mp, u64 mbid, const struct iovec *iov, int iovc, off_t offset);
+
+/**
+ * mp_rdcache_create() - Create an mblock page cache
+ * @size:  cache capacity in bytes
+ * @rcp:   cache (output)
+ */
+merr_t mp_rdcache_create(u64 size, struct mp_rdcache **rcp);
+
+/**
+ * mp_rdcache_destroy() - Destroy an mblock page cache
+ * @rc: cache (may be NULL)
+ */
+void mp_rdcache_destroy(struct mp_rdcache *rc);
+
+/**
+ * mp_rdcache_read() - Read from an mblock through the cache
+ * @rc:     cache
+ * @mp:     mpool handle
+ * @fill:   function to read missing pages from media
+ * @mbid:   mblock object ID
+ * @iov:    iovec for output data
+ * @iovc:   iovec count
+ * @offset: PAGE aligned offset into the mblock
+ *
+ * All missing pages of a read are filled by a single call to @fill that
+ * spans from the first to the last missing page.  Reads that are not
+ * made of whole pages, or that are too large to be worth caching,
+ * bypass the cache.
+ */
+merr_t
+mp_rdcache_read(
+	struct mp_rdcache      *rc,
+	struct mpool           *mp,
+	mp_rdcache_fill_fn     *fill,
+	u64                     mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset);
+
+/**
+ * mp_rdcache_inval() - Drop all cached pages of an mblock
+ * @rc:   cache (may be NULL)
+ * @mbid: mblock object ID
+ */
+void mp_rdcache_inval(struct mp_rdcache *rc, u64 mbid);
+
+/**
+ * mp_rdcache_stats_get() - Retrieve cache statistics
+ * @rc:    cache (may be NULL)
+ * @stats: cache statistics (output)
+ */
+void mp_rdcache_stats_get(struct mp_rdcache *rc, struct mpool_rdcache_stats *stats);
+
+#endif /* MPOOL_RDCACHE_H */
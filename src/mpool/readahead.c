@@ -0,0 +1,534 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mblock read-ahead module.
+ *
+ * Streams are kept in MP_RA_SHARDS independently locked shards selected by
+ * thread, each holding up to MP_RA_STREAMS streams replaced in LRU order.
+ * A read that starts where the previous read of the same thread and mblock
+ * ended is sequential.  From the MP_RA_TRIGGER'th sequential read onward,
+ * the range following the read is read ahead in MP_RA_SLOT_SZ slots of the
+ * stream's buffer ring.  The window starts at two reads worth of slots and
+ * doubles on every sequential read up to the ring size, i.e., ra_max bytes.
+ *
+ * A stream is only used by its thread, but read-ahead completions and
+ * mp_ra_inval() may touch it from other threads, hence all slot state is
+ * protected by the shard lock.  Read-ahead data is copied out under the
+ * shard lock, which is only contended by threads that hash to the same
+ * shard.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/page.h>
+#include <util/minmax.h>
+
+#include "readahead.h"
+
+enum mp_ra_slot_state {
+	RA_SLOT_INFLIGHT = 1,
+	RA_SLOT_READY,
+	RA_SLOT_ERROR,
+};
+
+struct mp_ra_shard;
+
+/**
+ * struct mp_ra_slot - one read-ahead buffer of a stream
+ * @rsl_shard:    shard of the stream
+ * @rsl_inflight: in-flight slot count of the stream
+ * @rsl_off:      mblock offset of the data
+ * @rsl_len:      length of the data
+ * @rsl_state:    enum mp_ra_slot_state
+ * @rsl_iov:      iovec of the read-ahead read, rsl_iov.iov_base is the buffer
+ */
+struct mp_ra_slot {
+	struct mp_ra_shard     *rsl_shard;
+	u32                    *rsl_inflight;
+	off_t                   rsl_off;
+	size_t                  rsl_len;
+	int                     rsl_state;
+	struct iovec            rsl_iov;
+};
+
+/**
+ * struct mp_ra_stream - sequential read stream of a thread on an mblock
+ * @rst_tid:      thread
+ * @rst_mbid:     mblock object ID
+ * @rst_stamp:    LRU stamp
+ * @rst_valid:    stream is in use
+ * @rst_waiters:  number of threads waiting on the stream, which must not be
+ *                replaced while non-zero
+ * @rst_seq:      number of consecutive sequential reads
+ * @rst_win:      read-ahead window in slots
+ * @rst_head:     index of the slot with the lowest offset
+ * @rst_cnt:      number of slots holding or reading data
+ * @rst_inflight: number of slots being read
+ * @rst_next:     offset at which the next sequential read starts
+ * @rst_raend:    offset at which the next read-ahead starts
+ * @rst_mblen:    mblock length, 0 if the mblock is not committed
+ * @rst_arena:    buffer ring, allocated on first read-ahead
+ * @rst_slotv:    slots of the buffer ring
+ */
+struct mp_ra_stream {
+	pthread_t               rst_tid;
+	u64                     rst_mbid;
+	u64                     rst_stamp;
+	bool                    rst_valid;
+	u32                     rst_waiters;
+	u32                     rst_seq;
+	u32                     rst_win;
+	u32                     rst_head;
+	u32                     rst_cnt;
+	u32                     rst_inflight;
+	off_t                   rst_next;
+	off_t                   rst_raend;
+	size_t                  rst_mblen;
+	char                   *rst_arena;
+	struct mp_ra_slot      *rst_slotv;
+};
+
+/**
+ * struct mp_ra_shard - independently locked set of streams
+ * @rsh_lock:    protects the streams of the shard and their slots
+ * @rsh_cv:      signaled when a read-ahead completes
+ * @rsh_clock:   LRU clock
+ * @rsh_inval:   number of mp_ra_inval() calls
+ * @rsh_streamv: streams
+ */
+struct mp_ra_shard {
+	struct mutex            rsh_lock;
+	pthread_cond_t          rsh_cv;
+	u64                     rsh_clock;
+	u64                     rsh_inval;
+	struct mp_ra_stream     rsh_streamv[MP_RA_STREAMS];
+} __aligned(SMP_CACHE_BYTES);
+
+/**
+ * struct mp_ra - read-ahead context of an mpool handle
+ * @ra_mp:     mpool handle
+ * @ra_slotc:  number of slots per stream
+ * @ra_shardv: shards
+ */
+struct mp_ra {
+	struct mpool           *ra_mp;
+	u32                     ra_slotc;
+	struct mp_ra_shard      ra_shardv[MP_RA_SHARDS];
+};
+
+static inline struct mp_ra_shard *mp_ra_shard(struct mp_ra *ra, pthread_t tid)
+{
+	u64 hash = (u64)(uintptr_t)tid * 0x9e3779b97f4a7c15ull;
+
+	return ra->ra_shardv + ((hash >> 32) % MP_RA_SHARDS);
+}
+
+static void mp_ra_slot_done(const struct mpool_mbio_cqe *cqe)
+{
+	struct mp_ra_slot  *slot = cqe->mce_arg;
+	struct mp_ra_shard *shard = slot->rsl_shard;
+
+	mutex_lock(&shard->rsh_lock);
+	slot->rsl_state = cqe->mce_err ? RA_SLOT_ERROR : RA_SLOT_READY;
+	--*slot->rsl_inflight;
+	pthread_cond_broadcast(&shard->rsh_cv);
+	mutex_unlock(&shard->rsh_lock);
+}
+
+/**
+ * mp_ra_stream_drain() - Wait for a stream's read-ahead and drop its data
+ *
+ * Must be called with the shard lock held, which is dropped while waiting.
+ */
+static void mp_ra_stream_drain(struct mp_ra_shard *shard, struct mp_ra_stream *s)
+{
+	s->rst_waiters++;
+	while (s->rst_inflight > 0)
+		pthread_cond_wait(&shard->rsh_cv, &shard->rsh_lock.pth_mutex);
+	s->rst_waiters--;
+
+	s->rst_head = 0;
+	s->rst_cnt = 0;
+	s->rst_win = 0;
+	s->rst_seq = 0;
+}
+
+static struct mp_ra_stream *mp_ra_stream_find(struct mp_ra_shard *shard, pthread_t tid, u64 mbid)
+{
+	struct mp_ra_stream *s;
+	int                  i;
+
+	for (i = 0; i < MP_RA_STREAMS; i++) {
+		s = shard->rsh_streamv + i;
+
+		if (s->rst_valid && s->rst_mbid == mbid && pthread_equal(s->rst_tid, tid))
+			return s;
+	}
+
+	return NULL;
+}
+
+/**
+ * mp_ra_mblen() - Length of an mblock, 0 if it is not committed
+ */
+static size_t mp_ra_mblen(struct mp_ra *ra, u64 mbid)
+{
+	struct mblock_props props;
+
+	/* Served by the object cache in the common case. */
+	if (mpool_mblock_props_get(ra->ra_mp, mbid, &props) || !props.mpr_iscommitted)
+		return 0;
+
+	return props.mpr_write_len;
+}
+
+/**
+ * mp_ra_stream_alloc() - Replace the least recently used idle stream
+ */
+static struct mp_ra_stream *
+mp_ra_stream_alloc(struct mp_ra_shard *shard, pthread_t tid, u64 mbid, size_t mblen)
+{
+	struct mp_ra_stream *s, *victim = NULL;
+	int                  i;
+
+	for (i = 0; i < MP_RA_STREAMS; i++) {
+		s = shard->rsh_streamv + i;
+
+		if (s->rst_waiters > 0 || s->rst_inflight > 0)
+			continue;
+
+		if (!s->rst_valid) {
+			victim = s;
+			break;
+		}
+
+		if (!victim || s->rst_stamp < victim->rst_stamp)
+			victim = s;
+	}
+
+	if (!victim)
+		return NULL;
+
+	s = victim;
+	s->rst_valid = true;
+	s->rst_tid = tid;
+	s->rst_mbid = mbid;
+	s->rst_head = 0;
+	s->rst_cnt = 0;
+	s->rst_win = 0;
+	s->rst_seq = 0;
+	s->rst_mblen = mblen;
+
+	return s;
+}
+
+/**
+ * mp_ra_stream_advance() - Drop consumed slots and fill the window
+ * @ra:     read-ahead context
+ * @s:      stream
+ * @offset: offset of the current read
+ * @len:    length of the current read
+ */
+static void mp_ra_stream_advance(struct mp_ra *ra, struct mp_ra_stream *s, off_t offset, size_t len)
+{
+	struct mp_ra_slot  *slot;
+	merr_t              err;
+
+	while (s->rst_cnt > 0) {
+		slot = s->rst_slotv + s->rst_head;
+
+		if (slot->rsl_state == RA_SLOT_INFLIGHT || slot->rsl_off + slot->rsl_len > offset)
+			break;
+
+		s->rst_head = (s->rst_head + 1) % ra->ra_slotc;
+		s->rst_cnt--;
+	}
+
+	if (s->rst_cnt == 0)
+		s->rst_raend = offset;
+
+	if (s->rst_win == 0)
+		s->rst_win = (roundup(2 * len, MP_RA_SLOT_SZ) / MP_RA_SLOT_SZ);
+	else
+		s->rst_win *= 2;
+	s->rst_win = min_t(u32, s->rst_win, ra->ra_slotc);
+
+	while (s->rst_cnt < s->rst_win && s->rst_raend < s->rst_mblen) {
+		slot = s->rst_slotv + (s->rst_head + s->rst_cnt) % ra->ra_slotc;
+
+		slot->rsl_off = s->rst_raend;
+		slot->rsl_len = min_t(size_t, MP_RA_SLOT_SZ, s->rst_mblen - s->rst_raend);
+		slot->rsl_iov.iov_len = slot->rsl_len;
+		slot->rsl_state = RA_SLOT_INFLIGHT;
+		s->rst_inflight++;
+
+		err = mpool_mblock_read_async(ra->ra_mp, s->rst_mbid, &slot->rsl_iov, 1,
+					      slot->rsl_off, NULL, mp_ra_slot_done, slot);
+		if (err) {
+			slot->rsl_state = RA_SLOT_ERROR;
+			s->rst_inflight--;
+			break;
+		}
+
+		s->rst_cnt++;
+		s->rst_raend += slot->rsl_len;
+	}
+}
+
+/**
+ * mp_ra_iov_copy() - Copy a buffer into an iovec at a given byte offset
+ */
+static void mp_ra_iov_copy(const struct iovec *iov, int iovc, size_t skip, const char *src, size_t len)
+{
+	size_t  n;
+	int     i;
+
+	for (i = 0; i < iovc && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+
+		n = min_t(size_t, len, iov[i].iov_len - skip);
+		memcpy((char *)iov[i].iov_base + skip, src, n);
+		src += n;
+		len -= n;
+		skip = 0;
+	}
+}
+
+/**
+ * mp_ra_stream_serve() - Copy the range [offset, offset + len) out of the slots
+ *
+ * Return: true if the range was fully served from read-ahead data.
+ */
+static bool
+mp_ra_stream_serve(
+	struct mp_ra           *ra,
+	struct mp_ra_shard     *shard,
+	struct mp_ra_stream    *s,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset,
+	size_t                  len)
+{
+	struct mp_ra_slot  *slot = NULL;
+	off_t               pos = offset;
+	size_t              n;
+	u32                 i;
+
+	while (pos < offset + len) {
+		for (i = 0; i < s->rst_cnt; i++) {
+			slot = s->rst_slotv + (s->rst_head + i) % ra->ra_slotc;
+
+			if (pos >= slot->rsl_off && pos < slot->rsl_off + slot->rsl_len)
+				break;
+		}
+
+		if (i == s->rst_cnt || slot->rsl_state == RA_SLOT_ERROR)
+			return false;
+
+		if (slot->rsl_state == RA_SLOT_INFLIGHT) {
+			s->rst_waiters++;
+			pthread_cond_wait(&shard->rsh_cv, &shard->rsh_lock.pth_mutex);
+			s->rst_waiters--;
+			continue;
+		}
+
+		n = min_t(size_t, offset + len - pos, slot->rsl_off + slot->rsl_len - pos);
+		mp_ra_iov_copy(iov, iovc, pos - offset,
+			       (char *)slot->rsl_iov.iov_base + (pos - slot->rsl_off), n);
+		pos += n;
+	}
+
+	return true;
+}
+
+merr_t
+mp_ra_read(
+	struct mp_ra           *ra,
+	mp_rdcache_fill_fn     *fill,
+	u64                     mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset)
+{
+	struct mp_ra_shard     *shard;
+	struct mp_ra_stream    *s;
+	pthread_t               tid;
+	size_t                  len = 0, mblen;
+	bool                    served = false;
+	u64                     inval;
+	int                     i;
+
+	for (i = 0; i < iovc; i++)
+		len += iov[i].iov_len;
+
+	/* Reads larger than half the window gain little from read-ahead. */
+	if (len == 0 || !PAGE_ALIGNED(offset) || len > (size_t)ra->ra_slotc * MP_RA_SLOT_SZ / 2)
+		return fill(ra->ra_mp, mbid, iov, iovc, offset);
+
+	tid = pthread_self();
+	shard = mp_ra_shard(ra, tid);
+
+	mutex_lock(&shard->rsh_lock);
+	s = mp_ra_stream_find(shard, tid, mbid);
+	if (!s) {
+		/*
+		 * The props lookup may go to the kernel, so do it without the
+		 * shard lock, and redo it if an mp_ra_inval() ran meanwhile.
+		 * Only this thread creates streams for itself, so there is
+		 * still no stream for the mblock after relocking.
+		 */
+		do {
+			inval = shard->rsh_inval;
+			mutex_unlock(&shard->rsh_lock);
+
+			mblen = mp_ra_mblen(ra, mbid);
+
+			mutex_lock(&shard->rsh_lock);
+		} while (inval != shard->rsh_inval);
+
+		s = mp_ra_stream_alloc(shard, tid, mbid, mblen);
+		if (s)
+			s->rst_next = offset + len;
+		goto unlock;
+	}
+
+	s->rst_stamp = ++shard->rsh_clock;
+
+	if (offset != s->rst_next) {
+		mp_ra_stream_drain(shard, s);
+		s->rst_next = offset + len;
+		goto unlock;
+	}
+
+	s->rst_next = offset + len;
+
+	if (++s->rst_seq < MP_RA_TRIGGER || s->rst_mblen == 0)
+		goto unlock;
+
+	if (!s->rst_arena) {
+		s->rst_arena = aligned_alloc(PAGE_SIZE, (size_t)ra->ra_slotc * MP_RA_SLOT_SZ);
+		if (!s->rst_arena)
+			goto unlock;
+
+		for (i = 0; i < ra->ra_slotc; i++)
+			s->rst_slotv[i].rsl_iov.iov_base = s->rst_arena + (size_t)i * MP_RA_SLOT_SZ;
+	}
+
+	mp_ra_stream_advance(ra, s, offset, len);
+
+	served = mp_ra_stream_serve(ra, shard, s, iov, iovc, offset, len);
+
+unlock:
+	mutex_unlock(&shard->rsh_lock);
+
+	return served ? 0 : fill(ra->ra_mp, mbid, iov, iovc, offset);
+}
+
+void mp_ra_inval(struct mp_ra *ra, u64 mbid)
+{
+	struct mp_ra_shard     *shard;
+	struct mp_ra_stream    *s;
+	int                     i, j;
+
+	if (!ra)
+		return;
+
+	for (i = 0; i < MP_RA_SHARDS; i++) {
+		shard = ra->ra_shardv + i;
+
+		mutex_lock(&shard->rsh_lock);
+		shard->rsh_inval++;
+		for (j = 0; j < MP_RA_STREAMS; j++) {
+			s = shard->rsh_streamv + j;
+
+			if (s->rst_valid && s->rst_mbid == mbid) {
+				mp_ra_stream_drain(shard, s);
+				s->rst_mblen = 0;
+			}
+		}
+		mutex_unlock(&shard->rsh_lock);
+	}
+}
+
+merr_t mp_ra_create(struct mpool *mp, size_t ra_max, struct mp_ra **rap)
+{
+	struct mp_ra_shard *shard;
+	struct mp_ra       *ra;
+	struct mp_ra_slot  *slotv;
+	u32                 slotc;
+	int                 i, j, k;
+
+	if (!mp || !rap)
+		return merr(EINVAL);
+
+	slotc = clamp_t(size_t, ra_max / MP_RA_SLOT_SZ, 2, 1024);
+
+	ra = aligned_alloc(SMP_CACHE_BYTES, sizeof(*ra));
+	if (!ra)
+		return merr(ENOMEM);
+
+	memset(ra, 0, sizeof(*ra));
+
+	slotv = calloc(MP_RA_SHARDS * MP_RA_STREAMS * slotc, sizeof(*slotv));
+	if (!slotv) {
+		free(ra);
+		return merr(ENOMEM);
+	}
+
+	ra->ra_mp = mp;
+	ra->ra_slotc = slotc;
+
+	for (i = 0; i < MP_RA_SHARDS; i++) {
+		shard = ra->ra_shardv + i;
+
+		mutex_init(&shard->rsh_lock);
+		pthread_cond_init(&shard->rsh_cv, NULL);
+
+		for (j = 0; j < MP_RA_STREAMS; j++) {
+			struct mp_ra_stream *s = shard->rsh_streamv + j;
+
+			s->rst_slotv = slotv;
+			slotv += slotc;
+
+			for (k = 0; k < slotc; k++) {
+				s->rst_slotv[k].rsl_shard = shard;
+				s->rst_slotv[k].rsl_inflight = &s->rst_inflight;
+			}
+		}
+	}
+
+	*rap = ra;
+
+	return 0;
+}
+
+void mp_ra_destroy(struct mp_ra *ra)
+{
+	struct mp_ra_shard *shard;
+	int                 i, j;
+
+	if (!ra)
+		return;
+
+	for (i = 0; i < MP_RA_SHARDS; i++) {
+		shard = ra->ra_shardv + i;
+
+		mutex_lock(&shard->rsh_lock);
+		for (j = 0; j < MP_RA_STREAMS; j++) {
+			mp_ra_stream_drain(shard, shard->rsh_streamv + j);
+			free(shard->rsh_streamv[j].rst_arena);
+		}
+		mutex_unlock(&shard->rsh_lock);
+
+		pthread_cond_destroy(&shard->rsh_cv);
+		mutex_destroy(&shard->rsh_lock);
+	}
+
+	free(ra->ra_shardv[0].rsh_streamv[0].rst_slotv);
+	free(ra);
+}
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_READAHEAD_H
+#define MPOOL_READAHEAD_H
+
+/*
+ * Sequential mblock read detection and read-ahead.
+ *
+ * A stream is tracked per (thread, mblock).  Once a thread has issued
+ * MP_RA_TRIGGER back-to-back reads of an mblock, the following ranges are
+ * read asynchronously into a ring of buffers private to the stream and
+ * subsequent reads are served from the ring by memcpy.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "rdcache.h"
+
+#define MP_RA_SHARDS            16
+#define MP_RA_STREAMS           4       /* per shard */
+#define MP_RA_TRIGGER           2
+#define MP_RA_SLOT_SZ           (128 * 1024)
+#define MP_RA_MAX_DEFAULT       (1024 * 1024)
+
+struct mp_ra;
+
+/**
+ * mp_ra_create() - Create a read-ahead context
+ * @mp:     mpool handle on which read-ahead is issued
+ * @ra_max: maximum read-ahead window per stream in bytes
+ * @rap:    read-ahead context (output)
+ *
+ * Read-ahead is issued with mpool_mblock_read_async() and is limited to
+ * committed mblocks, whose length cannot change.
+ */
+merr_t mp_ra_create(struct mpool *mp, size_t ra_max, struct mp_ra **rap);
+
+/**
+ * mp_ra_destroy() - Destroy a read-ahead context
+ * @ra: read-ahead context (may be NULL)
+ *
+ * Waits for read-ahead in flight.
+ */
+void mp_ra_destroy(struct mp_ra *ra);
+
+/**
+ * mp_ra_read() - Read from an mblock with sequential read-ahead
+ * @ra:     read-ahead context
+ * @fill:   function to read ranges not covered by read-ahead
+ * @mbid:   mblock object ID
+ * @iov:    iovec for output data
+ * @iovc:   iovec count
+ * @offset: PAGE aligned offset into the mblock
+ *
+ * Reads that are not fully covered by read-ahead data, including any
+ * read for which read-ahead failed, are passed on to @fill.
+ */
+merr_t
+mp_ra_read(
+	struct mp_ra           *ra,
+	mp_rdcache_fill_fn     *fill,
+	u64                     mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset);
+
+/**
+ * mp_ra_inval() - Drop all read-ahead data of an mblock
+ * @ra:   read-ahead context (may be NULL)
+ * @mbid: mblock object ID
+ */
+void mp_ra_inval(struct mp_ra *ra, u64 mbid);
+
+#endif /* MPOOL_READAHEAD_H */
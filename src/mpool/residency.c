@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Page residency accounting of mapped ranges.
+ *
+ * mincore() returns one byte per page, of which only the low bit tells
+ * whether the page is resident.  Counting and packing those bits is done
+ * 32 bytes at a time with AVX2 when the CPU supports it, and 8 bytes at a
+ * time otherwise.
+ */
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "residency.h"
+
+static pthread_once_t   mp_rss_once = PTHREAD_ONCE_INIT;
+static bool             mp_rss_avx2;
+
+static void mp_rss_init(void)
+{
+#if defined(__x86_64__)
+	mp_rss_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+static u64 mp_rss_count_sw(const u8 *vec, size_t n)
+{
+	const u64   mask = 0x0101010101010101ull;
+	u64         cnt = 0, w;
+	size_t      i;
+
+	for (i = 0; i + sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, vec + i, sizeof(w));
+		cnt += __builtin_popcountll(w & mask);
+	}
+
+	for (; i < n; i++)
+		cnt += vec[i] & 1;
+
+	return cnt;
+}
+
+static void mp_rss_pack_sw(const u8 *vec, size_t n, u64 *bitmap)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (vec[i] & 1)
+			bitmap[i / 64] |= 1ull << (i % 64);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static u64 mp_rss_count_avx2(const u8 *vec, size_t n)
+{
+	const __m256i   ones = _mm256_set1_epi8(1);
+	const __m256i   zero = _mm256_setzero_si256();
+	__m256i         acc = zero, x;
+	u64             sum[4];
+	size_t          i;
+
+	/* Sum the low bits of each 8 bytes into a 64-bit lane. */
+	for (i = 0; i + 32 <= n; i += 32) {
+		x = _mm256_loadu_si256((const __m256i *)(vec + i));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_and_si256(x, ones), zero));
+	}
+
+	_mm256_storeu_si256((__m256i *)sum, acc);
+
+	return sum[0] + sum[1] + sum[2] + sum[3] + mp_rss_count_sw(vec + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void mp_rss_pack_avx2(const u8 *vec, size_t n, u64 *bitmap)
+{
+	__m256i lo, hi;
+	u32     mlo, mhi;
+	size_t  i;
+
+	/* Move the low bit of each byte to its sign bit and gather them. */
+	for (i = 0; i + 64 <= n; i += 64) {
+		lo = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)(vec + i)), 7);
+		hi = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)(vec + i + 32)), 7);
+		mlo = _mm256_movemask_epi8(lo);
+		mhi = _mm256_movemask_epi8(hi);
+
+		bitmap[i / 64] |= ((u64)mhi << 32) | mlo;
+	}
+
+	mp_rss_pack_sw(vec + i, n - i, bitmap + i / 64);
+}
+#endif
+
+static u64 mp_rss_count(const u8 *vec, size_t n)
+{
+#if defined(__x86_64__)
+	if (mp_rss_avx2)
+		return mp_rss_count_avx2(vec, n);
+#endif
+
+	return mp_rss_count_sw(vec, n);
+}
+
+static void mp_rss_pack(const u8 *vec, size_t n, u64 *bitmap)
+{
+#if defined(__x86_64__)
+	if (mp_rss_avx2) {
+		mp_rss_pack_avx2(vec, n, bitmap);
+		return;
+	}
+#endif
+
+	mp_rss_pack_sw(vec, n, bitmap);
+}
+
+merr_t
+mp_rss_scan(const void *addr, size_t pagec, u32 stride, u64 *residentp, u64 *bitmap)
+{
+	unsigned char   vec[MP_RSS_CHUNK];
+	const char     *base = addr;
+	u64             resident = 0, sampled = 0;
+	size_t          off, n, step;
+
+	if (stride > 1 && bitmap)
+		return merr(EINVAL);
+
+	pthread_once(&mp_rss_once, mp_rss_init);
+
+	if (bitmap)
+		memset(bitmap, 0, (pagec + 63) / 64 * sizeof(*bitmap));
+
+	stride = max_t(u32, stride, 1);
+	step = stride > 1 ? (size_t)MP_RSS_GROUP * stride : MP_RSS_CHUNK;
+
+	/* Chunks are multiples of 64 pages so that they pack into whole words. */
+	for (off = 0; off < pagec; off += step) {
+		n = min_t(size_t, pagec - off, stride > 1 ? MP_RSS_GROUP : MP_RSS_CHUNK);
+
+		if (mincore((void *)(base + off * PAGE_SIZE), n * PAGE_SIZE, vec))
+			return merr(errno);
+
+		resident += mp_rss_count(vec, n);
+		sampled += n;
+
+		if (bitmap)
+			mp_rss_pack(vec, n, bitmap + off / 64);
+	}
+
+	if (sampled < pagec && sampled > 0)
+		resident = (resident * pagec + sampled / 2) / sampled;
+
+	*residentp = resident;
+
+	return 0;
+}
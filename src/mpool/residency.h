@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_RESIDENCY_H
+#define MPOOL_RESIDENCY_H
+
+#include <util/platform.h>
+
+#include "mpool_err.h"
+
+#define MP_RSS_CHUNK            4096    /* pages per mincore() of an exact scan */
+#define MP_RSS_GROUP            512     /* pages per mincore() of a sampled scan */
+
+/**
+ * mp_rss_scan() - Count the resident pages of a mapped range
+ * @addr:      page-aligned start of the range
+ * @pagec:     number of pages in the range
+ * @stride:    probe one group of MP_RSS_GROUP pages out of every @stride,
+ *             0 or 1 to probe every page
+ * @residentp: number of resident pages, estimated if sampled (output)
+ * @bitmap:    one bit per page of the range, set if the page is resident
+ *             (output, may be NULL, must be NULL if sampled)
+ *
+ * Uses a fixed scratch vector rather than one sized by the range, and an
+ * AVX2 kernel to count and pack the mincore() vector when the CPU supports
+ * it.
+ */
+merr_t
+mp_rss_scan(const void *addr, size_t pagec, u32 stride, u64 *residentp, u64 *bitmap);
+
+#endif /* MPOOL_RESIDENCY_H */
@@ -0,0 +1,1122 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mblock tiering module.
+ *
+ * mpool_mblock_migrate() copies a committed mblock into a new mblock of
+ * another media class through MP_MIGRATE_DEPTH chunk buffers on the async
+ * mblock I/O engine.  Chunks are read concurrently and written in order as
+ * soon as they arrive, and a buffer is refilled as soon as the write of its
+ * chunk completes, so that reads from the source media class overlap
+ * writes to the target media class.
+ *
+ * Tracked mblocks live in a chained hash table split into MP_TIER_SHARDS
+ * independently locked shards selected by mblock ID.  Each policy period
+ * the engine thread samples the residency of the registered mcache maps,
+ * scores each tracked mblock as its access count plus one per
+ * 2^MP_TIER_RSS_SHIFT resident pages, halves the access counts, and then
+ * demotes the coldest and promotes the hottest candidates, at most
+ * mtp_maxobj in total, with the copies paced to mtp_bwcap bytes per second.
+ * Demotions go first so as to make room for promotions.  A migrated mblock
+ * is handed over only if the remap callback accepts its new ID, in which
+ * case the source mblock is deleted through the deferred delete queue.
+ */
+
+#include <util/platform.h>
+#include <util/mutex.h>
+#include <util/atomic.h>
+#include <util/minmax.h>
+#include <util/page.h>
+
+#include <mpctl/impool.h>
+
+#include <time.h>
+
+#include "residency.h"
+#include "tier.h"
+
+#define NSEC_PER_SEC            1000000000ull
+#define MP_TIER_MCLASS_NONE     U8_MAX
+
+/**
+ * struct mp_tier_ent - tracked mblock
+ * @te_next:   next entry in the hash bucket
+ * @te_mbid:   mblock object ID
+ * @te_hits:   decaying access count
+ * @te_rss:    resident mcache pages sampled this period
+ * @te_mclass: media class, MP_TIER_MCLASS_NONE until looked up
+ * @te_busy:   mblock is being migrated
+ */
+struct mp_tier_ent {
+	struct mp_tier_ent     *te_next;
+	u64                     te_mbid;
+	u32                     te_hits;
+	u32                     te_rss;
+	u8                      te_mclass;
+	bool                    te_busy;
+};
+
+/**
+ * struct mp_tier_shard - independently locked partition of the table
+ * @ts_lock: protects all fields of the shard
+ * @ts_bktv: MP_TIER_BKTS hash buckets, NULL while the engine is stopped
+ * @ts_cnt:  number of tracked mblocks
+ */
+struct mp_tier_shard {
+	struct mutex            ts_lock;
+	struct mp_tier_ent    **ts_bktv;
+	u64                     ts_cnt;
+} __aligned(SMP_CACHE_BYTES);
+
+/**
+ * struct mp_tier_map - registered mcache map
+ * @tm_next:  next registered map
+ * @tm_key:   map handle
+ * @tm_addr:  base address of the map
+ * @tm_bktsz: size of the map bucket of each mblock
+ * @tm_mbidc: number of mblocks in the map
+ * @tm_mbidv: mblock object IDs, in map order
+ */
+struct mp_tier_map {
+	struct mp_tier_map     *tm_next;
+	const void             *tm_key;
+	char                   *tm_addr;
+	size_t                  tm_bktsz;
+	int                     tm_mbidc;
+	u64                     tm_mbidv[];
+};
+
+/**
+ * struct mp_tier_cand - migration candidate
+ * @tc_mbid:  mblock object ID
+ * @tc_score: access count plus residency at the time of the evaluation
+ */
+struct mp_tier_cand {
+	u64                     tc_mbid;
+	u32                     tc_score;
+};
+
+/**
+ * struct mp_tier - tiering engine
+ * @t_mp:      mpool handle
+ * @t_enabled: mblock accesses are tracked
+ * @t_lock:    protects the fields from t_cv to t_stats
+ * @t_cv:      signaled when the engine must stop or pause, once it stopped,
+ *             and at the end of each policy period
+ * @t_tid:     engine thread
+ * @t_started: engine thread is running
+ * @t_stop:    engine thread must exit
+ * @t_joining: a caller of mp_tier_stop() is joining the engine thread
+ * @t_pause:   engine thread must not start a policy period
+ * @t_busy:    engine thread is running a policy period
+ * @t_params:  policy parameters
+ * @t_remap:   remap callback
+ * @t_arg:     remap callback argument
+ * @t_bwnext:  CLOCK_MONOTONIC time in ns before which not to copy a chunk
+ * @t_stats:   statistics, but for mts_tracked
+ * @t_scan:    shard at which the engine thread starts the next evaluation
+ * @t_candmax: size of t_demv and t_promv
+ * @t_demv:    demotion candidates
+ * @t_promv:   promotion candidates
+ * @t_resv:    tracked mblocks of unknown media class
+ * @t_maplock: protects t_maps
+ * @t_maps:    registered mcache maps
+ * @t_shardv:  table of tracked mblocks
+ */
+struct mp_tier {
+	struct mpool               *t_mp;
+	atomic_t                    t_enabled;
+	struct mutex                t_lock;
+	pthread_cond_t              t_cv;
+	pthread_t                   t_tid;
+	bool                        t_started;
+	bool                        t_stop;
+	bool                        t_joining;
+	bool                        t_pause;
+	bool                        t_busy;
+	struct mpool_tier_params    t_params;
+	mpool_tier_remap_fn        *t_remap;
+	void                       *t_arg;
+	u64                         t_bwnext;
+	struct mpool_tier_stats     t_stats;
+	u32                         t_scan;
+	u32                         t_candmax;
+	struct mp_tier_cand        *t_demv;
+	struct mp_tier_cand        *t_promv;
+	u64                        *t_resv;
+	struct mutex                t_maplock;
+	struct mp_tier_map         *t_maps;
+	struct mp_tier_shard        t_shardv[MP_TIER_SHARDS];
+};
+
+static u64 mp_tier_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * mp_tier_bkt() - Lock the shard of an mblock and return its hash bucket
+ * @tier:   tiering engine
+ * @mbid:   mblock object ID
+ * @shardp: locked shard (output)
+ *
+ * Return: the hash bucket, or NULL if the engine is stopped
+ */
+static struct mp_tier_ent **
+mp_tier_bkt(struct mp_tier *tier, u64 mbid, struct mp_tier_shard **shardp)
+{
+	struct mp_tier_shard   *shard;
+	u64                     hash;
+
+	hash = mbid * 0x9e3779b97f4a7c15ull;
+	shard = tier->t_shardv + (hash >> (64 - MP_TIER_SHARDS_SHIFT));
+
+	mutex_lock(&shard->ts_lock);
+	*shardp = shard;
+
+	if (!shard->ts_bktv)
+		return NULL;
+
+	return shard->ts_bktv + ((hash >> 16) & (MP_TIER_BKTS - 1));
+}
+
+/**
+ * mp_tier_find() - Find the link to the entry of an mblock in a bucket
+ *
+ * Return: the link to the entry, or the NULL link at the end of the bucket
+ */
+static struct mp_tier_ent **mp_tier_find(struct mp_tier_ent **pp, u64 mbid)
+{
+	while (*pp && (*pp)->te_mbid != mbid)
+		pp = &(*pp)->te_next;
+
+	return pp;
+}
+
+/**
+ * mp_tier_get() - Find or create the entry of an mblock
+ *
+ * Called with the shard lock held.
+ */
+static struct mp_tier_ent *
+mp_tier_get(struct mp_tier_shard *shard, struct mp_tier_ent **bkt, u64 mbid)
+{
+	struct mp_tier_ent    **pp = mp_tier_find(bkt, mbid);
+	struct mp_tier_ent     *ent = *pp;
+
+	if (ent)
+		return ent;
+
+	ent = calloc(1, sizeof(*ent));
+	if (!ent)
+		return NULL;
+
+	ent->te_mbid = mbid;
+	ent->te_mclass = MP_TIER_MCLASS_NONE;
+	*pp = ent;
+	shard->ts_cnt++;
+
+	return ent;
+}
+
+void mp_tier_touch(struct mp_tier *tier, u64 mbid, u32 hits)
+{
+	struct mp_tier_shard   *shard;
+	struct mp_tier_ent    **bkt;
+	struct mp_tier_ent     *ent;
+
+	if (!tier || !atomic_read(&tier->t_enabled))
+		return;
+
+	bkt = mp_tier_bkt(tier, mbid, &shard);
+	if (bkt) {
+		ent = mp_tier_get(shard, bkt, mbid);
+		if (ent)
+			ent->te_hits = min_t(u64, (u64)ent->te_hits + hits, U32_MAX);
+	}
+	mutex_unlock(&shard->ts_lock);
+}
+
+void mp_tier_forget(struct mp_tier *tier, u64 mbid)
+{
+	struct mp_tier_shard   *shard;
+	struct mp_tier_ent    **bkt, **pp;
+	struct mp_tier_ent     *ent;
+
+	if (!tier || !atomic_read(&tier->t_enabled))
+		return;
+
+	bkt = mp_tier_bkt(tier, mbid, &shard);
+	if (bkt) {
+		pp = mp_tier_find(bkt, mbid);
+		ent = *pp;
+		if (ent) {
+			*pp = ent->te_next;
+			shard->ts_cnt--;
+			free(ent);
+		}
+	}
+	mutex_unlock(&shard->ts_lock);
+}
+
+/**
+ * mp_tier_update() - Update the entry of an mblock
+ * @tier:   tiering engine
+ * @mbid:   mblock object ID
+ * @mclass: media class to set, or MP_TIER_MCLASS_NONE
+ * @rss:    resident pages to account
+ */
+static void mp_tier_update(struct mp_tier *tier, u64 mbid, u8 mclass, u32 rss)
+{
+	struct mp_tier_shard   *shard;
+	struct mp_tier_ent    **bkt;
+	struct mp_tier_ent     *ent;
+
+	bkt = mp_tier_bkt(tier, mbid, &shard);
+	if (bkt) {
+		ent = mp_tier_get(shard, bkt, mbid);
+		if (ent) {
+			if (mclass != MP_TIER_MCLASS_NONE)
+				ent->te_mclass = mclass;
+
+			/* An mblock may be in several maps. */
+			ent->te_rss = max_t(u32, ent->te_rss, rss);
+		}
+	}
+	mutex_unlock(&shard->ts_lock);
+}
+
+/**
+ * mp_tier_busy_set() - Mark an mblock as being migrated, or not
+ *
+ * Return: false if the mblock is not tracked, or if it is already being
+ * migrated and busy is true
+ */
+static bool mp_tier_busy_set(struct mp_tier *tier, u64 mbid, bool busy)
+{
+	struct mp_tier_shard   *shard;
+	struct mp_tier_ent    **bkt;
+	struct mp_tier_ent     *ent = NULL;
+
+	bkt = mp_tier_bkt(tier, mbid, &shard);
+	if (bkt) {
+		ent = *mp_tier_find(bkt, mbid);
+		if (ent && busy && ent->te_busy)
+			ent = NULL;
+		else if (ent)
+			ent->te_busy = busy;
+	}
+	mutex_unlock(&shard->ts_lock);
+
+	return ent;
+}
+
+/**
+ * mp_tier_rekey() - Move the access count of a migrated mblock to its new ID
+ */
+static void mp_tier_rekey(struct mp_tier *tier, u64 oldid, u64 newid, u8 mclass)
+{
+	struct mp_tier_shard   *shard;
+	struct mp_tier_ent    **bkt, **pp;
+	struct mp_tier_ent     *ent;
+	u32                     hits = 0;
+
+	bkt = mp_tier_bkt(tier, oldid, &shard);
+	if (bkt) {
+		pp = mp_tier_find(bkt, oldid);
+		ent = *pp;
+		if (ent) {
+			hits = ent->te_hits;
+			*pp = ent->te_next;
+			shard->ts_cnt--;
+			free(ent);
+		}
+	}
+	mutex_unlock(&shard->ts_lock);
+
+	bkt = mp_tier_bkt(tier, newid, &shard);
+	if (bkt) {
+		ent = mp_tier_get(shard, bkt, newid);
+		if (ent) {
+			ent->te_hits = hits;
+			ent->te_mclass = mclass;
+		}
+	}
+	mutex_unlock(&shard->ts_lock);
+}
+
+/**
+ * mp_tier_pace() - Wait until the bandwidth cap allows copying @len bytes
+ *
+ * Return: false if the engine is being stopped or paused
+ */
+static bool mp_tier_pace(struct mp_tier *tier, size_t len)
+{
+	struct timespec ts;
+	u64             now, bw;
+	bool            stop;
+
+	mutex_lock(&tier->t_lock);
+	bw = tier->t_params.mtp_bwcap;
+	if (bw) {
+		now = mp_tier_now();
+
+		/* Do not let an idle period build up credit. */
+		if (tier->t_bwnext < now)
+			tier->t_bwnext = now;
+
+		while (!tier->t_stop && !tier->t_pause && tier->t_bwnext > now) {
+			ts.tv_sec = tier->t_bwnext / NSEC_PER_SEC;
+			ts.tv_nsec = tier->t_bwnext % NSEC_PER_SEC;
+			pthread_cond_timedwait(&tier->t_cv, &tier->t_lock.pth_mutex, &ts);
+			now = mp_tier_now();
+		}
+
+		tier->t_bwnext += len * NSEC_PER_SEC / bw;
+	}
+	stop = tier->t_stop || tier->t_pause;
+	mutex_unlock(&tier->t_lock);
+
+	return !stop;
+}
+
+/**
+ * mp_mblock_copy() - Copy a committed mblock into a new mblock
+ * @mp:      mpool handle
+ * @srcid:   source mblock object ID
+ * @mclassp: media class of the new mblock
+ * @tier:    tiering engine whose bandwidth cap applies, or NULL
+ * @dstid:   committed new mblock object ID (output)
+ * @lenp:    number of bytes copied (output)
+ */
+static merr_t
+mp_mblock_copy(
+	struct mpool           *mp,
+	u64                     srcid,
+	enum mp_media_classp    mclassp,
+	struct mp_tier         *tier,
+	u64                    *dstid,
+	size_t                 *lenp)
+{
+	struct mpool_mbio_cqe   cqev[2 * MP_MIGRATE_DEPTH];
+	struct iovec            iov[MP_MIGRATE_DEPTH];
+	bool                    ready[MP_MIGRATE_DEPTH] = { };
+	struct mblock_props     props, dprops;
+	struct mpool_mbio_cq   *cq;
+	size_t                  len, chunk, off;
+	char                   *buf;
+	merr_t                  err;
+	u64                     dst;
+	u32                     chunkc, rd, wr, done, inflight, slot;
+	int                     n, i;
+
+	err = mpool_mblock_find(mp, srcid, &props);
+	if (err)
+		return err;
+
+	/* Only committed mblocks are immutable. */
+	if (!props.mpr_iscommitted)
+		return merr(EINVAL);
+
+	err = mpool_mblock_alloc(mp, mclassp, false, &dst, &dprops);
+	if (err)
+		return err;
+
+	len = props.mpr_write_len;
+	if (len > dprops.mpr_alloc_cap) {
+		mpool_mblock_abort(mp, dst);
+		return merr(EFBIG);
+	}
+
+	chunk = dprops.mpr_optimal_wrsz ?: MP_MIGRATE_CHUNK_MAX;
+	chunk = clamp_t(size_t, chunk, PAGE_SIZE, MP_MIGRATE_CHUNK_MAX);
+	chunk -= chunk % PAGE_SIZE;
+	chunkc = (len + chunk - 1) / chunk;
+
+	buf = aligned_alloc(PAGE_SIZE, MP_MIGRATE_DEPTH * chunk);
+	if (!buf) {
+		mpool_mblock_abort(mp, dst);
+		return merr(ENOMEM);
+	}
+
+	err = mpool_mbio_cq_create(&cq);
+	if (err) {
+		free(buf);
+		mpool_mblock_abort(mp, dst);
+		return err;
+	}
+
+	rd = wr = done = inflight = 0;
+
+	while (done < chunkc) {
+		/* The buffer of a chunk is free once the write of the chunk before it completed. */
+		while (rd < chunkc && rd < done + MP_MIGRATE_DEPTH) {
+			slot = rd % MP_MIGRATE_DEPTH;
+			off = (size_t)rd * chunk;
+
+			iov[slot].iov_base = buf + slot * chunk;
+			iov[slot].iov_len = min_t(size_t, chunk, len - off);
+
+			if (tier && !mp_tier_pace(tier, iov[slot].iov_len)) {
+				err = merr(ECANCELED);
+				break;
+			}
+
+			err = mpool_mblock_read_async(mp, srcid, iov + slot, 1, off, cq, NULL,
+						      (void *)(uintptr_t)rd);
+			if (err)
+				break;
+
+			inflight++;
+			rd++;
+		}
+
+		/* Writes to an mblock are issued, and complete, in submission order. */
+		while (!err && wr < rd && ready[wr % MP_MIGRATE_DEPTH]) {
+			slot = wr % MP_MIGRATE_DEPTH;
+			ready[slot] = false;
+
+			err = mpool_mblock_write_async(mp, dst, iov + slot, 1, cq, NULL,
+						       (void *)(uintptr_t)wr);
+			if (err)
+				break;
+
+			inflight++;
+			wr++;
+		}
+
+		if (err)
+			break;
+
+		err = mpool_mbio_cq_reap(cq, cqev, NELEM(cqev), 1, &n);
+		if (err)
+			break;
+
+		for (i = 0; i < n; i++) {
+			inflight--;
+
+			if (cqev[i].mce_err) {
+				err = err ?: cqev[i].mce_err;
+				continue;
+			}
+
+			if (cqev[i].mce_op == MPOOL_MBIO_READ)
+				ready[(uintptr_t)cqev[i].mce_arg % MP_MIGRATE_DEPTH] = true;
+			else
+				done++;
+		}
+
+		if (err)
+			break;
+	}
+
+	/* The buffers may not be released before the I/O in flight completes. */
+	while (inflight > 0) {
+		if (!mpool_mbio_cq_reap(cq, cqev, NELEM(cqev), 1, &n))
+			inflight -= n;
+	}
+
+	mpool_mbio_cq_destroy(cq);
+	free(buf);
+
+	if (!err)
+		err = mpool_mblock_commit(mp, dst);
+	if (err) {
+		mpool_mblock_abort(mp, dst);
+		return err;
+	}
+
+	*dstid = dst;
+	*lenp = len;
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mblock_migrate(
+	struct mpool           *mp,
+	uint64_t                srcid,
+	enum mp_media_classp    mclassp,
+	uint64_t               *dstid)
+{
+	size_t len;
+
+	if (!mp || !dstid || mclassp >= MP_MED_NUMBER)
+		return merr(EINVAL);
+
+	return mp_mblock_copy(mp, srcid, mclassp, NULL, dstid, &len);
+}
+
+/**
+ * mp_tier_rss_sample() - Account the resident pages of the registered maps
+ */
+static void mp_tier_rss_sample(struct mp_tier *tier)
+{
+	struct mp_tier_map *map;
+	size_t              pagec;
+	u64                 rss;
+	int                 i;
+
+	mutex_lock(&tier->t_maplock);
+	for (map = tier->t_maps; map; map = map->tm_next) {
+		pagec = (map->tm_bktsz + PAGE_SIZE - 1) / PAGE_SIZE;
+
+		for (i = 0; i < map->tm_mbidc; i++) {
+			if (mp_rss_scan(map->tm_addr + i * map->tm_bktsz, pagec, MP_TIER_RSS_STRIDE,
+					&rss, NULL))
+				continue;
+
+			if (rss > 0)
+				mp_tier_update(tier, map->tm_mbidv[i], MP_TIER_MCLASS_NONE,
+					       min_t(u64, rss, U32_MAX));
+		}
+	}
+	mutex_unlock(&tier->t_maplock);
+}
+
+/**
+ * mp_tier_evaluate() - Score and decay the tracked mblocks
+ * @tier:   tiering engine
+ * @demcp:  number of demotion candidates (output)
+ * @promcp: number of promotion candidates (output)
+ * @rescp:  number of mblocks of unknown media class (output)
+ *
+ * Untracks the mblocks on the capacity media class that are neither
+ * accessed nor resident.  If there are more candidates than fit, those in
+ * the shards scanned last are left for later periods.
+ */
+static void mp_tier_evaluate(struct mp_tier *tier, u32 *demcp, u32 *promcp, u32 *rescp)
+{
+	struct mpool_tier_params   *params = &tier->t_params;
+	struct mp_tier_shard       *shard;
+	struct mp_tier_ent        **pp, *ent;
+	u32                         demc = 0, promc = 0, resc = 0;
+	u32                         score, s, b;
+
+	/* Start from a different shard each period. */
+	tier->t_scan++;
+
+	for (s = 0; s < MP_TIER_SHARDS; s++) {
+		shard = tier->t_shardv + (tier->t_scan + s) % MP_TIER_SHARDS;
+
+		mutex_lock(&shard->ts_lock);
+		for (b = 0; shard->ts_bktv && b < MP_TIER_BKTS; b++) {
+			pp = shard->ts_bktv + b;
+
+			while ((ent = *pp)) {
+				score = ent->te_hits + (ent->te_rss >> MP_TIER_RSS_SHIFT);
+				ent->te_hits >>= 1;
+				ent->te_rss = 0;
+
+				if (ent->te_mclass == MP_MED_CAPACITY && !ent->te_busy && !score) {
+					*pp = ent->te_next;
+					shard->ts_cnt--;
+					free(ent);
+					continue;
+				}
+
+				pp = &ent->te_next;
+
+				if (ent->te_busy)
+					continue;
+
+				if (ent->te_mclass == MP_MED_STAGING) {
+					if (score <= params->mtp_cold && demc < tier->t_candmax) {
+						tier->t_demv[demc].tc_mbid = ent->te_mbid;
+						tier->t_demv[demc++].tc_score = score;
+					}
+				} else if (ent->te_mclass == MP_MED_CAPACITY) {
+					if (score >= params->mtp_hot && promc < tier->t_candmax) {
+						tier->t_promv[promc].tc_mbid = ent->te_mbid;
+						tier->t_promv[promc++].tc_score = score;
+					}
+				} else if (resc < MP_TIER_RESOLVE_MAX) {
+					tier->t_resv[resc++] = ent->te_mbid;
+				}
+			}
+		}
+		mutex_unlock(&shard->ts_lock);
+	}
+
+	*demcp = demc;
+	*promcp = promc;
+	*rescp = resc;
+}
+
+static int mp_tier_cand_cmp(const void *lhs, const void *rhs)
+{
+	const struct mp_tier_cand *l = lhs, *r = rhs;
+
+	if (l->tc_score != r->tc_score)
+		return l->tc_score < r->tc_score ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * mp_tier_move() - Migrate a tracked mblock and hand it over to the client
+ */
+static merr_t mp_tier_move(struct mp_tier *tier, u64 mbid, enum mp_media_classp mclassp)
+{
+	struct mpool   *mp = tier->t_mp;
+	size_t          len;
+	merr_t          err;
+	u64             newid;
+	bool            accepted;
+
+	if (!mp_tier_busy_set(tier, mbid, true))
+		return 0;
+
+	err = mp_mblock_copy(mp, mbid, mclassp, tier, &newid, &len);
+	if (err) {
+		mp_tier_busy_set(tier, mbid, false);
+
+		/* A copy cancelled by a stop or a pause is retried later. */
+		if (merr_errno(err) == ECANCELED)
+			return err;
+
+		mutex_lock(&tier->t_lock);
+		tier->t_stats.mts_failed++;
+		mutex_unlock(&tier->t_lock);
+
+		return err;
+	}
+
+	/* The source mblock may have been deleted while it was being copied. */
+	accepted = mp_tier_busy_set(tier, mbid, false) && tier->t_remap(tier->t_arg, mbid, newid);
+	if (!accepted) {
+		mpool_mblock_delete(mp, newid);
+
+		mutex_lock(&tier->t_lock);
+		tier->t_stats.mts_rejected++;
+		mutex_unlock(&tier->t_lock);
+
+		return 0;
+	}
+
+	mp_tier_rekey(tier, mbid, newid, mclassp);
+	mpool_mblock_delete_defer(mp, &mbid, 1);
+
+	mutex_lock(&tier->t_lock);
+	if (mclassp == MP_MED_STAGING)
+		tier->t_stats.mts_promoted++;
+	else
+		tier->t_stats.mts_demoted++;
+	tier->t_stats.mts_bytes += len;
+	mutex_unlock(&tier->t_lock);
+
+	return 0;
+}
+
+/**
+ * mp_tier_period() - Run one policy period
+ */
+static void mp_tier_period(struct mp_tier *tier)
+{
+	struct mblock_props props;
+	merr_t              err;
+	u32                 demc, promc, resc, movec = 0, i;
+
+	mp_tier_rss_sample(tier);
+	mp_tier_evaluate(tier, &demc, &promc, &resc);
+
+	/* Look up the media class of newly tracked committed mblocks. */
+	for (i = 0; i < resc; i++) {
+		err = mpool_mblock_find(tier->t_mp, tier->t_resv[i], &props);
+		if (err) {
+			if (merr_errno(err) == ENOENT)
+				mp_tier_forget(tier, tier->t_resv[i]);
+			continue;
+		}
+
+		if (props.mpr_iscommitted)
+			mp_tier_update(tier, tier->t_resv[i], props.mpr_mclassp, 0);
+	}
+
+	/* Demote the coldest mblocks first, then promote the hottest ones. */
+	qsort(tier->t_demv, demc, sizeof(*tier->t_demv), mp_tier_cand_cmp);
+	qsort(tier->t_promv, promc, sizeof(*tier->t_promv), mp_tier_cand_cmp);
+
+	for (i = 0; i < demc && movec < tier->t_params.mtp_maxobj; i++, movec++) {
+		err = mp_tier_move(tier, tier->t_demv[i].tc_mbid, MP_MED_CAPACITY);
+		if (err && merr_errno(err) == ECANCELED)
+			return;
+	}
+
+	for (i = promc; i > 0 && movec < tier->t_params.mtp_maxobj; i--, movec++) {
+		err = mp_tier_move(tier, tier->t_promv[i - 1].tc_mbid, MP_MED_STAGING);
+		if (err && (merr_errno(err) == ENOSPC || merr_errno(err) == ECANCELED))
+			break;
+	}
+}
+
+static void *mp_tier_main(void *arg)
+{
+	struct mp_tier *tier = arg;
+	struct timespec ts;
+	u64             deadline;
+
+	mutex_lock(&tier->t_lock);
+	while (!tier->t_stop) {
+		deadline = mp_tier_now() + tier->t_params.mtp_period_ms * 1000000ull;
+		ts.tv_sec = deadline / NSEC_PER_SEC;
+		ts.tv_nsec = deadline % NSEC_PER_SEC;
+
+		while (!tier->t_stop && (tier->t_pause || mp_tier_now() < deadline)) {
+			if (tier->t_pause)
+				pthread_cond_wait(&tier->t_cv, &tier->t_lock.pth_mutex);
+			else
+				pthread_cond_timedwait(&tier->t_cv, &tier->t_lock.pth_mutex, &ts);
+		}
+
+		if (tier->t_stop)
+			break;
+
+		tier->t_busy = true;
+		mutex_unlock(&tier->t_lock);
+
+		mp_tier_period(tier);
+
+		mutex_lock(&tier->t_lock);
+		tier->t_busy = false;
+		pthread_cond_broadcast(&tier->t_cv);
+	}
+	mutex_unlock(&tier->t_lock);
+
+	return NULL;
+}
+
+/**
+ * mp_tier_untrack() - Drop all tracked mblocks and the table
+ *
+ * Called with tracking disabled.
+ */
+static void mp_tier_untrack(struct mp_tier *tier)
+{
+	struct mp_tier_shard   *shard;
+	struct mp_tier_ent     *ent;
+	int                     s, b;
+
+	for (s = 0; s < MP_TIER_SHARDS; s++) {
+		shard = tier->t_shardv + s;
+
+		mutex_lock(&shard->ts_lock);
+		for (b = 0; shard->ts_bktv && b < MP_TIER_BKTS; b++) {
+			while ((ent = shard->ts_bktv[b])) {
+				shard->ts_bktv[b] = ent->te_next;
+				free(ent);
+			}
+		}
+
+		free(shard->ts_bktv);
+		shard->ts_bktv = NULL;
+		shard->ts_cnt = 0;
+		mutex_unlock(&shard->ts_lock);
+	}
+}
+
+static void mp_tier_stop(struct mp_tier *tier)
+{
+	mutex_lock(&tier->t_lock);
+
+	/* Only one caller joins the engine thread, the others wait for it. */
+	while (tier->t_joining)
+		pthread_cond_wait(&tier->t_cv, &tier->t_lock.pth_mutex);
+
+	if (!tier->t_started) {
+		mutex_unlock(&tier->t_lock);
+		return;
+	}
+
+	tier->t_stop = true;
+	tier->t_joining = true;
+	pthread_cond_broadcast(&tier->t_cv);
+	mutex_unlock(&tier->t_lock);
+
+	pthread_join(tier->t_tid, NULL);
+
+	atomic_set(&tier->t_enabled, 0);
+	mp_tier_untrack(tier);
+
+	mutex_lock(&tier->t_lock);
+	free(tier->t_demv);
+	free(tier->t_promv);
+	free(tier->t_resv);
+	tier->t_demv = tier->t_promv = NULL;
+	tier->t_resv = NULL;
+	tier->t_started = false;
+	tier->t_joining = false;
+	pthread_cond_broadcast(&tier->t_cv);
+	mutex_unlock(&tier->t_lock);
+}
+
+void mp_tier_pause(struct mp_tier *tier)
+{
+	if (!tier)
+		return;
+
+	mutex_lock(&tier->t_lock);
+	tier->t_pause = true;
+	pthread_cond_broadcast(&tier->t_cv);
+
+	while (tier->t_busy)
+		pthread_cond_wait(&tier->t_cv, &tier->t_lock.pth_mutex);
+	mutex_unlock(&tier->t_lock);
+}
+
+void mp_tier_resume(struct mp_tier *tier)
+{
+	if (!tier)
+		return;
+
+	mutex_lock(&tier->t_lock);
+	tier->t_pause = false;
+	pthread_cond_broadcast(&tier->t_cv);
+	mutex_unlock(&tier->t_lock);
+}
+
+void mpool_tier_params_init(struct mpool_tier_params *params)
+{
+	memset(params, 0, sizeof(*params));
+
+	params->mtp_period_ms = MP_TIER_PERIOD_MS_DEFAULT;
+	params->mtp_hot = MP_TIER_HOT_DEFAULT;
+	params->mtp_cold = 0;
+	params->mtp_maxobj = MP_TIER_MAXOBJ_DEFAULT;
+	params->mtp_bwcap = MP_TIER_BWCAP_DEFAULT;
+}
+
+mpool_err_t
+mpool_tier_start(
+	struct mpool                   *mp,
+	const struct mpool_tier_params *params,
+	mpool_tier_remap_fn            *remap,
+	void                           *arg)
+{
+	struct mpool_mclass_props   mcprops;
+	struct mp_tier_shard       *shard;
+	struct mp_tier             *tier;
+	merr_t                      err;
+	int                         rc, s;
+
+	if (!mp || !params || !remap || !params->mtp_period_ms || !params->mtp_maxobj ||
+	    params->mtp_hot <= params->mtp_cold)
+		return merr(EINVAL);
+
+	/* There is nothing to tier between unless both media classes exist. */
+	err = mpool_mclass_get(mp, MP_MED_STAGING, &mcprops);
+	if (!err)
+		err = mpool_mclass_get(mp, MP_MED_CAPACITY, &mcprops);
+	if (err)
+		return err;
+
+	tier = mp->mp_tier;
+
+	mutex_lock(&tier->t_lock);
+	if (tier->t_started) {
+		mutex_unlock(&tier->t_lock);
+		return merr(EBUSY);
+	}
+
+	tier->t_candmax = params->mtp_maxobj * 4;
+	tier->t_demv = calloc(tier->t_candmax, sizeof(*tier->t_demv));
+	tier->t_promv = calloc(tier->t_candmax, sizeof(*tier->t_promv));
+	tier->t_resv = calloc(MP_TIER_RESOLVE_MAX, sizeof(*tier->t_resv));
+	if (!tier->t_demv || !tier->t_promv || !tier->t_resv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (s = 0; s < MP_TIER_SHARDS; s++) {
+		shard = tier->t_shardv + s;
+
+		mutex_lock(&shard->ts_lock);
+		shard->ts_bktv = calloc(MP_TIER_BKTS, sizeof(*shard->ts_bktv));
+		mutex_unlock(&shard->ts_lock);
+
+		if (!shard->ts_bktv) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
+	}
+
+	tier->t_params = *params;
+	tier->t_remap = remap;
+	tier->t_arg = arg;
+	tier->t_stop = false;
+	tier->t_bwnext = 0;
+	atomic_set(&tier->t_enabled, 1);
+
+	rc = pthread_create(&tier->t_tid, NULL, mp_tier_main, tier);
+	if (rc) {
+		atomic_set(&tier->t_enabled, 0);
+		err = merr(rc);
+		goto errout;
+	}
+
+	tier->t_started = true;
+	mutex_unlock(&tier->t_lock);
+
+	return 0;
+
+errout:
+	mp_tier_untrack(tier);
+	free(tier->t_demv);
+	free(tier->t_promv);
+	free(tier->t_resv);
+	tier->t_demv = tier->t_promv = NULL;
+	tier->t_resv = NULL;
+	mutex_unlock(&tier->t_lock);
+
+	return err;
+}
+
+mpool_err_t mpool_tier_stop(struct mpool *mp)
+{
+	if (!mp)
+		return merr(EINVAL);
+
+	mp_tier_stop(mp->mp_tier);
+
+	return 0;
+}
+
+mpool_err_t mpool_tier_stats_get(struct mpool *mp, struct mpool_tier_stats *stats)
+{
+	struct mp_tier *tier;
+	int             s;
+
+	if (!mp || !stats)
+		return merr(EINVAL);
+
+	tier = mp->mp_tier;
+
+	mutex_lock(&tier->t_lock);
+	*stats = tier->t_stats;
+	mutex_unlock(&tier->t_lock);
+
+	stats->mts_tracked = 0;
+
+	for (s = 0; s < MP_TIER_SHARDS; s++) {
+		mutex_lock(&tier->t_shardv[s].ts_lock);
+		stats->mts_tracked += tier->t_shardv[s].ts_cnt;
+		mutex_unlock(&tier->t_shardv[s].ts_lock);
+	}
+
+	return 0;
+}
+
+merr_t
+mp_tier_map_add(
+	struct mp_tier *tier,
+	const void     *key,
+	void           *addr,
+	size_t          bktsz,
+	const u64      *mbidv,
+	int             mbidc)
+{
+	struct mp_tier_map *map;
+
+	if (!tier)
+		return 0;
+
+	map = malloc(sizeof(*map) + mbidc * sizeof(*mbidv));
+	if (!map)
+		return merr(ENOMEM);
+
+	map->tm_key = key;
+	map->tm_addr = addr;
+	map->tm_bktsz = bktsz;
+	map->tm_mbidc = mbidc;
+	memcpy(map->tm_mbidv, mbidv, mbidc * sizeof(*mbidv));
+
+	mutex_lock(&tier->t_maplock);
+	map->tm_next = tier->t_maps;
+	tier->t_maps = map;
+	mutex_unlock(&tier->t_maplock);
+
+	return 0;
+}
+
+void mp_tier_map_remove(struct mp_tier *tier, const void *key)
+{
+	struct mp_tier_map **pp, *map = NULL;
+
+	if (!tier)
+		return;
+
+	mutex_lock(&tier->t_maplock);
+	for (pp = &tier->t_maps; *pp; pp = &(*pp)->tm_next) {
+		if ((*pp)->tm_key == key) {
+			map = *pp;
+			*pp = map->tm_next;
+			break;
+		}
+	}
+	mutex_unlock(&tier->t_maplock);
+
+	free(map);
+}
+
+merr_t mp_tier_create(struct mpool *mp, struct mp_tier **tierp)
+{
+	pthread_condattr_t  attr;
+	struct mp_tier     *tier;
+	int                 s;
+
+	if (!mp || !tierp)
+		return merr(EINVAL);
+
+	tier = aligned_alloc(__alignof__(*tier), sizeof(*tier));
+	if (!tier)
+		return merr(ENOMEM);
+
+	memset(tier, 0, sizeof(*tier));
+	tier->t_mp = mp;
+	atomic_set(&tier->t_enabled, 0);
+	mutex_init(&tier->t_lock);
+	mutex_init(&tier->t_maplock);
+
+	/* The period and bandwidth deadlines are in CLOCK_MONOTONIC time. */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&tier->t_cv, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (s = 0; s < MP_TIER_SHARDS; s++)
+		mutex_init(&tier->t_shardv[s].ts_lock);
+
+	*tierp = tier;
+
+	return 0;
+}
+
+void mp_tier_destroy(struct mp_tier *tier)
+{
+	struct mp_tier_map *map;
+	int                 s;
+
+	if (!tier)
+		return;
+
+	mp_tier_stop(tier);
+
+	while ((map = tier->t_maps)) {
+		tier->t_maps = map->tm_next;
+		free(map);
+	}
+
+	for (s = 0; s < MP_TIER_SHARDS; s++)
+		mutex_destroy(&tier->t_shardv[s].ts_lock);
+
+	pthread_cond_destroy(&tier->t_cv);
+	mutex_destroy(&tier->t_maplock);
+	mutex_destroy(&tier->t_lock);
+	free(tier);
+}
@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_TIER_H
+#define MPOOL_TIER_H
+
+/*
+ * Media class tiering of mblocks.
+ *
+ * While the tiering engine is started, the mblocks read or committed
+ * through an mpool handle are tracked with a decaying access count, to
+ * which the resident pages of the mcache maps that contain them add.
+ * The engine periodically demotes cold mblocks from the staging to the
+ * capacity media class and promotes hot ones the other way, by copying
+ * each one with mpool_mblock_migrate() and handing the new ID to the
+ * client through a remap callback.
+ */
+
+#include <util/platform.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MP_TIER_SHARDS_SHIFT    4
+#define MP_TIER_SHARDS          (1u << MP_TIER_SHARDS_SHIFT)
+#define MP_TIER_BKTS            1024
+#define MP_TIER_RESOLVE_MAX     256
+#define MP_TIER_RSS_SHIFT       4
+#define MP_TIER_RSS_STRIDE      4
+#define MP_MIGRATE_DEPTH        4
+#define MP_MIGRATE_CHUNK_MAX    (1024 * 1024)
+
+#define MP_TIER_PERIOD_MS_DEFAULT   1000
+#define MP_TIER_HOT_DEFAULT         8
+#define MP_TIER_MAXOBJ_DEFAULT      16
+#define MP_TIER_BWCAP_DEFAULT       (64ul << 20)
+
+struct mp_tier;
+
+/**
+ * mp_tier_create() - Create the (stopped) tiering engine of an mpool handle
+ * @mp:    mpool handle
+ * @tierp: tiering engine (output)
+ */
+merr_t mp_tier_create(struct mpool *mp, struct mp_tier **tierp);
+
+/**
+ * mp_tier_destroy() - Stop and destroy a tiering engine
+ * @tier: tiering engine (may be NULL)
+ */
+void mp_tier_destroy(struct mp_tier *tier);
+
+/**
+ * mp_tier_pause() - Wait for the engine thread to be idle and keep it so
+ * @tier: tiering engine (may be NULL)
+ *
+ * A migration in progress is cancelled.  Accesses are still tracked while
+ * the engine is paused, but no policy period runs until mp_tier_resume().
+ */
+void mp_tier_pause(struct mp_tier *tier);
+
+/**
+ * mp_tier_resume() - Let the engine thread run policy periods again
+ * @tier: tiering engine (may be NULL)
+ */
+void mp_tier_resume(struct mp_tier *tier);
+
+/**
+ * mp_tier_touch() - Account accesses to an mblock
+ * @tier: tiering engine (may be NULL)
+ * @mbid: mblock object ID
+ * @hits: number of accesses, 0 to only start tracking the mblock
+ *
+ * Does nothing unless the engine is started.
+ */
+void mp_tier_touch(struct mp_tier *tier, u64 mbid, u32 hits);
+
+/**
+ * mp_tier_forget() - Stop tracking an aborted or deleted mblock
+ * @tier: tiering engine (may be NULL)
+ * @mbid: mblock object ID
+ */
+void mp_tier_forget(struct mp_tier *tier, u64 mbid);
+
+/**
+ * mp_tier_map_add() - Register the mblocks of an mcache map
+ * @tier:  tiering engine (may be NULL)
+ * @key:   map handle
+ * @addr:  base address of the map
+ * @bktsz: size of the map bucket of each mblock
+ * @mbidv: mblock object IDs, in map order
+ * @mbidc: number of mblock object IDs
+ *
+ * Maps are registered whether or not the engine is started, so that the
+ * residency of maps created before mpool_tier_start() is accounted.
+ */
+merr_t
+mp_tier_map_add(
+	struct mp_tier *tier,
+	const void     *key,
+	void           *addr,
+	size_t          bktsz,
+	const u64      *mbidv,
+	int             mbidc);
+
+/**
+ * mp_tier_map_remove() - Unregister an mcache map before it is unmapped
+ * @tier: tiering engine (may be NULL)
+ * @key:  map handle
+ */
+void mp_tier_map_remove(struct mp_tier *tier, const void *key);
+
+#endif /* MPOOL_TIER_H */
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Worker pool module.
+ *
+ * Device discovery, mpool activation and device trim all spread a list of
+ * independent items over a few short-lived threads, of which the calling
+ * thread is one.
+ */
+
+#include <util/platform.h>
+#include <util/minmax.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+void mp_run_workers(void *(*fn)(void *), void *arg, int nthreads)
+{
+	pthread_t   tidv[MP_WORKERS_MAX - 1];
+	int         tidc = 0, tmax;
+
+	tmax = clamp_t(int, nthreads, 1, MP_WORKERS_MAX);
+
+	while (tidc < tmax - 1 && !pthread_create(tidv + tidc, NULL, fn, arg))
+		tidc++;
+
+	fn(arg);
+
+	while (tidc > 0)
+		pthread_join(tidv[--tidc], NULL);
+}
+
+int mp_workers_io(int max, int itemc)
+{
+	long ncpus;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return clamp_t(long, ncpus * 2, 1, max_t(int, min_t(int, max, itemc), 1));
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_WORKERS_H
+#define MPOOL_WORKERS_H
+
+#include <util/platform.h>
+
+#define MP_WORKERS_MAX          16
+
+/**
+ * mp_run_workers() - Run a worker in a pool of threads and wait for it
+ * @fn:       worker, run once by each thread
+ * @arg:      argument of the worker, shared by all the threads
+ * @nthreads: number of threads, counting the calling thread
+ *
+ * Starts up to min(@nthreads, MP_WORKERS_MAX) - 1 threads, runs @fn in the
+ * calling thread as well, and joins them.  A thread that cannot be started
+ * only lowers the concurrency, so the workers must pull their items from
+ * state shared through @arg rather than each being handed a part upfront.
+ */
+void mp_run_workers(void *(*fn)(void *), void *arg, int nthreads);
+
+/**
+ * mp_workers_io() - Number of threads for a pool that mostly waits for I/O
+ * @max:   upper bound
+ * @itemc: number of work items
+ *
+ * Return: twice the number of online CPUs, clamped to [1, min(@max, @itemc)]
+ */
+int mp_workers_io(int max, int itemc);
+
+#endif /* MPOOL_WORKERS_H */
@@ -64,6 +64,18 @@ static inline int atomic_inc_return(atomic_t *v)
 	return __atomic_add_fetch(&v->counter, 1, __ATOMIC_RELAXED);
 }
 
+/* Atomically adds @i to @v. */
+static inline void atomic_add(int i, atomic_t *v)
+{
+	(void)__atomic_fetch_add(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+/* Atomically sets @v to @newv and returns the old value. */
+static inline int atomic_xchg(atomic_t *v, int newv)
+{
+	return __atomic_exchange_n(&v->counter, newv, __ATOMIC_RELAXED);
+}
+
 /*
  * Atomically sets v to newv if it was equal to oldv and returns the old value.
  */
@@ -27,6 +27,8 @@
 #define __packed                __attribute__((packed))
 #define __aligned(_size)        __attribute__((aligned((_size))))
 
+#define SMP_CACHE_BYTES         64
+
 #define __maybe_unused          __attribute__((__unused__))
 #define __weak                  __attribute__((__weak__, __noinline__))
 
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Unit tests of the libmpool modules that are layered on the mblock and
+ * mcache APIs.  The modules are built into this tool against an in-memory
+ * mblock store, so no mpool or device is needed.  The pd engine tests run
+ * on temporary files.
+ *
+ * Usage:
+ *    $ mpunit              # run all suites
+ *    $ mpunit mbframe      # run the named suites
+ *    $ mpunit -l           # list the suites and their tests
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "mpunit.h"
+
+static struct mpunit_suite *suitev[] = {
+	&mpunit_mbframe,
+	&mpunit_mbkv,
+	&mpunit_mapcache,
+	&mpunit_hotset,
+	&mpunit_mbslab,
+	&mpunit_pd_uring,
+	&mpunit_mbio,
+	NULL,
+};
+
+static const char *progname;
+
+static void usage(void)
+{
+	printf("usage: %s [-hlv] [suite ...]\n", progname);
+	printf("-h  print this help list\n");
+	printf("-l  list the suites and their tests\n");
+	printf("-v  report each test that passes\n");
+}
+
+static int run_suite(struct mpunit_suite *suite, bool verbose)
+{
+	struct mpunit_test *test;
+	int                 failed = 0;
+
+	for (test = suite->mus_testv; test->mut_name; test++) {
+		if (test->mut_func()) {
+			fprintf(stderr, "%s.%s: FAILED\n", suite->mus_name, test->mut_name);
+			failed++;
+			continue;
+		}
+
+		if (verbose)
+			printf("%s.%s: ok\n", suite->mus_name, test->mut_name);
+	}
+
+	return failed;
+}
+
+static void list_suites(void)
+{
+	struct mpunit_suite   **suite;
+	struct mpunit_test     *test;
+
+	for (suite = suitev; *suite; suite++) {
+		for (test = (*suite)->mus_testv; test->mut_name; test++)
+			printf("%s.%s\n", (*suite)->mus_name, test->mut_name);
+	}
+}
+
+static struct mpunit_suite *find_suite(const char *name)
+{
+	struct mpunit_suite **suite;
+
+	for (suite = suitev; *suite; suite++)
+		if (!strcmp((*suite)->mus_name, name))
+			return *suite;
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct mpunit_suite   **suite, *named;
+	bool                    verbose = false;
+	int                     failed = 0;
+	int                     c, i;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? progname + 1 : argv[0];
+
+	while ((c = getopt(argc, argv, "hlv")) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EX_OK);
+
+		case 'l':
+			list_suites();
+			exit(EX_OK);
+
+		case 'v':
+			verbose = true;
+			break;
+
+		default:
+			usage();
+			exit(EX_USAGE);
+		}
+	}
+
+	if (optind == argc) {
+		for (suite = suitev; *suite; suite++)
+			failed += run_suite(*suite, verbose);
+	}
+
+	for (i = optind; i < argc; i++) {
+		named = find_suite(argv[i]);
+		if (!named) {
+			fprintf(stderr, "%s: unknown suite %s\n", progname, argv[i]);
+			exit(EX_USAGE);
+		}
+
+		failed += run_suite(named, verbose);
+	}
+
+	if (failed) {
+		fprintf(stderr, "%s: %d test(s) failed\n", progname, failed);
+		exit(EX_SOFTWARE);
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPUNIT_H
+#define MPOOL_MPUNIT_H
+
+#include <stdio.h>
+
+#include <mpool/mpool.h>
+
+/*
+ * A test returns 0 on success.  MPUNIT_ASSERT() reports the failed
+ * condition and fails the test.
+ */
+#define MPUNIT_ASSERT(_cond)                                                    \
+	do {                                                                    \
+		if (!(_cond)) {                                                 \
+			fprintf(stderr, "%s:%d: assertion failed: %s\n",        \
+				__FILE__, __LINE__, #_cond);                    \
+			return -1;                                              \
+		}                                                               \
+	} while (0)
+
+typedef int (mpunit_func_t)(void);
+
+struct mpunit_test {
+	const char     *mut_name;
+	mpunit_func_t  *mut_func;
+};
+
+/*
+ * A suite is a NULL terminated vector of tests.
+ */
+struct mpunit_suite {
+	const char             *mus_name;
+	struct mpunit_test     *mus_testv;
+};
+
+extern struct mpunit_suite mpunit_mbframe;
+extern struct mpunit_suite mpunit_mbkv;
+extern struct mpunit_suite mpunit_mapcache;
+extern struct mpunit_suite mpunit_hotset;
+extern struct mpunit_suite mpunit_mbslab;
+extern struct mpunit_suite mpunit_pd_uring;
+extern struct mpunit_suite mpunit_mbio;
+
+#endif /* MPOOL_MPUNIT_H */
@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Hot set tests: the resident ranges recorded from one map of a set of
+ * mblocks, saved and loaded back, must be exactly the ranges populated by
+ * a warmup of a fresh map of the same mblocks.  Records are shared memory
+ * pages written by the test, and the fresh maps are memfd mappings whose
+ * pages only become resident when populated.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+
+#include "mpunit.h"
+#include "hotset.h"
+
+#define MBLOCK_PAGES    1024
+#define BKTSZ           (MBLOCK_PAGES * PAGE_SIZE)
+#define NMBLOCKS        3
+#define WARMUP_WAIT_MS  5000
+
+/**
+ * struct hs_range - pages [hr_first, hr_last] of mblock hr_mbidx
+ */
+struct hs_range {
+	int     hr_mbidx;
+	int     hr_first;
+	int     hr_last;
+};
+
+static const u64    mbidv[NMBLOCKS] = { 100, 200, 300 };
+static char         dirname[] = "/tmp/mpunit.XXXXXX";
+static char         path[sizeof(dirname) + sizeof("/" MP_HOTSET_FILE)];
+
+static char *hs_map(bool memfd)
+{
+	char   *addr;
+	int     fd = -1;
+
+	if (memfd) {
+		fd = memfd_create("mpunit", 0);
+		if (fd == -1 || ftruncate(fd, NMBLOCKS * BKTSZ)) {
+			if (fd != -1)
+				close(fd);
+			return NULL;
+		}
+	}
+
+	addr = mmap(NULL, NMBLOCKS * BKTSZ, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | (memfd ? 0 : MAP_ANONYMOUS), fd, 0);
+
+	if (fd != -1)
+		close(fd);
+
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+static void hs_unmap(char *addr)
+{
+	munmap(addr, NMBLOCKS * BKTSZ);
+}
+
+/*
+ * Make the given ranges of a fresh map resident, and record each mblock of
+ * the map with the given heat.
+ */
+static int
+hs_record(struct mp_hotset *hs, const struct hs_range *rangev, int rangec, const u64 *heatv)
+{
+	char   *addr;
+	int     i, pg;
+
+	addr = hs_map(false);
+	MPUNIT_ASSERT(addr);
+
+	for (i = 0; i < rangec; i++) {
+		for (pg = rangev[i].hr_first; pg <= rangev[i].hr_last; pg++)
+			addr[rangev[i].hr_mbidx * BKTSZ + pg * PAGE_SIZE] = 1;
+	}
+
+	for (i = 0; i < NMBLOCKS; i++)
+		mp_hotset_record(hs, mbidv[i], addr + i * BKTSZ, MBLOCK_PAGES, heatv[i]);
+
+	hs_unmap(addr);
+
+	return 0;
+}
+
+static bool hs_expected(const struct hs_range *rangev, int rangec, int mbidx, int pg)
+{
+	int i;
+
+	for (i = 0; i < rangec; i++) {
+		if (rangev[i].hr_mbidx == mbidx && pg >= rangev[i].hr_first && pg <= rangev[i].hr_last)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Load the saved descriptor and warm up a fresh map with it, then check
+ * that exactly the given ranges were populated.
+ */
+static int hs_check(const struct hs_range *rangev, int rangec)
+{
+	struct mpool_mcache_hotset *set;
+	struct mp_hotset           *hs;
+	unsigned char              *vec;
+	merr_t                      err;
+	char                       *addr;
+	int                         expect = 0, resident, i, ms;
+	int                         rc = -1;
+
+	for (i = 0; i < rangec; i++)
+		expect += rangev[i].hr_last - rangev[i].hr_first + 1;
+
+	vec = malloc(NMBLOCKS * MBLOCK_PAGES);
+	addr = hs_map(true);
+	if (!vec || !addr)
+		goto out;
+
+	err = mp_hotset_load(path, &set);
+	if (err)
+		goto out;
+
+	err = mp_hotset_create(0, &hs);
+	if (!err) {
+		err = mp_hotset_warmup(hs, addr, addr, BKTSZ, mbidv, NMBLOCKS, set);
+
+		/* The warmup thread populates the ranges in the background. */
+		for (ms = 0; !err && ms < WARMUP_WAIT_MS; ms += 10) {
+			if (mincore(addr, NMBLOCKS * BKTSZ, vec))
+				break;
+
+			for (i = resident = 0; i < NMBLOCKS * MBLOCK_PAGES; i++)
+				resident += vec[i] & 1;
+
+			if (resident >= expect)
+				break;
+
+			usleep(10 * 1000);
+		}
+
+		mp_hotset_cancel(hs, addr);
+		mp_hotset_destroy(hs);
+	}
+
+	mpool_mcache_hotset_free(set);
+
+	if (err || mincore(addr, NMBLOCKS * BKTSZ, vec))
+		goto out;
+
+	for (i = 0; i < NMBLOCKS * MBLOCK_PAGES; i++) {
+		if (!!(vec[i] & 1) != hs_expected(rangev, rangec, i / MBLOCK_PAGES, i % MBLOCK_PAGES)) {
+			fprintf(stderr, "%s: page %d of mblock %d\n", __func__,
+				i % MBLOCK_PAGES, i / MBLOCK_PAGES);
+			goto out;
+		}
+	}
+
+	rc = 0;
+
+out:
+	if (addr)
+		hs_unmap(addr);
+	free(vec);
+
+	return rc;
+}
+
+static int hs_setup(void)
+{
+	MPUNIT_ASSERT(mkdtemp(dirname));
+
+	snprintf(path, sizeof(path), "%s/%s", dirname, MP_HOTSET_FILE);
+
+	return 0;
+}
+
+static void hs_teardown(void)
+{
+	unlink(path);
+	rmdir(dirname);
+	strcpy(dirname, "/tmp/mpunit.XXXXXX");
+}
+
+/*
+ * Runs separated by more than MP_HOTSET_GAP pages stay apart, and of
+ * three mblocks only the two hottest are saved.
+ */
+static int test_save_load(void)
+{
+	const struct hs_range   rangev[] = {
+		{ 0, 0, 9 }, { 0, 100, 149 }, { 1, 0, 31 }, { 2, 500, 599 },
+	};
+	const u64               heatv[NMBLOCKS] = { 50, 20, 10 };
+	struct mp_hotset       *hs;
+	int                     rc;
+
+	MPUNIT_ASSERT(!hs_setup());
+
+	rc = mp_hotset_create(2, &hs) ? -1 : 0;
+	if (!rc) {
+		rc = hs_record(hs, rangev, NELEM(rangev), heatv);
+		rc = rc ?: (mp_hotset_save(hs, path) ? -1 : 0);
+		mp_hotset_destroy(hs);
+	}
+
+	rc = rc ?: hs_check(rangev, NELEM(rangev) - 1);
+	hs_teardown();
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * A later record of an mblock supersedes an earlier one, a save without
+ * records leaves the descriptor alone, and a save from a new recorder
+ * replaces it.
+ */
+static int test_reload(void)
+{
+	const struct hs_range   rangev1[] = { { 0, 0, 63 }, { 1, 0, 63 } };
+	const struct hs_range   rangev2[] = { { 0, 200, 263 }, { 1, 0, 63 } };
+	const struct hs_range   rangev3[] = { { 2, 7, 7 } };
+	const u64               heatv[NMBLOCKS] = { 1, 1, 1 };
+	struct mp_hotset       *hs;
+	int                     rc;
+
+	MPUNIT_ASSERT(!hs_setup());
+
+	rc = mp_hotset_create(NMBLOCKS, &hs) ? -1 : 0;
+	if (!rc) {
+		rc = hs_record(hs, rangev1, NELEM(rangev1), heatv);
+		rc = rc ?: hs_record(hs, rangev2, NELEM(rangev2), heatv);
+		rc = rc ?: (mp_hotset_save(hs, path) ? -1 : 0);
+		mp_hotset_destroy(hs);
+	}
+
+	rc = rc ?: hs_check(rangev2, NELEM(rangev2));
+
+	if (!rc) {
+		rc = mp_hotset_create(NMBLOCKS, &hs) ? -1 : 0;
+		rc = rc ?: (mp_hotset_save(hs, path) ? -1 : 0);
+		rc = rc ?: hs_check(rangev2, NELEM(rangev2));
+
+		rc = rc ?: hs_record(hs, rangev3, NELEM(rangev3), heatv);
+		rc = rc ?: (mp_hotset_save(hs, path) ? -1 : 0);
+		rc = rc ?: hs_check(rangev3, NELEM(rangev3));
+		mp_hotset_destroy(hs);
+	}
+
+	hs_teardown();
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static int test_corrupt(void)
+{
+	const struct hs_range       rangev[] = { { 1, 0, 31 } };
+	const u64                   heatv[NMBLOCKS] = { 1, 1, 1 };
+	struct mpool_mcache_hotset *set;
+	struct mp_hotset           *hs;
+	merr_t                      err;
+	FILE                       *fp;
+	int                         rc;
+
+	MPUNIT_ASSERT(!hs_setup());
+
+	err = mp_hotset_load(path, &set);
+	rc = merr_errno(err) == ENOENT ? 0 : -1;
+
+	rc = rc ?: (mp_hotset_create(NMBLOCKS, &hs) ? -1 : 0);
+	if (!rc) {
+		rc = hs_record(hs, rangev, NELEM(rangev), heatv);
+		rc = rc ?: (mp_hotset_save(hs, path) ? -1 : 0);
+		mp_hotset_destroy(hs);
+	}
+
+	/* Flip a bit of the first record, past the header. */
+	fp = rc ? NULL : fopen(path, "r+");
+	if (fp) {
+		fseek(fp, 20, SEEK_SET);
+		fputc(0x55, fp);
+		fclose(fp);
+
+		err = mp_hotset_load(path, &set);
+		rc = merr_errno(err) == EBADMSG ? 0 : -1;
+	}
+
+	if (!rc && truncate(path, 10) == 0) {
+		err = mp_hotset_load(path, &set);
+		rc = merr_errno(err) == EBADMSG ? 0 : -1;
+	}
+
+	hs_teardown();
+
+	MPUNIT_ASSERT(fp && !rc);
+
+	return 0;
+}
+
+static struct mpunit_test hotset_testv[] = {
+	{ "save_load",          test_save_load },
+	{ "reload",             test_reload },
+	{ "corrupt",            test_corrupt },
+	{ NULL,                 NULL },
+};
+
+struct mpunit_suite mpunit_hotset = {
+	.mus_name  = "hotset",
+	.mus_testv = hotset_testv,
+};
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Map cache tests: lookups must return the map of the same key only,
+ * references must keep maps out of the idle list, idle maps beyond the
+ * cap must be evicted least recently used first, and invalidation must
+ * drop idle maps at once and referenced maps at their last put.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+
+#include "mpunit.h"
+#include "mapcache.h"
+
+#define OBJ_MAX         8
+#define OBJ_LEN         100
+
+/**
+ * struct mc_obj - cached object standing for an mcache map
+ * @mo_ent:   cache entry
+ * @mo_mbidv: mblock IDs
+ * @mo_freed: destroyed by the cache
+ */
+struct mc_obj {
+	struct mp_mapcache_ent  mo_ent;
+	u64                     mo_mbidv[2];
+	bool                    mo_freed;
+};
+
+static struct mc_obj    objv[OBJ_MAX];
+static int              freev[OBJ_MAX];
+static int              freec;
+
+static merr_t mc_obj_free(void *priv)
+{
+	struct mc_obj *obj = priv;
+
+	obj->mo_freed = true;
+	freev[freec++] = obj - objv;
+
+	return 0;
+}
+
+/*
+ * Map object i onto mblocks (i, i + 1), through the cache.
+ */
+static struct mc_obj *mc_obj_map(struct mp_mapcache *mc, int i, u32 advice)
+{
+	struct mc_obj  *obj;
+	u64             mbidv[2] = { i, i + 1 };
+
+	obj = mp_mapcache_get(mc, mbidv, 2, advice);
+	if (obj)
+		return obj;
+
+	obj = objv + i;
+	memset(obj, 0, sizeof(*obj));
+	obj->mo_mbidv[0] = mbidv[0];
+	obj->mo_mbidv[1] = mbidv[1];
+	obj->mo_ent.mce_priv = obj;
+	obj->mo_ent.mce_mbidv = obj->mo_mbidv;
+	obj->mo_ent.mce_mbidc = 2;
+	obj->mo_ent.mce_advice = advice;
+	obj->mo_ent.mce_len = OBJ_LEN;
+
+	mp_mapcache_insert(mc, &obj->mo_ent);
+
+	return obj;
+}
+
+static void mc_obj_unmap(struct mp_mapcache *mc, struct mc_obj *obj)
+{
+	mp_mapcache_put(mc, &obj->mo_ent);
+}
+
+static struct mp_mapcache *mc_create(u64 cap)
+{
+	struct mp_mapcache *mc;
+
+	memset(objv, 0, sizeof(objv));
+	freec = 0;
+
+	return mp_mapcache_create(cap, mc_obj_free, &mc) ? NULL : mc;
+}
+
+static int test_get_put(void)
+{
+	struct mpool_mapcache_stats     stats;
+	struct mp_mapcache             *mc;
+	struct mc_obj                  *a, *b;
+	u64                             mbidv[2] = { 0, 1 };
+
+	mc = mc_create(10 * OBJ_LEN);
+	MPUNIT_ASSERT(mc);
+
+	MPUNIT_ASSERT(!mp_mapcache_get(mc, mbidv, 2, 0));
+
+	a = mc_obj_map(mc, 0, 0);
+	b = mc_obj_map(mc, 0, 0);
+	MPUNIT_ASSERT(a == b);
+
+	/* The advice and the whole vector are part of the key. */
+	MPUNIT_ASSERT(!mp_mapcache_get(mc, mbidv, 2, 1));
+	MPUNIT_ASSERT(!mp_mapcache_get(mc, mbidv, 1, 0));
+
+	/* Dropping the last reference leaves the map idle, not destroyed. */
+	mc_obj_unmap(mc, a);
+	mc_obj_unmap(mc, b);
+	MPUNIT_ASSERT(!a->mo_freed);
+
+	mp_mapcache_stats_get(mc, &stats);
+	MPUNIT_ASSERT(stats.mms_idle == OBJ_LEN);
+
+	/* An idle map is served again and is no longer idle. */
+	b = mc_obj_map(mc, 0, 0);
+	MPUNIT_ASSERT(a == b);
+
+	mp_mapcache_stats_get(mc, &stats);
+	MPUNIT_ASSERT(stats.mms_idle == 0);
+	MPUNIT_ASSERT(stats.mms_hits == 2);
+	MPUNIT_ASSERT(stats.mms_misses == 4);
+
+	mc_obj_unmap(mc, b);
+	mp_mapcache_destroy(mc);
+	MPUNIT_ASSERT(a->mo_freed);
+
+	return 0;
+}
+
+static int test_eviction_order(void)
+{
+	struct mpool_mapcache_stats     stats;
+	struct mp_mapcache             *mc;
+	struct mc_obj                  *obj;
+	int                             i;
+
+	mc = mc_create(3 * OBJ_LEN);
+	MPUNIT_ASSERT(mc);
+
+	/* Idle maps 0, 1 and 2, then use 0 again: 1 is the least recently used. */
+	for (i = 0; i < 3; i++)
+		mc_obj_unmap(mc, mc_obj_map(mc, i, 0));
+
+	mc_obj_unmap(mc, mc_obj_map(mc, 0, 0));
+	MPUNIT_ASSERT(freec == 0);
+
+	/* A referenced map does not count against the cap. */
+	obj = mc_obj_map(mc, 3, 0);
+	MPUNIT_ASSERT(freec == 0);
+
+	mc_obj_unmap(mc, obj);
+	MPUNIT_ASSERT(freec == 1 && freev[0] == 1);
+
+	mc_obj_unmap(mc, mc_obj_map(mc, 4, 0));
+	MPUNIT_ASSERT(freec == 2 && freev[1] == 2);
+
+	mc_obj_unmap(mc, mc_obj_map(mc, 5, 0));
+	MPUNIT_ASSERT(freec == 3 && freev[2] == 0);
+
+	mp_mapcache_stats_get(mc, &stats);
+	MPUNIT_ASSERT(stats.mms_evictions == 3);
+	MPUNIT_ASSERT(stats.mms_idle == 3 * OBJ_LEN);
+
+	/* Lowering the cap evicts from the least recently used end. */
+	mp_mapcache_cap_set(mc, OBJ_LEN);
+	MPUNIT_ASSERT(freec == 5 && objv[3].mo_freed && objv[4].mo_freed);
+
+	mp_mapcache_cap_set(mc, 0);
+	MPUNIT_ASSERT(freec == 6 && freev[5] == 5);
+
+	/* With a cap of 0, a map is destroyed at its last put. */
+	obj = mc_obj_map(mc, 6, 0);
+	mc_obj_unmap(mc, obj);
+	MPUNIT_ASSERT(obj->mo_freed);
+
+	mp_mapcache_destroy(mc);
+
+	return 0;
+}
+
+static int test_inval(void)
+{
+	struct mpool_mapcache_stats     stats;
+	struct mp_mapcache             *mc;
+	struct mc_obj                  *a, *b;
+
+	mc = mc_create(10 * OBJ_LEN);
+	MPUNIT_ASSERT(mc);
+
+	/* Map 0 on mblocks (0, 1) is idle, map 2 on mblocks (2, 3) is referenced. */
+	a = mc_obj_map(mc, 0, 0);
+	mc_obj_unmap(mc, a);
+	b = mc_obj_map(mc, 2, 0);
+
+	mp_mapcache_inval(mc, 7);
+	MPUNIT_ASSERT(freec == 0);
+
+	mp_mapcache_inval(mc, 1);
+	MPUNIT_ASSERT(a->mo_freed);
+
+	mp_mapcache_inval(mc, 3);
+	MPUNIT_ASSERT(!b->mo_freed);
+
+	/* An invalidated map is not served, and goes away at its last put. */
+	MPUNIT_ASSERT(!mp_mapcache_get(mc, b->mo_mbidv, 2, 0));
+
+	mc_obj_unmap(mc, b);
+	MPUNIT_ASSERT(b->mo_freed);
+
+	mp_mapcache_stats_get(mc, &stats);
+	MPUNIT_ASSERT(stats.mms_invals == 2);
+	MPUNIT_ASSERT(stats.mms_idle == 0);
+
+	mp_mapcache_destroy(mc);
+
+	return 0;
+}
+
+static struct mpunit_test mapcache_testv[] = {
+	{ "get_put",            test_get_put },
+	{ "eviction_order",     test_eviction_order },
+	{ "inval",              test_inval },
+	{ NULL,                 NULL },
+};
+
+struct mpunit_suite mpunit_mapcache = {
+	.mus_name  = "mapcache",
+	.mus_testv = mapcache_testv,
+};
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Framed mblock tests: data written through an mbframe writer, compressed
+ * or not, must read back intact from any offset, and corruption of a frame
+ * or of the trailer must be reported as EBADMSG rather than returned.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+
+#include "mpunit.h"
+#include "mpunit_mblock.h"
+
+#define MBID            1
+#define DATA_MAX        (4u << 20)
+
+/*
+ * Compressible data repeats a short phrase, incompressible data comes
+ * from a xorshift generator.
+ */
+static void data_fill(char *buf, size_t len, bool compressible, u32 seed)
+{
+	static const char   phrase[] = "a framed mblock test phrase ";
+	size_t              i;
+
+	for (i = 0; i < len; i++) {
+		if (compressible) {
+			buf[i] = phrase[(i / 3) % (sizeof(phrase) - 1)] ^ ((i >> 12) & 3);
+			continue;
+		}
+
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		buf[i] = seed;
+	}
+}
+
+static int
+mbframe_write(const char *data, size_t len, u32 framesz, u32 flags, size_t chunk, size_t *wrlen)
+{
+	struct mpool_mbframe_writer    *w;
+	mpool_err_t                     err;
+	size_t                          off, n, dlen;
+
+	mpunit_mblock_reset(MBID);
+
+	err = mpool_mbframe_writer_open(mpunit_mp, MBID, framesz, flags, &w);
+	MPUNIT_ASSERT(!err);
+
+	for (off = 0; off < len; off += n) {
+		n = min_t(size_t, chunk, len - off);
+
+		err = mpool_mbframe_writer_append(w, data + off, n);
+		MPUNIT_ASSERT(!err);
+	}
+
+	err = mpool_mbframe_writer_close(w, &dlen, wrlen);
+	MPUNIT_ASSERT(!err);
+	MPUNIT_ASSERT(dlen == len);
+
+	return 0;
+}
+
+/*
+ * Write len bytes, then read them back whole and in ranges that start
+ * and end at arbitrary offsets, including across frame boundaries.
+ */
+static int mbframe_roundtrip(size_t len, u32 framesz, u32 flags, bool compressible)
+{
+	struct mpool_mbframe_reader    *r;
+	mpool_err_t                     err;
+	size_t                          dlen, wrlen, off, n;
+	char                           *data, *buf;
+	u32                             seed = 17;
+	int                             rc = -1;
+	int                             i;
+
+	data = calloc(1, DATA_MAX);
+	buf = malloc(DATA_MAX);
+	if (!data || !buf)
+		goto out;
+
+	data_fill(data, len, compressible, 1);
+
+	if (mbframe_write(data, len, framesz, flags, 100003, &wrlen))
+		goto out;
+
+	if (len > 0 && compressible && (flags & MPOOL_MBFRAME_COMPRESS) && wrlen >= len / 2) {
+		fprintf(stderr, "%s: %zu bytes stored as %zu\n", __func__, len, wrlen);
+		goto out;
+	}
+
+	err = mpool_mbframe_reader_open(mpunit_mp, MBID, &r, &dlen);
+	if (err || dlen != len)
+		goto out;
+
+	err = mpool_mbframe_read(r, buf, len, 0);
+	if (err || memcmp(buf, data, len))
+		goto close;
+
+	for (i = 0; i < 500 && len > 0; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		off = seed % len;
+		n = (seed >> 7) % (len - off + 1);
+		if (i % 2)
+			n %= 5000;
+
+		err = mpool_mbframe_read(r, buf, n, off);
+		if (err || memcmp(buf, data + off, n))
+			goto close;
+	}
+
+	/* Reads past the end of the data are rejected. */
+	err = mpool_mbframe_read(r, buf, 2, len);
+	if (mpool_errno(err) != EINVAL)
+		goto close;
+
+	rc = 0;
+
+close:
+	mpool_mbframe_reader_close(r);
+out:
+	free(buf);
+	free(data);
+
+	return rc;
+}
+
+static int test_roundtrip_compressed(void)
+{
+	MPUNIT_ASSERT(!mbframe_roundtrip(DATA_MAX - 777, 0, MPOOL_MBFRAME_COMPRESS, true));
+
+	return 0;
+}
+
+static int test_roundtrip_incompressible(void)
+{
+	/* Frames that do not compress are stored raw. */
+	MPUNIT_ASSERT(!mbframe_roundtrip(DATA_MAX - 4321, 0, MPOOL_MBFRAME_COMPRESS, false));
+
+	return 0;
+}
+
+static int test_roundtrip_raw(void)
+{
+	MPUNIT_ASSERT(!mbframe_roundtrip(DATA_MAX, 0, 0, true));
+
+	return 0;
+}
+
+static int test_roundtrip_small_frames(void)
+{
+	MPUNIT_ASSERT(!mbframe_roundtrip(123457, PAGE_SIZE, MPOOL_MBFRAME_COMPRESS, true));
+
+	return 0;
+}
+
+static int test_roundtrip_empty(void)
+{
+	MPUNIT_ASSERT(!mbframe_roundtrip(0, 0, MPOOL_MBFRAME_COMPRESS, true));
+
+	return 0;
+}
+
+/*
+ * A flipped bit in a frame fails the reads that touch that frame only.
+ */
+static int mbframe_corrupt_frame(u32 flags)
+{
+	struct mpool_mbframe_reader    *r;
+	mpool_err_t                     err;
+	size_t                          len = 1u << 20, mblen, wrlen;
+	char                           *data, *buf, *mb;
+	int                             rc = -1;
+
+	data = malloc(len);
+	buf = malloc(len);
+	if (!data || !buf)
+		goto out;
+
+	data_fill(data, len, true, 1);
+
+	if (mbframe_write(data, len, PAGE_SIZE, flags, len, &wrlen))
+		goto out;
+
+	/* The first frame is stored at the start of the mblock. */
+	mb = mpunit_mblock_data(MBID, &mblen);
+	mb[10] ^= 0x10;
+
+	err = mpool_mbframe_reader_open(mpunit_mp, MBID, &r, NULL);
+	if (err)
+		goto out;
+
+	if (mpool_errno(mpool_mbframe_read(r, buf, 16, 0)) != EBADMSG)
+		goto close;
+
+	if (mpool_errno(mpool_mbframe_read(r, buf, len, 0)) != EBADMSG)
+		goto close;
+
+	err = mpool_mbframe_read(r, buf, len / 2, len / 2);
+	if (err || memcmp(buf, data + len / 2, len / 2))
+		goto close;
+
+	rc = 0;
+
+close:
+	mpool_mbframe_reader_close(r);
+out:
+	free(buf);
+	free(data);
+
+	return rc;
+}
+
+static int test_corrupt_frame(void)
+{
+	MPUNIT_ASSERT(!mbframe_corrupt_frame(MPOOL_MBFRAME_COMPRESS));
+	MPUNIT_ASSERT(!mbframe_corrupt_frame(0));
+
+	return 0;
+}
+
+/*
+ * The trailer ends on the last byte of the mblock and is checksummed.
+ */
+static int test_corrupt_trailer(void)
+{
+	struct mpool_mbframe_reader    *r;
+	mpool_err_t                     err;
+	size_t                          len = 300000, mblen, wrlen;
+	char                           *data, *mb;
+	int                             rc;
+
+	data = malloc(len);
+	MPUNIT_ASSERT(data);
+
+	data_fill(data, len, false, 3);
+	rc = mbframe_write(data, len, 0, MPOOL_MBFRAME_COMPRESS, len, &wrlen);
+	free(data);
+	MPUNIT_ASSERT(!rc);
+
+	mb = mpunit_mblock_data(MBID, &mblen);
+	MPUNIT_ASSERT(mblen == wrlen && PAGE_ALIGNED(mblen));
+
+	mb[mblen - 5] ^= 1;
+	err = mpool_mbframe_reader_open(mpunit_mp, MBID, &r, NULL);
+	MPUNIT_ASSERT(mpool_errno(err) == EBADMSG);
+
+	mb[mblen - 5] ^= 1;
+	err = mpool_mbframe_reader_open(mpunit_mp, MBID, &r, NULL);
+	MPUNIT_ASSERT(!err);
+	mpool_mbframe_reader_close(r);
+
+	/* An mblock that was not written by an mbframe writer. */
+	memset(mb, 0, mblen);
+	err = mpool_mbframe_reader_open(mpunit_mp, MBID, &r, NULL);
+	MPUNIT_ASSERT(mpool_errno(err) == EBADMSG);
+
+	return 0;
+}
+
+static struct mpunit_test mbframe_testv[] = {
+	{ "roundtrip_compressed",       test_roundtrip_compressed },
+	{ "roundtrip_incompressible",   test_roundtrip_incompressible },
+	{ "roundtrip_raw",              test_roundtrip_raw },
+	{ "roundtrip_small_frames",     test_roundtrip_small_frames },
+	{ "roundtrip_empty",            test_roundtrip_empty },
+	{ "corrupt_frame",              test_corrupt_frame },
+	{ "corrupt_trailer",            test_corrupt_trailer },
+	{ NULL,                         NULL },
+};
+
+struct mpunit_suite mpunit_mbframe = {
+	.mus_name  = "mbframe",
+	.mus_testv = mbframe_testv,
+};
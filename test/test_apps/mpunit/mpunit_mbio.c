@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Async mblock I/O engine tests: how many I/Os the engine has in flight.
+ * The writes to an mblock are issued one at a time and in submission
+ * order whatever the number of workers, writes to different mblocks and
+ * reads are issued concurrently, up to one per worker.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+
+#include "mbio.h"
+
+#include "mpunit.h"
+#include "mpunit_mblock.h"
+
+#define MT_WORKC        4
+#define MT_IOC          16
+#define MT_DELAY_US     2000
+
+/**
+ * struct mbio_test - I/Os of a test
+ * @mt_cq:   completion queue of the I/Os
+ * @mt_buf:  MT_IOC pages, one per I/O
+ * @mt_iovv: one iovec per I/O
+ */
+struct mbio_test {
+	struct mpool_mbio_cq   *mt_cq;
+	char                   *mt_buf;
+	struct iovec            mt_iovv[MT_IOC];
+};
+
+static int mt_open(struct mbio_test *mt)
+{
+	int i;
+
+	for (i = 0; i < MPUNIT_MBLOCK_MAX; i++)
+		mpunit_mblock_reset(i);
+
+	memset(mt, 0, sizeof(*mt));
+
+	MPUNIT_ASSERT(!mp_mbio_create(mpunit_mp, MT_WORKC, &mpunit_mbio_engine));
+	MPUNIT_ASSERT(!mpool_mbio_cq_create(&mt->mt_cq));
+
+	mt->mt_buf = aligned_alloc(PAGE_SIZE, MT_IOC * PAGE_SIZE);
+	MPUNIT_ASSERT(mt->mt_buf);
+
+	for (i = 0; i < MT_IOC; i++) {
+		memset(mt->mt_buf + i * PAGE_SIZE, 'a' + i, PAGE_SIZE);
+		mt->mt_iovv[i].iov_base = mt->mt_buf + i * PAGE_SIZE;
+		mt->mt_iovv[i].iov_len = PAGE_SIZE;
+	}
+
+	mpunit_mblock_io_trace(MT_DELAY_US);
+
+	return 0;
+}
+
+static void mt_close(struct mbio_test *mt)
+{
+	mpunit_mblock_io_trace(0);
+
+	mp_mbio_destroy(mpunit_mbio_engine);
+	mpunit_mbio_engine = NULL;
+
+	mpool_mbio_cq_destroy(mt->mt_cq);
+	free(mt->mt_buf);
+}
+
+/*
+ * Reap the cnt I/Os of the test, in completion order, into cqev[].
+ */
+static int mt_reap(struct mbio_test *mt, struct mpool_mbio_cqe *cqev, int cnt)
+{
+	int n, i;
+
+	for (i = 0; i < cnt; i += n)
+		MPUNIT_ASSERT(!mpool_mbio_cq_reap(mt->mt_cq, cqev + i, cnt - i, 1, &n) && n > 0);
+
+	return 0;
+}
+
+/*
+ * The writes of a single mblock, e.g., those of an mblock writer, never
+ * overlap, so the commit queued behind them finds them all done.
+ */
+static int test_write_one(void)
+{
+	struct mpool_mbio_cqe   cqev[MT_IOC + 1];
+	struct mbio_test        mt;
+	size_t                  len;
+	char                   *data;
+	int                     rc, i;
+
+	rc = mt_open(&mt);
+
+	for (i = 0; i < MT_IOC && !rc; i++)
+		rc = mp_mbio_submit(mpunit_mbio_engine, MPOOL_MBIO_WRITE, 1, mt.mt_iovv + i, 1, 0,
+				    mt.mt_cq, NULL, (void *)(uintptr_t)i) ? -1 : 0;
+
+	rc = rc ?: (mp_mbio_submit(mpunit_mbio_engine, MP_MBIO_COMMIT, 1, NULL, 0, 0, mt.mt_cq,
+				   NULL, (void *)(uintptr_t)i) ? -1 : 0);
+	rc = rc ?: mt_reap(&mt, cqev, MT_IOC + 1);
+
+	for (i = 0; i < MT_IOC + 1 && !rc; i++)
+		rc = (cqev[i].mce_err || cqev[i].mce_arg != (void *)(uintptr_t)i) ? -1 : 0;
+
+	rc = rc ?: (mpunit_mblock_io_depth() == 1 ? 0 : -1);
+
+	if (!rc) {
+		data = mpunit_mblock_data(1, &len);
+		rc = (len == MT_IOC * PAGE_SIZE && !memcmp(data, mt.mt_buf, len)) ? 0 : -1;
+	}
+
+	mt_close(&mt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * Writes to different mblocks are issued concurrently, as long as their
+ * mblocks are routed to different workers.
+ */
+static int test_write_many(void)
+{
+	struct mpool_mbio_cqe   cqev[MT_IOC];
+	struct mbio_test        mt;
+	int                     rc, i;
+
+	rc = mt_open(&mt);
+
+	for (i = 0; i < MT_IOC && !rc; i++)
+		rc = mp_mbio_submit(mpunit_mbio_engine, MPOOL_MBIO_WRITE, i % MPUNIT_MBLOCK_MAX,
+				    mt.mt_iovv + i, 1, 0, mt.mt_cq, NULL, NULL) ? -1 : 0;
+
+	rc = rc ?: mt_reap(&mt, cqev, MT_IOC);
+
+	for (i = 0; i < MT_IOC && !rc; i++)
+		rc = cqev[i].mce_err ? -1 : 0;
+
+	rc = rc ?: ((mpunit_mblock_io_depth() > 1 && mpunit_mblock_io_depth() <= MT_WORKC) ?
+		    0 : -1);
+
+	mt_close(&mt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * Reads, even of a single mblock, keep every worker busy.
+ */
+static int test_read_one(void)
+{
+	struct mpool_mbio_cqe   cqev[MT_IOC];
+	struct mbio_test        mt;
+	struct iovec            iov;
+	char                   *buf;
+	int                     rc, i;
+
+	rc = mt_open(&mt);
+
+	buf = aligned_alloc(PAGE_SIZE, MT_IOC * PAGE_SIZE);
+	MPUNIT_ASSERT(buf);
+
+	iov.iov_base = mt.mt_buf;
+	iov.iov_len = MT_IOC * PAGE_SIZE;
+
+	rc = rc ?: (mpool_mblock_write(mpunit_mp, 1, &iov, 1) ? -1 : 0);
+	rc = rc ?: (mpool_mblock_commit(mpunit_mp, 1) ? -1 : 0);
+
+	memset(buf, 0, MT_IOC * PAGE_SIZE);
+	mpunit_mblock_io_trace(MT_DELAY_US);
+
+	for (i = 0; i < MT_IOC && !rc; i++) {
+		mt.mt_iovv[i].iov_base = buf + i * PAGE_SIZE;
+
+		rc = mp_mbio_submit(mpunit_mbio_engine, MPOOL_MBIO_READ, 1, mt.mt_iovv + i, 1,
+				    i * PAGE_SIZE, mt.mt_cq, NULL, NULL) ? -1 : 0;
+	}
+
+	rc = rc ?: mt_reap(&mt, cqev, MT_IOC);
+
+	for (i = 0; i < MT_IOC && !rc; i++)
+		rc = cqev[i].mce_err ? -1 : 0;
+
+	rc = rc ?: (mpunit_mblock_io_depth() == MT_WORKC ? 0 : -1);
+	rc = rc ?: (memcmp(buf, mt.mt_buf, MT_IOC * PAGE_SIZE) ? -1 : 0);
+
+	free(buf);
+	mt_close(&mt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static struct mpunit_test mbio_testv[] = {
+	{ "write_one",          test_write_one },
+	{ "write_many",         test_write_many },
+	{ "read_one",           test_read_one },
+	{ NULL,                 NULL },
+};
+
+struct mpunit_suite mpunit_mbio = {
+	.mus_name  = "mbio",
+	.mus_testv = mbio_testv,
+};
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Indexed sorted mblock tests: every pair added through an mbkv writer
+ * must be found with its value, through reads or through an mcache map,
+ * absent keys must not be found, and writer and reader must reject keys
+ * out of order, oversize pairs and corrupt mblocks.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+
+#include "mpunit.h"
+#include "mpunit_mblock.h"
+
+#define MBID            2
+#define NKEYS           20000
+
+/* Stored keys are even, odd keys are absent. */
+static int key_make(char *key, u32 i)
+{
+	return sprintf(key, "key%08u", i);
+}
+
+static size_t val_make(char *val, u32 i)
+{
+	size_t vlen = (i * 7) % 200;
+	size_t j;
+
+	for (j = 0; j < vlen; j++)
+		val[j] = i + j;
+
+	return vlen;
+}
+
+static int mbkv_write(u32 nkeys, u32 blksz, u32 bits)
+{
+	struct mpool_mbkv_writer   *w;
+	mpool_err_t                 err;
+	uint64_t                    n;
+	char                        key[32], val[256];
+	size_t                      klen, vlen;
+	u32                         i;
+
+	mpunit_mblock_reset(MBID);
+
+	err = mpool_mbkv_writer_open(mpunit_mp, MBID, blksz, bits, &w);
+	MPUNIT_ASSERT(!err);
+
+	for (i = 0; i < nkeys; i++) {
+		klen = key_make(key, 2 * i);
+		vlen = val_make(val, 2 * i);
+
+		err = mpool_mbkv_writer_add(w, key, klen, val, vlen);
+		MPUNIT_ASSERT(!err);
+	}
+
+	err = mpool_mbkv_writer_close(w, &n, NULL);
+	MPUNIT_ASSERT(!err);
+	MPUNIT_ASSERT(n == nkeys);
+
+	return 0;
+}
+
+/*
+ * Look up every stored key, then as many absent keys: odd keys, which
+ * fall between stored keys, and keys that sort before the first or after
+ * the last stored key.
+ */
+static int mbkv_lookup(u32 nkeys, u32 flags)
+{
+	struct mpool_mbkv_reader   *r;
+	mpool_err_t                 err;
+	uint64_t                    n;
+	char                        key[32], val[256], buf[256];
+	size_t                      klen, vlen, len;
+	int                         rc = -1;
+	u32                         i;
+
+	err = mpool_mbkv_reader_open(mpunit_mp, MBID, flags, &r, &n);
+	MPUNIT_ASSERT(!err);
+
+	if (n != nkeys)
+		goto close;
+
+	for (i = 0; i < nkeys; i++) {
+		klen = key_make(key, 2 * i);
+		vlen = val_make(val, 2 * i);
+
+		err = mpool_mbkv_get(r, key, klen, buf, sizeof(buf), &len);
+		if (err || len != vlen || memcmp(buf, val, vlen))
+			goto close;
+
+		/* A short buffer gets a prefix of the value and its full length. */
+		if (vlen > 1) {
+			memset(buf, 0, sizeof(buf));
+
+			err = mpool_mbkv_get(r, key, klen, buf, 1, &len);
+			if (err || len != vlen || buf[0] != val[0] || buf[1])
+				goto close;
+		}
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		klen = key_make(key, 2 * i + 1);
+
+		err = mpool_mbkv_get(r, key, klen, buf, sizeof(buf), NULL);
+		if (mpool_errno(err) != ENOENT)
+			goto close;
+	}
+
+	if (mpool_errno(mpool_mbkv_get(r, "a", 1, NULL, 0, NULL)) != ENOENT ||
+	    mpool_errno(mpool_mbkv_get(r, "key", 3, NULL, 0, NULL)) != ENOENT ||
+	    mpool_errno(mpool_mbkv_get(r, "zzz", 3, NULL, 0, NULL)) != ENOENT)
+		goto close;
+
+	rc = 0;
+
+close:
+	mpool_mbkv_reader_close(r);
+
+	return rc;
+}
+
+static int test_roundtrip(void)
+{
+	MPUNIT_ASSERT(!mbkv_write(NKEYS, 0, MPOOL_MBKV_BLOOM_BITS));
+	MPUNIT_ASSERT(!mbkv_lookup(NKEYS, 0));
+	MPUNIT_ASSERT(!mbkv_lookup(NKEYS, MPOOL_MBKV_MMAP));
+
+	return 0;
+}
+
+static int test_roundtrip_nobloom(void)
+{
+	MPUNIT_ASSERT(!mbkv_write(NKEYS, 0, 0));
+	MPUNIT_ASSERT(!mbkv_lookup(NKEYS, 0));
+	MPUNIT_ASSERT(!mbkv_lookup(NKEYS, MPOOL_MBKV_MMAP));
+
+	return 0;
+}
+
+static int test_roundtrip_large_blocks(void)
+{
+	MPUNIT_ASSERT(!mbkv_write(NKEYS, 4 * PAGE_SIZE, MPOOL_MBKV_BLOOM_BITS));
+	MPUNIT_ASSERT(!mbkv_lookup(NKEYS, 0));
+	MPUNIT_ASSERT(!mbkv_lookup(NKEYS, MPOOL_MBKV_MMAP));
+
+	return 0;
+}
+
+static int test_roundtrip_small(void)
+{
+	MPUNIT_ASSERT(!mbkv_write(0, 0, MPOOL_MBKV_BLOOM_BITS));
+	MPUNIT_ASSERT(!mbkv_lookup(0, 0));
+
+	MPUNIT_ASSERT(!mbkv_write(1, 0, MPOOL_MBKV_BLOOM_BITS));
+	MPUNIT_ASSERT(!mbkv_lookup(1, 0));
+
+	return 0;
+}
+
+/*
+ * With a filter, a lookup of an absent key reads one page at most, and
+ * rarely more than the filter page.
+ */
+static int test_bloom(void)
+{
+	struct mpool_mbkv_reader   *r;
+	mpool_err_t                 err;
+	uint64_t                    reads;
+	char                        key[32];
+	size_t                      klen;
+	u32                         i;
+
+	MPUNIT_ASSERT(!mbkv_write(NKEYS, 0, MPOOL_MBKV_BLOOM_BITS));
+
+	err = mpool_mbkv_reader_open(mpunit_mp, MBID, 0, &r, NULL);
+	MPUNIT_ASSERT(!err);
+
+	reads = mpunit_mblock_reads();
+
+	for (i = 0; i < NKEYS; i++) {
+		klen = key_make(key, 2 * i + 1);
+		if (mpool_errno(mpool_mbkv_get(r, key, klen, NULL, 0, NULL)) != ENOENT)
+			break;
+	}
+
+	reads = mpunit_mblock_reads() - reads;
+	mpool_mbkv_reader_close(r);
+
+	MPUNIT_ASSERT(i == NKEYS);
+	MPUNIT_ASSERT(reads < NKEYS + NKEYS / 10);
+
+	return 0;
+}
+
+static int test_writer_errors(void)
+{
+	struct mpool_mbkv_writer   *w;
+	mpool_err_t                 err;
+	static char                 val[64 << 10];
+
+	mpunit_mblock_reset(MBID);
+
+	err = mpool_mbkv_writer_open(mpunit_mp, MBID, 0, MPOOL_MBKV_BLOOM_BITS, &w);
+	MPUNIT_ASSERT(!err);
+
+	err = mpool_mbkv_writer_add(w, "b", 1, "1", 1);
+	MPUNIT_ASSERT(!err);
+
+	/* Keys must be strictly increasing. */
+	err = mpool_mbkv_writer_add(w, "b", 1, "2", 1);
+	MPUNIT_ASSERT(mpool_errno(err) == EINVAL);
+
+	err = mpool_mbkv_writer_add(w, "a", 1, "2", 1);
+	MPUNIT_ASSERT(mpool_errno(err) == EINVAL);
+
+	err = mpool_mbkv_writer_add(w, "", 0, "2", 1);
+	MPUNIT_ASSERT(mpool_errno(err) == EINVAL);
+
+	/* A pair must fit into a block. */
+	err = mpool_mbkv_writer_add(w, "c", 1, val, sizeof(val));
+	MPUNIT_ASSERT(mpool_errno(err) == EMSGSIZE);
+
+	/* A key that has the previous key as a prefix sorts after it. */
+	err = mpool_mbkv_writer_add(w, "ba", 2, "3", 1);
+	MPUNIT_ASSERT(!err);
+
+	err = mpool_mbkv_writer_close(w, NULL, NULL);
+	MPUNIT_ASSERT(!err);
+
+	return 0;
+}
+
+static int test_corrupt(void)
+{
+	struct mpool_mbkv_reader   *r;
+	mpool_err_t                 err;
+	size_t                      mblen, klen;
+	char                        key[32], *mb;
+
+	MPUNIT_ASSERT(!mbkv_write(NKEYS, 0, MPOOL_MBKV_BLOOM_BITS));
+
+	mb = mpunit_mblock_data(MBID, &mblen);
+
+	/* The trailer ends on the last byte of the mblock and is checksummed. */
+	mb[mblen - 5] ^= 1;
+	err = mpool_mbkv_reader_open(mpunit_mp, MBID, 0, &r, NULL);
+	MPUNIT_ASSERT(mpool_errno(err) == EBADMSG);
+	mb[mblen - 5] ^= 1;
+
+	/* A bad record count in the first data block, which holds key 0. */
+	memset(mb + PAGE_SIZE - 4, 0xff, 4);
+
+	err = mpool_mbkv_reader_open(mpunit_mp, MBID, 0, &r, NULL);
+	MPUNIT_ASSERT(!err);
+
+	klen = key_make(key, 0);
+	err = mpool_mbkv_get(r, key, klen, NULL, 0, NULL);
+	mpool_mbkv_reader_close(r);
+
+	MPUNIT_ASSERT(mpool_errno(err) == EBADMSG);
+
+	return 0;
+}
+
+static struct mpunit_test mbkv_testv[] = {
+	{ "roundtrip",                  test_roundtrip },
+	{ "roundtrip_nobloom",          test_roundtrip_nobloom },
+	{ "roundtrip_large_blocks",     test_roundtrip_large_blocks },
+	{ "roundtrip_small",            test_roundtrip_small },
+	{ "bloom",                      test_bloom },
+	{ "writer_errors",              test_writer_errors },
+	{ "corrupt",                    test_corrupt },
+	{ NULL,                         NULL },
+};
+
+struct mpunit_suite mpunit_mbkv = {
+	.mus_name  = "mbkv",
+	.mus_testv = mbkv_testv,
+};
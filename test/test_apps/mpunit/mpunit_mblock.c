@@ -0,0 +1,445 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * In-memory mblocks for mpunit.  Writes are appended to a page aligned
+ * buffer per mblock and reads are checked against the constraints of the
+ * real mblock API, i.e., page aligned offsets, buffers and lengths.  An
+ * mcache map hands out the buffers of its mblocks in place.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <util/platform.h>
+#include <util/atomic.h>
+#include <util/page.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/impool.h>
+
+#include "mpool_err.h"
+#include "mbio.h"
+#include "tier.h"
+
+#include "mpunit_mblock.h"
+
+struct mpunit_mblock {
+	char       *mb_data;
+	size_t      mb_len;
+	bool        mb_allocated;
+	bool        mb_writing;
+	bool        mb_committed;
+};
+
+struct mpool_mblock_writer {
+	struct mpunit_mblock   *mbw_mb;
+};
+
+struct mpool_mcache_map {
+	size_t                  mh_mbidc;
+	uint64_t                mh_mbidv[];
+};
+
+static struct mpunit_mblock mpunit_mblockv[MPUNIT_MBLOCK_MAX];
+static uint64_t             mpunit_reads;
+static int                  mpunit_fail_append = -1;
+static unsigned int         mpunit_io_delay;
+static atomic_t             mpunit_io_depth;
+static atomic_t             mpunit_io_depth_max;
+static char                 mpunit_mpool;
+
+struct mpool *mpunit_mp = (struct mpool *)&mpunit_mpool;
+struct mp_mbio *mpunit_mbio_engine;
+
+static struct mpunit_mblock *mpunit_mblock_get(uint64_t mbid)
+{
+	struct mpunit_mblock *mb;
+
+	if (mbid >= MPUNIT_MBLOCK_MAX)
+		return NULL;
+
+	mb = mpunit_mblockv + mbid;
+
+	if (!mb->mb_data) {
+		mb->mb_data = aligned_alloc(PAGE_SIZE, MPUNIT_MBLOCK_CAP);
+		if (!mb->mb_data)
+			return NULL;
+	}
+
+	return mb;
+}
+
+void mpunit_mblock_reset(uint64_t mbid)
+{
+	struct mpunit_mblock *mb = mpunit_mblock_get(mbid);
+
+	if (mb) {
+		mb->mb_len = 0;
+		mb->mb_allocated = false;
+		mb->mb_writing = false;
+		mb->mb_committed = false;
+	}
+}
+
+char *mpunit_mblock_data(uint64_t mbid, size_t *len)
+{
+	struct mpunit_mblock *mb = mpunit_mblock_get(mbid);
+
+	*len = mb ? mb->mb_len : 0;
+
+	return mb ? mb->mb_data : NULL;
+}
+
+uint64_t mpunit_mblock_reads(void)
+{
+	return mpunit_reads;
+}
+
+void mpunit_mblock_fail_append(int after)
+{
+	mpunit_fail_append = after;
+}
+
+void mpunit_mblock_io_trace(unsigned int delay_us)
+{
+	mpunit_io_delay = delay_us;
+	atomic_set(&mpunit_io_depth_max, 0);
+}
+
+int mpunit_mblock_io_depth(void)
+{
+	return atomic_read(&mpunit_io_depth_max);
+}
+
+/*
+ * Account for an I/O in progress and hold it for mpunit_io_delay, so that
+ * the I/Os issued concurrently overlap.
+ */
+static void mpunit_io_begin(void)
+{
+	int depth, max;
+
+	depth = atomic_inc_return(&mpunit_io_depth);
+
+	do {
+		max = atomic_read(&mpunit_io_depth_max);
+	} while (depth > max && atomic_cmpxchg(&mpunit_io_depth_max, max, depth) != max);
+
+	if (mpunit_io_delay)
+		usleep(mpunit_io_delay);
+}
+
+static void mpunit_io_end(void)
+{
+	atomic_dec(&mpunit_io_depth);
+}
+
+mpool_err_t
+mpool_mblock_alloc(
+	struct mpool           *mp,
+	enum mp_media_classp    mclassp,
+	bool                    spare,
+	uint64_t               *mbid,
+	struct mblock_props    *props)
+{
+	struct mpunit_mblock   *mb;
+	uint64_t                i;
+
+	for (i = 0; i < MPUNIT_MBLOCK_MAX; i++) {
+		mb = mpunit_mblock_get(i);
+		if (!mb)
+			return merr(ENOMEM);
+
+		if (mb->mb_allocated || mb->mb_writing || mb->mb_committed)
+			continue;
+
+		mb->mb_allocated = true;
+		*mbid = i;
+
+		return props ? mpool_mblock_props_get(mp, i, props) : 0;
+	}
+
+	return merr(ENOSPC);
+}
+
+mpool_err_t mpool_mblock_abort(struct mpool *mp, uint64_t mbid)
+{
+	mpunit_mblock_reset(mbid);
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_find(struct mpool *mp, uint64_t objid, struct mblock_props *props)
+{
+	return mpool_mblock_props_get(mp, objid, props);
+}
+
+mpool_err_t mpool_mblock_delete_defer(struct mpool *mp, const uint64_t *mbidv, int mbidc)
+{
+	int i;
+
+	for (i = 0; i < mbidc; i++)
+		mpunit_mblock_reset(mbidv[i]);
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mblock_writer_open(
+	struct mpool                *mp,
+	uint64_t                     mbid,
+	int                          depth,
+	struct mpool_mblock_writer **wp)
+{
+	struct mpool_mblock_writer *w;
+	struct mpunit_mblock       *mb;
+
+	mb = mpunit_mblock_get(mbid);
+	if (!mb)
+		return merr(ENOENT);
+
+	if (mb->mb_writing || mb->mb_committed)
+		return merr(EINVAL);
+
+	w = malloc(sizeof(*w));
+	if (!w)
+		return merr(ENOMEM);
+
+	mb->mb_len = 0;
+	mb->mb_writing = true;
+	w->mbw_mb = mb;
+	*wp = w;
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_writer_append(struct mpool_mblock_writer *w, const void *data, size_t len)
+{
+	struct mpunit_mblock *mb = w->mbw_mb;
+
+	if (mpunit_fail_append >= 0 && !mpunit_fail_append--)
+		return merr(ENOSPC);
+
+	if (len > MPUNIT_MBLOCK_CAP - mb->mb_len)
+		return merr(ENOSPC);
+
+	memcpy(mb->mb_data + mb->mb_len, data, len);
+	mb->mb_len += len;
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_writer_close(struct mpool_mblock_writer *w, size_t *len)
+{
+	struct mpunit_mblock *mb = w->mbw_mb;
+
+	if (len)
+		*len = mb->mb_len;
+
+	/* The last write of a real writer is padded to a page. */
+	memset(mb->mb_data + mb->mb_len, 0, roundup(mb->mb_len, PAGE_SIZE) - mb->mb_len);
+	mb->mb_len = roundup(mb->mb_len, PAGE_SIZE);
+	mb->mb_writing = false;
+	mb->mb_committed = true;
+	free(w);
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_writer_abort(struct mpool_mblock_writer *w)
+{
+	struct mpunit_mblock *mb = w->mbw_mb;
+
+	/* A real writer aborts its mblock. */
+	mb->mb_len = 0;
+	mb->mb_allocated = false;
+	mb->mb_writing = false;
+	free(w);
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_props_get(struct mpool *mp, uint64_t mbid, struct mblock_props *props)
+{
+	struct mpunit_mblock *mb;
+
+	mb = mpunit_mblock_get(mbid);
+	if (!mb)
+		return merr(ENOENT);
+
+	memset(props, 0, sizeof(*props));
+	props->mpr_objid = mbid;
+	props->mpr_alloc_cap = MPUNIT_MBLOCK_CAP;
+	props->mpr_write_len = mb->mb_len;
+	props->mpr_optimal_wrsz = 128 << 10;
+	props->mpr_iscommitted = mb->mb_committed;
+
+	return 0;
+}
+
+mpool_err_t
+mpool_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset)
+{
+	struct mpunit_mblock   *mb;
+	int                     i;
+
+	mb = mpunit_mblock_get(mbid);
+	if (!mb)
+		return merr(ENOENT);
+
+	if (!mb->mb_committed || !PAGE_ALIGNED(offset))
+		return merr(EINVAL);
+
+	mpunit_reads++;
+
+	for (i = 0; i < iovc; i++) {
+		if (!PAGE_ALIGNED(iov[i].iov_base) || !PAGE_ALIGNED(iov[i].iov_len))
+			return merr(EINVAL);
+
+		if (offset + iov[i].iov_len > mb->mb_len)
+			return merr(EINVAL);
+
+		memcpy(iov[i].iov_base, mb->mb_data + offset, iov[i].iov_len);
+		offset += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+merr_t
+mp_mblock_read(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc, off_t offset)
+{
+	merr_t err;
+
+	mpunit_io_begin();
+	err = mpool_mblock_read(mp, mbid, iov, iovc, offset);
+	mpunit_io_end();
+
+	return err;
+}
+
+mpool_err_t
+mpool_mblock_read_async(
+	struct mpool           *mp,
+	uint64_t                mbid,
+	const struct iovec     *iov,
+	int                     iovc,
+	off_t                   offset,
+	struct mpool_mbio_cq   *cq,
+	mpool_mbio_cb          *cb,
+	void                   *arg)
+{
+	return mp_mbio_submit(mpunit_mbio_engine, MPOOL_MBIO_READ, mbid, iov, iovc, offset, cq, cb, arg);
+}
+
+/*
+ * Writes append to the mblock, as the mblock write ioctl does.
+ */
+mpool_err_t mpool_mblock_write(struct mpool *mp, uint64_t mbid, const struct iovec *iov, int iovc)
+{
+	struct mpunit_mblock   *mb;
+	merr_t                  err = 0;
+	int                     i;
+
+	mb = mpunit_mblock_get(mbid);
+	if (!mb)
+		return merr(ENOENT);
+
+	mpunit_io_begin();
+
+	for (i = 0; i < iovc; i++) {
+		if (mb->mb_committed || !PAGE_ALIGNED(iov[i].iov_base) ||
+		    !PAGE_ALIGNED(iov[i].iov_len) || iov[i].iov_len > MPUNIT_MBLOCK_CAP - mb->mb_len) {
+			err = merr(EINVAL);
+			break;
+		}
+
+		memcpy(mb->mb_data + mb->mb_len, iov[i].iov_base, iov[i].iov_len);
+		mb->mb_len += iov[i].iov_len;
+		mb->mb_writing = true;
+	}
+
+	mpunit_io_end();
+
+	return err;
+}
+
+mpool_err_t mpool_mblock_commit(struct mpool *mp, uint64_t mbid)
+{
+	struct mpunit_mblock *mb;
+
+	mb = mpunit_mblock_get(mbid);
+	if (!mb)
+		return merr(ENOENT);
+
+	if (mb->mb_committed)
+		return merr(EINVAL);
+
+	mb->mb_writing = false;
+	mb->mb_committed = true;
+
+	return 0;
+}
+
+mpool_err_t mpool_mblock_delete(struct mpool *mp, uint64_t mbid)
+{
+	mpunit_mblock_reset(mbid);
+
+	return 0;
+}
+
+void mp_tier_touch(struct mp_tier *tier, u64 mbid, u32 hits)
+{
+}
+
+mpool_err_t
+mpool_mcache_mmap(
+	struct mpool               *mp,
+	size_t                      mbidc,
+	uint64_t                   *mbidv,
+	enum mpc_vma_advice         advice,
+	struct mpool_mcache_map   **mapp)
+{
+	struct mpool_mcache_map    *map;
+	struct mpunit_mblock       *mb;
+	size_t                      i;
+
+	for (i = 0; i < mbidc; i++) {
+		mb = mpunit_mblock_get(mbidv[i]);
+		if (!mb)
+			return merr(ENOENT);
+
+		if (!mb->mb_committed)
+			return merr(EINVAL);
+	}
+
+	map = malloc(sizeof(*map) + mbidc * sizeof(*mbidv));
+	if (!map)
+		return merr(ENOMEM);
+
+	map->mh_mbidc = mbidc;
+	memcpy(map->mh_mbidv, mbidv, mbidc * sizeof(*mbidv));
+	*mapp = map;
+
+	return 0;
+}
+
+void *mpool_mcache_getbase(struct mpool_mcache_map *map, const uint32_t mbidx)
+{
+	if (mbidx >= map->mh_mbidc)
+		return NULL;
+
+	return mpunit_mblockv[map->mh_mbidv[mbidx]].mb_data;
+}
+
+mpool_err_t mpool_mcache_munmap(struct mpool_mcache_map *map)
+{
+	free(map);
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPUNIT_MBLOCK_H
+#define MPOOL_MPUNIT_MBLOCK_H
+
+/*
+ * In-memory stand-in for the mblock and mcache map APIs.  Mblock IDs are
+ * indices below MPUNIT_MBLOCK_MAX, each mblock holds up to MPUNIT_MBLOCK_CAP
+ * bytes, and the mpool handle is ignored.  mpool_mblock_alloc() hands out
+ * the lowest mblock that is neither allocated nor written.
+ *
+ * mpool_mblock_read_async() is issued on the async mblock I/O engine
+ * mpunit_mbio_engine, which the tests that use it create.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MPUNIT_MBLOCK_MAX       8
+#define MPUNIT_MBLOCK_CAP       (16u << 20)
+
+struct mp_mbio;
+
+extern struct mpool *mpunit_mp;
+extern struct mp_mbio *mpunit_mbio_engine;
+
+/**
+ * mpunit_mblock_reset() - Discard the contents of an mblock
+ * @mbid: mblock ID
+ */
+void mpunit_mblock_reset(uint64_t mbid);
+
+/**
+ * mpunit_mblock_data() - Access the contents of an mblock, e.g., to corrupt them
+ * @mbid: mblock ID
+ * @len:  number of bytes written (output)
+ */
+char *mpunit_mblock_data(uint64_t mbid, size_t *len);
+
+/**
+ * mpunit_mblock_reads() - Number of mblock reads issued so far
+ */
+uint64_t mpunit_mblock_reads(void);
+
+/**
+ * mpunit_mblock_fail_append() - Fail an upcoming mblock writer append
+ * @after: number of appends that still succeed, or -1 to fail none
+ *
+ * The failing append returns ENOSPC, those that follow succeed again.
+ */
+void mpunit_mblock_fail_append(int after);
+
+/**
+ * mpunit_mblock_io_trace() - Start tracking the depth of mblock I/O
+ * @delay_us: time each read or write takes from now on
+ *
+ * Resets the depth reported by mpunit_mblock_io_depth().
+ */
+void mpunit_mblock_io_trace(unsigned int delay_us);
+
+/**
+ * mpunit_mblock_io_depth() - Most mblock I/Os in progress at once
+ *
+ * Counts the writes and the reads of the async mblock I/O engine since
+ * the last call to mpunit_mblock_io_trace().
+ */
+int mpunit_mblock_io_depth(void);
+
+#endif /* MPOOL_MPUNIT_MBLOCK_H */
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Slab store tests: objects must read back once their slab is sealed,
+ * compaction must hand every live object over to the client, and a
+ * compaction that fails part way must leave all live objects in place.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+
+#include "mpunit.h"
+#include "mpunit_mblock.h"
+
+#define OBJ_MAX         8
+#define OBJ_LEN         1000
+
+/**
+ * struct ms_client - client of a slab store
+ * @mc_objv:  handles of the objects
+ * @mc_live:  objects not deleted
+ * @mc_remap: number of remap callbacks
+ */
+struct ms_client {
+	struct mpool_slab_obj   mc_objv[OBJ_MAX];
+	bool                    mc_live[OBJ_MAX];
+	int                     mc_remap;
+};
+
+static void ms_fill(char *buf, int i)
+{
+	memset(buf, 'a' + i, OBJ_LEN);
+	buf[0] = i;
+}
+
+static bool ms_remap(void *arg, const struct mpool_slab_obj *oldobj, const struct mpool_slab_obj *newobj)
+{
+	struct ms_client   *client = arg;
+	int                 i;
+
+	client->mc_remap++;
+
+	for (i = 0; i < OBJ_MAX; i++) {
+		if (client->mc_live[i] && !memcmp(client->mc_objv + i, oldobj, sizeof(*oldobj))) {
+			client->mc_objv[i] = *newobj;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static struct mpool_slab *ms_open(struct ms_client *client)
+{
+	struct mpool_slab_params    params;
+	struct mpool_slab          *ms;
+	int                         i;
+
+	for (i = 0; i < MPUNIT_MBLOCK_MAX; i++)
+		mpunit_mblock_reset(i);
+
+	memset(client, 0, sizeof(*client));
+
+	/* Compaction only runs when the test asks for it. */
+	mpool_slab_params_init(&params);
+	params.msp_period_ms = 3600 * 1000;
+
+	return mpool_slab_open(mpunit_mp, MP_MED_CAPACITY, &params, ms_remap, client, &ms) ?
+		NULL : ms;
+}
+
+/*
+ * Check that exactly the live objects of the client can be read.
+ */
+static int ms_check(struct mpool_slab *ms, struct ms_client *client)
+{
+	const void *data;
+	char        buf[OBJ_LEN];
+	mpool_err_t err;
+	int         i;
+
+	for (i = 0; i < OBJ_MAX; i++) {
+		err = mpool_slab_get(ms, client->mc_objv + i, &data);
+		if (!client->mc_live[i]) {
+			MPUNIT_ASSERT(mpool_errno(err) == ENOENT);
+			continue;
+		}
+
+		MPUNIT_ASSERT(!err);
+
+		ms_fill(buf, i);
+		MPUNIT_ASSERT(!memcmp(data, buf, OBJ_LEN));
+	}
+
+	return 0;
+}
+
+static int ms_put(struct mpool_slab *ms, struct ms_client *client)
+{
+	const void *data;
+	char        buf[OBJ_LEN];
+	int         i;
+
+	for (i = 0; i < OBJ_MAX; i++) {
+		ms_fill(buf, i);
+		MPUNIT_ASSERT(!mpool_slab_put(ms, buf, OBJ_LEN, client->mc_objv + i));
+		client->mc_live[i] = true;
+	}
+
+	/* Objects are readable once their slab is sealed. */
+	MPUNIT_ASSERT(mpool_errno(mpool_slab_get(ms, client->mc_objv, &data)) == EAGAIN);
+	MPUNIT_ASSERT(!mpool_slab_flush(ms));
+
+	return 0;
+}
+
+static int ms_del(struct mpool_slab *ms, struct ms_client *client, int i)
+{
+	MPUNIT_ASSERT(!mpool_slab_del(ms, client->mc_objv + i));
+	client->mc_live[i] = false;
+
+	return 0;
+}
+
+static int test_put_get(void)
+{
+	struct mpool_slab_stats stats;
+	struct ms_client        client;
+	struct mpool_slab      *ms;
+	int                     rc;
+
+	ms = ms_open(&client);
+	MPUNIT_ASSERT(ms);
+
+	rc = ms_put(ms, &client);
+	rc = rc ?: ms_check(ms, &client);
+	rc = rc ?: ms_del(ms, &client, 3);
+	rc = rc ?: ms_check(ms, &client);
+
+	if (!rc) {
+		mpool_slab_stats_get(ms, &stats);
+		rc = (stats.mss_objects == OBJ_MAX - 1 && stats.mss_slabs == 1) ? 0 : -1;
+	}
+
+	mpool_slab_close(ms);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static int test_compact(void)
+{
+	struct mpool_slab_stats stats;
+	struct ms_client        client;
+	struct mpool_slab      *ms;
+	int                     rc, i;
+
+	ms = ms_open(&client);
+	MPUNIT_ASSERT(ms);
+
+	rc = ms_put(ms, &client);
+	for (i = 1; i < OBJ_MAX && !rc; i += 2)
+		rc = ms_del(ms, &client, i);
+
+	rc = rc ?: (mpool_slab_compact(ms) ? -1 : 0);
+	rc = rc ?: ms_check(ms, &client);
+
+	if (!rc) {
+		mpool_slab_stats_get(ms, &stats);
+		rc = (client.mc_remap == OBJ_MAX / 2 && stats.mss_relocated == OBJ_MAX / 2 &&
+		      stats.mss_compacted == 1) ? 0 : -1;
+	}
+
+	mpool_slab_close(ms);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * A copy that fails part way must not kill anything but the copies made
+ * before it.  The second pass lists the same objects at the same indices
+ * as the first one did, so that a stale handle left over from the first
+ * pass would name a live object.
+ */
+static int test_compact_fail(void)
+{
+	struct ms_client    client;
+	struct mpool_slab  *ms;
+	int                 rc, i;
+
+	ms = ms_open(&client);
+	MPUNIT_ASSERT(ms);
+
+	rc = ms_put(ms, &client);
+	for (i = 1; i < OBJ_MAX && !rc; i += 2)
+		rc = ms_del(ms, &client, i);
+
+	/* The copies of objects 0, 2, 4 and 6, in that order. */
+	rc = rc ?: (mpool_slab_compact(ms) ? -1 : 0);
+	rc = rc ?: ms_del(ms, &client, 4);
+	rc = rc ?: ms_del(ms, &client, 6);
+
+	/* Fail the copy of object 2. */
+	if (!rc) {
+		client.mc_remap = 0;
+		mpunit_mblock_fail_append(1);
+		rc = mpool_errno(mpool_slab_compact(ms)) == ENOSPC ? 0 : -1;
+		mpunit_mblock_fail_append(-1);
+	}
+
+	rc = rc ?: (client.mc_remap ? -1 : 0);
+	rc = rc ?: ms_check(ms, &client);
+
+	/* The next pass succeeds. */
+	rc = rc ?: (mpool_slab_compact(ms) ? -1 : 0);
+	rc = rc ?: (client.mc_remap == 2 ? 0 : -1);
+	rc = rc ?: ms_check(ms, &client);
+
+	mpool_slab_close(ms);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static struct mpunit_test mbslab_testv[] = {
+	{ "put_get",            test_put_get },
+	{ "compact",            test_compact },
+	{ "compact_fail",       test_compact_fail },
+	{ NULL,                 NULL },
+};
+
+struct mpunit_suite mpunit_mbslab = {
+	.mus_name  = "mbslab",
+	.mus_testv = mbslab_testv,
+};
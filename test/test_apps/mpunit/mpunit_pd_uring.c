@@ -0,0 +1,417 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * io_uring pd engine tests: pd_file_pwritev() and pd_file_preadv() on a
+ * temporary file opened with MPOOL_PD_URING set.  Data written through
+ * the pd is checked with pread() and data written with pwrite() is read
+ * back through the pd, for staged and unstaged chunks, requests of more
+ * chunks than fit in the ring, REQ_FUA and REQ_PREFLUSH writes, reads
+ * past the end of the file and unaligned O_DIRECT requests.
+ *
+ * The tests are skipped if the kernel does not have io_uring.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/string.h>
+
+#include "mpcore_defs.h"
+#include "pd_uring.h"
+
+#include "mpunit.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX __IOV_MAX
+#endif
+
+#define PT_ZONEPG       256                             /* 1MiB zones */
+#define PT_DEVSZ        (16ul << 20)
+#define PT_FILESZ       (8ul << 20)
+
+/**
+ * struct pd_test - pd under test
+ * @pt_pd:   pd over @pt_path
+ * @pt_path: temporary file
+ * @pt_fd:   second descriptor of @pt_path, to check the pd I/O against
+ */
+struct pd_test {
+	struct mpool_dev_info   pt_pd;
+	char                    pt_path[PATH_MAX];
+	int                     pt_fd;
+};
+
+static void pt_fill(char *buf, size_t len, u64 off)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (off + i) * 7 + ((off + i) >> 12);
+}
+
+/*
+ * Open a pd over a new PT_FILESZ file whose device size is PT_DEVSZ, so
+ * that the end of the file is not the end of the device.
+ *
+ * Return: 0 on success, 1 if the io_uring engine is not available
+ */
+static int pt_open(struct pd_test *pt, const char *engine)
+{
+	struct pd_file_private *priv;
+	const char             *dir;
+	merr_t                  err;
+	int                     fd;
+
+	memset(pt, 0, sizeof(*pt));
+	pt->pt_fd = -1;
+
+	dir = getenv("TMPDIR") ?: "/tmp";
+	snprintf(pt->pt_path, sizeof(pt->pt_path), "%s/mpunit_pd_XXXXXX", dir);
+
+	fd = mkstemp(pt->pt_path);
+	MPUNIT_ASSERT(fd != -1);
+	pt->pt_fd = fd;
+
+	MPUNIT_ASSERT(!ftruncate(fd, PT_FILESZ));
+
+	setenv(PD_FILE_URING_ENV, engine, 1);
+	err = pd_file_open(pt->pt_path, 0, &pt->pt_pd.pdi_parm);
+	unsetenv(PD_FILE_URING_ENV);
+	MPUNIT_ASSERT(!err);
+
+	pt->pt_pd.pdi_prop.pdp_devsz = PT_DEVSZ;
+	pt->pt_pd.pdi_zonepg = PT_ZONEPG;
+	strlcpy(pt->pt_pd.pdi_name, "mpunit_pd", sizeof(pt->pt_pd.pdi_name));
+
+	priv = pt->pt_pd.pdi_parm.dpr_dev_private;
+	if (!priv->pfp_uring) {
+		printf("pd_uring: io_uring not available, skipped\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void pt_close(struct pd_test *pt)
+{
+	if (pt->pt_pd.pdi_parm.dpr_dev_private)
+		pd_file_close(&pt->pt_pd.pdi_parm);
+
+	if (pt->pt_fd != -1) {
+		close(pt->pt_fd);
+		unlink(pt->pt_path);
+	}
+}
+
+static bool pt_direct(struct pd_test *pt)
+{
+	struct pd_file_private *priv = pt->pt_pd.pdi_parm.dpr_dev_private;
+
+	return fcntl(priv->pfp_fd, F_GETFL) & O_DIRECT;
+}
+
+/*
+ * Split buf into iovcnt buffers of len bytes, the last one taking the rest.
+ */
+static void pt_split(struct iovec *iov, int iovcnt, char *buf, size_t buflen, size_t len)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		iov[i].iov_base = buf + i * len;
+		iov[i].iov_len = (i == iovcnt - 1) ? buflen - i * len : len;
+	}
+}
+
+/*
+ * Write len bytes at off through the pd in iovcnt buffers and check them
+ * with pread(), then write them again with pwrite() and read them back
+ * through the pd.
+ */
+static int pt_rw(struct pd_test *pt, char *buf, size_t len, int iovcnt, u64 off, int op_flags)
+{
+	struct iovec   *iov;
+	char           *cmp;
+	u64             zonelen;
+	int             rc = -1;
+
+	zonelen = (u64)PT_ZONEPG << PAGE_SHIFT;
+
+	iov = calloc(iovcnt, sizeof(*iov));
+	cmp = malloc(len);
+	if (!iov || !cmp)
+		goto out;
+
+	pt_fill(buf, len, off);
+	pt_split(iov, iovcnt, buf, len, len / iovcnt);
+
+	if (pd_file_pwritev(&pt->pt_pd, iov, iovcnt, off / zonelen, off % zonelen, op_flags))
+		goto out;
+
+	if (pread(pt->pt_fd, cmp, len, off) != len || memcmp(buf, cmp, len))
+		goto out;
+
+	pt_fill(cmp, len, off + 1);
+	if (pwrite(pt->pt_fd, cmp, len, off) != len)
+		goto out;
+
+	memset(buf, 0, len);
+	if (pd_file_preadv(&pt->pt_pd, iov, iovcnt, off / zonelen, off % zonelen))
+		goto out;
+
+	rc = memcmp(buf, cmp, len) ? -1 : 0;
+
+out:
+	free(cmp);
+	free(iov);
+
+	return rc;
+}
+
+static int test_staged(void)
+{
+	struct pd_test  pt;
+	char           *buf;
+	int             rc;
+
+	rc = pt_open(&pt, "uring");
+	if (rc) {
+		pt_close(&pt);
+		return rc < 0 ? rc : 0;
+	}
+
+	buf = malloc(PD_URING_BUFSZ);
+	MPUNIT_ASSERT(buf);
+
+	/* One and several buffers, across a zone boundary. */
+	rc = pt_rw(&pt, buf, 5000, 1, 123, 0);
+	rc = rc ?: pt_rw(&pt, buf, 12345, 7, ((u64)PT_ZONEPG << PAGE_SHIFT) - 1000, 0);
+	rc = rc ?: pt_rw(&pt, buf, PD_URING_BUFSZ, 3, 4096, 0);
+
+	free(buf);
+	pt_close(&pt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static int test_unstaged(void)
+{
+	struct pd_test  pt;
+	size_t          len = 4 * PD_URING_BUFSZ + 100;
+	char           *buf;
+	int             rc;
+
+	rc = pt_open(&pt, "uring");
+	if (rc) {
+		pt_close(&pt);
+		return rc < 0 ? rc : 0;
+	}
+
+	buf = malloc(len);
+	MPUNIT_ASSERT(buf);
+
+	rc = pt_rw(&pt, buf, len, 1, 777, 0);
+	rc = rc ?: pt_rw(&pt, buf, len, 5, 3 << 20, 0);
+
+	free(buf);
+	pt_close(&pt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * Requests of more IOV_MAX chunks than there are ring entries, staged and
+ * unstaged.
+ */
+static int test_multi_chunk(void)
+{
+	struct pd_test  pt;
+	size_t          len;
+	char           *buf;
+	int             iovcnt;
+	int             rc;
+
+	rc = pt_open(&pt, "uring");
+	if (rc) {
+		pt_close(&pt);
+		return rc < 0 ? rc : 0;
+	}
+
+	iovcnt = IOV_MAX * (PD_URING_DEPTH + 3) + 17;
+
+	/* 16 bytes per buffer, the chunks are staged. */
+	len = (size_t)iovcnt * 16;
+	buf = malloc(len);
+	MPUNIT_ASSERT(buf);
+
+	rc = pt_rw(&pt, buf, len, iovcnt, 100, 0);
+	free(buf);
+
+	/* 128 bytes per buffer, the full chunks are not. */
+	len = (size_t)iovcnt * 128;
+	buf = malloc(len);
+	MPUNIT_ASSERT(buf);
+
+	rc = rc ?: pt_rw(&pt, buf, len, iovcnt, 1 << 20, 0);
+	free(buf);
+
+	pt_close(&pt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static int test_fua_preflush(void)
+{
+	struct pd_test  pt;
+	size_t          len = 2 * PD_URING_BUFSZ;
+	char           *buf;
+	int             rc;
+
+	rc = pt_open(&pt, "uring");
+	if (rc) {
+		pt_close(&pt);
+		return rc < 0 ? rc : 0;
+	}
+
+	buf = malloc(len);
+	MPUNIT_ASSERT(buf);
+
+	rc = pt_rw(&pt, buf, 1000, 2, 0, REQ_FUA);
+	rc = rc ?: pt_rw(&pt, buf, len, 1, 8192, REQ_FUA);
+	rc = rc ?: pt_rw(&pt, buf, 1000, 1, 4 << 20, REQ_PREFLUSH);
+	rc = rc ?: pt_rw(&pt, buf, len, 4, 5 << 20, REQ_PREFLUSH | REQ_FUA);
+
+	free(buf);
+	pt_close(&pt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * A read that is within the device but past the end of the file is short
+ * and must fail with EIO, as it does with the synchronous engine.
+ */
+static int test_short_read(void)
+{
+	struct pd_test  pt;
+	struct iovec    iov;
+	size_t          len = 2 * PD_URING_BUFSZ;
+	char           *buf;
+	u64             zonelen;
+	int             rc;
+
+	rc = pt_open(&pt, "uring");
+	if (rc) {
+		pt_close(&pt);
+		return rc < 0 ? rc : 0;
+	}
+
+	buf = malloc(len);
+	MPUNIT_ASSERT(buf);
+
+	zonelen = (u64)PT_ZONEPG << PAGE_SHIFT;
+
+	/* Staged and unstaged. */
+	iov.iov_base = buf;
+	iov.iov_len = 8192;
+	rc = merr_errno(pd_file_preadv(&pt.pt_pd, &iov, 1, PT_FILESZ / zonelen - 1,
+				       zonelen - 4096)) == EIO ? 0 : -1;
+
+	iov.iov_len = len;
+	rc = rc ?: merr_errno(pd_file_preadv(&pt.pt_pd, &iov, 1, PT_FILESZ / zonelen - 1,
+					     zonelen - 4096)) == EIO ? 0 : -1;
+
+	/* Entirely past the end of the file. */
+	rc = rc ?: merr_errno(pd_file_preadv(&pt.pt_pd, &iov, 1, PT_FILESZ / zonelen, 0)) == EIO ?
+		0 : -1;
+
+	/* The ring is still usable. */
+	rc = rc ?: pt_rw(&pt, buf, len, 2, 0, 0);
+
+	free(buf);
+	pt_close(&pt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+/*
+ * O_DIRECT requests must be aligned in offset and length, their buffers
+ * need not be.
+ */
+static int test_direct(void)
+{
+	struct pd_test  pt;
+	struct iovec    iov;
+	size_t          len = 4 * PD_URING_BUFSZ;
+	char           *buf;
+	int             rc;
+
+	rc = pt_open(&pt, "direct");
+	if (rc) {
+		pt_close(&pt);
+		return rc < 0 ? rc : 0;
+	}
+
+	if (!pt_direct(&pt)) {
+		printf("pd_uring: O_DIRECT not supported in %s, skipped\n", pt.pt_path);
+		pt_close(&pt);
+		return 0;
+	}
+
+	buf = aligned_alloc(PD_URING_ALIGN, len + PD_URING_ALIGN);
+	MPUNIT_ASSERT(buf);
+
+	iov.iov_base = buf;
+	iov.iov_len = 4096;
+	rc = merr_errno(pd_file_pwritev(&pt.pt_pd, &iov, 1, 0, 512, 0)) == EINVAL ? 0 : -1;
+	rc = rc ?: merr_errno(pd_file_preadv(&pt.pt_pd, &iov, 1, 0, 512)) == EINVAL ? 0 : -1;
+
+	iov.iov_len = 1000;
+	rc = rc ?: merr_errno(pd_file_pwritev(&pt.pt_pd, &iov, 1, 0, 0, 0)) == EINVAL ? 0 : -1;
+	rc = rc ?: merr_errno(pd_file_preadv(&pt.pt_pd, &iov, 1, 0, 0)) == EINVAL ? 0 : -1;
+
+	/* Aligned buffers, then unaligned buffers that are staged. */
+	rc = rc ?: pt_rw(&pt, buf, len, 4, 1 << 20, REQ_FUA);
+	rc = rc ?: pt_rw(&pt, buf + 1, len, 3, 2 << 20, 0);
+
+	free(buf);
+	pt_close(&pt);
+
+	MPUNIT_ASSERT(!rc);
+
+	return 0;
+}
+
+static struct mpunit_test pd_uring_testv[] = {
+	{ "staged",             test_staged },
+	{ "unstaged",           test_unstaged },
+	{ "multi_chunk",        test_multi_chunk },
+	{ "fua_preflush",       test_fua_preflush },
+	{ "short_read",         test_short_read },
+	{ "direct",             test_direct },
+	{ NULL,                 NULL },
+};
+
+struct mpunit_suite mpunit_pd_uring = {
+	.mus_name  = "pd_uring",
+	.mus_testv = pd_uring_testv,
+};
@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * This tool compares the pd file I/O engines.  It writes and then reads a
+ * file sequentially through pd_file_pwritev() and pd_file_preadv(), once
+ * with the synchronous preadv()/pwritev() engine and once with each of the
+ * io_uring engines that MPOOL_PD_URING selects, and reports the throughput
+ * and the mean latency of the requests of each pass.
+ *
+ * The reads of the buffered engines are served from the page cache that
+ * the writes filled, compare them with each other rather than with the
+ * O_DIRECT engine.
+ *
+ * Examples:
+ *    $ pdbench /tmp/pdbench.dat
+ *    $ pdbench -b 4k -s 16m /tmp/pdbench.dat
+ *    $ pdbench -f -b 1m -i 4k /tmp/pdbench.dat
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+
+#include "mpcore_defs.h"
+#include "pd_uring.h"
+
+#define PB_ZONEPG       256                             /* 1MiB zones */
+
+/**
+ * struct pb_engine - I/O engine under test
+ * @pe_name: name in the report
+ * @pe_env:  value of PD_FILE_URING_ENV that selects it, NULL for none
+ */
+struct pb_engine {
+	const char     *pe_name;
+	const char     *pe_env;
+};
+
+static struct pb_engine pb_enginev[] = {
+	{ "sync",       NULL },
+	{ "uring",      "uring" },
+	{ "direct",     "direct" },
+	{ NULL,         NULL },
+};
+
+static const char  *progname;
+static size_t       bsize = 128 << 10;
+static size_t       iovsz;
+static size_t       total = 64 << 20;
+static int          op_flags;
+
+static void usage(void)
+{
+	printf("usage: %s [options] <file>\n", progname);
+	printf("-b bsize  request size (default: %zu)\n", bsize);
+	printf("-f        write with REQ_FUA\n");
+	printf("-h        print this help list\n");
+	printf("-i iovsz  buffer size, a request is bsize / iovsz buffers (default: bsize)\n");
+	printf("-s size   bytes written and read by each pass (default: %zu)\n", total);
+	printf("file      file to test on, created if it does not exist\n");
+}
+
+static int cvt_size(const char *str, size_t *sizep)
+{
+	unsigned long long  val;
+	char               *end;
+
+	errno = 0;
+	val = strtoull(str, &end, 0);
+	if (errno || end == str)
+		return EINVAL;
+
+	switch (*end) {
+	case 'g':
+	case 'G':
+		val <<= 10;
+		/* fallthrough */
+	case 'm':
+	case 'M':
+		val <<= 10;
+		/* fallthrough */
+	case 'k':
+	case 'K':
+		val <<= 10;
+		end++;
+		break;
+
+	default:
+		break;
+	}
+
+	if (*end || !val)
+		return EINVAL;
+
+	*sizep = val;
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Write or read total bytes through the pd in bsize requests.
+ */
+static merr_t
+pb_pass(
+	struct mpool_dev_info  *pd,
+	bool                    write,
+	struct iovec           *iov,
+	int                     iovcnt,
+	double                 *secsp)
+{
+	u64     zonelen = (u64)PB_ZONEPG << PAGE_SHIFT;
+	merr_t  err = 0;
+	double  start;
+	u64     off;
+
+	start = now();
+
+	for (off = 0; off < total && !err; off += bsize) {
+		if (write)
+			err = pd_file_pwritev(pd, iov, iovcnt, off / zonelen, off % zonelen,
+					      op_flags);
+		else
+			err = pd_file_preadv(pd, iov, iovcnt, off / zonelen, off % zonelen);
+	}
+
+	*secsp = now() - start;
+
+	return err;
+}
+
+static void pb_report(const char *engine, const char *op, double secs)
+{
+	printf("%-8s %-6s %10.1f MB/s %10.1f us/req\n", engine, op,
+	       total / secs / (1 << 20), secs * 1e6 / (total / bsize));
+}
+
+static int pb_run(const char *path, struct pb_engine *pe, char *buf)
+{
+	struct mpool_dev_info   pd;
+	struct pd_file_private *priv;
+	struct iovec           *iov;
+	char                    errbuf[128];
+	merr_t                  err;
+	double                  wsecs, rsecs, start;
+	int                     iovcnt, i;
+
+	memset(&pd, 0, sizeof(pd));
+
+	if (pe->pe_env)
+		setenv(PD_FILE_URING_ENV, pe->pe_env, 1);
+	else
+		unsetenv(PD_FILE_URING_ENV);
+
+	err = pd_file_open(path, 0, &pd.pdi_parm);
+	unsetenv(PD_FILE_URING_ENV);
+	if (err) {
+		fprintf(stderr, "%s: open %s: %s\n", progname, path,
+			mpool_strinfo(err, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+
+	priv = pd.pdi_parm.dpr_dev_private;
+	if (pe->pe_env && !priv->pfp_uring) {
+		printf("%-8s io_uring not available\n", pe->pe_name);
+		pd_file_close(&pd.pdi_parm);
+		return 0;
+	}
+
+	if (pe->pe_env && !strcmp(pe->pe_env, "direct") &&
+	    !(fcntl(priv->pfp_fd, F_GETFL) & O_DIRECT)) {
+		printf("%-8s O_DIRECT not supported\n", pe->pe_name);
+		pd_file_close(&pd.pdi_parm);
+		return 0;
+	}
+
+	pd.pdi_prop.pdp_devsz = total;
+	pd.pdi_zonepg = PB_ZONEPG;
+	snprintf(pd.pdi_name, sizeof(pd.pdi_name), "pdbench");
+
+	iovcnt = bsize / iovsz;
+
+	iov = calloc(iovcnt, sizeof(*iov));
+	if (!iov) {
+		pd_file_close(&pd.pdi_parm);
+		return -1;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		iov[i].iov_base = buf + i * iovsz;
+		iov[i].iov_len = iovsz;
+	}
+
+	err = pb_pass(&pd, true, iov, iovcnt, &wsecs);
+	if (!err) {
+		/* Time the writes to the media, not to the page cache. */
+		start = now();
+		fsync(priv->pfp_fd);
+		wsecs += now() - start;
+
+		err = pb_pass(&pd, false, iov, iovcnt, &rsecs);
+	}
+
+	pd_file_close(&pd.pdi_parm);
+	free(iov);
+
+	if (err) {
+		fprintf(stderr, "%s: %s: %s\n", progname, pe->pe_name,
+			mpool_strinfo(err, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+
+	pb_report(pe->pe_name, "write", wsecs);
+	pb_report(pe->pe_name, "read", rsecs);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct pb_engine   *pe;
+	const char         *path;
+	char               *buf;
+	int                 fd, c;
+	int                 rc = 0;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? progname + 1 : argv[0];
+
+	while ((c = getopt(argc, argv, ":b:fhi:s:")) != -1) {
+		switch (c) {
+		case 'b':
+			if (cvt_size(optarg, &bsize)) {
+				fprintf(stderr, "%s: invalid bsize '%s'\n", progname, optarg);
+				exit(EX_USAGE);
+			}
+			break;
+
+		case 'f':
+			op_flags |= REQ_FUA;
+			break;
+
+		case 'h':
+			usage();
+			exit(EX_OK);
+
+		case 'i':
+			if (cvt_size(optarg, &iovsz)) {
+				fprintf(stderr, "%s: invalid iovsz '%s'\n", progname, optarg);
+				exit(EX_USAGE);
+			}
+			break;
+
+		case 's':
+			if (cvt_size(optarg, &total)) {
+				fprintf(stderr, "%s: invalid size '%s'\n", progname, optarg);
+				exit(EX_USAGE);
+			}
+			break;
+
+		case ':':
+			fprintf(stderr, "%s: option '-%c' requires an argument\n", progname, optopt);
+			exit(EX_USAGE);
+
+		default:
+			fprintf(stderr, "%s: invalid option '-%c'\n", progname, optopt);
+			exit(EX_USAGE);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		exit(EX_USAGE);
+	}
+
+	path = argv[optind];
+
+	if (!iovsz)
+		iovsz = bsize;
+
+	if (bsize % iovsz || total % bsize) {
+		fprintf(stderr, "%s: size must be a multiple of bsize and bsize of iovsz\n",
+			progname);
+		exit(EX_USAGE);
+	}
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1 || ftruncate(fd, total)) {
+		fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+		exit(EX_OSERR);
+	}
+	close(fd);
+
+	buf = aligned_alloc(PD_URING_ALIGN, roundup(bsize, PD_URING_ALIGN));
+	if (!buf) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		exit(EX_OSERR);
+	}
+
+	memset(buf, 0xa5, bsize);
+
+	for (pe = pb_enginev; pe->pe_name && !rc; pe++)
+		rc = pb_run(path, pe, buf);
+
+	free(buf);
+
+	return rc ? EX_SOFTWARE : EX_OK;
+}